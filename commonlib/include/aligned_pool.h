@@ -0,0 +1,48 @@
+#ifndef __aligned_pool_h__
+#define __aligned_pool_h__
+
+#include "system_exception.h"
+#include "mutex.h"
+#include <vector>
+
+/*  The pool of equally sized buffers aligned in memory, e.g. for the input/output
+    bypassing the system cache (O_DIRECT) that requires the aligned buffers.
+    The released buffers are kept for reuse up to the given number, the rest are freed.
+    @note The pool is thread-safe.
+*/
+class AlignedPool
+{
+public:
+    /*  @param bufferSize The size of buffer, it must be a multiple of alignment.
+        @param alignment The power of two.
+        @param maxFree The maximum number of released buffers kept for reuse.
+    */
+    AlignedPool( u32 bufferSize, u32 alignment, u32 maxFree );
+    ~AlignedPool();
+
+    /*  Returns the free buffer or allocates the new one.
+        @throw system_exception on out of memory.
+    */
+    u8* get( void );
+
+    /*  Gives the buffer back to the pool */
+    void put( u8* buffer );
+
+    u32 buffer_size( void ) const
+    { return bufferSize_; }
+
+    u32 alignment( void ) const
+    { return alignment_; }
+
+private:
+    AlignedPool( const AlignedPool& );
+    AlignedPool& operator=( const AlignedPool& );
+
+    u32 bufferSize_;
+    u32 alignment_;
+    u32 maxFree_;
+    std::vector<u8*> free_;
+    Mutex lock_;
+};
+
+#endif /* __aligned_pool_h__ */
@@ -0,0 +1,169 @@
+#ifndef __chunker_h__
+#define __chunker_h__
+
+#include "common_types.h"
+#include "message.h"
+#include "file.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#define CDC_MIN_CHUNK       16384
+#define CDC_AVG_CHUNK       65536
+#define CDC_MAX_CHUNK       262144
+#define CDC_HASH_SIZE       32      /* the chunk is named by its BLAKE3 hash */
+#define CDC_RECORD_SIZE     36      /* the hash and the size(4) of one chunk in network byte order */
+#define CDC_FILTER_MIN_BITS 20      /* log2 of the bits of the smallest and the largest filter of chunks */
+#define CDC_FILTER_MAX_BITS 36
+#define CDC_FILTER_MAX_HASHES 16
+
+/*  Content-defined chunking (FastCDC): the cut points are found by the gear hash of the last bytes,
+    so the same data is cut the same way wherever it is in the file. The hash is not looked at before
+    CDC_MIN_CHUNK bytes, the chunks are cut more eagerly after CDC_AVG_CHUNK bytes (normalized chunking)
+    and always at CDC_MAX_CHUNK bytes.
+*/
+class Chunker
+{
+public:
+    /*  Returns the size of the chunk at the start of data. The data is CDC_MAX_CHUNK bytes at least
+        unless it is the end of file.
+    */
+    static u32 cut(const u8* data, u32 size);
+
+    /*  Writes CDC_HASH_SIZE bytes of the name of chunk */
+    static void hash(const u8* data, u32 size, u8* name);
+
+    /*  Writes the record of chunk, CDC_RECORD_SIZE bytes */
+    static void encode(const u8* name, u32 size, u8* record);
+
+    /*  Returns the size of chunk of the record, its name is the first CDC_HASH_SIZE bytes */
+    static u32 record_size(const u8* record);
+};
+
+/*  Bloom filter of the names of chunks, the sender looks the chunks up in the filter of receiver's store
+    and asks the receiver about the likely ones only. The names are random, so their first 8 bytes (the key)
+    give the bits of the chunk by double hashing. The filter has no false negatives, the chunks are never
+    removed from it.
+    @note The filter is used by one thread.
+*/
+class ChunkFilter
+{
+public:
+    ChunkFilter();
+
+    /*  Returns the key of the chunk name */
+    static u64 key(const u8* name);
+
+    /*  Makes the empty filter of 2^bits bits and 'hashes' bits per key */
+    void reset(u32 bits, u32 hashes);
+
+    /*  Drops the filter, it has no bits then */
+    void clear();
+
+    void add(u64 key);
+
+    /*  Returns true if the key is likely added */
+    bool contains(u64 key) const;
+
+    /*  Copies the bytes of filter made by reset() from 'offset', they are given in order
+        @Returns false if they don't go on with the loaded ones or exceed the filter
+    */
+    bool load(u64 offset, const u8* data, u32 size);
+
+    /*  Returns true if all the bytes of filter are loaded */
+    bool complete() const
+    { return !bits_.empty() && loaded_ == bits_.size(); }
+
+    /*  Returns log2 of the bits, 0 if there is no filter */
+    u32 bits() const
+    { return log2_; }
+
+    u32 hashes() const
+    { return hashes_; }
+
+    /*  Returns the bytes of filter */
+    const std::vector<u8>& data() const
+    { return bits_; }
+
+private:
+    std::vector<u8> bits_;
+    u32 log2_;
+    u32 hashes_;
+    u64 loaded_;            /* the bytes of filter loaded by now */
+};
+
+/*  The chunks of file being sent, they are cut and announced to the receiver ahead of sending.
+    The receiver answers which of the announced chunks it has, so they are referred to instead
+    of being sent. The chunks are dropped as the file goes past them.
+    @note The queue is used by one thread.
+*/
+class ChunkQueue
+{
+public:
+    struct Chunk
+    {
+        i64  offset_;
+        u32  size_;
+        u8   name_[CDC_HASH_SIZE];
+        bool present_;      /* the receiver has the chunk */
+    };
+
+    ChunkQueue();
+
+    /*  Cuts and names the chunks after the announced ones, the file position is kept. The chunks are
+        looked up in the filter of receiver's store, the data goes on up to the first likely one at once.
+        @param most - the most chunks to announce
+        @param ahead - the most data of them
+        @param filter - the filter of receiver's store, all the chunks are likely if it is NULL
+        @param records - set to the records of the chunks
+        @param asked - set to true if the answer is waited for, i.e. some chunks are likely
+        @Returns the number of chunks, 0 if the file is announced up to 'end' or the last announcement
+        is not answered yet
+        @throw Exception if the file can't be read
+    */
+    u32 announce(File* file, i64 end, u32 most, u64 ahead, const ChunkFilter* filter, std::string* records,
+                 bool* asked);
+
+    /*  Takes the answer to the last announcement which is waited for
+        @param offset - the offset of its first chunk
+        @param present - the bits of the chunks the receiver has, the lowest bit of the first byte goes first
+        @Returns false if there is no such announcement
+    */
+    bool answered(i64 offset, const u8* present, u32 size);
+
+    /*  Looks for the next chunk the receiver has from 'offset'
+        @param literals - set to the data to send before it, 0 if the chunk is at 'offset'
+        @param chunk - set to the chunk at 'offset' the receiver has, NULL if it has none there
+        @Returns false if the data at 'offset' is not answered yet
+    */
+    bool next(i64 offset, u64* literals, const Chunk** chunk);
+
+    /*  Returns true if the data at 'offset' waits for the answer */
+    bool waiting(i64 offset) const
+    { return !dropped_ && waiting_ && offset >= answered_; }
+
+    /*  Returns the end of announced chunks */
+    i64 announced() const
+    { return announced_; }
+
+    /*  Drops the chunks, the rest of file is sent as is and the late answers are ignored */
+    void clear();
+
+private:
+    ChunkQueue(const ChunkQueue&);
+    ChunkQueue& operator=(const ChunkQueue&);
+
+    typedef std::deque<Chunk> ChunksT;
+
+    ChunksT chunks_;        /* the announced chunks which are not sent yet */
+    i64  announced_;        /* the end of announced chunks */
+    i64  answered_;         /* the end of chunks known to be or not to be in the receiver's store */
+    bool waiting_;          /* the chunks from 'answered_' wait for the answer */
+    i64  asked_;            /* waiting: the offset of the last announcement */
+    u32  pending_;          /* waiting: the number of chunks of the last announcement */
+    bool dropped_;
+    Message buffer_;        /* the data being cut */
+};
+
+#endif /* __chunker_h__ */
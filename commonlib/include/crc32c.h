@@ -0,0 +1,17 @@
+#ifndef __crc32c_h__
+#define __crc32c_h__
+
+#include "common_types.h"
+
+/*  Returns CRC32C (Castagnoli polynomial) of the data continuing the 'crc' of previous data,
+    0 starts the new checksum. It is computed by SSE4.2 crc32 instructions if the processor
+    has them, the long data is folded by VPCLMULQDQ before if it is there too, otherwise
+    the checksum is computed by slice-by-8 tables.
+    @note The function is thread-safe, its tables are built before main().
+*/
+u32 crc32c( const void* data, u32 size, u32 crc = 0 );
+
+/*  Returns true if the checksum is computed by the processor instructions */
+bool crc32c_hardware( void );
+
+#endif /* __crc32c_h__ */
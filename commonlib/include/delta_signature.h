@@ -0,0 +1,152 @@
+#ifndef __delta_signature_h__
+#define __delta_signature_h__
+
+#include "common_types.h"
+#include "message.h"
+#include "rawfile.h"
+#include "file.h"
+
+#include <vector>
+
+#define DELTA_STRONG_SIZE   16      /* the strong hash of block is the beginning of its BLAKE3 hash */
+#define DELTA_SIGNATURE_SIZE 20     /* the weak checksum(4) and the strong hash of one block in network byte order */
+#define DELTA_MIN_BLOCK     2048
+#define DELTA_MAX_BLOCK     131072
+
+/*  The signatures of the blocks of file, the sender looks for the same blocks in the new file by them.
+    The file is cut into blocks of the same size, the last one may be shorter. The weak checksum of block
+    is rolled over the data byte by byte (as in rsync), the strong hash confirms its matches.
+*/
+class BlockSignatures
+{
+public:
+    BlockSignatures();
+
+    /*  Returns the block size of the file of 'size' bytes, it is about the square root of the size,
+        so the signatures of the large file are not much more than its blocks sent
+    */
+    static u32 block_size(i64 size);
+
+    /*  Returns the weak checksum of the data */
+    static u32 checksum(const u8* data, u32 size);
+
+    /*  Writes DELTA_STRONG_SIZE bytes of the strong hash of the data */
+    static void strong(const u8* data, u32 size, u8* hash);
+
+    /*  Computes the signatures of file, it is read from the start to the end by positional reads
+        @param stop - the reading stops between its pieces when it turns true, the signatures are incomplete then
+        @throw system_exception if the file can't be read
+    */
+    void compute(const RawFile& file, const volatile bool* stop = NULL);
+
+    /*  Drops the signatures, the ones of the file of 'size' bytes are added then */
+    void reset(u32 blockSize, i64 size);
+
+    /*  Adds the signatures of the next blocks encoded by encode()
+        @Returns false if they exceed the blocks of file
+    */
+    bool add(const u8* data, u32 count);
+
+    /*  Writes the signatures of all the blocks, DELTA_SIGNATURE_SIZE bytes each */
+    void encode(Message* data) const;
+
+    u32 block_size() const
+    { return blockSize_; }
+
+    /*  Returns the size of file */
+    i64 size() const
+    { return size_; }
+
+    /*  Returns the number of blocks of file */
+    u32 blocks() const;
+
+    /*  Returns the number of signatures by now, they are complete when it is blocks() */
+    u32 count() const
+    { return (u32)weak_.size(); }
+
+    /*  Returns the size of block, the last one may be shorter */
+    u32 length(u32 block) const;
+
+    u32 weak(u32 block) const
+    { return weak_[block]; }
+
+    const u8* strong(u32 block) const
+    { return &strong_[(size_t)block * DELTA_STRONG_SIZE]; }
+
+private:
+    u32 blockSize_;
+    i64 size_;
+    std::vector<u32> weak_;
+    std::vector<u8>  strong_;   /* DELTA_STRONG_SIZE bytes per block */
+};
+
+/*  Finds the blocks of the receiver's file in the file being sent. The weak checksum is rolled
+    over the data and looked up among the signatures, the strong hash is computed on its hits only.
+    The matches of consecutive blocks are put together, so they go by one reference.
+    @note The matcher is used by one thread.
+*/
+class DeltaMatcher
+{
+public:
+    /*  @param limit - the most literals found at once and the most data of one match */
+    explicit DeltaMatcher(u32 limit);
+
+    /*  The signatures of receiver's file, they are added as they come */
+    BlockSignatures& signatures()
+    { return signatures_; }
+
+    /*  Indexes the signatures by their weak checksums, it is done when they are all added */
+    void index();
+
+    /*  Drops the signatures, the rest of file is sent by literals then */
+    void clear();
+
+    /*  Looks for the blocks of receiver's file from 'offset' of the file, the data is read ahead
+        and the file position is kept. The found match is kept until the literals before it are sent.
+        @param block - set to the first matched block if the data at 'offset' matches
+        @param size - set to the size of matched blocks going one after another
+        @Returns the number of literals before the next match, 0 if the data at 'offset' matches
+        @throw Exception if the file can't be read
+    */
+    u32 next(File* file, i64 offset, i64 end, u32* block, u32* size);
+
+    /*  Returns the data at 'offset' read by the last next(), e.g. the matched blocks to hash them */
+    const u8* data(i64 offset) const;
+
+private:
+    DeltaMatcher(const DeltaMatcher&);
+    DeltaMatcher& operator=(const DeltaMatcher&);
+
+    /*  Reads the data from 'offset' up to 'end', the data read before is kept
+        @throw Exception if the file can't be read
+    */
+    void load(File* file, i64 offset, i64 end);
+
+    /*  Returns the block with the checksum and the strong hash of data or -1 if there is none */
+    i32 find(u32 weak, const u8* data, u32 size) const;
+
+    /*  Returns the size of the matched block with the blocks following it which match the data after it
+        @param available - the data from the start of matched block
+    */
+    u32 extend(u32 block, const u8* data, u32 available) const;
+
+    BlockSignatures signatures_;
+    u32 limit_;
+    std::vector<u32> heads_;    /* the first block of every bucket of weak checksums */
+    std::vector<u32> chain_;    /* the next block of the same bucket */
+    u32 shift_;                 /* the bucket is the high bits of the mixed checksum */
+    std::vector<u32> filter_;   /* the bits of mixed checksums of the blocks, most of positions go by it */
+    u32 filterShift_;
+
+    Message buffer_;            /* the data read ahead */
+    i64 bufferAt_;              /* the offset of buffer in file */
+    u32 loaded_;                /* the data in the buffer */
+
+    i64 from_;                  /* no match starts from 'from_' up to 'to_' */
+    i64 to_;
+    bool found_;                /* the blocks at 'to_' match */
+    u32 foundBlock_;
+    u32 foundSize_;
+};
+
+#endif /* __delta_signature_h__ */
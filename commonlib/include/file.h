@@ -4,6 +4,15 @@
 #include "system_exception.h"
 #include <string>
 
+/*  How the file data is kept in the system cache */
+enum CachePolicy {
+    keep_CachePolicy = 1,   /* left to the system */
+    drop_CachePolicy = 2,   /* the file is read ahead sequentially and the used pages are dropped */
+};
+
+/*  The pages are dropped by regions of this size, so the hints are not given too often */
+#define CACHE_DROP_WINDOW 8388608
+
  /* An representation of file or directory. */
 class File
 {
@@ -18,6 +27,16 @@ public:
     /*  Creates new empty file */
     static void createEmpty( const std::string& path );
 
+    /*  Renames the file, the existing one at 'path' is replaced
+        @throw system_exception
+    */
+    static void replace( const std::string& from, const std::string& path );
+
+    /*  Creates the directory if there is none
+        @throw system_exception
+    */
+    static void createDirectory( const std::string& path );
+
     /*  Returns current directory path */
     static std::string getCurrentDirectory( void );
 
@@ -36,6 +55,9 @@ public:
     /*  Returns the file size.  */
 	i64 size( void ) const;
 
+    /*  Returns the modification time in seconds since the epoch */
+    i64 mtime( void ) const;
+
     /*  Resizes file */
     void resize( i64 size );
 
@@ -48,6 +70,22 @@ public:
 
     bool isOpened( void ) const;
 
+    /*  Sets how the file data is kept in the system cache, it is kept on reopening */
+    void setCachePolicy( CachePolicy policy );
+
+    CachePolicy cachePolicy( void ) const
+    { return cachePolicy_; }
+
+    /*  Moves the file position to the start of region which this object reads,
+        so the pages of the other regions are not dropped by it
+    */
+    void seekRegion( i64 offset );
+
+    /*  Drops the read pages before 'end' from the system cache if the policy is drop.
+        @param whole - drop all of them at once, otherwise they are dropped by windows
+    */
+    void dropCache( i64 end, bool whole = false );
+
     handle_t handle( void ) const
     { return handle_; }
 
@@ -57,6 +95,8 @@ public:
 private:
     handle_t handle_;
     std::string path_;
+    CachePolicy cachePolicy_;
+    i64 cacheDropped_;  /* the pages before are dropped */
 };
 
 #endif /* __file_h__ */
@@ -0,0 +1,85 @@
+#ifndef __ioring_h__
+#define __ioring_h__
+
+#include "system_exception.h"
+
+struct iovec;
+
+/*  Linux io_uring: the pair of submission and completion queues shared with the kernel.
+    It is the thin wrapper over raw system calls (liburing is not required).
+    @note The ring is not thread-safe, it is supposed to be used by one thread.
+    @note The ring descriptor is readable when completions are available, so it can be
+    attached to the Reactor.
+*/
+class IoRing
+{
+public:
+    /*  Completed request */
+    struct Completion
+    {
+        u64 userData_;  /* value given at request queuing */
+        i32 result_;    /* the number of bytes transferred or -errno */
+    };
+
+    /*  Checks if io_uring is supported by the kernel and allowed for the process.  */
+    static bool isSupported( void );
+
+    /*  Creates the ring.
+        @param entries The size of submission queue.
+        @throw system_exception if io_uring is not supported.
+    */
+    explicit IoRing( u32 entries );
+    ~IoRing( void );
+
+    /*  Registers the fixed buffers, they are addressed by index in *_fixed requests.
+        @throw system_exception
+    */
+    void register_buffers( const struct iovec* buffers, u32 count );
+
+    /*  Queues the socket receiving.
+        @param flags The recv() flags (e.g. MSG_WAITALL).
+        @param link If true the next queued request starts only after this one
+        transferred all the 'len' bytes, otherwise the next one is cancelled.
+        @return false if the submission queue is full.
+    */
+    bool recv( i32 fd, void* buf, u32 len, i32 flags, u64 userData, bool link = false );
+
+    /*  Queues the writing from the registered buffer at the file offset.
+        @return false if the submission queue is full.
+    */
+    bool write_fixed( i32 fd, const void* buf, u32 len, i64 offset, u16 bufIndex, u64 userData, bool link = false );
+
+    /*  Queues the file synchronization.
+        @param datasync If true only the data is synchronized (as fdatasync() does).
+        @return false if the submission queue is full.
+    */
+    bool fsync( i32 fd, bool datasync, u64 userData );
+
+    /*  Submits all the queued requests to the kernel without waiting.
+        @return the number of submitted requests.
+        @throw system_exception
+    */
+    u32 submit( void );
+
+    /*  Takes the next completion.
+        @return false if the completion queue is empty.
+    */
+    bool complete( Completion* completion );
+
+    /*  Returns the number of free entries in the submission queue */
+    u32 available( void ) const;
+
+    /*  Returns the ring descriptor */
+    i32 get_fd( void ) const
+    { return fd_; }
+
+private:
+    IoRing( const IoRing& );
+    IoRing& operator=( const IoRing& );
+
+    i32 fd_;
+    struct Impl;
+    Impl* pImpl_;
+};
+
+#endif /* __ioring_h__ */
@@ -0,0 +1,22 @@
+#ifndef __lz4_block_h__
+#define __lz4_block_h__
+
+#include "common_types.h"
+
+/*  Returns the size of LZ4 block of 'size' bytes in the worst case, when nothing matches */
+u32 lz4_bound( u32 size );
+
+/*  Compresses the data into one LZ4 block, it is decompressed by any LZ4 implementation.
+    @param high - the matches are looked for along the hash chains and taken lazily for the ratio,
+                  otherwise the first match of one hash probe is taken for the speed
+    @Returns the size of block or 0 if it doesn't fit 'capacity', i.e. the data is not compressible enough
+    @note The function is thread-safe, the match tables are allocated by the call.
+*/
+u32 lz4_compress( const u8* src, u32 size, u8* dst, u32 capacity, bool high = false );
+
+/*  Decompresses LZ4 block, the malformed one is never read or written out of the buffers
+    @Returns the size of data or -1 if the block is malformed or the data exceeds 'capacity'
+*/
+i32 lz4_decompress( const u8* src, u32 size, u8* dst, u32 capacity );
+
+#endif /* __lz4_block_h__ */
@@ -60,6 +60,8 @@ public:
     inline void clear();
     inline void erase(u32 bytes);
     inline void resize(u32 bufSize);
+    /* exchanges the buffers without copying */
+    inline void swap(Message& msg);
 
 protected:
     inline void set_protected_using(u32 bytes);
@@ -79,6 +81,11 @@ inline Message& Message::operator=(const Message& msg) {
         throw Exception("Message exception: trying to copy the data on protected region");
     }
 
+    if( 0 == msg.size_ ) {
+        clear();
+        return *this;
+    }
+
     reserve( msg.size_ );
     set(msg.buffer_, msg.size_);
     return *this;
@@ -202,6 +209,24 @@ inline void Message::resize(u32 bufSize)
     size_ = bufSize;
 }
 
+inline void Message::swap(Message& msg)
+{
+    if( protected_ || msg.protected_ ) {
+        assert( !"Message::swap Trying to swap the protected allocation!" );
+        throw Exception("Message exception: trying to swap the protected allocation");
+    }
+
+    u8* buffer = buffer_;
+    u32 size = size_;
+    u32 allocated = allocated_;
+    buffer_ = msg.buffer_;
+    size_ = msg.size_;
+    allocated_ = msg.allocated_;
+    msg.buffer_ = buffer;
+    msg.size_ = size;
+    msg.allocated_ = allocated;
+}
+
 inline void Message::clear() 
 {
     if( protected_ ) {
@@ -0,0 +1,168 @@
+#ifndef __pack_pipeline_h__
+#define __pack_pipeline_h__
+
+#include "thread.h"
+#include "condition.h"
+#include "message.h"
+#include "file.h"
+
+#include <vector>
+#include <list>
+
+#define PACK_BLOCK_SIZE     262144  /* the data of one LZ4 block, the blocks of chunk are packed and unpacked in parallel */
+#define PACK_HEADER_SIZE    8       /* the data size(4) and the block size(4) before each block of packed chunk */
+#define PACK_DEPTH          4       /* the chunks of one file read ahead and being packed */
+
+class PackPipeline;
+
+/*  The pool of threads which pack and unpack the LZ4 blocks of chunks. It is shared by all the files
+    of process, so the chunks are packed on the spare processors while the previous ones are sent.
+    The packed chunk is its blocks one after another: each block of at most PACK_BLOCK_SIZE bytes of data
+    follows the data size(4) and the block size(4) in network byte order, the block of the data size
+    is the data as is.
+    @note The pool is thread-safe.
+*/
+class PackWorkers
+{
+public:
+    /*  @param threads - the number of packing threads, 0 means the blocks are packed by the callers */
+    PackWorkers(u16 threads);
+    ~PackWorkers();
+
+    /*  Packs the queued blocks and stops the threads */
+    void stop();
+
+    u16 threads() const
+    { return (u16)threads_.size(); }
+
+    /*  Unpacks the chunk, its blocks are unpacked by the workers and the caller at once
+        @param data - set to the data of chunk
+        @param capacity - the most data the chunk may hold
+        @Returns false if the chunk is malformed or its data exceeds 'capacity'
+    */
+    bool unpack(const u8* chunk, u32 size, Message* data, u32 capacity);
+
+    struct Batch;
+
+    // The block being packed or unpacked
+    struct Job
+    {
+        Batch* batch_;
+        const u8* src_;
+        u32 size_;
+        u8* dst_;
+        u32 capacity_;
+        bool pack_;         /* the block is packed, otherwise it is unpacked */
+        bool high_;         /* pack: the ratio goes before the speed */
+        i32 result_;        /* the size of output, 0 if the packed block doesn't fit, -1 if it is malformed */
+    };
+
+    // The blocks of one chunk, the owner waits for all of them
+    struct Batch
+    {
+        Batch() : pending_(0) {}
+
+        std::vector<Job> jobs_;
+        u32 pending_;       /* the jobs which are not done yet */
+    };
+
+private:
+    friend class PackPipeline;
+
+    typedef std::list<Job*> QueueT;
+
+    class PackThread : public Thread
+    {
+    public:
+        PackThread(const std::string& name, PackWorkers* owner);
+    protected:
+        virtual void run();
+    private:
+        PackWorkers* owner_;
+    };
+    typedef std::vector<PackThread*> ThreadsT;
+    friend class PackThread;
+
+    /*  Queues the jobs of batch */
+    void submit(Batch* batch);
+
+    /*  Waits until the jobs of batch are done, the ones which are still queued are done by the caller */
+    void complete(Batch* batch);
+
+    /*  The packing thread routine */
+    void drain();
+
+    static void execute(Job* job);
+
+    Mutex     lock_;
+    Condition queued_;      /* the workers wait for the jobs */
+    Condition done_;        /* the owners of batches wait for their jobs */
+    bool      stopping_;
+    QueueT    jobs_;
+    ThreadsT  threads_;
+};
+
+/*  The chunks of one file read ahead of sending, the workers pack them while the previous
+    ones are sent. The chunks are taken in the order they are read.
+    @note The pipeline is used by one thread, only the workers run beside it.
+*/
+class PackPipeline
+{
+public:
+    // The chunk of file
+    struct Chunk
+    {
+        i64  offset_;       /* the offset of data in the file */
+        Message data_;
+        bool probe_;        /* the data is packed, otherwise it is sent as is */
+
+        /*  Writes the packed chunk, it is taken when the front() returns it
+            @Returns the size of packed chunk or 0 if it exceeds 'capacity' or the chunk is not packed
+        */
+        u32 packed(u8* dst, u32 capacity) const;
+
+        Message blocks_;    /* the LZ4 blocks in the slots of PACK_BLOCK_SIZE bytes */
+        PackWorkers::Batch batch_;
+    };
+
+    /*  @param high - the blocks are packed for the ratio, otherwise for the speed */
+    PackPipeline(PackWorkers* workers, bool high);
+    ~PackPipeline();
+
+    /*  Reads the next chunk of file and gives its blocks to the workers, the file position is kept
+        @param probe - the chunk is packed, otherwise it is sent as is
+        @throw Exception if the file can't be read
+    */
+    void read(File* file, i64 offset, u32 length, bool probe);
+
+    /*  Returns the number of chunks read ahead */
+    u32 size() const
+    { return (u32)chunks_.size(); }
+
+    /*  Returns the end of data read ahead, there must be chunks */
+    i64 end() const;
+
+    /*  Waits until the first chunk is packed
+        @Returns the chunk, there must be chunks
+    */
+    const Chunk* front();
+
+    /*  Takes the first chunk away, its buffers are reused */
+    void pop();
+
+    /*  Drops the chunks read ahead, e.g. when the file goes back */
+    void clear();
+
+private:
+    PackPipeline(const PackPipeline&);
+    PackPipeline& operator=(const PackPipeline&);
+
+    typedef std::list<Chunk*> ChunksT;
+
+    PackWorkers* workers_;
+    bool    high_;
+    ChunksT chunks_;        /* the chunks in the order of file */
+    ChunksT free_;          /* the chunks to read the next data to */
+};
+
+#endif /* __pack_pipeline_h__ */
@@ -0,0 +1,124 @@
+#ifndef __rawfile_h__
+#define __rawfile_h__
+
+#include "system_exception.h"
+#include "file.h"
+#include <string>
+
+#ifdef WIN32
+/* The same as POSIX one */
+struct iovec
+{
+    void*  iov_base;
+    size_t iov_len;
+};
+#else
+struct iovec;
+#endif
+
+/*  The alignment of buffers, offsets and sizes for the direct input/output */
+#define DIRECT_IO_ALIGNMENT 4096
+
+ /* An representation of file by the system descriptor without stdio buffering.
+    The positional input/output doesn't use the file position, so it is allowed to
+    read and write the different regions of one file from several threads.
+    @see File
+ */
+class RawFile
+{
+public:
+#ifdef WIN32
+    typedef HANDLE handle_t;
+#else
+    typedef i32 handle_t;
+#endif
+
+    RawFile();
+    RawFile( const std::string& path, const std::string& openmode );
+    virtual ~RawFile();
+
+    /*  Opens the file.
+        @param openmode The same as fopen() one ("rb", "wb+", "ab" etc.)
+        @param direct Bypass the system cache (O_DIRECT), so the buffers, offsets and sizes
+               must be aligned by DIRECT_IO_ALIGNMENT. The file is opened as usual if the
+               file system doesn't support it.
+        @throw system_exception
+    */
+    void open( const std::string& path, const std::string& openmode, bool direct = false );
+    void close( void );
+
+    /*  Positional input/output, the file position is neither used nor changed.
+        @return the number of bytes, it is less than the size only on end of file for reading.
+        @throw system_exception
+    */
+    u32 pread( void* buf, u32 size, i64 offset ) const;
+    u32 pwrite( const void* buf, u32 size, i64 offset );
+    u64 pwritev( const struct iovec* iov, u32 count, i64 offset );
+
+    /*  Sequential input/output from the file position */
+    u32 read( void* buf, u32 size );
+    u32 write( const void* buf, u32 size );
+
+    /*  Returns the file size.  */
+    i64 size( void ) const;
+
+    /*  Resizes file */
+    void resize( i64 size );
+
+    /*  Allocates the disk space for the first 'size' bytes without changing the file size,
+        so the data written later is not fragmented.
+        @return false if the file system doesn't support the preallocation.
+        @throw system_exception if there is no space or on other error.
+    */
+    bool allocate( i64 size );
+
+    /*  Flushes the written data to the disk */
+    void sync( void );
+
+    /*  The file position routines */
+    void rewind( void );
+    i64  tell( void ) const;
+    void seek( i64 offset, i32 origin );
+
+    bool isOpened( void ) const;
+
+    /*  Returns true if the file input/output bypasses the system cache */
+    bool isDirect( void ) const
+    { return direct_; }
+
+    /*  Sets how the file data is kept in the system cache, it is kept on reopening */
+    void setCachePolicy( CachePolicy policy );
+
+    CachePolicy cachePolicy( void ) const
+    { return cachePolicy_; }
+
+    /*  Accounts the written region if the policy is drop. The writeback of each full window
+        is started at once and the window is dropped from the system cache after the next one,
+        so the writeback is mostly done by then. The file is supposed to be written sequentially.
+    */
+    void written( i64 offset, u64 size );
+
+    /*  Drops the rest of written pages, the ones being written back are left to the system */
+    void dropCache( void );
+
+    handle_t handle( void ) const
+    { return handle_; }
+
+    const std::string& path() const
+    { return path_; }
+
+private:
+    RawFile( const RawFile& );
+    RawFile& operator=( const RawFile& );
+
+    handle_t handle_;
+    i64 position_;
+    bool direct_;
+    std::string path_;
+    CachePolicy cachePolicy_;
+    i64 cacheEnd_;      /* the end of written data */
+    i64 cacheStarted_;  /* the writeback of pages before is started */
+    i64 cacheDropped_;  /* the pages before are dropped */
+};
+
+#endif /* __rawfile_h__ */
@@ -0,0 +1,86 @@
+#ifndef __reactor_h__
+#define __reactor_h__
+
+#include "thread.h"
+#include "socket.h"
+
+class Task;
+
+/*  Demultiplexer of the descriptors events.
+    Runs the attached task in the reactor thread each time when its descriptor
+    becomes readable (or the peer closed the connection), and writable if the task
+    waits for it.
+    On Linux it is based on the edge-triggered epoll, so the task must read
+    the descriptor until EWOULDBLOCK, otherwise the next event will not come.
+    The other platforms use select().
+    @see Timer
+*/
+class Reactor : public Thread
+{
+public:
+    Reactor( void );
+    explicit Reactor( const std::string& name );
+
+   /*   Destructor.
+        @note calls cancel() if it has not been called
+        @see cancel()
+    */
+    virtual ~Reactor( void );
+
+   /*   Attaches the task to the descriptor.
+        @param fd The descriptor for readiness waiting (must be in nonblocking mode).
+        @param task The task that is run when descriptor is readable.
+        @note This call transfers the ownership of the task to the reactor
+        (in other words, the task will be deleted by the reactor).
+        @warning Task must not be a stack object.
+        @throw Exception if the descriptor or the task has been already attached.
+        @throw system_exception if descriptor can't be watched.
+    */
+    void attach( SD fd, Task* task );
+
+   /*   Detaches the task from its descriptor.
+        @param takeOwnership If 'true' then the reactor will not be in charge of the task anymore
+        (in other words, the task will not be deleted by the reactor).
+        @return 'true' if the task was successfully detached, otherwise - 'false'.
+        @note It is safe to detach the task from its own run(), the task is deleted
+        after it returns.
+    */
+    bool detach( Task* task, bool takeOwnership = false );
+
+   /*   Runs the attached task once more without the descriptor event.
+        It is used to continue the task that stopped reading its descriptor
+        (e.g. on the full queue), so it must read the descriptor until EWOULDBLOCK then.
+        @return 'false' if the task is not attached.
+        @note It is safe to call from any thread.
+    */
+    bool resume( Task* task );
+
+   /*   Runs the attached task also when its descriptor becomes writable.
+        It is used to send the data which didn't fit the socket buffer, the event
+        is edge-triggered as the reading one, so the task must write the descriptor
+        until EWOULDBLOCK then.
+        @param writable 'false' stops waiting for the writable descriptor.
+        @return 'false' if the task is not attached.
+        @throw system_exception if descriptor can't be watched.
+        @note It is safe to call from any thread.
+    */
+    bool watch_writable( Task* task, bool writable );
+
+   /*   Terminates this reactor, discarding and deleting any currently attached tasks   */
+    virtual void cancel( void );
+
+   /*   Returns the number of attached descriptors */
+    u32 size( void ) const;
+
+    struct ReactorImpl;
+
+protected:
+   /* Reimplemented from Thread */
+    virtual void run( void );
+
+private:
+    /* Implementation details */
+    ReactorImpl* impl_;
+};
+
+#endif /* __reactor_h__ */
@@ -34,7 +34,8 @@ public:
     */
     virtual void close();
 
-    /*  Returns the remote port number to which this socket is connected.
+    /*  Returns the remote port number to which this socket is connected,
+        the connecting one is returned even if the socket is closed.
         @throw system_exception
     */
     u16 get_port() const;
@@ -42,10 +43,49 @@ public:
     /*  Transmit a message to another transport end-point. 
         If the socket does not have enough buffer space available to hold 
         the  message  being sent, this method blocks.
+        @param more - more data follows, so the message is not sent in the separate segment (MSG_MORE)
         @return the number of bytes that were sent, -1 if an error of EWOULDBLOCK was returned.
         @throw system_exception
     */
-    s32 send(const void* msg, s32 len);
+    s32 send(const void* msg, s32 len, bool more = false);
+
+    /*  Checks if the file can be sent by sendfile() */
+    static bool isSendfileSupported( void );
+
+    /*  Transmits the file region bypassing the user space (sendfile()),
+        the file position is neither used nor changed.
+        @return the number of bytes that were sent, -1 if an error of EWOULDBLOCK was returned.
+        @throw system_exception
+    */
+    i64 sendfile(i32 fileFd, i64 offset, u64 count);
+
+    /*  Enables the zero-copy sending (SO_ZEROCOPY).
+        @return false if it is not supported, send_zerocopy() can't be used then.
+    */
+    bool enable_zerocopy();
+
+    /*  Transmits the message without copying it to the socket buffer (MSG_ZEROCOPY).
+        The message must not be changed until the kernel releases it, each call that sent
+        some bytes gets the next number (from 0) reported by zerocopy_completion().
+        @return the number of bytes that were sent, -1 if an error of EWOULDBLOCK was returned,
+                0 if the limit of pending notifications is reached, so they must be read first.
+        @throw system_exception
+    */
+    s32 send_zerocopy(const void* msg, s32 len);
+
+    /*  Reads the notification of released zero-copy messages from the socket error queue.
+        @param first, last - the numbers of released messages
+        @param copied - the kernel copied the data anyway, so the zero-copy sending is useless
+        @return false if there is no notification.
+        @throw system_exception
+    */
+    bool zerocopy_completion(u32* first, u32* last, bool* copied);
+
+    /*  Blocks until the notification of zero-copy sending is available.
+        @return false when timeout ends
+        @throw system_exception if the connection is closed or on errors
+    */
+    bool until_zerocopy_completion(i32 timeoutMs);
 
     /*  Receives a message from the socket.
         @return the number of bytes received, -1 if an error of EWOULDBLOCK was returned.
@@ -97,6 +137,7 @@ private:
     /* Flag used to determine if socket is opened. */
     bool is_open_;
     mutable IPAddress address_;
+    u16 port_;          /* the port of connect(), 0 for the accepted socket */
     std::string target_;
 };
 
@@ -125,6 +125,11 @@ public:
     */
     static bool sleep( u32 aMilis );
 
+    /*
+    * Returns the number of processors which are currently online.
+    */
+    static u16 getNumberOfProcessors();
+
     /*
     * Returns thread's id.
     */
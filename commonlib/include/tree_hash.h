@@ -0,0 +1,140 @@
+#ifndef __tree_hash_h__
+#define __tree_hash_h__
+
+#include "thread.h"
+#include "condition.h"
+#include "message.h"
+
+#include <string>
+#include <vector>
+#include <list>
+
+#define TREE_HASH_SIZE      32          /* the hash and the chaining values of leaves are BLAKE3 outputs */
+#define TREE_HASH_LEAF      1048576     /* the subtree hashed by one worker, it is a power of two of BLAKE3 chunks */
+#define TREE_HASH_IN_FLIGHT 4           /* the leaves of one file being hashed at once */
+
+class TreeHash;
+
+/*  The pool of threads which hash the leaves of files. It is shared by all the files of process,
+    so their leaves are hashed on the spare processors while the files are read or written.
+    @note The pool is thread-safe.
+*/
+class HashWorkers
+{
+public:
+    /*  @param threads - the number of hashing threads, 0 means the leaves are hashed by the callers */
+    HashWorkers(u16 threads);
+    ~HashWorkers();
+
+    /*  Hashes the queued leaves and stops the threads */
+    void stop();
+
+    u16 threads() const
+    { return (u16)threads_.size(); }
+
+private:
+    friend class TreeHash;
+
+    struct Job
+    {
+        TreeHash* owner_;
+        u32 index_;         /* the leaf number in its file */
+        Message data_;
+    };
+    typedef std::list<Job*> JobsT;
+
+    class HashThread : public Thread
+    {
+    public:
+        HashThread(const std::string& name, HashWorkers* owner);
+    protected:
+        virtual void run();
+    private:
+        HashWorkers* owner_;
+    };
+    typedef std::vector<HashThread*> ThreadsT;
+    friend class HashThread;
+
+    /*  Queues the leaf, it is hashed at once if there are no threads */
+    void submit(Job* job);
+
+    /*  The hashing thread routine */
+    void drain();
+
+    Mutex     lock_;
+    Condition cond_;
+    bool      stopping_;
+    JobsT     jobs_;
+    ThreadsT  threads_;
+};
+
+/*  BLAKE3 hash of the data given piece by piece, e.g. a file being sent or received.
+    The data is cut into leaves of TREE_HASH_LEAF bytes which are the subtrees of BLAKE3 tree,
+    so the workers hash them in parallel and the hash is put together from their chaining
+    values at the end. The chaining values of leaves are compared to find the corrupted part.
+    @note The hash is used by one thread, only the workers run beside it.
+*/
+class TreeHash
+{
+public:
+    explicit TreeHash(HashWorkers* workers);
+    ~TreeHash();
+
+    /*  Appends the data, the full leaf is given to the workers when the next data comes.
+        It waits if TREE_HASH_IN_FLIGHT leaves are being hashed already.
+    */
+    void update(const u8* data, u32 size);
+
+    /*  Returns the number of leaves hashed by now without the gaps from the first one */
+    u32 ready();
+
+    /*  Copies the chaining value of hashed leaf, it is TREE_HASH_SIZE bytes */
+    void leaf(u32 index, u8* cv);
+
+    /*  Hashes the last leaf and waits for the others, ready() counts all the leaves then
+        @param hash - TREE_HASH_SIZE bytes of the whole data
+    */
+    void finish(u8* hash);
+
+    /*  Drops the leaves from the one holding 'offset', the data goes on from the start of that leaf then
+        @Returns the offset of data to give again
+    */
+    u64 rewind(u64 offset);
+
+    /*  Returns the number of bytes given by now */
+    u64 size() const
+    { return size_; }
+
+    /*  Returns the hash as the lowercase hex digits */
+    static std::string hex(const u8* hash);
+
+    /*  Hashes the data at once by the caller, e.g. a block of file
+        @param hash - TREE_HASH_SIZE bytes of BLAKE3 hash of the data
+    */
+    static void digest(const u8* data, u32 size, u8* hash);
+
+private:
+    TreeHash(const TreeHash&);
+    TreeHash& operator=(const TreeHash&);
+
+    friend class HashWorkers;
+
+    /*  Stores the chaining value of leaf hashed by a worker */
+    void hashed(u32 index, const Message& data);
+
+    /*  Waits until the workers have no leaves of the file */
+    void wait_pending();
+
+    Mutex     lock_;
+    Condition cond_;
+    HashWorkers* workers_;
+    Message   leaf_;        /* the last leaf being filled */
+    u64       size_;
+    std::vector<u32> cvs_;  /* 8 words of chaining value per leaf */
+    std::vector<bool> done_; /* the leaf is hashed */
+    u32       pending_;     /* the leaves being hashed by the workers */
+    u32       ready_;       /* the leaves hashed without gaps */
+    bool      finished_;
+};
+
+#endif /* __tree_hash_h__ */
@@ -4,6 +4,7 @@
 #include "common_types.h"
 #include <string>
 #include <vector>
+#include <map>
 
 #ifndef WIN32
     #define SC_ESC     27
@@ -44,6 +45,14 @@ u16 split( const std::string& in_str, s8 delimiter, StringsT* out );
 u16 split( const std::string& in_str, const std::string& delimiter, StringsT* out);
 void trimWhiteSpace( std::string* pStr );
 
+/*  Command line options container (key is an option name without leading "--") */
+typedef std::map<std::string,std::string> OptionsT;
+
+/*  Parses the command line options in form "--name=value" or "--name" (value is empty).
+    @return the number of parsed options.
+*/
+u16 parse_options( int argc, char* argv[], OptionsT* out );
+
 u8* i64toa( u8* pBuf, u8 buf_size, i64 value);
 u8* i64toa( u8* pBuf, u8* end, i64 value);
 u8* u64toa( u8* pBuf, u8 buf_size, u64 value);
@@ -56,6 +65,11 @@ std::string tostring( i32 value );
 std::string tostring( u64 value );
 std::string tostring( i64 value );
 
+/*  Converts the decimal digits to the number.
+    @return false if the string is empty, contains not a digit or the number is out of range.
+*/
+bool atou64( const std::string& str, u64* value );
+
 /*  Returns the current UTC time in milliseconds.   */
 u64 current_time();
 
@@ -0,0 +1,80 @@
+#ifndef __zerocopy_sender_h__
+#define __zerocopy_sender_h__
+
+#include "aligned_pool.h"
+#include <list>
+
+class TCPSockClient;
+
+/*  Sends the buffers of the pool without copying them to the socket buffer (MSG_ZEROCOPY).
+    The sent buffer is given back to the pool only when the kernel releases it, so the
+    completion notifications are read from the socket error queue. If the zero-copy
+    sending is not supported, the buffers are sent by copying and released at once.
+    @note The sender is not thread-safe, it is supposed to be used by one sending task at a time.
+*/
+class ZeroCopySender
+{
+public:
+    /*  @param socket - the connected socket, it must outlive the sender
+        @param bufferSize - the size of buffers
+        @param maxBuffers - the maximum number of buffers being filled and sent
+    */
+    ZeroCopySender(TCPSockClient* socket, u32 bufferSize, u32 maxBuffers);
+    ~ZeroCopySender();
+
+    /*  Returns the buffer to fill, it waits for the kernel to release one if all of them are in use.
+        @throw Exception if the connection is closed or the completions are not received
+    */
+    u8* get_buffer();
+
+    /*  Gives the unused buffer back */
+    void put_buffer(u8* buffer);
+
+    /*  Sends the whole buffer, it is given back when the kernel releases it.
+        @throw Exception
+    */
+    void send(u8* buffer, u32 size);
+
+    u32 buffer_size() const
+    { return pool_.buffer_size(); }
+
+    TCPSockClient* socket() const
+    { return socket_; }
+
+    /*  Returns true if the buffers are really sent without copying */
+    bool isZeroCopy() const
+    { return zerocopy_; }
+
+    /*  Returns the number of sends the kernel copied anyway (e.g. to the loopback) */
+    u32 copied() const
+    { return copied_; }
+
+private:
+    ZeroCopySender(const ZeroCopySender&);
+    ZeroCopySender& operator=(const ZeroCopySender&);
+
+    struct InFlight
+    {
+        u8* buffer_;
+        u32 first_;     /* the number of the first send of buffer */
+        u32 count_;     /* the number of sends of buffer */
+        u32 pending_;   /* the sends not released yet */
+    };
+    typedef std::list<InFlight> InFlightT;
+
+    /*  Reads the completion notifications and releases the buffers,
+        @param wait - wait for the notification if there is none
+    */
+    void reap(bool wait);
+
+    TCPSockClient* socket_;
+    AlignedPool pool_;
+    u32 maxBuffers_;
+    u32 used_;          /* buffers being filled or in flight */
+    bool zerocopy_;
+    u32 nextId_;        /* the number of next zero-copy send */
+    u32 copied_;
+    InFlightT inFlight_;
+};
+
+#endif /* __zerocopy_sender_h__ */
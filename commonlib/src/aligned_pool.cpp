@@ -0,0 +1,77 @@
+#ifndef WIN32
+#   include <stdlib.h>
+#else
+#   include <malloc.h>
+#endif
+
+#include "aligned_pool.h"
+
+using namespace std;
+
+AlignedPool::AlignedPool( u32 bufferSize, u32 alignment, u32 maxFree )
+    : bufferSize_(bufferSize),
+    alignment_(alignment),
+    maxFree_(maxFree)
+{
+    assert( alignment > 0 && 0 == (alignment & (alignment - 1)) );
+    assert( bufferSize > 0 && 0 == bufferSize % alignment );
+    free_.reserve( maxFree );
+}
+
+AlignedPool::~AlignedPool()
+{
+    for(vector<u8*>::iterator It = free_.begin(); It != free_.end(); ++It)
+    {
+#ifdef WIN32
+        _aligned_free( *It );
+#else
+        free( *It );
+#endif
+    }
+}
+
+u8* AlignedPool::get()
+{
+    {
+        MGuard g(lock_);
+        if( !free_.empty() )
+        {
+            u8* buffer = free_.back();
+            free_.pop_back();
+            return buffer;
+        }
+    }
+
+#ifdef WIN32
+    void* buffer = _aligned_malloc( bufferSize_, alignment_ );
+    if( NULL == buffer )
+        throw system_exception("_aligned_malloc", ENOMEM);
+#else
+    void* buffer = NULL;
+    i32 err = posix_memalign( &buffer, alignment_, bufferSize_ );
+    if( 0 != err )
+        throw system_exception("posix_memalign", err);
+#endif
+    return (u8*)buffer;
+}
+
+void AlignedPool::put( u8* buffer )
+{
+    if( NULL == buffer )
+        return;
+
+    {
+        MGuard g(lock_);
+        if( free_.size() < maxFree_ )
+        {
+            free_.push_back( buffer );
+            return;
+        }
+    }
+
+#ifdef WIN32
+    _aligned_free( buffer );
+#else
+    free( buffer );
+#endif
+}
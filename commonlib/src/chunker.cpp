@@ -0,0 +1,297 @@
+#include <string.h>
+#include <algorithm>
+
+#include "chunker.h"
+#include "tree_hash.h"
+
+using namespace std;
+
+#define CDC_READ_SIZE       4194304     /* the file is cut by pieces of this size */
+
+namespace {
+
+/*  The gear table and the masks of cut points, the sender and the receiver must have the same ones */
+struct Gear
+{
+    Gear()
+    {
+        // splitmix64 of the fixed seed
+        u64 state = 0x9e3779b97f4a7c15ULL;
+        for(u32 i = 0; i < 256; ++i)
+        {
+            u64 z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            table_[i] = z ^ (z >> 31);
+        }
+        // the chunk before the average size needs two bits more to be cut, the one after it two bits less
+        small_ = spread(18);
+        large_ = spread(14);
+    }
+
+    /*  Returns the mask of 'bits' bits spread over the high bits of the hash, they depend on more bytes */
+    static u64 spread(u32 bits)
+    {
+        u64 mask = 0;
+        for(u32 i = 0; i < bits; ++i)
+            mask |= 1ULL << (63 - i * 48 / bits);
+        return mask;
+    }
+
+    u64 table_[256];
+    u64 small_;
+    u64 large_;
+};
+
+const Gear gear;
+
+inline void put32(u8* ptr, u32 value)
+{
+    ptr[0] = (u8)(value >> 24); ptr[1] = (u8)(value >> 16); ptr[2] = (u8)(value >> 8); ptr[3] = (u8)value;
+}
+
+inline u32 get32(const u8* ptr)
+{
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) | ((u32)ptr[2] << 8) | ptr[3];
+}
+
+inline u64 get64(const u8* ptr)
+{
+    return ((u64)get32(ptr) << 32) | get32(ptr + 4);
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+u32 Chunker::cut(const u8* data, u32 size)
+{
+    if( size <= CDC_MIN_CHUNK )
+        return size;
+
+    u32 end = min(size, (u32)CDC_MAX_CHUNK);
+    u32 normal = min(end, (u32)CDC_AVG_CHUNK);
+    u64 hash = 0;
+    u32 i = CDC_MIN_CHUNK;
+    for(; i < normal; ++i)
+    {
+        hash = (hash << 1) + gear.table_[data[i]];
+        if( 0 == (hash & gear.small_) )
+            return i + 1;
+    }
+    for(; i < end; ++i)
+    {
+        hash = (hash << 1) + gear.table_[data[i]];
+        if( 0 == (hash & gear.large_) )
+            return i + 1;
+    }
+    return end;
+}
+
+void Chunker::hash(const u8* data, u32 size, u8* name)
+{
+    TreeHash::digest(data, size, name);
+}
+
+void Chunker::encode(const u8* name, u32 size, u8* record)
+{
+    memcpy(record, name, CDC_HASH_SIZE);
+    put32(record + CDC_HASH_SIZE, size);
+}
+
+u32 Chunker::record_size(const u8* record)
+{
+    return get32(record + CDC_HASH_SIZE);
+}
+
+/////////////////////////////////////////////////////////////////////////
+ChunkFilter::ChunkFilter()
+    : log2_(0),
+    hashes_(0),
+    loaded_(0)
+{}
+
+u64 ChunkFilter::key(const u8* name)
+{
+    return get64(name);
+}
+
+void ChunkFilter::reset(u32 bits, u32 hashes)
+{
+    assert( bits >= CDC_FILTER_MIN_BITS && bits <= CDC_FILTER_MAX_BITS && hashes > 0 && hashes <= CDC_FILTER_MAX_HASHES );
+    bits_.assign((size_t)1 << (bits - 3), 0);
+    log2_ = bits;
+    hashes_ = hashes;
+    loaded_ = 0;
+}
+
+void ChunkFilter::clear()
+{
+    vector<u8>().swap(bits_);
+    log2_ = 0;
+    hashes_ = 0;
+    loaded_ = 0;
+}
+
+void ChunkFilter::add(u64 key)
+{
+    // the bit is the high bits of the step from the key, the step is odd, so the bits differ
+    u64 step = (key * 0x9e3779b97f4a7c15ULL) | 1;
+    for(u32 i = 0; i < hashes_; ++i, key += step)
+    {
+        u64 bit = key >> (64 - log2_);
+        bits_[(size_t)(bit >> 3)] |= (u8)(1 << (bit & 7));
+    }
+}
+
+bool ChunkFilter::contains(u64 key) const
+{
+    u64 step = (key * 0x9e3779b97f4a7c15ULL) | 1;
+    for(u32 i = 0; i < hashes_; ++i, key += step)
+    {
+        u64 bit = key >> (64 - log2_);
+        if( 0 == (bits_[(size_t)(bit >> 3)] & (1 << (bit & 7))) )
+            return false;
+    }
+    return true;
+}
+
+bool ChunkFilter::load(u64 offset, const u8* data, u32 size)
+{
+    if( offset != loaded_ || size > bits_.size() - loaded_ )
+        return false;
+    if( size > 0 )
+        memcpy(&bits_[(size_t)offset], data, size);
+    loaded_ += size;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+ChunkQueue::ChunkQueue()
+    : announced_(0),
+    answered_(0),
+    waiting_(false),
+    asked_(0),
+    pending_(0),
+    dropped_(false)
+{}
+
+u32 ChunkQueue::announce(File* file, i64 end, u32 most, u64 ahead, const ChunkFilter* filter, string* records,
+                         bool* asked)
+{
+    records->clear();
+    *asked = false;
+    if( dropped_ || waiting_ )
+        return 0;
+    if( 0 == buffer_.size() )
+        buffer_.reserve(CDC_READ_SIZE + CDC_MAX_CHUNK);
+
+    // the file position is the sent data, the chunks are cut ahead of it
+    i64 position = file->tell();
+    i64 from = announced_;
+    i64 likely = -1;
+    u32 count = 0;
+    u32 kept = 0;
+    try {
+        while( count < most && announced_ < end && (u64)(announced_ - from) < ahead )
+        {
+            u32 wanted = (u32)min((i64)buffer_.size(), end - announced_);
+            if( kept < wanted ) {
+                file->seek( announced_ + kept, SEEK_SET );
+                file->read( buffer_.get() + kept, wanted - kept );
+            }
+
+            // the chunk is cut from CDC_MAX_CHUNK bytes, so the short rest is cut with the next piece
+            u32 pos = 0;
+            while( count < most && (u64)(announced_ - from) < ahead && pos < wanted &&
+                   (wanted - pos >= CDC_MAX_CHUNK || announced_ + (wanted - pos) == end) )
+            {
+                Chunk chunk;
+                chunk.offset_ = announced_;
+                chunk.size_ = Chunker::cut(buffer_.get() + pos, wanted - pos);
+                chunk.present_ = false;
+                Chunker::hash(buffer_.get() + pos, chunk.size_, chunk.name_);
+                chunks_.push_back(chunk);
+                if( likely < 0 && (NULL == filter || filter->contains(ChunkFilter::key(chunk.name_))) )
+                    likely = chunk.offset_;
+
+                u8 record[CDC_RECORD_SIZE];
+                Chunker::encode(chunk.name_, chunk.size_, record);
+                records->append((const char*)record, CDC_RECORD_SIZE);
+                pos += chunk.size_;
+                announced_ += chunk.size_;
+                ++count;
+            }
+            kept = wanted - pos;
+            memmove(buffer_.get(), buffer_.get() + pos, kept);
+        }
+    }
+    catch(...) {
+        file->seek( position, SEEK_SET );
+        throw;
+    }
+    file->seek( position, SEEK_SET );
+
+    // the data before the first likely chunk goes as is, the rest waits for the answer
+    if( count > 0 && likely < 0 )
+        answered_ = announced_;
+    else if( count > 0 ) {
+        answered_ = likely;
+        waiting_ = true;
+        asked_ = from;
+        pending_ = count;
+        *asked = true;
+    }
+    return count;
+}
+
+bool ChunkQueue::answered(i64 offset, const u8* present, u32 size)
+{
+    // the answers to the chunks announced before the queue is dropped are late
+    if( dropped_ )
+        return true;
+    if( !waiting_ || offset != asked_ || size != (pending_ + 7) / 8 )
+        return false;
+
+    // the announced chunks are the last ones of queue, the ones before the first likely one may be sent already
+    ChunksT::size_type last = chunks_.size();
+    for(u32 i = pending_; i > 0 && last > 0; --i, --last)
+        chunks_[last - 1].present_ = (0 != (present[(i - 1) / 8] & (1 << ((i - 1) % 8))));
+    answered_ = announced_;
+    waiting_ = false;
+    return true;
+}
+
+bool ChunkQueue::next(i64 offset, u64* literals, const Chunk** chunk)
+{
+    *chunk = NULL;
+    while( !chunks_.empty() && chunks_.front().offset_ + (i64)chunks_.front().size_ <= offset )
+        chunks_.pop_front();
+    if( dropped_ )
+    {
+        *literals = ~(u64)0;
+        return true;
+    }
+    if( offset >= answered_ )
+        return false;
+
+    // the data goes as is up to the next chunk the receiver has
+    for(ChunksT::const_iterator It = chunks_.begin(); It != chunks_.end() && It->offset_ < answered_; ++It)
+    {
+        if( !It->present_ || It->offset_ < offset )
+            continue;
+        *literals = (u64)(It->offset_ - offset);
+        if( 0 == *literals )
+            *chunk = &*It;
+        return true;
+    }
+    *literals = (u64)(answered_ - offset);
+    return true;
+}
+
+void ChunkQueue::clear()
+{
+    chunks_.clear();
+    waiting_ = false;
+    pending_ = 0;
+    dropped_ = true;
+}
@@ -0,0 +1,326 @@
+#if defined(_M_X64) || defined(__x86_64__)
+#   define HAVE_SSE42_CRC
+#   include <nmmintrin.h>
+#   ifdef WIN32
+#       include <intrin.h>
+#       define SSE42_TARGET
+#   else
+#       define SSE42_TARGET __attribute__((target("sse4.2")))
+#   endif
+#   if defined(_MSC_VER) && _MSC_VER >= 1920
+#       define HAVE_VPCLMUL_CRC
+#       define VPCLMUL_TARGET
+#   elif defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8
+#       define HAVE_VPCLMUL_CRC
+#       define VPCLMUL_TARGET __attribute__((target("sse4.2,avx2,pclmul,vpclmulqdq")))
+#   endif
+#   ifdef HAVE_VPCLMUL_CRC
+#       include <immintrin.h>
+#   endif
+#endif
+
+#include <string.h>
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82f63b78  /* reflected Castagnoli polynomial */
+#define CRC32C_LONG     8192        /* the blocks checksummed by three at once */
+#define CRC32C_SHORT    256
+#define CRC32C_FOLDED   512         /* the data folded by carry-less multiplication at least */
+
+namespace {
+
+// The tables are built once by the static object before main(), so they are read only then
+struct Crc32cTables
+{
+    Crc32cTables( void );
+
+    /* slice-by-8 */
+    u32 slice_[8][256];
+    /* the operators appending CRC32C_LONG and CRC32C_SHORT zero bytes to the checksum */
+    u32 long_[4][256];
+    u32 short_[4][256];
+    bool hardware_;
+    bool folding_;
+};
+
+u32 gf2_matrix_times( const u32* mat, u32 vec )
+{
+    u32 sum = 0;
+    for(; vec; vec >>= 1, ++mat)
+    {
+        if( vec & 1 )
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+void gf2_matrix_square( u32* square, const u32* mat )
+{
+    for(u32 n = 0; n < 32; ++n)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/*  Builds the tables applying 'length' zero bytes to the checksum by one byte of it at once,
+    'length' must be a power of two
+*/
+void zeros_tables( u32 zeros[4][256], u32 length )
+{
+    // the operator of one zero bit, then it is squared up to 'length' bytes
+    u32 odd[32];
+    u32 even[32];
+    odd[0] = CRC32C_POLY;
+    for(u32 n = 1, row = 1; n < 32; ++n, row <<= 1)
+        odd[n] = row;
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    u32* op = odd;
+    while( length )
+    {
+        gf2_matrix_square(even, odd);
+        op = even;
+        length >>= 1;
+        if( 0 == length )
+            break;
+        gf2_matrix_square(odd, even);
+        op = odd;
+        length >>= 1;
+    }
+
+    for(u32 n = 0; n < 256; ++n)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+inline u32 shift( const u32 zeros[4][256], u32 crc )
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+bool detect_sse42( void )
+{
+#ifdef HAVE_SSE42_CRC
+#   ifdef WIN32
+    int info[4];
+    __cpuid(info, 1);
+    return 0 != (info[2] & (1 << 20));
+#   else
+    return __builtin_cpu_supports("sse4.2");
+#   endif
+#else
+    return false;
+#endif
+}
+
+bool detect_vpclmul( void )
+{
+#ifdef HAVE_VPCLMUL_CRC
+#   ifdef WIN32
+    // AVX2 and VPCLMULQDQ of the processor, the wide registers are saved by the system
+    int info[4];
+    __cpuid(info, 1);
+    if( 0 == (info[2] & (1 << 27)) || 6 != (_xgetbv(0) & 6) )
+        return false;
+    __cpuidex(info, 7, 0);
+    return 0 != (info[1] & (1 << 5)) && 0 != (info[2] & (1 << 10));
+#   else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("vpclmulqdq");
+#   endif
+#else
+    return false;
+#endif
+}
+
+Crc32cTables::Crc32cTables( void )
+{
+    for(u32 n = 0; n < 256; ++n)
+    {
+        u32 crc = n;
+        for(u32 k = 0; k < 8; ++k)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        slice_[0][n] = crc;
+    }
+    for(u32 n = 0; n < 256; ++n)
+    {
+        u32 crc = slice_[0][n];
+        for(u32 k = 1; k < 8; ++k)
+        {
+            crc = slice_[0][crc & 0xff] ^ (crc >> 8);
+            slice_[k][n] = crc;
+        }
+    }
+
+    zeros_tables(long_, CRC32C_LONG);
+    zeros_tables(short_, CRC32C_SHORT);
+    hardware_ = detect_sse42();
+    folding_ = hardware_ && detect_vpclmul();
+}
+
+const Crc32cTables tables;
+
+inline u64 load64( const u8* ptr )
+{
+    u64 value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+u32 crc32c_slice8( const u8* next, u32 size, u32 crc )
+{
+    // the words are taken in the little-endian order of x86
+    while( size && 0 != ((size_t)next & 7) )
+    {
+        crc = tables.slice_[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        --size;
+    }
+    for(; size >= 8; size -= 8, next += 8)
+    {
+        u64 word = load64(next) ^ crc;
+        crc = tables.slice_[7][word & 0xff] ^
+              tables.slice_[6][(word >> 8) & 0xff] ^
+              tables.slice_[5][(word >> 16) & 0xff] ^
+              tables.slice_[4][(word >> 24) & 0xff] ^
+              tables.slice_[3][(word >> 32) & 0xff] ^
+              tables.slice_[2][(word >> 40) & 0xff] ^
+              tables.slice_[1][(word >> 48) & 0xff] ^
+              tables.slice_[0][word >> 56];
+    }
+    while( size-- )
+        crc = tables.slice_[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef HAVE_SSE42_CRC
+/*  Takes three blocks at once, so the latency of crc32 instruction is hidden,
+    then their checksums are put together by the zeros operators
+*/
+template<u32 BLOCK>
+inline SSE42_TARGET u32 crc32c_blocks( const u8** next, u32* size, u32 crc0, const u32 zeros[4][256] )
+{
+    while( *size >= 3 * BLOCK )
+    {
+        u64 crc1 = 0;
+        u64 crc2 = 0;
+        u64 crc = crc0;
+        const u8* end = *next + BLOCK;
+        for(const u8* ptr = *next; ptr < end; ptr += 8)
+        {
+            crc = _mm_crc32_u64(crc, load64(ptr));
+            crc1 = _mm_crc32_u64(crc1, load64(ptr + BLOCK));
+            crc2 = _mm_crc32_u64(crc2, load64(ptr + 2 * BLOCK));
+        }
+        crc0 = shift(zeros, (u32)crc) ^ (u32)crc1;
+        crc0 = shift(zeros, crc0) ^ (u32)crc2;
+        *next += 3 * BLOCK;
+        *size -= 3 * BLOCK;
+    }
+    return crc0;
+}
+
+#ifdef HAVE_VPCLMUL_CRC
+/*  The constants folding 128 bits over D bits: x^(D+63) and x^(D-1) mod P bit-reflected,
+    they are multiplied by the low and the high halves of the folded bits
+*/
+const u32 FOLD_1024[2] = { 0x6577b245, 0x7417153f };
+const u32 FOLD_768[2] = { 0xc92f998d, 0x3365346a };
+const u32 FOLD_512[2] = { 0x1c19243b, 0x75bba45b };
+const u32 FOLD_256[2] = { 0x33ccbbbc, 0xa2158b34 };
+const u32 FOLD_128[2] = { 0x3743f7bd, 0x3171d430 };
+
+inline VPCLMUL_TARGET __m256i fold_constant( const u32 fold[2] )
+{
+    // the reflected product takes the constant in the upper 32 bits
+    return _mm256_set_epi64x((i64)((u64)fold[1] << 32), (i64)((u64)fold[0] << 32),
+                             (i64)((u64)fold[1] << 32), (i64)((u64)fold[0] << 32));
+}
+
+inline VPCLMUL_TARGET __m256i fold256( __m256i bits, __m256i fold )
+{
+    return _mm256_xor_si256(_mm256_clmulepi64_epi128(bits, fold, 0x00), _mm256_clmulepi64_epi128(bits, fold, 0x11));
+}
+
+/*  Folds the data by 128 bytes at once, so one crc32 instruction per cycle doesn't bound the rate.
+    The eight lanes of 16 bytes are moved 1024 bits ahead and added to the next ones, at last they
+    are folded into one lane which is congruent to the data, so crc32 of its 16 bytes is the checksum.
+*/
+VPCLMUL_TARGET u32 crc32c_vpclmul( const u8** next, u32* size, u32 crc )
+{
+    const u8* ptr = *next;
+    const u8* end = ptr + (*size & ~127u);
+    __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)ptr), _mm256_set_epi64x(0, 0, 0, crc));
+    __m256i x1 = _mm256_loadu_si256((const __m256i*)(ptr + 32));
+    __m256i x2 = _mm256_loadu_si256((const __m256i*)(ptr + 64));
+    __m256i x3 = _mm256_loadu_si256((const __m256i*)(ptr + 96));
+
+    const __m256i fold = fold_constant(FOLD_1024);
+    for(ptr += 128; ptr < end; ptr += 128)
+    {
+        x0 = _mm256_xor_si256(fold256(x0, fold), _mm256_loadu_si256((const __m256i*)ptr));
+        x1 = _mm256_xor_si256(fold256(x1, fold), _mm256_loadu_si256((const __m256i*)(ptr + 32)));
+        x2 = _mm256_xor_si256(fold256(x2, fold), _mm256_loadu_si256((const __m256i*)(ptr + 64)));
+        x3 = _mm256_xor_si256(fold256(x3, fold), _mm256_loadu_si256((const __m256i*)(ptr + 96)));
+    }
+
+    x3 = _mm256_xor_si256(x3, fold256(x0, fold_constant(FOLD_768)));
+    x3 = _mm256_xor_si256(x3, fold256(x1, fold_constant(FOLD_512)));
+    x3 = _mm256_xor_si256(x3, fold256(x2, fold_constant(FOLD_256)));
+    __m128i lane = _mm256_castsi256_si128(x3);
+    __m128i last = _mm_xor_si128(_mm256_extracti128_si256(x3, 1),
+                                 _mm256_castsi256_si128(fold256(_mm256_castsi128_si256(lane), fold_constant(FOLD_128))));
+
+    u64 crc64 = _mm_crc32_u64(0, (u64)_mm_cvtsi128_si64(last));
+    crc64 = _mm_crc32_u64(crc64, (u64)_mm_extract_epi64(last, 1));
+    *size -= (u32)(end - *next);
+    *next = end;
+    return (u32)crc64;
+}
+#endif
+
+SSE42_TARGET u32 crc32c_sse42( const u8* next, u32 size, u32 crc )
+{
+#ifdef HAVE_VPCLMUL_CRC
+    if( tables.folding_ && size >= CRC32C_FOLDED )
+        crc = crc32c_vpclmul(&next, &size, crc);
+#endif
+    while( size && 0 != ((size_t)next & 7) )
+    {
+        crc = _mm_crc32_u8(crc, *next++);
+        --size;
+    }
+
+    crc = crc32c_blocks<CRC32C_LONG>(&next, &size, crc, tables.long_);
+    crc = crc32c_blocks<CRC32C_SHORT>(&next, &size, crc, tables.short_);
+
+    u64 crc64 = crc;
+    for(; size >= 8; size -= 8, next += 8)
+        crc64 = _mm_crc32_u64(crc64, load64(next));
+    crc = (u32)crc64;
+
+    while( size-- )
+        crc = _mm_crc32_u8(crc, *next++);
+    return crc;
+}
+#endif
+
+} // namespace
+
+u32 crc32c( const void* data, u32 size, u32 crc )
+{
+    const u8* next = (const u8*)data;
+    crc = ~crc;
+#ifdef HAVE_SSE42_CRC
+    if( tables.hardware_ )
+        return ~crc32c_sse42(next, size, crc);
+#endif
+    return ~crc32c_slice8(next, size, crc);
+}
+
+bool crc32c_hardware( void )
+{
+    return tables.hardware_;
+}
@@ -0,0 +1,345 @@
+#include <string.h>
+#include <algorithm>
+
+#include "delta_signature.h"
+#include "tree_hash.h"
+
+using namespace std;
+
+#define DELTA_READ_SIZE     1048576     /* the file is signed by pieces of this size, it is a multiple of blocks */
+#define DELTA_NO_BLOCK      0xffffffff
+
+namespace {
+
+inline void put32(u8* ptr, u32 value)
+{
+    ptr[0] = (u8)(value >> 24); ptr[1] = (u8)(value >> 16); ptr[2] = (u8)(value >> 8); ptr[3] = (u8)value;
+}
+
+inline u32 get32(const u8* ptr)
+{
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) | ((u32)ptr[2] << 8) | ptr[3];
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+BlockSignatures::BlockSignatures()
+    : blockSize_(DELTA_MIN_BLOCK),
+    size_(0)
+{}
+
+u32 BlockSignatures::block_size(i64 size)
+{
+    u32 block = DELTA_MIN_BLOCK;
+    while( block < DELTA_MAX_BLOCK && (i64)block * block < size )
+        block <<= 1;
+    return block;
+}
+
+u32 BlockSignatures::checksum(const u8* data, u32 size)
+{
+    // 'b' sums the prefix sums, so the first byte counts 'size' times
+    u32 a = 0;
+    u32 b = 0;
+    for(u32 i = 0; i < size; ++i)
+    {
+        a += data[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+void BlockSignatures::strong(const u8* data, u32 size, u8* hash)
+{
+    u8 full[TREE_HASH_SIZE];
+    TreeHash::digest(data, size, full);
+    memcpy(hash, full, DELTA_STRONG_SIZE);
+}
+
+void BlockSignatures::compute(const RawFile& file, const volatile bool* stop)
+{
+    reset(block_size(file.size()), file.size());
+    weak_.reserve(blocks());
+    strong_.reserve((size_t)blocks() * DELTA_STRONG_SIZE);
+
+    Message buffer(DELTA_READ_SIZE);
+    u8 hash[DELTA_STRONG_SIZE];
+    for(i64 offset = 0; offset < size_; )
+    {
+        if( stop && *stop )
+            break;
+        u32 wanted = (u32)min((i64)DELTA_READ_SIZE, size_ - offset);
+        u32 read = file.pread(buffer.get(), wanted, offset);
+        // the file cut by someone else is signed up to its end
+        if( read < wanted )
+            size_ = offset + read;
+
+        for(u32 pos = 0; pos < read; pos += blockSize_)
+        {
+            u32 length = min(blockSize_, read - pos);
+            weak_.push_back( checksum(buffer.get() + pos, length) );
+            strong(buffer.get() + pos, length, hash);
+            strong_.insert(strong_.end(), hash, hash + DELTA_STRONG_SIZE);
+        }
+        offset += read;
+    }
+}
+
+void BlockSignatures::reset(u32 blockSize, i64 size)
+{
+    blockSize_ = blockSize;
+    size_ = size;
+    weak_.clear();
+    strong_.clear();
+}
+
+bool BlockSignatures::add(const u8* data, u32 count)
+{
+    if( count > blocks() - this->count() )
+        return false;
+    for(u32 i = 0; i < count; ++i, data += DELTA_SIGNATURE_SIZE)
+    {
+        weak_.push_back( get32(data) );
+        strong_.insert(strong_.end(), data + 4, data + 4 + DELTA_STRONG_SIZE);
+    }
+    return true;
+}
+
+void BlockSignatures::encode(Message* data) const
+{
+    u32 count = this->count();
+    data->resize(0);
+    if( 0 == count )
+        return;
+    data->reserve( count * DELTA_SIGNATURE_SIZE );
+    data->resize( count * DELTA_SIGNATURE_SIZE );
+    u8* ptr = data->get();
+    for(u32 i = 0; i < count; ++i, ptr += DELTA_SIGNATURE_SIZE)
+    {
+        put32(ptr, weak_[i]);
+        memcpy(ptr + 4, strong(i), DELTA_STRONG_SIZE);
+    }
+}
+
+u32 BlockSignatures::blocks() const
+{
+    return (u32)((size_ + blockSize_ - 1) / blockSize_);
+}
+
+u32 BlockSignatures::length(u32 block) const
+{
+    return (block + 1 < blocks()) ? blockSize_ : (u32)(size_ - (i64)block * blockSize_);
+}
+
+/////////////////////////////////////////////////////////////////////////
+DeltaMatcher::DeltaMatcher(u32 limit)
+    : limit_(limit),
+    shift_(32),
+    filterShift_(32),
+    bufferAt_(0),
+    loaded_(0),
+    from_(-1),
+    to_(-1),
+    found_(false),
+    foundBlock_(0),
+    foundSize_(0)
+{}
+
+void DeltaMatcher::index()
+{
+    // the buckets are twice the blocks at least, so the most of probes find an empty one
+    u32 count = signatures_.count();
+    u32 bits = 10;
+    while( bits < 31 && (1U << bits) < 2 * (u64)count )
+        ++bits;
+    shift_ = 32 - bits;
+    heads_.assign(1U << bits, DELTA_NO_BLOCK);
+    chain_.assign(count, DELTA_NO_BLOCK);
+
+    // the filter has 32 bits per block, it is small enough to stay in cache while the data is rolled
+    bits = 15;
+    while( bits < 31 && (1U << bits) < 32 * (u64)count )
+        ++bits;
+    filterShift_ = 32 - bits;
+    filter_.assign((1U << bits) / 32, 0);
+
+    // the chain goes from the first block, so the earlier one of the same blocks is referred
+    for(u32 block = count; block > 0; --block)
+    {
+        u32 bucket = (signatures_.weak(block - 1) * 2654435761U) >> shift_;
+        chain_[block - 1] = heads_[bucket];
+        heads_[bucket] = block - 1;
+        u32 bit = (signatures_.weak(block - 1) * 2654435761U) >> filterShift_;
+        filter_[bit >> 5] |= 1U << (bit & 31);
+    }
+    from_ = to_ = -1;
+    found_ = false;
+}
+
+void DeltaMatcher::clear()
+{
+    heads_.clear();
+    chain_.clear();
+    filter_.clear();
+    from_ = to_ = -1;
+    found_ = false;
+}
+
+u32 DeltaMatcher::next(File* file, i64 offset, i64 end, u32* block, u32* size)
+{
+    // the literals before the match found already may take several frames
+    if( from_ <= offset && offset <= to_ && (offset < to_ || found_) )
+    {
+        if( offset < to_ )
+            return (u32)(to_ - offset);
+        *block = foundBlock_;
+        *size = foundSize_;
+        return 0;
+    }
+
+    from_ = offset;
+    found_ = false;
+    u32 rest = (u32)min(end - offset, (i64)limit_);
+    if( heads_.empty() || 0 == signatures_.count() )
+    {
+        to_ = offset + rest;
+        return rest;
+    }
+
+    u32 blockSize = signatures_.block_size();
+    load(file, offset, min(end, offset + (i64)limit_ + blockSize));
+    const u8* data = this->data(offset);
+    u32 available = loaded_;
+
+    // the checksum is rolled over the data, the start of block goes out and the next byte comes in
+    i32 match = -1;
+    u32 pos = 0;
+    if( available >= blockSize )
+    {
+        u32 a = 0;
+        u32 b = 0;
+        for(u32 i = 0; i < blockSize; ++i)
+        {
+            a += data[i];
+            b += a;
+        }
+        const u32* filter = &filter_[0];
+        u32 last = min(rest - 1, available - blockSize);
+        for(;;)
+        {
+            u32 weak = (a & 0xffff) | (b << 16);
+            u32 bit = (weak * 2654435761U) >> filterShift_;
+            if( (filter[bit >> 5] & (1U << (bit & 31))) &&
+                0 <= (match = find(weak, data + pos, blockSize)) )
+                break;
+            if( pos >= last )
+                break;
+            u32 out = data[pos];
+            a += data[pos + blockSize] - out;
+            b += a - blockSize * out;
+            ++pos;
+        }
+    }
+
+    // the short last block is looked for at the end of file only
+    u32 last = signatures_.count() - 1;
+    u32 tail = signatures_.length(last);
+    if( match < 0 && tail < blockSize && bufferAt_ + loaded_ == end && tail <= available &&
+        available - tail < rest )
+    {
+        pos = available - tail;
+        match = find(BlockSignatures::checksum(data + pos, tail), data + pos, tail);
+    }
+
+    if( match < 0 )
+    {
+        to_ = offset + rest;
+        return rest;
+    }
+
+    to_ = offset + pos;
+    found_ = true;
+    foundBlock_ = (u32)match;
+    foundSize_ = extend(foundBlock_, data + pos, available - pos);
+    if( pos > 0 )
+        return pos;
+    *block = foundBlock_;
+    *size = foundSize_;
+    return 0;
+}
+
+const u8* DeltaMatcher::data(i64 offset) const
+{
+    assert( offset >= bufferAt_ && offset <= bufferAt_ + loaded_ );
+    return buffer_.get() + (offset - bufferAt_);
+}
+
+void DeltaMatcher::load(File* file, i64 offset, i64 end)
+{
+    // the data read before from 'offset' is moved to the start of buffer
+    u32 kept = 0;
+    if( offset >= bufferAt_ && offset < bufferAt_ + loaded_ )
+    {
+        kept = (u32)(bufferAt_ + loaded_ - offset);
+        memmove(buffer_.get(), buffer_.get() + (offset - bufferAt_), kept);
+    }
+    bufferAt_ = offset;
+    loaded_ = kept;
+    u32 wanted = (u32)(end - offset);
+    if( wanted <= kept )
+        return;
+
+    if( 0 == buffer_.size() )
+        buffer_.reserve(limit_ + DELTA_MAX_BLOCK);
+    assert( wanted <= buffer_.size() );
+
+    // the file position is the sent data, the data is read ahead of it
+    i64 position = file->tell();
+    try {
+        file->seek( offset + kept, SEEK_SET );
+        file->read( buffer_.get() + kept, wanted - kept );
+    }
+    catch(...) {
+        file->seek( position, SEEK_SET );
+        throw;
+    }
+    file->seek( position, SEEK_SET );
+    loaded_ = wanted;
+}
+
+i32 DeltaMatcher::find(u32 weak, const u8* data, u32 size) const
+{
+    u8 hash[DELTA_STRONG_SIZE];
+    bool hashed = false;
+    for(u32 block = heads_[(weak * 2654435761U) >> shift_]; DELTA_NO_BLOCK != block; block = chain_[block])
+    {
+        if( signatures_.weak(block) != weak || signatures_.length(block) != size )
+            continue;
+        if( !hashed ) {
+            BlockSignatures::strong(data, size, hash);
+            hashed = true;
+        }
+        if( 0 == memcmp(hash, signatures_.strong(block), DELTA_STRONG_SIZE) )
+            return (i32)block;
+    }
+    return -1;
+}
+
+u32 DeltaMatcher::extend(u32 block, const u8* data, u32 available) const
+{
+    u8 hash[DELTA_STRONG_SIZE];
+    u32 size = signatures_.length(block);
+    for(u32 next = block + 1; next < signatures_.count(); ++next)
+    {
+        u32 length = signatures_.length(next);
+        if( size + length > available || size + length > limit_ ||
+            BlockSignatures::checksum(data + size, length) != signatures_.weak(next) )
+            break;
+        BlockSignatures::strong(data + size, length, hash);
+        if( 0 != memcmp(hash, signatures_.strong(next), DELTA_STRONG_SIZE) )
+            break;
+        size += length;
+    }
+    return size;
+}
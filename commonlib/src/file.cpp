@@ -8,6 +8,7 @@
 #ifndef WIN32
 #   include <dirent.h>
 #   include <unistd.h>
+#   include <fcntl.h>
 #else 
 #   include <direct.h>
 #   include <io.h>
@@ -31,6 +32,28 @@ void File::createEmpty( const std::string& path )
     }
 }
 
+void File::replace( const std::string& from, const std::string& path )
+{
+#ifdef WIN32
+    if( !MoveFileExA( from.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+        throw system_exception( "Cannot rename \"" + from + "\" to \"" + path + "\"" );
+#else
+    if( 0 != rename( from.c_str(), path.c_str() ) )
+        throw system_exception( "Cannot rename \"" + from + "\" to \"" + path + "\"" );
+#endif
+}
+
+void File::createDirectory( const std::string& path )
+{
+#ifdef WIN32
+    if( 0 != _mkdir( path.c_str() ) && EEXIST != errno )
+        throw system_exception( "Cannot create directory: " + path );
+#else
+    if( 0 != mkdir( path.c_str(), 0755 ) && EEXIST != errno )
+        throw system_exception( "Cannot create directory: " + path );
+#endif
+}
+
 std::string File::getCurrentDirectory()
 {
     s8 cCurrentPath[ 4096 ];
@@ -53,12 +76,16 @@ std::string File::getCurrentDirectory()
 }
 
 File::File() 
-    : handle_(0)
+    : handle_(0),
+    cachePolicy_(keep_CachePolicy),
+    cacheDropped_(0)
 {}
 
 File::File( const std::string& path, 
             const std::string& openmode )
-    : handle_(0)
+    : handle_(0),
+    cachePolicy_(keep_CachePolicy),
+    cacheDropped_(0)
 {
     open( path, openmode );
 }
@@ -82,6 +109,8 @@ void File::open( const std::string& path, const std::string& openmode )
     if( 0 == handle_ )
 		throw system_exception(std::string("Can't open file ") + path, ERRNO);
     path_ = path;
+    cacheDropped_ = 0;
+    setCachePolicy( cachePolicy_ );
 }
 
 void File::close()
@@ -155,10 +184,39 @@ bool File::isOpened() const
     return 0 != handle_;
 }
 
+void File::setCachePolicy( CachePolicy policy )
+{
+    cachePolicy_ = policy;
+#ifdef POSIX_FADV_SEQUENTIAL
+    // the hints are advisory, so their errors are ignored
+    if( isOpened() && drop_CachePolicy == policy )
+        posix_fadvise( fileno(handle_), 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+}
+
+void File::seekRegion( i64 offset )
+{
+    seek( offset, SEEK_SET );
+    cacheDropped_ = offset;
+}
+
+void File::dropCache( i64 end, bool whole )
+{
+    if( drop_CachePolicy != cachePolicy_ || !isOpened() )
+        return;
+    if( end - cacheDropped_ < (whole ? 1 : CACHE_DROP_WINDOW) )
+        return;
+
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise( fileno(handle_), cacheDropped_, end - cacheDropped_, POSIX_FADV_DONTNEED );
+#endif
+    cacheDropped_ = end;
+}
+
 i64 File::size() const
 {
 #ifdef WIN32
-	return (i64)_filelength(_fileno( handle_ ));
+	return (i64)_filelengthi64(_fileno( handle_ ));
 #else
     struct stat64 fileInfo;
     memset(&fileInfo, 0, sizeof(fileInfo));
@@ -167,6 +225,21 @@ i64 File::size() const
 #endif 
 }
 
+i64 File::mtime() const
+{
+#ifdef WIN32
+    struct _stat64 fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    _fstat64(_fileno( handle_ ), &fileInfo);
+    return (i64)fileInfo.st_mtime;
+#else
+    struct stat64 fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fstat64(fileno( handle_ ), &fileInfo);
+    return (i64)fileInfo.st_mtime;
+#endif 
+}
+
 void File::resize( i64 size )
 {
 #ifdef WIN32
@@ -180,7 +253,7 @@ void File::resize( i64 size )
     if( 0 == SetEndOfFile( file ) )
         throw system_exception( "SetEndOfFile: " );
 #else
-	if (0 != ftruncate(fileno( handle_ ), size))
+	if (0 != ftruncate64(fileno( handle_ ), size))
 		throw system_exception("ftruncate: ");
 #endif
 
@@ -0,0 +1,312 @@
+#ifdef __linux
+#   include <linux/version.h>
+#   if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#       define HAVE_IO_URING
+#       include <unistd.h>
+#       include <sys/mman.h>
+#       include <sys/syscall.h>
+#       include <sys/uio.h>
+#       include <linux/io_uring.h>
+#   endif
+#endif
+
+#include "ioring.h"
+
+#ifdef HAVE_IO_URING
+
+struct IoRing::Impl
+{
+    Impl( void )
+        : sqRing_(MAP_FAILED), sqRingSize_(0),
+        cqRing_(MAP_FAILED), cqRingSize_(0),
+        sqes_((io_uring_sqe*)MAP_FAILED), sqesSize_(0),
+        sqTail_(0)
+    {}
+
+    void*  sqRing_;
+    size_t sqRingSize_;
+    void*  cqRing_;
+    size_t cqRingSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    /* submission queue */
+    volatile u32* sqHead_;
+    volatile u32* sqKTail_;
+    u32* sqArray_;
+    u32  sqMask_;
+    u32  sqEntries_;
+
+    /* the tail of queued requests, it is published to the kernel at submit() */
+    u32  sqTail_;
+
+    /* completion queue */
+    volatile u32* cqHead_;
+    volatile u32* cqTail_;
+    io_uring_cqe* cqes_;
+    u32  cqMask_;
+
+    void unmap( void );
+
+    /* Returns the next free submission entry or NULL if the queue is full */
+    io_uring_sqe* get_sqe( void );
+};
+
+void IoRing::Impl::unmap()
+{
+    if( MAP_FAILED != (void*)sqes_ )
+        munmap( sqes_, sqesSize_ );
+    if( MAP_FAILED != cqRing_ && cqRing_ != sqRing_ )
+        munmap( cqRing_, cqRingSize_ );
+    if( MAP_FAILED != sqRing_ )
+        munmap( sqRing_, sqRingSize_ );
+}
+
+io_uring_sqe* IoRing::Impl::get_sqe()
+{
+    u32 head = *sqHead_;
+    __sync_synchronize();
+    if( sqTail_ - head >= sqEntries_ )
+        return NULL;
+
+    u32 index = sqTail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset( sqe, 0, sizeof(io_uring_sqe) );
+    sqArray_[index] = index;
+    ++sqTail_;
+    return sqe;
+}
+
+bool IoRing::isSupported()
+{
+    io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+    i32 fd = (i32)syscall( __NR_io_uring_setup, 2, &params );
+    if( -1 == fd )
+        return false;
+    ::close( fd );
+    return true;
+}
+
+IoRing::IoRing( u32 entries )
+    : fd_(-1),
+    pImpl_( new Impl() )
+{
+    io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+
+    fd_ = (i32)syscall( __NR_io_uring_setup, entries, &params );
+    if( -1 == fd_ )
+    {
+        delete pImpl_;
+        throw system_exception("io_uring_setup", ERRNO);
+    }
+
+    pImpl_->sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(u32);
+    pImpl_->cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if( pImpl_->cqRingSize_ > pImpl_->sqRingSize_ )
+            pImpl_->sqRingSize_ = pImpl_->cqRingSize_;
+        pImpl_->cqRingSize_ = pImpl_->sqRingSize_;
+    }
+
+    pImpl_->sqRing_ = mmap( NULL, pImpl_->sqRingSize_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING );
+    if( MAP_FAILED != pImpl_->sqRing_ )
+    {
+        if( params.features & IORING_FEAT_SINGLE_MMAP )
+            pImpl_->cqRing_ = pImpl_->sqRing_;
+        else
+            pImpl_->cqRing_ = mmap( NULL, pImpl_->cqRingSize_, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING );
+    }
+    if( MAP_FAILED != pImpl_->cqRing_ )
+    {
+        pImpl_->sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        pImpl_->sqes_ = (io_uring_sqe*)mmap( NULL, pImpl_->sqesSize_, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES );
+    }
+    if( MAP_FAILED == (void*)pImpl_->sqes_ )
+    {
+        i32 err = ERRNO;
+        pImpl_->unmap();
+        ::close( fd_ );
+        delete pImpl_;
+        throw system_exception("IoRing: mmap", err);
+    }
+
+    u8* sq = (u8*)pImpl_->sqRing_;
+    pImpl_->sqHead_    = (u32*)(sq + params.sq_off.head);
+    pImpl_->sqKTail_   = (u32*)(sq + params.sq_off.tail);
+    pImpl_->sqArray_   = (u32*)(sq + params.sq_off.array);
+    pImpl_->sqMask_    = *(u32*)(sq + params.sq_off.ring_mask);
+    pImpl_->sqEntries_ = *(u32*)(sq + params.sq_off.ring_entries);
+    pImpl_->sqTail_    = *pImpl_->sqKTail_;
+
+    u8* cq = (u8*)pImpl_->cqRing_;
+    pImpl_->cqHead_ = (u32*)(cq + params.cq_off.head);
+    pImpl_->cqTail_ = (u32*)(cq + params.cq_off.tail);
+    pImpl_->cqes_   = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    pImpl_->cqMask_ = *(u32*)(cq + params.cq_off.ring_mask);
+}
+
+IoRing::~IoRing()
+{
+    pImpl_->unmap();
+    ::close( fd_ );
+    delete pImpl_;
+}
+
+void IoRing::register_buffers( const struct iovec* buffers, u32 count )
+{
+    if( 0 != syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) )
+        throw system_exception("io_uring_register, IORING_REGISTER_BUFFERS", ERRNO);
+}
+
+bool IoRing::recv( i32 fd, void* buf, u32 len, i32 flags, u64 userData, bool link )
+{
+    io_uring_sqe* sqe = pImpl_->get_sqe();
+    if( NULL == sqe )
+        return false;
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)buf;
+    sqe->len       = len;
+    sqe->msg_flags = flags;
+    sqe->user_data = userData;
+    if( link )
+        sqe->flags |= IOSQE_IO_LINK;
+    return true;
+}
+
+bool IoRing::write_fixed( i32 fd, const void* buf, u32 len, i64 offset, u16 bufIndex, u64 userData, bool link )
+{
+    io_uring_sqe* sqe = pImpl_->get_sqe();
+    if( NULL == sqe )
+        return false;
+
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)buf;
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = bufIndex;
+    sqe->user_data = userData;
+    if( link )
+        sqe->flags |= IOSQE_IO_LINK;
+    return true;
+}
+
+bool IoRing::fsync( i32 fd, bool datasync, u64 userData )
+{
+    io_uring_sqe* sqe = pImpl_->get_sqe();
+    if( NULL == sqe )
+        return false;
+
+    sqe->opcode      = IORING_OP_FSYNC;
+    sqe->fd          = fd;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    sqe->user_data   = userData;
+    return true;
+}
+
+u32 IoRing::submit()
+{
+    u32 toSubmit = pImpl_->sqTail_ - *pImpl_->sqKTail_;
+    if( 0 == toSubmit )
+        return 0;
+
+    /* the entries must be visible before the tail */
+    __sync_synchronize();
+    *pImpl_->sqKTail_ = pImpl_->sqTail_;
+    __sync_synchronize();
+
+    i32 submitted;
+    do
+    {
+        submitted = (i32)syscall( __NR_io_uring_enter, fd_, toSubmit, 0, 0, NULL, 0 );
+    }
+    while( -1 == submitted && EINTR == ERRNO );
+
+    if( -1 == submitted )
+        throw system_exception("io_uring_enter", ERRNO);
+    return (u32)submitted;
+}
+
+bool IoRing::complete( Completion* completion )
+{
+    u32 head = *pImpl_->cqHead_;
+    __sync_synchronize();
+    if( head == *pImpl_->cqTail_ )
+        return false;
+
+    io_uring_cqe* cqe = &pImpl_->cqes_[head & pImpl_->cqMask_];
+    completion->userData_ = cqe->user_data;
+    completion->result_   = cqe->res;
+
+    /* the entry is read before it is released to the kernel */
+    __sync_synchronize();
+    *pImpl_->cqHead_ = head + 1;
+    return true;
+}
+
+u32 IoRing::available() const
+{
+    return pImpl_->sqEntries_ - (pImpl_->sqTail_ - *pImpl_->sqHead_);
+}
+
+#else /* HAVE_IO_URING */
+
+struct IoRing::Impl {};
+
+bool IoRing::isSupported()
+{
+    return false;
+}
+
+IoRing::IoRing( u32 )
+    : fd_(-1),
+    pImpl_(NULL)
+{
+    throw Exception("IoRing: io_uring is not supported on this platform");
+}
+
+IoRing::~IoRing()
+{}
+
+void IoRing::register_buffers( const struct iovec*, u32 )
+{}
+
+bool IoRing::recv( i32, void*, u32, i32, u64, bool )
+{
+    return false;
+}
+
+bool IoRing::write_fixed( i32, const void*, u32, i64, u16, u64, bool )
+{
+    return false;
+}
+
+bool IoRing::fsync( i32, bool, u64 )
+{
+    return false;
+}
+
+u32 IoRing::submit()
+{
+    return 0;
+}
+
+bool IoRing::complete( Completion* )
+{
+    return false;
+}
+
+u32 IoRing::available() const
+{
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
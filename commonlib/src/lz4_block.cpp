@@ -0,0 +1,380 @@
+#include <string.h>
+#include <vector>
+#ifdef WIN32
+#   include <intrin.h>
+#endif
+
+#include "lz4_block.h"
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5       /* the block ends with the literals */
+#define LZ4_MATCH_LIMIT     12      /* the last match starts this far from the end at least */
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_FAST_HASH_LOG   14
+#define LZ4_SKIP_TRIGGER    6       /* the fast search steps one byte further after every 2^6 misses */
+#define LZ4_HIGH_HASH_LOG   15
+#define LZ4_HIGH_ATTEMPTS   16      /* the positions of hash chain compared for one match */
+#define LZ4_NO_POSITION     0xffffffff
+
+namespace {
+
+inline u32 load32( const u8* ptr )
+{
+    u32 value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+inline u64 load64( const u8* ptr )
+{
+    u64 value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+inline u32 hash4( const u8* ptr, u32 log )
+{
+    return (load32(ptr) * 2654435761U) >> (32 - log);
+}
+
+inline u32 lowest_byte( u64 diff )
+{
+#ifdef WIN32
+    unsigned long bit;
+    _BitScanForward64(&bit, diff);
+    return (u32)bit >> 3;
+#else
+    return (u32)__builtin_ctzll(diff) >> 3;
+#endif
+}
+
+/*  Returns the length of the common prefix of 'ip' and 'ref' data up to 'limit' */
+inline u32 common( const u8* ip, const u8* ref, const u8* limit )
+{
+    const u8* start = ip;
+    while( ip + 8 <= limit )
+    {
+        // the first different byte is the lowest one of the little-endian words
+        u64 diff = load64(ip) ^ load64(ref);
+        if( diff )
+            return (u32)(ip - start) + lowest_byte(diff);
+        ip += 8;
+        ref += 8;
+    }
+    while( ip < limit && *ip == *ref )
+    {
+        ++ip;
+        ++ref;
+    }
+    return (u32)(ip - start);
+}
+
+// The block being written, it never exceeds its capacity
+class BlockWriter
+{
+public:
+    BlockWriter( u8* dst, u32 capacity )
+        : start_(dst),
+        op_(dst),
+        end_(dst + capacity)
+    {}
+
+    /*  Writes the literals followed by the match, the last literals have no match ('length' is 0)
+        @Returns false if the sequence doesn't fit
+    */
+    bool sequence( const u8* literals, u32 count, u32 offset, u32 length );
+
+    u32 size() const
+    { return (u32)(op_ - start_); }
+
+private:
+    static u8* put_length( u8* op, u32 rest );
+
+    u8* start_;
+    u8* op_;
+    u8* end_;
+};
+
+u8* BlockWriter::put_length( u8* op, u32 rest )
+{
+    for(; rest >= 255; rest -= 255)
+        *op++ = 255;
+    *op++ = (u8)rest;
+    return op;
+}
+
+bool BlockWriter::sequence( const u8* literals, u32 count, u32 offset, u32 length )
+{
+    // the token, the literals with their length and the match with its offset and length
+    u64 needed = 1 + (u64)count + count / 255 + 1;
+    if( length )
+        needed += 2 + (length - LZ4_MIN_MATCH) / 255 + 1;
+    if( needed > (u64)(end_ - op_) )
+        return false;
+
+    u8* token = op_++;
+    if( count >= 15 ) {
+        *token = 15 << 4;
+        op_ = put_length(op_, count - 15);
+    }
+    else
+        *token = (u8)(count << 4);
+    memcpy(op_, literals, count);
+    op_ += count;
+    if( 0 == length )
+        return true;
+
+    *op_++ = (u8)offset;
+    *op_++ = (u8)(offset >> 8);
+    u32 rest = length - LZ4_MIN_MATCH;
+    if( rest >= 15 ) {
+        *token |= 15;
+        op_ = put_length(op_, rest - 15);
+    }
+    else
+        *token |= (u8)rest;
+    return true;
+}
+
+/*  The positions of data by the hash of their first bytes, each one refers to the previous
+    position of the same hash, so the matches are looked for along the chain
+*/
+class HashChains
+{
+public:
+    HashChains( const u8* src )
+        : src_(src),
+        next_(0),
+        head_(1 << LZ4_HIGH_HASH_LOG, LZ4_NO_POSITION),
+        chain_(LZ4_MAX_OFFSET + 1, 0)
+    {}
+
+    /*  Returns the length of the longest match of 'ip' within the offset limit, 0 if there is none
+        @param ref - set to the start of match
+    */
+    u32 find( const u8* ip, const u8* limit, const u8** ref );
+
+private:
+    /*  Adds the positions up to 'pos' to the chains */
+    void insert( u32 pos );
+
+    const u8* src_;
+    u32 next_;                  /* the first position which is not in the chains */
+    std::vector<u32> head_;     /* the last position of every hash */
+    std::vector<u16> chain_;    /* the distance to the previous position of the same hash, 0 ends the chain */
+};
+
+void HashChains::insert( u32 pos )
+{
+    for(; next_ < pos; ++next_)
+    {
+        u32 h = hash4(src_ + next_, LZ4_HIGH_HASH_LOG);
+        u32 prev = head_[h];
+        u32 delta = (LZ4_NO_POSITION == prev || next_ - prev > LZ4_MAX_OFFSET) ? 0 : next_ - prev;
+        chain_[next_ & LZ4_MAX_OFFSET] = (u16)delta;
+        head_[h] = next_;
+    }
+}
+
+u32 HashChains::find( const u8* ip, const u8* limit, const u8** ref )
+{
+    u32 pos = (u32)(ip - src_);
+    insert(pos);
+
+    u32 best = 0;
+    u32 candidate = head_[hash4(ip, LZ4_HIGH_HASH_LOG)];
+    for(u32 attempts = LZ4_HIGH_ATTEMPTS; LZ4_NO_POSITION != candidate && attempts > 0; --attempts)
+    {
+        if( pos - candidate > LZ4_MAX_OFFSET )
+            break;
+        const u8* match = src_ + candidate;
+        // the longer match must go on at the end of the best one
+        if( match[best] == ip[best] && load32(match) == load32(ip) )
+        {
+            u32 length = LZ4_MIN_MATCH + common(ip + LZ4_MIN_MATCH, match + LZ4_MIN_MATCH, limit);
+            if( length > best ) {
+                best = length;
+                *ref = match;
+            }
+        }
+        u32 delta = chain_[candidate & LZ4_MAX_OFFSET];
+        if( 0 == delta )
+            break;
+        candidate -= delta;
+    }
+    return best;
+}
+
+bool compress_fast( const u8* src, u32 size, BlockWriter* out )
+{
+    const u8* ip = src;
+    const u8* anchor = src;
+    const u8* end = src + size;
+    if( size > LZ4_MATCH_LIMIT )
+    {
+        const u8* mflimit = end - LZ4_MATCH_LIMIT;
+        const u8* limit = end - LZ4_LAST_LITERALS;
+        std::vector<u32> table(1 << LZ4_FAST_HASH_LOG, 0);
+        u32 misses = 1 << LZ4_SKIP_TRIGGER;
+
+        // the first byte has nothing to match
+        ++ip;
+        while( ip <= mflimit )
+        {
+            u32 h = hash4(ip, LZ4_FAST_HASH_LOG);
+            const u8* ref = src + table[h];
+            table[h] = (u32)(ip - src);
+            if( ip - ref > LZ4_MAX_OFFSET || load32(ref) != load32(ip) )
+            {
+                // the incompressible data is skipped faster and faster
+                ip += misses++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1 << LZ4_SKIP_TRIGGER;
+
+            while( ip > anchor && ref > src && ip[-1] == ref[-1] )
+            {
+                --ip;
+                --ref;
+            }
+            u32 length = LZ4_MIN_MATCH + common(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, limit);
+            if( !out->sequence(anchor, (u32)(ip - anchor), (u32)(ip - ref), length) )
+                return false;
+            ip += length;
+            anchor = ip;
+
+            // the end of match is likely the start of the next one
+            if( ip <= mflimit )
+                table[hash4(ip - 2, LZ4_FAST_HASH_LOG)] = (u32)(ip - 2 - src);
+        }
+    }
+    return out->sequence(anchor, (u32)(end - anchor), 0, 0);
+}
+
+bool compress_high( const u8* src, u32 size, BlockWriter* out )
+{
+    const u8* ip = src;
+    const u8* anchor = src;
+    const u8* end = src + size;
+    if( size > LZ4_MATCH_LIMIT )
+    {
+        const u8* mflimit = end - LZ4_MATCH_LIMIT;
+        const u8* limit = end - LZ4_LAST_LITERALS;
+        HashChains chains(src);
+
+        while( ip <= mflimit )
+        {
+            const u8* ref = NULL;
+            u32 length = chains.find(ip, limit, &ref);
+            if( length < LZ4_MIN_MATCH )
+            {
+                ++ip;
+                continue;
+            }
+
+            // the match of the next byte may be longer, then the byte goes to the literals
+            while( ip + 1 <= mflimit )
+            {
+                const u8* next = NULL;
+                u32 nextLength = chains.find(ip + 1, limit, &next);
+                if( nextLength <= length )
+                    break;
+                ++ip;
+                ref = next;
+                length = nextLength;
+            }
+
+            if( !out->sequence(anchor, (u32)(ip - anchor), (u32)(ip - ref), length) )
+                return false;
+            ip += length;
+            anchor = ip;
+        }
+    }
+    return out->sequence(anchor, (u32)(end - anchor), 0, 0);
+}
+
+} // namespace
+
+u32 lz4_bound( u32 size )
+{
+    return size + size / 255 + 16;
+}
+
+u32 lz4_compress( const u8* src, u32 size, u8* dst, u32 capacity, bool high )
+{
+    BlockWriter out(dst, capacity);
+    bool fits = high ? compress_high(src, size, &out) : compress_fast(src, size, &out);
+    return fits ? out.size() : 0;
+}
+
+i32 lz4_decompress( const u8* src, u32 size, u8* dst, u32 capacity )
+{
+    const u8* ip = src;
+    const u8* end = src + size;
+    u8* op = dst;
+    u8* limit = dst + capacity;
+
+    for(;;)
+    {
+        if( ip >= end )
+            return -1;
+        u32 token = *ip++;
+
+        u64 count = token >> 4;
+        if( 15 == count )
+        {
+            u32 byte = 255;
+            while( 255 == byte )
+            {
+                if( ip >= end )
+                    return -1;
+                byte = *ip++;
+                count += byte;
+            }
+        }
+        if( count > (u64)(end - ip) || count > (u64)(limit - op) )
+            return -1;
+        memcpy(op, ip, (size_t)count);
+        op += count;
+        ip += count;
+
+        // the last sequence has the literals only
+        if( ip == end )
+            break;
+
+        if( end - ip < 2 )
+            return -1;
+        u32 offset = ip[0] | ((u32)ip[1] << 8);
+        ip += 2;
+        if( 0 == offset || offset > (u32)(op - dst) )
+            return -1;
+
+        u64 length = token & 15;
+        if( 15 == length )
+        {
+            u32 byte = 255;
+            while( 255 == byte )
+            {
+                if( ip >= end )
+                    return -1;
+                byte = *ip++;
+                length += byte;
+            }
+        }
+        length += LZ4_MIN_MATCH;
+        if( length > (u64)(limit - op) )
+            return -1;
+
+        // the match overlapping its copy repeats the last 'offset' bytes
+        const u8* match = op - offset;
+        if( offset >= length )
+            memcpy(op, match, (size_t)length);
+        else
+        {
+            for(u64 i = 0; i < length; ++i)
+                op[i] = match[i];
+        }
+        op += length;
+    }
+    return (i32)(op - dst);
+}
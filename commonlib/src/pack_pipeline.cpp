@@ -0,0 +1,294 @@
+#include <string.h>
+#include <algorithm>
+
+#include "pack_pipeline.h"
+#include "lz4_block.h"
+#include "useful.h"
+
+using namespace std;
+
+namespace {
+
+inline void put32(u8* ptr, u32 value)
+{
+    ptr[0] = (u8)(value >> 24); ptr[1] = (u8)(value >> 16); ptr[2] = (u8)(value >> 8); ptr[3] = (u8)value;
+}
+
+inline u32 get32(const u8* ptr)
+{
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) | ((u32)ptr[2] << 8) | ptr[3];
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+PackWorkers::PackThread::PackThread(const std::string& name, PackWorkers* owner)
+    : Thread(name),
+    owner_(owner)
+{}
+
+void PackWorkers::PackThread::run()
+{
+    owner_->drain();
+}
+
+/////////////////////////////////////////////////////////////////////////
+PackWorkers::PackWorkers(u16 threads)
+    : stopping_(false)
+{
+    for(u16 i = 0; i < threads; ++i)
+    {
+        threads_.push_back( new PackThread("Pack-" + tostring((u32)i), this) );
+        threads_.back()->start();
+    }
+}
+
+PackWorkers::~PackWorkers()
+{
+    stop();
+}
+
+void PackWorkers::stop()
+{
+    {
+        MGuard g(lock_);
+        if( stopping_ )
+            return;
+        stopping_ = true;
+        queued_.broadcast();
+    }
+
+    for(ThreadsT::iterator It = threads_.begin(); It != threads_.end(); ++It)
+    {
+        (*It)->join();
+        delete *It;
+    }
+    threads_.clear();
+}
+
+bool PackWorkers::unpack(const u8* chunk, u32 size, Message* data, u32 capacity)
+{
+    // the headers are checked before any block is unpacked
+    Batch batch;
+    u32 total = 0;
+    for(u32 pos = 0; pos < size; )
+    {
+        if( size - pos < PACK_HEADER_SIZE )
+            return false;
+        u32 dataSize = get32(chunk + pos);
+        u32 blockSize = get32(chunk + pos + 4);
+        pos += PACK_HEADER_SIZE;
+        if( 0 == dataSize || dataSize > PACK_BLOCK_SIZE || dataSize > capacity - total ||
+            blockSize > dataSize || blockSize > size - pos )
+            return false;
+
+        Job job = { &batch, chunk + pos, blockSize, NULL, dataSize, false, false, -1 };
+        batch.jobs_.push_back(job);
+        total += dataSize;
+        pos += blockSize;
+    }
+    if( 0 == total )
+        return false;
+
+    data->reserve( total );
+    data->resize( total );
+    u8* dst = data->get();
+    for(vector<Job>::iterator It = batch.jobs_.begin(); It != batch.jobs_.end(); ++It)
+    {
+        It->dst_ = dst;
+        dst += It->capacity_;
+    }
+    submit(&batch);
+    complete(&batch);
+
+    for(vector<Job>::iterator It = batch.jobs_.begin(); It != batch.jobs_.end(); ++It)
+    {
+        if( It->result_ != (i32)It->capacity_ )
+            return false;
+    }
+    return true;
+}
+
+void PackWorkers::submit(Batch* batch)
+{
+    MGuard g(lock_);
+    batch->pending_ = (u32)batch->jobs_.size();
+    for(vector<Job>::iterator It = batch->jobs_.begin(); It != batch->jobs_.end(); ++It)
+        jobs_.push_back(&*It);
+    if( !threads_.empty() )
+        queued_.broadcast();
+}
+
+void PackWorkers::complete(Batch* batch)
+{
+    MGuard g(lock_);
+    while( batch->pending_ > 0 )
+    {
+        // the caller doesn't wait for the workers busy with the blocks of other files
+        QueueT::iterator It = jobs_.begin();
+        while( It != jobs_.end() && (*It)->batch_ != batch )
+            ++It;
+        if( It == jobs_.end() )
+        {
+            done_.wait(&lock_);
+            continue;
+        }
+
+        Job* job = *It;
+        jobs_.erase(It);
+        {
+            Unlocker<Mutex> unlocker(lock_);
+            execute(job);
+        }
+        --batch->pending_;
+    }
+}
+
+void PackWorkers::drain()
+{
+    MGuard g(lock_);
+    for(;;)
+    {
+        // the queued blocks are packed before stopping, their owners wait for them
+        while( jobs_.empty() && !stopping_ )
+            queued_.wait(&lock_);
+        if( jobs_.empty() )
+            return;
+
+        Job* job = jobs_.front();
+        jobs_.pop_front();
+        {
+            Unlocker<Mutex> unlocker(lock_);
+            execute(job);
+        }
+        --job->batch_->pending_;
+        done_.broadcast();
+    }
+}
+
+void PackWorkers::execute(Job* job)
+{
+    if( job->pack_ )
+        job->result_ = (i32)lz4_compress(job->src_, job->size_, job->dst_, job->capacity_, job->high_);
+    else if( job->size_ == job->capacity_ )
+    {
+        memcpy(job->dst_, job->src_, job->size_);
+        job->result_ = (i32)job->size_;
+    }
+    else
+        job->result_ = lz4_decompress(job->src_, job->size_, job->dst_, job->capacity_);
+}
+
+/////////////////////////////////////////////////////////////////////////
+u32 PackPipeline::Chunk::packed(u8* dst, u32 capacity) const
+{
+    if( !probe_ )
+        return 0;
+
+    u32 size = 0;
+    for(vector<PackWorkers::Job>::const_iterator It = batch_.jobs_.begin(); It != batch_.jobs_.end(); ++It)
+        size += PACK_HEADER_SIZE + (It->result_ > 0 ? (u32)It->result_ : It->size_);
+    if( size > capacity )
+        return 0;
+
+    // the block which doesn't get smaller is stored as is
+    for(vector<PackWorkers::Job>::const_iterator It = batch_.jobs_.begin(); It != batch_.jobs_.end(); ++It)
+    {
+        u32 block = It->result_ > 0 ? (u32)It->result_ : It->size_;
+        put32(dst, It->size_);
+        put32(dst + 4, block);
+        memcpy(dst + PACK_HEADER_SIZE, It->result_ > 0 ? It->dst_ : It->src_, block);
+        dst += PACK_HEADER_SIZE + block;
+    }
+    return size;
+}
+
+/////////////////////////////////////////////////////////////////////////
+PackPipeline::PackPipeline(PackWorkers* workers, bool high)
+    : workers_(workers),
+    high_(high)
+{}
+
+PackPipeline::~PackPipeline()
+{
+    clear();
+    for(ChunksT::iterator It = free_.begin(); It != free_.end(); ++It)
+        delete *It;
+}
+
+void PackPipeline::read(File* file, i64 offset, u32 length, bool probe)
+{
+    Chunk* chunk = NULL;
+    if( free_.empty() )
+        chunk = new Chunk();
+    else {
+        chunk = free_.front();
+        free_.pop_front();
+    }
+    chunk->offset_ = offset;
+    chunk->probe_ = probe;
+    chunk->data_.reserve( length );
+    chunk->data_.resize( length );
+    chunk->batch_.jobs_.clear();
+
+    // the file position is the sent data, the chunk is read ahead of it
+    i64 position = file->tell();
+    try {
+        file->seek( offset, SEEK_SET );
+        file->read( chunk->data_.get(), length );
+    }
+    catch(...) {
+        free_.push_back(chunk);
+        file->seek( position, SEEK_SET );
+        throw;
+    }
+    file->seek( position, SEEK_SET );
+    chunks_.push_back(chunk);
+    if( !probe )
+        return;
+
+    // the block must get smaller, so its slot holds it
+    chunk->blocks_.reserve( length );
+    for(u32 pos = 0; pos < length; pos += PACK_BLOCK_SIZE)
+    {
+        u32 size = min(length - pos, (u32)PACK_BLOCK_SIZE);
+        PackWorkers::Job job = { &chunk->batch_, chunk->data_.get() + pos, size, chunk->blocks_.get() + pos,
+                                 size - 1, true, high_, 0 };
+        chunk->batch_.jobs_.push_back(job);
+    }
+    workers_->submit(&chunk->batch_);
+}
+
+i64 PackPipeline::end() const
+{
+    assert( !chunks_.empty() );
+    return chunks_.back()->offset_ + chunks_.back()->data_.size();
+}
+
+const PackPipeline::Chunk* PackPipeline::front()
+{
+    assert( !chunks_.empty() );
+    Chunk* chunk = chunks_.front();
+    workers_->complete(&chunk->batch_);
+    return chunk;
+}
+
+void PackPipeline::pop()
+{
+    assert( !chunks_.empty() );
+    Chunk* chunk = chunks_.front();
+    workers_->complete(&chunk->batch_);
+    chunks_.pop_front();
+    free_.push_back(chunk);
+}
+
+void PackPipeline::clear()
+{
+    // the workers may hold the blocks of dropped chunks still
+    for(ChunksT::iterator It = chunks_.begin(); It != chunks_.end(); ++It)
+    {
+        workers_->complete(&(*It)->batch_);
+        free_.push_back(*It);
+    }
+    chunks_.clear();
+}
@@ -0,0 +1,387 @@
+#ifndef WIN32
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#endif
+
+#include "rawfile.h"
+
+using namespace std;
+
+#ifdef WIN32
+#   define NO_HANDLE INVALID_HANDLE_VALUE
+#else
+#   define NO_HANDLE (-1)
+#endif
+
+/*  The maximum number of buffers for one pwritev() call */
+const u32 MAX_IOVEC_COUNT = 1024;
+
+RawFile::RawFile()
+    : handle_(NO_HANDLE),
+    position_(0),
+    direct_(false),
+    cachePolicy_(keep_CachePolicy),
+    cacheEnd_(0),
+    cacheStarted_(0),
+    cacheDropped_(0)
+{}
+
+RawFile::RawFile( const std::string& path, const std::string& openmode )
+    : handle_(NO_HANDLE),
+    position_(0),
+    direct_(false),
+    cachePolicy_(keep_CachePolicy),
+    cacheEnd_(0),
+    cacheStarted_(0),
+    cacheDropped_(0)
+{
+    open( path, openmode );
+}
+
+RawFile::~RawFile()
+{
+    close();
+}
+
+void RawFile::open( const std::string& path, const std::string& openmode, bool direct )
+{
+    assert( !openmode.empty() );
+    /*  trying to reopen */
+    close();
+
+    bool update = (string::npos != openmode.find('+'));
+#ifdef WIN32
+    DWORD access = GENERIC_READ;
+    DWORD creation = OPEN_EXISTING;
+    switch( openmode[0] )
+    {
+    case 'w': access = GENERIC_WRITE; creation = CREATE_ALWAYS; break;
+    case 'a': access = GENERIC_WRITE; creation = OPEN_ALWAYS; break;
+    }
+    if( update )
+        access = GENERIC_READ | GENERIC_WRITE;
+
+    DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+    if( direct )
+        attributes |= FILE_FLAG_NO_BUFFERING;
+
+    handle_ = CreateFileA( path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           creation, attributes, NULL );
+#else
+    i32 flags = O_RDONLY;
+    switch( openmode[0] )
+    {
+    case 'w': flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+    case 'a': flags = O_WRONLY | O_CREAT; break;
+    }
+    if( update )
+        flags = (flags & ~O_WRONLY) | O_RDWR;
+
+#   ifdef O_DIRECT
+    if( direct )
+    {
+        handle_ = open64( path.c_str(), flags | O_DIRECT, 0644 );
+        // tmpfs and some others refuse O_DIRECT, the file is written through the cache then
+        if( NO_HANDLE == handle_ && EINVAL == ERRNO )
+            direct = false;
+    }
+#   else
+    direct = false;
+#   endif
+    if( !direct )
+        handle_ = open64( path.c_str(), flags, 0644 );
+#endif
+    if( NO_HANDLE == handle_ )
+        throw system_exception(std::string("Can't open file ") + path, ERRNO);
+
+    path_ = path;
+    position_ = 0;
+    direct_ = direct;
+    cacheEnd_ = cacheStarted_ = cacheDropped_ = 0;
+
+    /* the positional writing can't be used with O_APPEND, so the position is moved instead */
+    if( 'a' == openmode[0] )
+        position_ = size();
+}
+
+void RawFile::close()
+{
+    if( isOpened() )
+    {
+#ifdef WIN32
+        CloseHandle( handle_ );
+#else
+        ::close( handle_ );
+#endif
+    }
+    handle_ = NO_HANDLE;
+    direct_ = false;
+}
+
+u32 RawFile::pread( void* buf, u32 size, i64 offset ) const
+{
+    assert(NULL != buf);
+    u32 done = 0;
+    while( done < size )
+    {
+#ifdef WIN32
+        OVERLAPPED ov;
+        memset( &ov, 0, sizeof(ov) );
+        ov.Offset = (DWORD)(offset + done);
+        ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+        DWORD n = 0;
+        if( !ReadFile(handle_, (u8*)buf + done, size - done, &n, &ov) )
+        {
+            if( ERROR_HANDLE_EOF == GetLastError() )
+                break;
+            throw system_exception("ReadFile", ERRNO);
+        }
+#else
+        ssize_t n = pread64( handle_, (u8*)buf + done, size - done, offset + done );
+        if( -1 == n )
+        {
+            if( EINTR == ERRNO )
+                continue;
+            throw system_exception("pread", ERRNO);
+        }
+#endif
+        if( 0 == n )
+            break;
+        done += (u32)n;
+    }
+    return done;
+}
+
+u32 RawFile::pwrite( const void* buf, u32 size, i64 offset )
+{
+    assert(NULL != buf);
+    u32 done = 0;
+    while( done < size )
+    {
+#ifdef WIN32
+        OVERLAPPED ov;
+        memset( &ov, 0, sizeof(ov) );
+        ov.Offset = (DWORD)(offset + done);
+        ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+        DWORD n = 0;
+        if( !WriteFile(handle_, (const u8*)buf + done, size - done, &n, &ov) )
+            throw system_exception("WriteFile", ERRNO);
+#else
+        ssize_t n = pwrite64( handle_, (const u8*)buf + done, size - done, offset + done );
+        if( -1 == n )
+        {
+            if( EINTR == ERRNO )
+                continue;
+            throw system_exception("pwrite", ERRNO);
+        }
+#endif
+        if( 0 == n )
+            throw system_exception("pwrite", ENOSPC);
+        done += (u32)n;
+    }
+    return done;
+}
+
+u64 RawFile::pwritev( const struct iovec* iov, u32 count, i64 offset )
+{
+    u64 done = 0;
+#ifdef WIN32
+    for(u32 i = 0; i < count; ++i)
+        done += pwrite( iov[i].iov_base, (u32)iov[i].iov_len, offset + done );
+#else
+    while( count > 0 )
+    {
+        ssize_t n = pwritev64( handle_, iov, (i32)min(count, MAX_IOVEC_COUNT), offset + done );
+        if( -1 == n )
+        {
+            if( EINTR == ERRNO )
+                continue;
+            throw system_exception("pwritev", ERRNO);
+        }
+        if( 0 == n )
+            throw system_exception("pwritev", ENOSPC);
+        done += n;
+
+        /* skip the written buffers, the partially written one is completed by pwrite() */
+        while( count > 0 && (size_t)n >= iov->iov_len )
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if( count > 0 && n > 0 )
+        {
+            u32 rest = (u32)(iov->iov_len - n);
+            done += pwrite( (const u8*)iov->iov_base + n, rest, offset + done );
+            ++iov;
+            --count;
+        }
+    }
+#endif
+    return done;
+}
+
+u32 RawFile::read( void* buf, u32 size )
+{
+    u32 n = pread( buf, size, position_ );
+    position_ += n;
+    return n;
+}
+
+u32 RawFile::write( const void* buf, u32 size )
+{
+    u32 n = pwrite( buf, size, position_ );
+    position_ += n;
+    return n;
+}
+
+i64 RawFile::size() const
+{
+#ifdef WIN32
+    LARGE_INTEGER sz;
+    if( !GetFileSizeEx(handle_, &sz) )
+        throw system_exception("GetFileSizeEx", ERRNO);
+    return (i64)sz.QuadPart;
+#else
+    struct stat64 fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    if( 0 != fstat64(handle_, &fileInfo) )
+        throw system_exception("fstat64", ERRNO);
+    return fileInfo.st_size;
+#endif
+}
+
+void RawFile::resize( i64 size )
+{
+#ifdef WIN32
+    LARGE_INTEGER pos;
+    pos.QuadPart = size;
+
+    if( INVALID_SET_FILE_POINTER == SetFilePointer(handle_, pos.LowPart, &pos.HighPart, FILE_BEGIN) )
+        throw system_exception("SetFilePointer", ERRNO);
+
+    if( 0 == SetEndOfFile( handle_ ) )
+        throw system_exception("SetEndOfFile", ERRNO);
+#else
+    if( 0 != ftruncate64(handle_, size) )
+        throw system_exception("ftruncate64", ERRNO);
+#endif
+
+    rewind();
+}
+
+bool RawFile::allocate( i64 size )
+{
+    if( size <= 0 )
+        return true;
+
+#ifdef WIN32
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    if( !SetFileInformationByHandle(handle_, FileAllocationInfo, &info, sizeof(info)) )
+        throw system_exception("SetFileInformationByHandle, FileAllocationInfo", ERRNO);
+    return true;
+#elif defined(__linux)
+    if( 0 == fallocate64(handle_, FALLOC_FL_KEEP_SIZE, 0, size) )
+        return true;
+    if( EOPNOTSUPP == ERRNO || ENOSYS == ERRNO )
+        return false;
+    throw system_exception("fallocate", ERRNO);
+#else
+    /* posix_fallocate() changes the size of short file, it is fine since the file is resized before */
+    i32 err = posix_fallocate( handle_, 0, size );
+    if( 0 == err )
+        return true;
+    if( EINVAL == err || EOPNOTSUPP == err )
+        return false;
+    throw system_exception("posix_fallocate", err);
+#endif
+}
+
+void RawFile::setCachePolicy( CachePolicy policy )
+{
+    cachePolicy_ = policy;
+}
+
+void RawFile::written( i64 offset, u64 size )
+{
+    if( drop_CachePolicy != cachePolicy_ || direct_ )
+        return;
+    if( offset + (i64)size > cacheEnd_ )
+        cacheEnd_ = offset + size;
+
+    // the hints are advisory, so their errors are ignored
+    while( cacheEnd_ - cacheStarted_ >= CACHE_DROP_WINDOW )
+    {
+#ifdef __linux
+        sync_file_range( handle_, cacheStarted_, CACHE_DROP_WINDOW, SYNC_FILE_RANGE_WRITE );
+#endif
+        cacheStarted_ += CACHE_DROP_WINDOW;
+        if( cacheStarted_ - cacheDropped_ <= CACHE_DROP_WINDOW )
+            continue;
+
+        // the dirty pages are not dropped, so their writeback is waited for
+#ifdef __linux
+        sync_file_range( handle_, cacheDropped_, CACHE_DROP_WINDOW,
+                         SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+#endif
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise( handle_, cacheDropped_, CACHE_DROP_WINDOW, POSIX_FADV_DONTNEED );
+#endif
+        cacheDropped_ += CACHE_DROP_WINDOW;
+    }
+}
+
+void RawFile::dropCache()
+{
+#ifdef POSIX_FADV_DONTNEED
+    if( drop_CachePolicy == cachePolicy_ && !direct_ && isOpened() && cacheEnd_ > cacheDropped_ )
+        posix_fadvise( handle_, cacheDropped_, cacheEnd_ - cacheDropped_, POSIX_FADV_DONTNEED );
+#endif
+    cacheStarted_ = cacheDropped_ = cacheEnd_;
+}
+
+void RawFile::sync()
+{
+#ifdef WIN32
+    if( !FlushFileBuffers(handle_) )
+        throw system_exception("FlushFileBuffers", ERRNO);
+#elif defined(__linux)
+    if( 0 != fdatasync(handle_) )
+        throw system_exception("fdatasync", ERRNO);
+#else
+    if( 0 != fsync(handle_) )
+        throw system_exception("fsync", ERRNO);
+#endif
+}
+
+void RawFile::rewind()
+{
+    position_ = 0;
+}
+
+i64 RawFile::tell() const
+{
+    return position_;
+}
+
+void RawFile::seek( i64 offset, i32 origin )
+{
+    i64 base = 0;
+    if( SEEK_CUR == origin )
+        base = position_;
+    else if( SEEK_END == origin )
+        base = size();
+
+    if( base + offset < 0 )
+        throw system_exception("RawFile::seek", EINVAL);
+    position_ = base + offset;
+}
+
+bool RawFile::isOpened() const
+{
+    return NO_HANDLE != handle_;
+}
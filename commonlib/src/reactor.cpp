@@ -0,0 +1,495 @@
+#ifndef WIN32
+#   include <unistd.h>
+#   include <fcntl.h>
+#   ifdef __linux
+#       include <sys/epoll.h>
+#   else
+#       include <sys/select.h>
+#   endif
+#endif
+
+#include "reactor.h"
+
+#include "task.h"
+#include "task_impl.h"
+#include "useful.h"
+
+#include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+/*  The maximum number of events are handled per one wait */
+const int MAX_REACTOR_EVENTS = 256;
+
+#ifdef __linux
+/*  The events of attached descriptor, EPOLLOUT is added while the task waits for it */
+const u32 REACTOR_EVENTS = EPOLLIN | EPOLLRDHUP | EPOLLET;
+#endif
+
+#ifdef WIN32
+/*  There is no wakeup descriptor for select() on Windows, so it is the period
+    of attached descriptors set rereading (in milliseconds) */
+const int SELECT_PERIOD = 100;
+#endif
+
+struct Reactor::ReactorImpl
+{
+    /*  Attached descriptor */
+    struct Entry
+    {
+        Entry( SD fd, Task* task )
+            : fd_(fd),
+            task_(task),
+            detached_(false),
+            writable_(false)
+        {}
+
+        SD    fd_;
+        Task* task_;
+        bool  detached_;
+        bool  writable_; /* the task is run when the descriptor becomes writable too */
+    };
+
+    typedef std::map<SD, Entry*> EntriesT;
+    typedef std::list<Entry*> GarbageT;
+    typedef std::list<Entry*> ResumedT;
+
+    ReactorImpl( void );
+    ~ReactorImpl( void );
+
+    /*  Lock */
+    mutable Mutex lock_;
+
+    /*  Attached descriptors */
+    EntriesT entries_;
+
+    /*  Detached entries, they are destroyed by the reactor thread
+        when no one task is running
+    */
+    GarbageT garbage_;
+
+    /*  Entries to run at next iteration without the event */
+    ResumedT resumed_;
+
+    /*  True if the reactor is cancelled, otherwise false */
+    bool isCancelled_;
+
+#ifdef __linux
+    /*  epoll descriptor */
+    i32 epfd_;
+#endif
+
+#ifndef WIN32
+    /*  Self-pipe to wake up the waiting reactor thread */
+    i32 wakeup_[2];
+#endif
+
+    void run( void );
+
+    void attach( SD fd, Task* task );
+
+    bool detach( Task* task, bool takeOwnership );
+
+    bool resume( Task* task );
+
+    bool watch_writable( Task* task, bool writable );
+
+    bool cancel( void );
+
+    void clean( void );
+
+    /* @note Non-synchronized */
+    void destroy( Entry* entry );
+
+    /*  Destroys the detached entries */
+    void collect( void );
+
+    /*  Interrupts the waiting of events */
+    void wakeup( void );
+
+    /*  Returns true if the entry is attached yet */
+    bool isAlive( Entry* entry ) const;
+};
+
+Reactor::ReactorImpl::ReactorImpl()
+    : isCancelled_(false)
+{
+#ifdef __linux
+    epfd_ = epoll_create( REQUIRED_FD_SETSIZE );
+    if( -1 == epfd_ )
+        throw system_exception("epoll_create", ERRNO);
+#endif
+
+#ifndef WIN32
+    if( 0 != pipe( wakeup_ ) )
+        throw system_exception("pipe", ERRNO);
+    fcntl( wakeup_[0], F_SETFL, fcntl(wakeup_[0], F_GETFL, 0) | O_NONBLOCK );
+    fcntl( wakeup_[1], F_SETFL, fcntl(wakeup_[1], F_GETFL, 0) | O_NONBLOCK );
+#endif
+
+#ifdef __linux
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL means the wakeup pipe */
+    if( 0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeup_[0], &ev) )
+        throw system_exception("epoll_ctl, EPOLL_CTL_ADD", ERRNO);
+#endif
+}
+
+Reactor::ReactorImpl::~ReactorImpl()
+{
+#ifndef WIN32
+    ::close( wakeup_[0] );
+    ::close( wakeup_[1] );
+#endif
+#ifdef __linux
+    ::close( epfd_ );
+#endif
+}
+
+Reactor::Reactor()
+    : Thread("Reactor"),
+    impl_( new ReactorImpl() )
+{
+    Thread::start();
+}
+
+Reactor::Reactor( const std::string& name )
+    : Thread(name),
+    impl_( new ReactorImpl() )
+{
+    Thread::start();
+}
+
+Reactor::~Reactor()
+{
+    cancel();
+    delete impl_;
+}
+
+void Reactor::ReactorImpl::wakeup()
+{
+#ifndef WIN32
+    s8 ch = 0;
+    ::write( wakeup_[1], &ch, 1 );
+#endif
+}
+
+bool Reactor::ReactorImpl::isAlive( Entry* entry ) const
+{
+    MGuard g(lock_);
+    return !entry->detached_;
+}
+
+void Reactor::ReactorImpl::destroy( Entry* entry )
+{
+    if( NULL != entry->task_ )
+        TaskAccessor::destroy( entry->task_ );
+    delete entry;
+}
+
+void Reactor::ReactorImpl::collect()
+{
+    GarbageT garbage;
+    {
+        MGuard g(lock_);
+        garbage.swap( garbage_ );
+    }
+    for(GarbageT::iterator it = garbage.begin(); it != garbage.end(); ++it)
+        destroy( *it );
+}
+
+void Reactor::ReactorImpl::run()
+{
+    for(;;)
+    {
+        /* the previous events are handled, so nobody uses the detached tasks */
+        collect();
+
+        std::vector<Entry*> ready;
+#ifdef __linux
+        struct epoll_event events[MAX_REACTOR_EVENTS];
+        i32 n = epoll_wait( epfd_, events, MAX_REACTOR_EVENTS, -1 );
+        if( -1 == n )
+        {
+            if( EINTR == ERRNO )
+                continue;
+            throw system_exception("epoll_wait", ERRNO);
+        }
+
+        for(i32 i = 0; i < n; ++i)
+        {
+            if( NULL == events[i].data.ptr )
+            {
+                s8 buf[64];
+                while( 0 < ::read(wakeup_[0], buf, sizeof(buf)) );
+                continue;
+            }
+            ready.push_back( (Entry*)events[i].data.ptr );
+        }
+#else
+        fd_set set, writeSet;
+        FD_ZERO( &set );
+        FD_ZERO( &writeSet );
+        SD maxFd = 0;
+        {
+            MGuard g(lock_);
+#   ifndef WIN32
+            FD_SET( wakeup_[0], &set );
+            maxFd = wakeup_[0];
+#   endif
+            for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+            {
+                FD_SET( it->first, &set );
+                if( it->second->writable_ )
+                    FD_SET( it->first, &writeSet );
+                if( it->first > maxFd )
+                    maxFd = it->first;
+            }
+        }
+
+#   ifdef WIN32
+        struct timeval tv;
+        tv.tv_sec  = 0;
+        tv.tv_usec = SELECT_PERIOD * 1000;
+        i32 n = ::select( static_cast<int>(maxFd+1), &set, &writeSet, NULL, &tv );
+#   else
+        i32 n = ::select( static_cast<int>(maxFd+1), &set, &writeSet, NULL, NULL );
+#   endif
+        if( SOCKET_ERROR == n )
+        {
+            if( ERR_EINTR == SOCKET_ERRNO )
+                continue;
+#   ifdef WIN32
+            /* empty set is not allowed by winsock */
+            Sleep( SELECT_PERIOD );
+            continue;
+#   else
+            throw system_exception("::select", SOCKET_ERRNO);
+#   endif
+        }
+
+#   ifndef WIN32
+        if( FD_ISSET(wakeup_[0], &set) )
+        {
+            s8 buf[64];
+            while( 0 < ::read(wakeup_[0], buf, sizeof(buf)) );
+        }
+#   endif
+        {
+            MGuard g(lock_);
+            for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+            {
+                if( FD_ISSET(it->first, &set) || FD_ISSET(it->first, &writeSet) )
+                    ready.push_back( it->second );
+            }
+        }
+#endif /* __linux */
+
+        {
+            MGuard g(lock_);
+            if( isCancelled_ )
+                return;
+
+            for(ResumedT::iterator it = resumed_.begin(); it != resumed_.end(); ++it)
+            {
+                if( ready.end() == std::find(ready.begin(), ready.end(), *it) )
+                    ready.push_back( *it );
+            }
+            resumed_.clear();
+        }
+
+        /* all locks are released */
+        for(std::vector<Entry*>::iterator it = ready.begin(); it != ready.end(); ++it)
+        {
+            if( isAlive(*it) )
+                TaskAccessor::run( (*it)->task_ );
+        }
+    }
+}
+
+void Reactor::attach( SD fd, Task* task )
+{
+    impl_->attach( fd, task );
+}
+
+void Reactor::ReactorImpl::attach( SD fd, Task* task )
+{
+    MGuard g(lock_);
+
+    if( isCancelled_ )
+        throw Exception("Reactor::attach() unable to attach task - reactor was stopped!");
+
+    if( entries_.end() != entries_.find(fd) )
+        throw Exception("Reactor::attach(" + tostring((u32)fd) + ", task (name=" + task->get_name() +
+                        ")) failed: the descriptor was already attached.");
+
+    for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        if( it->second->task_ == task )
+            throw Exception("Reactor::attach(" + tostring((u32)fd) + ", task (name=" + task->get_name() +
+                            ")) failed: the task was already attached.");
+    }
+
+    Entry* entry = new Entry(fd, task);
+
+#ifdef __linux
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = REACTOR_EVENTS;
+    ev.data.ptr = entry;
+    if( 0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) )
+    {
+        delete entry;
+        throw system_exception("epoll_ctl, EPOLL_CTL_ADD", ERRNO);
+    }
+#else
+    if( FD_SETSIZE <= entries_.size() )
+    {
+        delete entry;
+        throw Exception("Reactor::attach(" + tostring((u32)fd) + ") failed: FD_SETSIZE is reached.");
+    }
+#endif
+
+    entries_.insert( EntriesT::value_type(fd, entry) );
+    wakeup();
+}
+
+bool Reactor::detach( Task* task, bool takeOwnership )
+{
+    return impl_->detach( task, takeOwnership );
+}
+
+bool Reactor::ReactorImpl::detach( Task* task, bool takeOwnership )
+{
+    MGuard g(lock_);
+
+    EntriesT::iterator it = entries_.begin();
+    for(; it != entries_.end(); ++it)
+    {
+        if( it->second->task_ == task )
+            break;
+    }
+    if( it == entries_.end() )
+        return false;
+
+    Entry* entry = it->second;
+    entries_.erase( it );
+
+#ifdef __linux
+    /* the descriptor may be closed already, so the error is ignored */
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    epoll_ctl( epfd_, EPOLL_CTL_DEL, entry->fd_, &ev );
+#endif
+
+    entry->detached_ = true;
+    resumed_.remove( entry );
+    if( takeOwnership )
+        entry->task_ = NULL;
+
+    garbage_.push_back( entry );
+    wakeup();
+    return true;
+}
+
+bool Reactor::resume( Task* task )
+{
+    return impl_->resume( task );
+}
+
+bool Reactor::ReactorImpl::resume( Task* task )
+{
+    MGuard g(lock_);
+
+    for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        if( it->second->task_ == task )
+        {
+            resumed_.push_back( it->second );
+            wakeup();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Reactor::watch_writable( Task* task, bool writable )
+{
+    return impl_->watch_writable( task, writable );
+}
+
+bool Reactor::ReactorImpl::watch_writable( Task* task, bool writable )
+{
+    MGuard g(lock_);
+
+    for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        Entry* entry = it->second;
+        if( entry->task_ != task )
+            continue;
+        if( entry->writable_ == writable )
+            return true;
+
+#ifdef __linux
+        /* the descriptor which is writable already is reported at once */
+        struct epoll_event ev;
+        memset( &ev, 0, sizeof(ev) );
+        ev.events = REACTOR_EVENTS | (writable ? EPOLLOUT : 0);
+        ev.data.ptr = entry;
+        if( 0 != epoll_ctl(epfd_, EPOLL_CTL_MOD, entry->fd_, &ev) )
+            throw system_exception("epoll_ctl, EPOLL_CTL_MOD", ERRNO);
+#else
+        /* the sets of select() are made anew */
+        wakeup();
+#endif
+        entry->writable_ = writable;
+        return true;
+    }
+    return false;
+}
+
+u32 Reactor::size() const
+{
+    MGuard g(impl_->lock_);
+    return (u32)impl_->entries_.size();
+}
+
+void Reactor::ReactorImpl::clean()
+{
+    collect();
+
+    MGuard g(lock_);
+    for(EntriesT::iterator it = entries_.begin(); it != entries_.end(); ++it)
+        destroy( it->second );
+    entries_.clear();
+}
+
+bool Reactor::ReactorImpl::cancel()
+{
+    MGuard g(lock_);
+    if( isCancelled_ )
+        return false;
+
+    isCancelled_ = true;
+    wakeup();
+    return true;
+}
+
+void Reactor::cancel()
+{
+    if( impl_->cancel() )
+    {
+        this->join();
+        impl_->clean();
+    }
+}
+
+void Reactor::run()
+{
+    impl_->run();
+}
@@ -6,23 +6,37 @@
 #include <sys/ioctl.h>
 #endif 
 
+#ifdef __linux
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+#if defined(__linux) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#   define HAVE_MSG_ZEROCOPY
+#endif
+
 #include "tcpclient.h"
 
 using namespace std;
 
 TCPSockClient::TCPSockClient() 
-    : is_open_(false) 
+    : is_open_(false),
+    port_(0)
 {}
 
 
 TCPSockClient::TCPSockClient(SD fd) 
     : TCPSocket(fd), 
-    is_open_(true) 
+    is_open_(true),
+    port_(0)
 {}
 
 bool TCPSockClient::connect(const IPAddress& address, u16 port) 
 {
     address_ = address;
+    port_ = port;
 
     if( is_open_ ) 
         return true; 
@@ -52,7 +66,8 @@ bool TCPSockClient::connect(const IPAddress& address, u16 port)
 }
 
 TCPSockClient::TCPSockClient(const IPAddress& address, u16 port)
-    : is_open_(false)
+    : is_open_(false),
+    port_(0)
 {
     connect(address, port);
 }
@@ -79,6 +94,9 @@ IPAddress& TCPSockClient::getIPAddress() const
 
 u16 TCPSockClient::get_port() const 
 {
+    if( 0 != port_ )
+        return port_;
+
     struct sockaddr_in addr;
     socklen_t nameLen = sizeof (addr);
     if( 0 != getpeername(m_fd, (sockaddr*)&addr, &nameLen) )
@@ -86,10 +104,15 @@ u16 TCPSockClient::get_port() const
     return ntohs( addr.sin_port );
 }
 
-s32 TCPSockClient::send(const void* msg, s32 len) 
+s32 TCPSockClient::send(const void* msg, s32 len, bool more) 
 {
 #ifndef WIN32
-    s32 ret = ::send(m_fd, msg, len, 0);
+    i32 flags = 0;
+#   ifdef MSG_MORE
+    if( more )
+        flags |= MSG_MORE;
+#   endif
+    s32 ret = ::send(m_fd, msg, len, flags);
 #else 
     s32 ret = ::send(m_fd, (const s8*)msg, len, 0); 
 #endif 
@@ -104,6 +127,139 @@ s32 TCPSockClient::send(const void* msg, s32 len)
     return ret;
 }
 
+bool TCPSockClient::isSendfileSupported()
+{
+#ifdef __linux
+    return true;
+#else
+    return false;
+#endif
+}
+
+i64 TCPSockClient::sendfile(i32 fileFd, i64 offset, u64 count)
+{
+#ifdef __linux
+    off64_t pos = offset;
+    ssize_t ret;
+    do
+    {
+        ret = ::sendfile64(m_fd, fileFd, &pos, count);
+    }
+    while( -1 == ret && ERR_EINTR == SOCKET_ERRNO );
+
+    if( -1 == ret )
+    {
+        s32 errorCode = SOCKET_ERRNO;
+        if( ERR_WOULDBLOCK == errorCode )
+            return -1;
+        throw system_exception("::sendfile", errorCode);
+    }
+    return ret;
+#else
+    throw system_exception("::sendfile", ENOSYS);
+#endif
+}
+
+bool TCPSockClient::enable_zerocopy()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    i32 on = 1;
+    return 0 == setsockopt(m_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+#else
+    return false;
+#endif
+}
+
+s32 TCPSockClient::send_zerocopy(const void* msg, s32 len)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    s32 ret = ::send(m_fd, msg, len, MSG_ZEROCOPY);
+    if( ret == SOCKET_ERROR )
+    {
+        s32 errorCode = SOCKET_ERRNO;
+        if( ERR_WOULDBLOCK == errorCode )
+            return -1;
+        if( ENOBUFS == errorCode )
+            return 0;
+        throw system_exception("::send, MSG_ZEROCOPY", errorCode);
+    }
+    return ret;
+#else
+    throw system_exception("::send, MSG_ZEROCOPY", ENOSYS);
+#endif
+}
+
+bool TCPSockClient::zerocopy_completion(u32* first, u32* last, bool* copied)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    for(;;)
+    {
+        s8 control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if( -1 == ::recvmsg(m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) )
+        {
+            s32 errorCode = SOCKET_ERRNO;
+            if( ERR_WOULDBLOCK == errorCode || EAGAIN == errorCode )
+                return false;
+            if( ERR_EINTR == errorCode )
+                continue;
+            throw system_exception("::recvmsg, MSG_ERRQUEUE", errorCode);
+        }
+
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if( !(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) )
+                continue;
+
+            struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+            if( err->ee_origin != SO_EE_ORIGIN_ZEROCOPY )
+                throw system_exception("::recvmsg, MSG_ERRQUEUE", err->ee_errno);
+
+            *first = err->ee_info;
+            *last = err->ee_data;
+            *copied = 0 != (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            return true;
+        }
+        // other messages of the queue are skipped
+    }
+#else
+    return false;
+#endif
+}
+
+bool TCPSockClient::until_zerocopy_completion(i32 timeoutMs)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    // the error queue is reported as POLLERR, it is not requested explicitly
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = 0;
+    pfd.revents = 0;
+
+    i32 ret;
+    do
+    {
+        ret = ::poll(&pfd, 1, timeoutMs);
+    }
+    while( -1 == ret && ERR_EINTR == SOCKET_ERRNO );
+
+    if( -1 == ret )
+        throw system_exception("::poll", SOCKET_ERRNO);
+    if( 0 == ret )
+        return false;
+    if( 0 == (pfd.revents & POLLERR) )
+        throw system_exception("zero-copy completion", EPIPE);
+    return true;
+#else
+    throw system_exception("zero-copy completion", ENOSYS);
+#endif
+}
+
 s32 TCPSockClient::recv( void* buf, s32 len )
 {
 #ifndef WIN32
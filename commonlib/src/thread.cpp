@@ -15,6 +15,7 @@
 #else 
 #   include <sys/time.h>
 #   include <signal.h>
+#   include <unistd.h>
 #endif /* WIN32 */
 
 using namespace std;
@@ -440,6 +441,18 @@ bool Thread::sleep( u32 aMilis )
 #endif /* WIN32 */
 }
 
+u16 Thread::getNumberOfProcessors()
+{
+#ifndef WIN32
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    return (cpus > 0) ? (u16)cpus : 1;
+#else
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return (info.dwNumberOfProcessors > 0) ? (u16)info.dwNumberOfProcessors : 1;
+#endif /* WIN32 */
+}
+
 void Thread::setCancelMode( CancellationType aMode ) 
 {
 #ifndef WIN32
@@ -0,0 +1,439 @@
+#include <string.h>
+#include <algorithm>
+
+#include "tree_hash.h"
+#include "useful.h"
+
+using namespace std;
+
+#define BLAKE3_BLOCK_LEN    64
+#define BLAKE3_CHUNK_LEN    1024
+#define BLAKE3_CHUNK_START  1
+#define BLAKE3_CHUNK_END    2
+#define BLAKE3_PARENT       4
+#define BLAKE3_ROOT         8
+
+namespace {
+
+const u32 IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+const u32 MSG_PERMUTATION[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+inline u32 rotr(u32 value, u32 bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+inline void quarter(u32* state, u32 a, u32 b, u32 c, u32 d, u32 mx, u32 my)
+{
+    state[a] = state[a] + state[b] + mx;
+    state[d] = rotr(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + my;
+    state[d] = rotr(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr(state[b] ^ state[c], 7);
+}
+
+inline void mix(u32* state, const u32* m)
+{
+    // the columns, then the diagonals
+    quarter(state, 0, 4, 8, 12, m[0], m[1]);
+    quarter(state, 1, 5, 9, 13, m[2], m[3]);
+    quarter(state, 2, 6, 10, 14, m[4], m[5]);
+    quarter(state, 3, 7, 11, 15, m[6], m[7]);
+    quarter(state, 0, 5, 10, 15, m[8], m[9]);
+    quarter(state, 1, 6, 11, 12, m[10], m[11]);
+    quarter(state, 2, 7, 8, 13, m[12], m[13]);
+    quarter(state, 3, 4, 9, 14, m[14], m[15]);
+}
+
+/*  BLAKE3 compression function, the first 8 words of 'out' are the chaining value */
+void compress(const u32* cv, const u32* block, u64 counter, u32 blockLen, u32 flags, u32* out)
+{
+    u32 state[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3], (u32)counter, (u32)(counter >> 32), blockLen, flags
+    };
+    u32 m[16];
+    u32 permuted[16];
+    memcpy(m, block, sizeof(m));
+    for(u32 r = 0; r < 7; ++r)
+    {
+        mix(state, m);
+        if( r == 6 )
+            break;
+        for(u32 i = 0; i < 16; ++i)
+            permuted[i] = m[MSG_PERMUTATION[i]];
+        memcpy(m, permuted, sizeof(m));
+    }
+    for(u32 i = 0; i < 8; ++i)
+    {
+        out[i] = state[i] ^ state[i + 8];
+        out[i + 8] = state[i + 8] ^ cv[i];
+    }
+}
+
+void load_block(const u8* data, u32 size, u32* block)
+{
+    u8 bytes[BLAKE3_BLOCK_LEN] = {0};
+    memcpy(bytes, data, size);
+    for(u32 i = 0; i < 16; ++i)
+        block[i] = (u32)bytes[4*i] | ((u32)bytes[4*i+1] << 8) | ((u32)bytes[4*i+2] << 16) | ((u32)bytes[4*i+3] << 24);
+}
+
+void store_words(const u32* words, u32 count, u8* bytes)
+{
+    for(u32 i = 0; i < count; ++i)
+    {
+        bytes[4*i] = (u8)words[i];
+        bytes[4*i+1] = (u8)(words[i] >> 8);
+        bytes[4*i+2] = (u8)(words[i] >> 16);
+        bytes[4*i+3] = (u8)(words[i] >> 24);
+    }
+}
+
+/*  The node which is not compressed yet, it gives the chaining value or the root hash */
+struct Output
+{
+    u32 cv_[8];
+    u32 block_[16];
+    u64 counter_;
+    u32 blockLen_;
+    u32 flags_;
+
+    void chaining_value(u32* cv) const
+    {
+        u32 out[16];
+        compress(cv_, block_, counter_, blockLen_, flags_, out);
+        memcpy(cv, out, 8 * sizeof(u32));
+    }
+
+    void root(u8* hash) const
+    {
+        u32 out[16];
+        compress(cv_, block_, 0, blockLen_, flags_ | BLAKE3_ROOT, out);
+        store_words(out, 8, hash);
+    }
+};
+
+Output parent_output(const u32* left, const u32* right)
+{
+    Output output;
+    memcpy(output.cv_, IV, sizeof(output.cv_));
+    memcpy(output.block_, left, 8 * sizeof(u32));
+    memcpy(output.block_ + 8, right, 8 * sizeof(u32));
+    output.counter_ = 0;
+    output.blockLen_ = BLAKE3_BLOCK_LEN;
+    output.flags_ = BLAKE3_PARENT;
+    return output;
+}
+
+Output chunk_output(const u8* data, u32 size, u64 counter)
+{
+    Output output;
+    memcpy(output.cv_, IV, sizeof(output.cv_));
+    u32 flags = BLAKE3_CHUNK_START;
+    u32 out[16];
+    for(; size > BLAKE3_BLOCK_LEN; size -= BLAKE3_BLOCK_LEN, data += BLAKE3_BLOCK_LEN)
+    {
+        load_block(data, BLAKE3_BLOCK_LEN, output.block_);
+        compress(output.cv_, output.block_, counter, BLAKE3_BLOCK_LEN, flags, out);
+        memcpy(output.cv_, out, sizeof(output.cv_));
+        flags = 0;
+    }
+    load_block(data, size, output.block_);
+    output.counter_ = counter;
+    output.blockLen_ = size;
+    output.flags_ = flags | BLAKE3_CHUNK_END;
+    return output;
+}
+
+/*  The stack of chaining values of the complete subtrees waiting for their right siblings */
+struct CvStack
+{
+    u32 cvs_[64][8];
+    u32 depth_;
+
+    CvStack() : depth_(0) {}
+
+    /*  Pushes the chaining value of subtree, the subtrees completed by it are merged.
+        @param total - the number of subtrees of its size by now
+    */
+    void push(u32* cv, u64 total)
+    {
+        while( 0 == (total & 1) )
+        {
+            parent_output(cvs_[--depth_], cv).chaining_value(cv);
+            total >>= 1;
+        }
+        memcpy(cvs_[depth_++], cv, 8 * sizeof(u32));
+    }
+
+    /*  Returns the root node of the subtrees with the last one */
+    Output fold(Output output) const
+    {
+        u32 cv[8];
+        for(u32 i = depth_; i > 0; --i)
+        {
+            output.chaining_value(cv);
+            output = parent_output(cvs_[i - 1], cv);
+        }
+        return output;
+    }
+};
+
+/*  Returns the root node of the subtree which starts with the chunk number 'counter' */
+Output subtree_output(const u8* data, u32 size, u64 counter)
+{
+    CvStack stack;
+    u32 cv[8];
+    u64 chunks = 0;
+    for(; size > BLAKE3_CHUNK_LEN; size -= BLAKE3_CHUNK_LEN, data += BLAKE3_CHUNK_LEN)
+    {
+        chunk_output(data, BLAKE3_CHUNK_LEN, counter + chunks).chaining_value(cv);
+        stack.push(cv, ++chunks);
+    }
+    return stack.fold( chunk_output(data, size, counter + chunks) );
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+HashWorkers::HashThread::HashThread(const std::string& name, HashWorkers* owner)
+    : Thread(name),
+    owner_(owner)
+{}
+
+void HashWorkers::HashThread::run()
+{
+    owner_->drain();
+}
+
+/////////////////////////////////////////////////////////////////////////
+HashWorkers::HashWorkers(u16 threads)
+    : stopping_(false)
+{
+    for(u16 i = 0; i < threads; ++i)
+    {
+        threads_.push_back( new HashThread("Hash-" + tostring((u32)i), this) );
+        threads_.back()->start();
+    }
+}
+
+HashWorkers::~HashWorkers()
+{
+    stop();
+}
+
+void HashWorkers::stop()
+{
+    {
+        MGuard g(lock_);
+        if( stopping_ )
+            return;
+        stopping_ = true;
+        cond_.broadcast();
+    }
+
+    for(ThreadsT::iterator It = threads_.begin(); It != threads_.end(); ++It)
+    {
+        (*It)->join();
+        delete *It;
+    }
+    threads_.clear();
+}
+
+void HashWorkers::submit(Job* job)
+{
+    {
+        MGuard g(lock_);
+        if( !threads_.empty() && !stopping_ )
+        {
+            jobs_.push_back(job);
+            cond_.signal();
+            return;
+        }
+    }
+
+    job->owner_->hashed(job->index_, job->data_);
+    delete job;
+}
+
+void HashWorkers::drain()
+{
+    MGuard g(lock_);
+    for(;;)
+    {
+        // the queued leaves are hashed before stopping, their files wait for them
+        while( jobs_.empty() && !stopping_ )
+            cond_.wait(&lock_);
+        if( jobs_.empty() )
+            return;
+
+        Job* job = jobs_.front();
+        jobs_.pop_front();
+
+        Unlocker<Mutex> unlocker(lock_);
+        job->owner_->hashed(job->index_, job->data_);
+        delete job;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+TreeHash::TreeHash(HashWorkers* workers)
+    : workers_(workers),
+    size_(0),
+    pending_(0),
+    ready_(0),
+    finished_(false)
+{}
+
+TreeHash::~TreeHash()
+{
+    wait_pending();
+}
+
+void TreeHash::update(const u8* data, u32 size)
+{
+    assert( !finished_ );
+    while( size > 0 )
+    {
+        // the full leaf is not the last one, so it is hashed as the subtree
+        if( TREE_HASH_LEAF == leaf_.size() )
+        {
+            HashWorkers::Job* job = new HashWorkers::Job();
+            job->owner_ = this;
+            {
+                MGuard g(lock_);
+                while( pending_ >= TREE_HASH_IN_FLIGHT )
+                    cond_.wait(&lock_);
+                job->index_ = (u32)done_.size();
+                done_.push_back(false);
+                cvs_.resize(cvs_.size() + 8);
+                ++pending_;
+            }
+            job->data_.swap(leaf_);
+            workers_->submit(job);
+        }
+
+        if( 0 == leaf_.size() )
+        {
+            leaf_.reserve(TREE_HASH_LEAF);
+            leaf_.resize(0);
+        }
+        u32 portion = min(size, (u32)TREE_HASH_LEAF - leaf_.size());
+        leaf_.add(data, portion);
+        data += portion;
+        size -= portion;
+        size_ += portion;
+    }
+}
+
+void TreeHash::hashed(u32 index, const Message& data)
+{
+    u32 cv[8];
+    Output output = subtree_output(data.get(), data.size(), (u64)index * (TREE_HASH_LEAF / BLAKE3_CHUNK_LEN));
+    output.chaining_value(cv);
+
+    MGuard g(lock_);
+    memcpy(&cvs_[index * 8], cv, sizeof(cv));
+    done_[index] = true;
+    --pending_;
+    while( ready_ < done_.size() && done_[ready_] )
+        ++ready_;
+    cond_.broadcast();
+}
+
+void TreeHash::wait_pending()
+{
+    MGuard g(lock_);
+    while( pending_ > 0 )
+        cond_.wait(&lock_);
+}
+
+u32 TreeHash::ready()
+{
+    MGuard g(lock_);
+    return ready_;
+}
+
+void TreeHash::leaf(u32 index, u8* cv)
+{
+    MGuard g(lock_);
+    assert( index < ready_ );
+    store_words(&cvs_[index * 8], 8, cv);
+}
+
+void TreeHash::finish(u8* hash)
+{
+    wait_pending();
+
+    // the last leaf is hashed here, since it may be the root itself
+    u32 index = (u32)done_.size() - (finished_ ? 1 : 0);
+    const u8* data = leaf_.size() ? leaf_.get() : (const u8*)"";
+    Output last = subtree_output(data, leaf_.size(), (u64)index * (TREE_HASH_LEAF / BLAKE3_CHUNK_LEN));
+
+    CvStack stack;
+    u32 cv[8];
+    for(u32 i = 0; i < index; ++i)
+    {
+        memcpy(cv, &cvs_[i * 8], sizeof(cv));
+        stack.push(cv, i + 1);
+    }
+    stack.fold(last).root(hash);
+
+    MGuard g(lock_);
+    if( !finished_ )
+    {
+        last.chaining_value(cv);
+        cvs_.insert(cvs_.end(), cv, cv + 8);
+        done_.push_back(true);
+        ready_ = (u32)done_.size();
+        finished_ = true;
+    }
+}
+
+u64 TreeHash::rewind(u64 offset)
+{
+    wait_pending();
+
+    MGuard g(lock_);
+    u32 index = (u32)(offset / TREE_HASH_LEAF);
+    if( index < done_.size() )
+    {
+        done_.resize(index);
+        cvs_.resize(index * 8);
+        ready_ = index;
+        leaf_.resize(0);
+        size_ = (u64)index * TREE_HASH_LEAF;
+    }
+    else if( offset < size_ )
+    {
+        // the offset is in the leaf being filled
+        leaf_.resize((u32)(offset - (u64)index * TREE_HASH_LEAF));
+        size_ = offset;
+    }
+    finished_ = false;
+    return size_;
+}
+
+void TreeHash::digest(const u8* data, u32 size, u8* hash)
+{
+    subtree_output(size ? data : (const u8*)"", size, 0).root(hash);
+}
+
+string TreeHash::hex(const u8* hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    string text;
+    for(u32 i = 0; i < TREE_HASH_SIZE; ++i)
+    {
+        text += digits[hash[i] >> 4];
+        text += digits[hash[i] & 0x0f];
+    }
+    return text;
+}
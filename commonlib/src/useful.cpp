@@ -152,6 +152,23 @@ void trimWhiteSpace(std::string* pStr)
         pStr->erase(0, pos);
 }
 
+u16 parse_options( int argc, char* argv[], OptionsT* pOut )
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if( 0 != arg.find("--") || arg.length() == 2 )
+            continue;
+
+        string::size_type pos = arg.find('=');
+        if( pos == string::npos )
+            (*pOut)[arg.substr(2)] = "";
+        else
+            (*pOut)[arg.substr(2, pos-2)] = arg.substr(pos+1);
+    }
+    return static_cast<u16>(pOut->size());
+}
+
 
 namespace 
 {
@@ -333,6 +350,26 @@ std::string tostring( i64 value )
     return std::string( i64toa( str_buf, MAX_INT64_STR_SIZE, value ), &str_buf[ MAX_INT64_STR_SIZE ] );
 }
 
+bool atou64( const std::string& str, u64* value )
+{
+    if( str.empty() )
+        return false;
+
+    u64 result = 0;
+    for(string::size_type i = 0; i < str.length(); ++i)
+    {
+        if( str[i] < '0' || str[i] > '9' )
+            return false;
+
+        u32 digit = str[i] - '0';
+        if( result > ((u64)-1 - digit) / 10 )
+            return false;
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return true;
+}
+
 #ifdef WIN32
 #include <windows.h>
 /*
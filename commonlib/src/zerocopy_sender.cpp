@@ -0,0 +1,122 @@
+#include "zerocopy_sender.h"
+#include "tcpclient.h"
+
+using namespace std;
+
+/*  The buffers are aligned by pages, the kernel pins them for sending */
+const u32 BUFFER_ALIGNMENT = 4096;
+
+/*  Waiting time of the completion notification, the connection is considered broken after it */
+const i32 COMPLETION_TIMEOUT = 30000;
+
+ZeroCopySender::ZeroCopySender(TCPSockClient* socket, u32 bufferSize, u32 maxBuffers)
+    : socket_(socket),
+    pool_(bufferSize, BUFFER_ALIGNMENT, maxBuffers),
+    maxBuffers_(maxBuffers),
+    used_(0),
+    zerocopy_(false),
+    nextId_(0),
+    copied_(0)
+{
+    zerocopy_ = socket_->enable_zerocopy();
+}
+
+ZeroCopySender::~ZeroCopySender()
+{
+    // the kernel keeps the pages of unreleased buffers by itself, so they are freed without waiting
+    for(InFlightT::iterator It = inFlight_.begin(); It != inFlight_.end(); ++It)
+        pool_.put( It->buffer_ );
+}
+
+u8* ZeroCopySender::get_buffer()
+{
+    while( used_ >= maxBuffers_ && !inFlight_.empty() )
+        reap(true);
+
+    u8* buffer = pool_.get();
+    ++used_;
+    return buffer;
+}
+
+void ZeroCopySender::put_buffer(u8* buffer)
+{
+    pool_.put( buffer );
+    --used_;
+}
+
+void ZeroCopySender::send(u8* buffer, u32 size)
+{
+    InFlight sent;
+    sent.buffer_ = buffer;
+    sent.first_ = nextId_;
+    sent.count_ = 0;
+
+    u32 done = 0;
+    try {
+        while( done < size )
+        {
+            s32 n = zerocopy_ ? socket_->send_zerocopy(buffer + done, size - done)
+                              : socket_->send(buffer + done, size - done);
+            if( 0 < n )
+            {
+                done += n;
+                if( zerocopy_ ) {
+                    ++nextId_;
+                    ++sent.count_;
+                }
+            }
+            else if( 0 == n )
+                reap(true); // too many notifications are not read
+            else
+                socket_->untilReadyToWrite();
+        }
+    }
+    catch(const Exception&) {
+        if( sent.count_ == 0 )
+            put_buffer( buffer );
+        else {
+            sent.pending_ = sent.count_;
+            inFlight_.push_back( sent );
+        }
+        throw;
+    }
+
+    if( sent.count_ == 0 ) {
+        put_buffer( buffer );
+        return;
+    }
+    sent.pending_ = sent.count_;
+    inFlight_.push_back( sent );
+    reap(false);
+}
+
+void ZeroCopySender::reap(bool wait)
+{
+    if( wait && !socket_->until_zerocopy_completion(COMPLETION_TIMEOUT) )
+        throw Exception("zero-copy sending: the kernel doesn't release the buffers");
+
+    u32 first = 0, last = 0;
+    bool copied = false;
+    while( socket_->zerocopy_completion(&first, &last, &copied) )
+    {
+        if( copied )
+            ++copied_;
+
+        // the numbers are compared by distances because they wrap around
+        u32 range = last - first;
+        for(InFlightT::iterator It = inFlight_.begin(); It != inFlight_.end(); )
+        {
+            for(u32 i = 0; i < It->count_; ++i)
+            {
+                if( It->first_ + i - first <= range )
+                    --It->pending_;
+            }
+            if( It->pending_ == 0 ) {
+                put_buffer( It->buffer_ );
+                It = inFlight_.erase( It );
+            }
+            else
+                ++It;
+        }
+    }
+}
@@ -6,6 +6,8 @@
 #include "notify_base.h"
 #include "filetransfer_defines.h"
 #include "file.h"
+#include "zerocopy_sender.h"
+#include "send_streams.h"
 
 #include <iostream>
 
@@ -106,14 +108,43 @@ protected:
         silence_logging_ = silence;
     }
 
+    /*  Adds the file or its stripe to the files of connection, the sending is started if it is stopped
+        @param stripe - the range of file if it is striped, NULL if the whole file is sent
+        @Returns false if the connection sends DEF_MAX_STREAMS files already, the file is not taken then
+    */
+    bool send_file(u32 fd, TCPSockClient* conn, File* file, const FileStripe* stripe);
+
+    /*  Sends the file by stripes over the given connection and the other ones to the same server,
+        the missing connections are created
+    */
+    void send_striped(TCPSockClient* conn, std::auto_ptr<File>& file, u32 stripes);
+
+    /*  Creates the zero-copy sender of connection instead of the previous one
+        @Returns false if the system doesn't support MSG_ZEROCOPY, so the packages are copied
+    */
+    bool reset_sender(u32 fd, TCPSockClient* conn);
+
+    /*  Returns true if both sockets are connected to the same server, the closed one too */
+    static bool same_server(TCPSockClient* link, TCPSockClient* conn);
+
 private:
+    HashWorkers hashers_;    /* Threads hashing the leaves of sent files, they outlive the streams */
+    PackWorkers packers_;    /* Threads packing the chunks of compressed files, they outlive the streams */
     Fd2SocketT  fd2sockets_; /* Linkage socket descriptor to connection object */
-    Fd2FileT    fd2file_;    /* Linkage connection to choosen file */
+    Fd2StreamsT fd2streams_; /* Linkage connection to choosen files */
+    Fd2SenderT  fd2sender_;  /* Linkage connection to its zero-copy sender */
 
     Timer timer_;
     u32 reconnect_interval_;
     u32 send_interval_;
     u32 packages_size_;
+    u32 file_stripes_; /* the connections one file is sent over at once */
+    CachePolicy cache_policy_; /* whether the sent pages are dropped from the system cache */
+    SendMode send_mode_; /* the way the files are sent */
+    Compression compression_; /* LZ4 packing of DATA frames */
+    bool delta_; /* the whole files are sent against the ones the server has, only the changed blocks go */
+    bool dedup_; /* the whole files refer to the chunks the server has, only the new chunks go */
+    WireProtocol wire_protocol_; /* binary frames or text tags for the old servers */
 
     bool silence_logging_;
     bool shutdown_; /* mainframe shutdown flag */
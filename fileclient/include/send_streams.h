@@ -0,0 +1,136 @@
+#ifndef __send_streams_h__
+#define __send_streams_h__
+
+#include <list>
+
+#include "filetransfer_defines.h"
+#include "frame.h"
+#include "file.h"
+#include "message.h"
+#include "mutex.h"
+#include "tree_hash.h"
+#include "pack_pipeline.h"
+#include "delta_signature.h"
+#include "chunker.h"
+
+//////////////////////////////////////////////////////////////
+// The file being sent on a stream of connection
+struct SendStream
+{
+    u32   id_;
+    File* file_;
+    i64   end_;         /* the end of content to send, it is the file size unless the stream is striped */
+    bool  striped_;     /* the stream carries one stripe of the file */
+    FileStripe stripe_; /* striped: the range of file */
+    bool  started_;     /* the start of file is sent */
+    u64   window_;      /* the payload the receiver allows to send */
+    u64   frameLeft_;   /* the payload of current DATA frame not sent yet */
+    bool  waitOffset_;  /* the resumable file waits for the offset to go on from */
+    bool  checksummed_; /* every DATA frame is followed by CHECKSUM frame */
+    u32   crc_;         /* checksummed: CRC32C of the payload of current DATA frame sent by now */
+    i64   retransmit_;  /* checksummed: the offset the server asks to send again from, -1 if none */
+    bool  resent_;      /* checksummed: the next DATA frame goes on from the offset of retransmit */
+    bool  ended_;       /* checksummed: the end of file is sent, the server confirms it or asks to retransmit */
+    bool  confirmed_;   /* checksummed: the server has the file, the stream may be removed */
+    TreeHash* hash_;    /* the tree hash of sent payload, NULL if the stream is not started or hashed */
+    i64   hashFrom_;    /* hashed: the offset of first payload of stream */
+    u32   leavesSent_;  /* hashed: the leaves sent by HASH frames */
+    bool  leaf_;        /* hashed: the retransmit is asked by the tree hash, its leaves are hashed again */
+    bool  compressed_;  /* checksummed: DATA frames are packed by LZ4 */
+    PackPipeline* pack_; /* compressed: the chunks read ahead and packed by the workers, NULL if not started */
+    u32   rawFrames_;   /* compressed: DATA frames sent raw before the next probe */
+    u32   rawSkip_;     /* compressed: the raw frames after the next failed probe, it doubles up to DEF_COMPRESS_SKIP */
+    i64   probeFrom_;   /* compressed: the failed probes of chunks read ahead before the offset are not counted */
+    u64   rawBytes_;    /* compressed: the payload sent by now */
+    u64   packedBytes_; /* compressed: the payload on the wire by now */
+    DeltaMatcher* delta_; /* hashed: the blocks the server has are looked for in the file, NULL if the stream is not delta */
+    bool  waitSignatures_; /* delta: the stream waits for the signatures of server's file */
+    u64   copiedBytes_; /* delta: the payload sent by COPY frames by now */
+    ChunkQueue* chunks_; /* hashed: the chunks announced to the server, NULL if the stream is not dedup */
+    u64   referencedBytes_; /* dedup: the payload sent by REFERENCE frames by now */
+};
+
+//////////////////////////////////////////////////////////////
+// The files sent over one connection. The frames of their streams are interleaved
+// in round-robin order, so the large file doesn't hold the small ones back.
+// The legacy protocol has no streams, its files are sent one by one.
+class SendStreams
+{
+public:
+    SendStreams();
+    ~SendStreams();
+
+    /*  Adds the file, the set owns it then
+        @param idle - set to true if the sending tasks chain is stopped, so it must be started
+        @param stripe - the range of file to send if it is striped over several connections
+        @Returns false if the connection sends DEF_MAX_STREAMS files already
+    */
+    bool add(File* file, bool* idle, const FileStripe* stripe = NULL);
+
+    /*  Returns the stream to send the next package of, the stream in the middle of DATA frame
+        goes on first. The streams which have no window are skipped if 'windowed' is true, the ones waiting
+        for their offset, signatures, the answer to their chunks or the confirmation of end are skipped always.
+        @Returns NULL if there is nothing to send now
+    */
+    SendStream* next(bool windowed);
+
+    /*  Returns the first added stream, NULL if the set is empty */
+    SendStream* front();
+
+    /*  Deletes the sent stream with its file */
+    void remove(SendStream* stream);
+
+    /*  Stops the sending tasks chain if there are no streams
+        @Returns true if the chain is stopped
+    */
+    bool finish();
+
+    /*  Deletes all the streams and stops the chain, e.g. when the connection is closed */
+    void clear();
+
+    /*  Stops the chain when the connection is lost, the streams are started again on the
+        next connection and go on from the offsets the server has
+    */
+    void interrupt();
+
+    /*  Starts the chain again on the new connection
+        @Returns true if there are interrupted streams, so the chain must be started
+    */
+    bool resume();
+
+    /*  Parses WINDOW, OFFSET, RETRANSMIT, SIGNATURE, HAVE, FILTER and ADDED frames received from the server, the file
+        waiting for the offset is moved there. The file asked to retransmit goes back when its DATA frame is done,
+        the leaves of tree hash are dropped from the offset if the tree hash mismatches.
+        @throw Exception if the frames are malformed
+    */
+    void received(const u8* data, u32 size);
+
+    /*  Returns the filter of server's chunk store, NULL if it is not received entirely yet.
+        @note The filter is changed by received() only, so the sending task uses it unlocked.
+    */
+    const ChunkFilter* filter() const
+    { return filter_.complete() ? &filter_ : NULL; }
+
+    /*  Moves the file back to the offset of retransmit, its DATA frame is sent entirely */
+    void rewind(SendStream* stream);
+
+private:
+    /*  rewind() implementation, the set is locked by the caller */
+    static void go_back(SendStream* stream);
+
+    /*  Adds the signatures of SIGNATURE frame to the delta stream, the stream goes on when it has all of them
+        @throw Exception if the signatures are malformed
+    */
+    static void signed_blocks(SendStream* stream, const u8* data, u32 size);
+
+    typedef std::list<SendStream*> StreamsT;
+
+    Mutex    lock_;
+    StreamsT streams_;
+    u32      nextId_;       /* the id of next stream */
+    bool     sending_;      /* the sending tasks chain is running */
+    Message  input_;        /* the frames from the server which are not received entirely */
+    ChunkFilter filter_;    /* the chunks of server's store, the server sends it on every connection */
+};
+
+#endif /* __send_streams_h__ */
@@ -3,6 +3,7 @@
 
 #include "mainframe.h"
 #include "tcpclient.h"
+#include "send_streams.h"
 
 class NotifyBase;
 
@@ -31,30 +32,110 @@ private:
     RefCountedPtr<TCPSockClient> connection_;
 };
 
-/* performs sending */
+/* performs sending, one package of the connection files per run */
 class SendingTask : public Task, public RefCounted
 {
     friend class Mainframe;
 protected:
     SendingTask(const std::string& name,
-                File* sendingFile,
+                SendStreams* streams,
                 TaskFactory* factory,
                 NotifyBase* notifyMgr,
                 TCPSockClient* connection,
-                u32 packages_size);
+                u32 packages_size,
+                u32 sendfile_segment,
+                ZeroCopySender* sender,
+                HashWorkers* hashers,
+                PackWorkers* packers,
+                Compression compression,
+                bool delta,
+                bool dedup,
+                WireProtocol protocol);
     ~SendingTask();
 
     virtual void run();
 
+    /*  Sends the start of file if it is not sent yet, the next package of its content
+        and the end of file when the content is sent entirely
+        @throw Exception
+    */
+    void send_package(SendStream* stream);
+
+    /*  Sends the next segment of file by sendfile() from the file position and moves it
+        @Returns the number of sent bytes
+        @throw Exception
+    */
+    i64 send_segment(File* file, u64 count);
+
+    /*  Returns CRC32C of the sent segment continuing 'crc' and hashes it if the stream is hashed,
+        the file is read from 'offset' up to the position it has
+        @throw Exception
+    */
+    u32 checksum(SendStream* stream, i64 offset, i64 count, u32 crc);
+
+    /*  Gives the payload read at 'offset' to the tree hash of stream, the payload sent again
+        after the checksum mismatch is hashed already
+    */
+    void hash_payload(SendStream* stream, i64 offset, const u8* data, u32 size);
+
+    /*  Sends the next chunk read ahead by DATA frame entirely, its payload is the packed chunk if it is
+        compressible enough, otherwise the raw frame is sent and the next chunks are not probed, their number
+        doubles with every failed probe up to DEF_COMPRESS_SKIP. The pipeline is filled up again before.
+        @param tag_inside - the frames going before the DATA frame
+        @Returns the number of sent bytes of file
+        @throw Exception
+    */
+    i64 send_packed(SendStream* stream, u16 flags, const std::string& tag_inside);
+
+    /*  Sends COPY frame of the blocks the server has instead of the data at the file position,
+        the data is hashed and the file is moved over it
+        @param tag_inside - the frames going before the COPY frame
+        @throw Exception
+    */
+    void send_copy(SendStream* stream, u16 flags, const std::string& tag_inside, u32 block, u32 size);
+
+    /*  Sends REFERENCE frame of the chunk the server has instead of the data at the file position,
+        the data is read to hash it and the file is moved over it
+        @param tag_inside - the frames going before the REFERENCE frame
+        @throw Exception
+    */
+    void send_reference(SendStream* stream, u16 flags, const std::string& tag_inside, const ChunkQueue::Chunk& chunk);
+
+    /*  Returns CHUNKS frame of the next chunks of dedup stream, it is empty if there are none to announce now
+        @throw Exception if the file can't be read
+    */
+    std::string chunk_frames(SendStream* stream);
+
+    /*  Returns HASH frames of the leaves hashed since the previous ones */
+    std::string leaf_frames(SendStream* stream);
+
+    /*  Returns the identity of resumable file, the file is rewound
+        @throw Exception
+    */
+    void identify(File* file, FileIdentity* identity);
+
+    /*  Reads WINDOW, OFFSET and RETRANSMIT frames without blocking
+        @throw Exception
+    */
+    void receive_windows();
+
 private:
     Mutex lock_;
     bool shutdown_;
 
-    File* sendingFile_;
+    SendStreams* streams_;  /* the files of connection, they are kept by Mainframe */
     TaskFactory* factory_;
     NotifyBase* notifyMgr_;
     RefCountedPtr<TCPSockClient> connection_;
     u32 packages_size_;
+    u32 sendfile_segment_; /* bytes sent by sendfile() at once, 0 - the file is sent by copying */
+    ZeroCopySender* sender_; /* the packages are sent by MSG_ZEROCOPY if it is not NULL */
+    HashWorkers* hashers_;   /* the threads hashing the leaves of sent files */
+    PackWorkers* packers_;   /* the threads packing the chunks of compressed files */
+    Compression compression_; /* the DATA frames of checksummed streams are packed unless it is none */
+    bool delta_;             /* the whole files are sent against the ones the server has */
+    bool dedup_;             /* the whole files refer to the chunks the server has unless they go by delta */
+    WireProtocol protocol_;  /* the files are wrapped in the binary frames or in the text tags */
 };
 
 #endif /*__user_tasks_h__ */
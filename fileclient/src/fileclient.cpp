@@ -14,6 +14,13 @@ void print_menu()
     printf("I - reconnecting time interval.\n");
     printf("S - sending time interval.\n");
     printf("P - packages size in bytes.\n");
+    printf("C - cache policy of sending files (keep or drop).\n");
+    printf("Z - sending mode (copy, sendfile or zerocopy).\n");
+    printf("W - wire protocol (binary frames or legacy text tags).\n");
+    printf("T - stripes of one file (connections it is sent over at once).\n");
+    printf("L - compression of the binary frames (none, fast or high).\n");
+    printf("D - delta transfer of the files the server has (on or off).\n");
+    printf("U - deduplication by the chunks the server has (on or off).\n");
     printf("M - call menu.\n");
     printf("Q - quit File Client.\n");
 }
@@ -5,6 +5,26 @@ using namespace std;
 
 /////////////////////////////////////////////////////////////////////
 namespace {
+    const char* send_mode_name( SendMode mode )
+    {
+        switch( mode )
+        {
+        case sendfile_SendMode: return "sendfile";
+        case zerocopy_SendMode: return "zerocopy";
+        default:                return "copy";
+        }
+    }
+
+    const char* compression_name( Compression compression )
+    {
+        switch( compression )
+        {
+        case fast_Compression: return "fast";
+        case high_Compression: return "high";
+        default:               return "none";
+        }
+    }
+
     // IP4 address form validation 
     string check_IP( const string& str_ip )
     {
@@ -32,10 +52,19 @@ namespace {
 
 Mainframe::Mainframe()
     : Thread("Mainframe"), 
-    shutdown_(false),
+    hashers_(DEF_HASH_THREADS),
+    packers_(DEF_PACK_THREADS),
     reconnect_interval_(DEF_RECONNECT_INTERVAL),
     send_interval_(DEF_SENDING_INTERVAL),
-    packages_size_(DEF_PACKAGE_SIZE)
+    packages_size_(DEF_PACKAGE_SIZE),
+    file_stripes_(DEF_FILE_STRIPES),
+    cache_policy_(keep_CachePolicy),
+    send_mode_(copy_SendMode),
+    compression_(none_Compression),
+    delta_(false),
+    dedup_(false),
+    wire_protocol_(frames_WireProtocol),
+    shutdown_(false)
 {
     IPAddress::init();
     start();
@@ -225,6 +254,146 @@ void Mainframe::run()
             } while(false);
             set_silence_logging(false); 
             break;
+        case 'C':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent cache policy of sending files is \""
+                     << (cache_policy_ == drop_CachePolicy ? "drop" : "keep") << "\".\n"
+                        "Switch it <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    cache_policy_ = (cache_policy_ == drop_CachePolicy) ? keep_CachePolicy : drop_CachePolicy;
+                    cout << "The sent pages are " << (cache_policy_ == drop_CachePolicy ? "dropped from" : "kept in")
+                         << " the system cache. OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'Z':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent sending mode is \"" << send_mode_name(send_mode_) << "\".\n"
+                        "Switch it to the next one <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    send_mode_ = (send_mode_ == copy_SendMode) ? sendfile_SendMode :
+                                 (send_mode_ == sendfile_SendMode) ? zerocopy_SendMode : copy_SendMode;
+                    if( send_mode_ == sendfile_SendMode && !TCPSockClient::isSendfileSupported() ) {
+                        cout << "sendfile() is not supported by the system.\n";
+                        send_mode_ = zerocopy_SendMode;
+                    }
+                    cout << "The files are sent in \"" << send_mode_name(send_mode_) << "\" mode. OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'T':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent number of stripes of one file is " << file_stripes_ << ".\n"
+                        "Set the new number of stripes <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    cout << "(No greater than " << DEF_MAX_STRIPES << ") New number of stripes is ";
+                    u32 n = 0; scanf("%d",&n);
+                    if( n > 0 && n <= DEF_MAX_STRIPES ) {
+                        file_stripes_ = n;
+                        cout << "The large files are sent over " << n << " connections at once"
+                             << (wire_protocol_ == legacy_WireProtocol ? " in the binary frames only" : "") << ". OK\n";
+                        ch = 0;
+                        break;
+                    }
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'L':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent compression is \"" << compression_name(compression_) << "\".\n"
+                        "Switch it to the next one <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    compression_ = (compression_ == none_Compression) ? fast_Compression :
+                                   (compression_ == fast_Compression) ? high_Compression : none_Compression;
+                    cout << "The compression is \"" << compression_name(compression_) << "\""
+                         << (compression_ != none_Compression ? ", the binary frames are packed in copy mode only" : "")
+                         << ". OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'D':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent delta transfer is \"" << (delta_ ? "on" : "off") << "\".\n"
+                        "Switch it <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    delta_ = !delta_;
+                    cout << "The delta transfer is \"" << (delta_ ? "on" : "off") << "\""
+                         << (delta_ ? ", the files replace the server's ones by their changed blocks in the binary frames only" : "")
+                         << ". OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'U':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent deduplication is \"" << (dedup_ ? "on" : "off") << "\".\n"
+                        "Switch it <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    dedup_ = !dedup_;
+                    cout << "The deduplication is \"" << (dedup_ ? "on" : "off") << "\""
+                         << (dedup_ ? ", the chunks the server has are referred instead of sent in the binary frames only" : "")
+                         << ". OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
+        case 'W':
+            do {
+                set_silence_logging(true);
+                cout << "\nCurrent wire protocol is \""
+                     << (wire_protocol_ == legacy_WireProtocol ? "legacy" : "frames") << "\".\n"
+                        "Switch it <enter>?\n";
+                fflush(stdin); ch = getch();
+                if( ch == SC_ENTER ) {
+                    wire_protocol_ = (wire_protocol_ == legacy_WireProtocol) ? frames_WireProtocol : legacy_WireProtocol;
+                    cout << "The files are sent " << (wire_protocol_ == legacy_WireProtocol ? "in the legacy text tags" : 
+                            "in the binary frames") << ". OK\n";
+                    ch = 0;
+                    break;
+                }
+                cout << "...request canceled\n";
+                ch = ch == 3 ? 'Q' : 0;
+            } while(false);
+            set_silence_logging(false); 
+            break;
         case 'F':
             do
             {
@@ -254,14 +423,28 @@ void Mainframe::run()
                     break;
                 }
 
-                if( fd2file_.end() == fd2file_.find(id) )
-                    fd2file_.insert(Fd2FileT::value_type(id,(File*)NULL));
+                std::auto_ptr<File> file(new File());
+                file->setCachePolicy(cache_policy_);
+                file->open(buf, "rb");
 
-                fd2file_[id].reset(new File(buf, "rb"));
+                // the large file is striped over several connections to the same server
+                u32 stripes = 1;
+                if( file_stripes_ > 1 && wire_protocol_ == frames_WireProtocol )
+                    stripes = (u32)min((i64)file_stripes_, (file->size() + FRAME_STRIPE_ALIGNMENT - 1) / FRAME_STRIPE_ALIGNMENT);
+                if( stripes > 1 ) {
+                    send_striped(It->second.get(), file, stripes);
+                    break;
+                }
+
+                // the file is sent along with the ones being sent over the connection
+                if( !send_file(id, It->second.get(), file.get(), NULL) ) {
+                    cout << "The connection sends " << DEF_MAX_STREAMS << " files already\n"
+                            "...request canceled\n";
+                    break;
+                }
+                file.release();
                 cout << "\"" << buf << "\" is opened for reading.\n"
                         "Sending will be stopped after the entire content be sent.\n";
-
-                create_task(send_TaskSpec, It->second.get());
             } while(false);
             set_silence_logging(false);
             break;
@@ -306,12 +489,30 @@ Task* Mainframe::create_task(TaskSpec type, TCPSockClient* conn)
         if( NULL == (spActiveConnection = conn))
             return NULL;
 
+        // the zero-copy sending is paced by packages if the sending interval is set
+        u32 segment = 0;
+        if( send_mode_ == sendfile_SendMode )
+            segment = (send_interval_ && packages_size_) ? packages_size_ : DEF_SENDFILE_SEGMENT;
+
         u32 fd = conn->get_fd();
+        ZeroCopySender* sender = NULL;
+        if( send_mode_ == zerocopy_SendMode && fd2sender_.end() != fd2sender_.find(fd) && 
+            fd2sender_[fd].get() && fd2sender_[fd]->socket() == conn )
+            sender = fd2sender_[fd].get();
+
         SendingTask* task = new SendingTask("sendtask-" + tostring(fd),
-                                            fd2file_[fd].get(), 
+                                            fd2streams_[fd].get(), 
                                             this, this, 
                                             spActiveConnection,
-                                            packages_size_);
+                                            packages_size_,
+                                            segment,
+                                            sender,
+                                            &hashers_,
+                                            &packers_,
+                                            compression_,
+                                            delta_,
+                                            dedup_,
+                                            wire_protocol_);
         try {
             timer_.schedule(task, send_interval_, 0);
         }
@@ -323,7 +524,7 @@ Task* Mainframe::create_task(TaskSpec type, TCPSockClient* conn)
     }
     else if( type == connect_TaskSpec )
     {
-        ConnectionTask* task = new ConnectionTask("connection-" + conn->get_fd(),
+        ConnectionTask* task = new ConnectionTask("connection-" + conn->getIPAddress().getHostAddress(),
                                                   conn->getIPAddress(), conn->get_port(),
                                                   this, this, conn);
         timer_.schedule(task, 50, reconnect_interval_); /* pause to delete previous copy of task */
@@ -339,6 +540,142 @@ void Mainframe::destroy_task( Task* task )
 
 void Mainframe::newlink_task(TaskSpec type, TCPSockClient* conn)
 {
-    if( type == connect_TaskSpec )
-        fd2sockets_.insert(Fd2SocketT::value_type(conn->get_fd(),conn));
+    if( type != connect_TaskSpec )
+        return;
+
+    // the descriptor of closed socket may be reused by the link to another server
+    u32 fd = conn->get_fd();
+    Fd2SocketT::iterator Same = fd2sockets_.find(fd);
+    if( Same != fd2sockets_.end() && Same->second.get() != conn && 
+        !same_server(Same->second.get(), conn) )
+    {
+        fd2streams_.erase(fd);
+        fd2sender_.erase(fd);
+    }
+    fd2sockets_[fd].reset(conn);
+
+    // the lost link to the same server is replaced, its interrupted files go on over the new one
+    Fd2SocketT::iterator It = fd2sockets_.begin();
+    while( It != fd2sockets_.end() )
+    {
+        TCPSockClient* link = It->second.get();
+        bool replaced = (link == conn) ? It->first != fd : !link->is_open() && same_server(link, conn);
+        if( !replaced ) {
+            ++It;
+            continue;
+        }
+
+        if( fd2streams_.end() != fd2streams_.find(It->first) && fd2streams_.end() == fd2streams_.find(fd) )
+            fd2streams_[fd].reset( fd2streams_[It->first].release() );
+        fd2streams_.erase(It->first);
+        fd2sender_.erase(It->first);
+        fd2sockets_.erase(It++);
+    }
+
+    if( fd2streams_.end() != fd2streams_.find(fd) && fd2streams_[fd]->resume() )
+    {
+        // the previous sender belongs to the lost link
+        fd2sender_.erase(fd);
+        if( send_mode_ == zerocopy_SendMode )
+            reset_sender(fd, conn);
+        notify("Resuming the interrupted files over connection #" + tostring(fd));
+        create_task(send_TaskSpec, conn);
+    }
+}
+
+bool Mainframe::send_file(u32 fd, TCPSockClient* conn, File* file, const FileStripe* stripe)
+{
+    if( fd2streams_.end() == fd2streams_.find(fd) )
+        fd2streams_.insert(Fd2StreamsT::value_type(fd,new SendStreams()));
+
+    bool idle = false;
+    if( !fd2streams_[fd]->add(file, &idle, stripe) )
+        return false;
+
+    if( fd2sender_.end() == fd2sender_.find(fd) )
+        fd2sender_.insert(Fd2SenderT::value_type(fd,(ZeroCopySender*)NULL));
+    // the sender is replaced only when no task uses it
+    if( send_mode_ == zerocopy_SendMode && (idle || NULL == fd2sender_[fd].get()) &&
+        !reset_sender(fd, conn) )
+        cout << "MSG_ZEROCOPY is not supported by the system, the packages are copied.\n";
+
+    if( idle )
+        create_task(send_TaskSpec, conn);
+    return true;
+}
+
+void Mainframe::send_striped(TCPSockClient* conn, std::auto_ptr<File>& file, u32 stripes)
+{
+    // the open connections to the same server are used first
+    std::vector<TCPSockClient*> links(1, conn);
+    for(Fd2SocketT::iterator It = fd2sockets_.begin(); It != fd2sockets_.end() && links.size() < stripes; ++It)
+    {
+        TCPSockClient* link = It->second.get();
+        if( link != conn && link->is_open() && same_server(link, conn) )
+            links.push_back(link);
+    }
+    while( links.size() < stripes )
+    {
+        TCPSockClient* link = NULL;
+        try {
+            link = new TCPSockClient(conn->getIPAddress(), conn->get_port());
+        }
+        catch(const Exception& ex) {
+            cout << "Can't connect one more stripe (" << ex.what() << "), the file is sent by "
+                 << links.size() << " stripes\n";
+            break;
+        }
+        newlink_task(connect_TaskSpec, link);
+        links.push_back(link);
+        link->release();
+    }
+
+    // the stripes start at the aligned offsets, so the direct writings of the server don't overlap
+    i64 size = file->size();
+    u64 length = (u64)(size / links.size());
+    length = (length + FRAME_STRIPE_ALIGNMENT - 1) & ~(u64)(FRAME_STRIPE_ALIGNMENT - 1);
+
+    FileStripe stripe;
+    stripe.transfer_ = (current_time() << 16) ^ (u64)conn->get_fd();
+    stripe.count_ = (u32)((size + length - 1) / length);
+    string path = file->path();
+    for(u32 i = 0; i < stripe.count_; ++i)
+    {
+        stripe.offset_ = i * length;
+        stripe.length_ = min(length, (u64)size - stripe.offset_);
+
+        // each stripe reads the file by its own handle
+        std::auto_ptr<File> part(file.release());
+        if( NULL == part.get() ) {
+            part.reset(new File());
+            part->setCachePolicy(cache_policy_);
+            part->open(path, "rb");
+        }
+        u32 id = (u32)links[i]->get_fd();
+        if( !send_file(id, links[i], part.get(), &stripe) ) {
+            cout << "The connection " << id << " sends " << DEF_MAX_STREAMS << " files already,"
+                    " the stripes of \"" << path << "\" are not sent entirely\n";
+            return;
+        }
+        part.release();
+    }
+    cout << "\"" << path << "\" is sent by " << stripe.count_ << " stripes over the connections";
+    for(u32 i = 0; i < stripe.count_; ++i)
+        cout << " " << links[i]->get_fd();
+    cout << ".\n";
+}
+
+bool Mainframe::same_server(TCPSockClient* link, TCPSockClient* conn)
+{
+    // the target name is cleared when the socket is closed, its address and port are kept
+    return link->getIPAddress().get_address().s_addr == conn->getIPAddress().get_address().s_addr &&
+           link->get_port() == conn->get_port();
+}
+
+bool Mainframe::reset_sender(u32 fd, TCPSockClient* conn)
+{
+    // the buffer has room for the start tag or frames before the package
+    u32 size = (packages_size_ + 2*1024 + 4095) & ~4095;
+    fd2sender_[fd].reset(new ZeroCopySender(conn, size, DEF_ZEROCOPY_BUFFERS));
+    return fd2sender_[fd]->isZeroCopy();
 }
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include <algorithm>
+
+#include "send_streams.h"
+#include "frame.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////
+SendStreams::SendStreams()
+    : nextId_(FRAME_FILE_STREAM),
+    sending_(false)
+{}
+
+SendStreams::~SendStreams()
+{
+    clear();
+}
+
+bool SendStreams::add(File* file, bool* idle, const FileStripe* stripe)
+{
+    MGuard g(lock_);
+    if( streams_.size() >= DEF_MAX_STREAMS )
+        return false;
+
+    SendStream* stream = new SendStream();
+    // the late WINDOW frames of sent file must not reach the new one, so the ids are not reused
+    stream->id_ = nextId_++;
+    stream->file_ = file;
+    stream->end_ = file->size();
+    stream->striped_ = (NULL != stripe);
+    if( stripe ) {
+        stream->stripe_ = *stripe;
+        stream->end_ = (i64)(stripe->offset_ + stripe->length_);
+    }
+    stream->started_ = false;
+    stream->window_ = DEF_STREAM_WINDOW;
+    stream->frameLeft_ = 0;
+    stream->waitOffset_ = false;
+    stream->checksummed_ = false;
+    stream->crc_ = 0;
+    stream->retransmit_ = -1;
+    stream->resent_ = false;
+    stream->ended_ = false;
+    stream->confirmed_ = false;
+    stream->hash_ = NULL;
+    stream->hashFrom_ = stripe ? (i64)stripe->offset_ : 0;
+    stream->leavesSent_ = 0;
+    stream->leaf_ = false;
+    stream->compressed_ = false;
+    stream->pack_ = NULL;
+    stream->rawFrames_ = 0;
+    stream->rawSkip_ = 1;
+    stream->probeFrom_ = 0;
+    stream->rawBytes_ = 0;
+    stream->packedBytes_ = 0;
+    stream->delta_ = NULL;
+    stream->waitSignatures_ = false;
+    stream->copiedBytes_ = 0;
+    stream->chunks_ = NULL;
+    stream->referencedBytes_ = 0;
+    streams_.push_back(stream);
+
+    *idle = !sending_;
+    sending_ = true;
+    return true;
+}
+
+SendStream* SendStreams::next(bool windowed)
+{
+    MGuard g(lock_);
+    StreamsT::iterator It = streams_.begin();
+    for(; It != streams_.end(); ++It)
+    {
+        if( (*It)->frameLeft_ > 0 )
+            return *It;
+    }
+
+    for(It = streams_.begin(); It != streams_.end(); ++It)
+    {
+        SendStream* stream = *It;
+        if( stream->waitOffset_ || stream->waitSignatures_ || stream->ended_ ||
+            (stream->chunks_ && stream->chunks_->waiting(stream->file_->tell())) )
+            continue;
+
+        // the start and the end of file take no window
+        bool sent = stream->started_ && stream->file_->tell() >= stream->end_;
+        // the chunk of compressed stream is read ahead and the copied blocks of delta stream are
+        // looked for ahead, so they are sent whole
+        u64 need = 1;
+        if( (stream->compressed_ || stream->delta_) && !sent )
+            need = min((u64)DEF_STREAM_QUANTUM, (u64)(stream->end_ - stream->file_->tell()));
+        // the chunk the server has is referred whole
+        if( stream->chunks_ && !sent )
+            need = min((u64)CDC_MAX_CHUNK, (u64)(stream->end_ - stream->file_->tell()));
+        if( windowed && stream->started_ && !sent && stream->window_ < need )
+            continue;
+
+        // the chosen stream waits for the others next time
+        streams_.erase(It);
+        streams_.push_back(stream);
+        return stream;
+    }
+    return NULL;
+}
+
+SendStream* SendStreams::front()
+{
+    MGuard g(lock_);
+    return streams_.empty() ? NULL : streams_.front();
+}
+
+void SendStreams::remove(SendStream* stream)
+{
+    MGuard g(lock_);
+    streams_.remove(stream);
+    delete stream->chunks_;
+    delete stream->delta_;
+    delete stream->pack_;
+    delete stream->hash_;
+    delete stream->file_;
+    delete stream;
+}
+
+bool SendStreams::finish()
+{
+    MGuard g(lock_);
+    if( !streams_.empty() )
+        return false;
+    sending_ = false;
+    return true;
+}
+
+void SendStreams::clear()
+{
+    MGuard g(lock_);
+    for(StreamsT::iterator It = streams_.begin(); It != streams_.end(); ++It)
+    {
+        delete (*It)->chunks_;
+        delete (*It)->delta_;
+        delete (*It)->pack_;
+        delete (*It)->hash_;
+        delete (*It)->file_;
+        delete *It;
+    }
+    streams_.clear();
+    input_.clear();
+    filter_.clear();
+    sending_ = false;
+}
+
+void SendStreams::interrupt()
+{
+    MGuard g(lock_);
+    for(StreamsT::iterator It = streams_.begin(); It != streams_.end(); ++It)
+    {
+        SendStream* stream = *It;
+        stream->started_ = false;
+        stream->window_ = DEF_STREAM_WINDOW;
+        stream->frameLeft_ = 0;
+        stream->waitOffset_ = false;
+        stream->crc_ = 0;
+        stream->retransmit_ = -1;
+        stream->resent_ = false;
+        stream->ended_ = false;
+        stream->confirmed_ = false;
+        // the payload is hashed again from the offset the server has
+        delete stream->hash_;
+        stream->hash_ = NULL;
+        stream->leavesSent_ = 0;
+        stream->leaf_ = false;
+        delete stream->pack_;
+        stream->pack_ = NULL;
+        stream->rawFrames_ = 0;
+        stream->rawSkip_ = 1;
+        stream->probeFrom_ = 0;
+        // the server signs its file again
+        delete stream->delta_;
+        stream->delta_ = NULL;
+        stream->waitSignatures_ = false;
+        // the server answers the chunks announced again
+        delete stream->chunks_;
+        stream->chunks_ = NULL;
+    }
+    input_.clear();
+    // the filter is sent again on the next connection
+    filter_.clear();
+    sending_ = false;
+}
+
+bool SendStreams::resume()
+{
+    MGuard g(lock_);
+    if( sending_ || streams_.empty() )
+        return false;
+    sending_ = true;
+    return true;
+}
+
+void SendStreams::received(const u8* data, u32 size)
+{
+    MGuard g(lock_);
+    input_.add(data, size);
+
+    u32 consumed = 0;
+    const u8* buffer = input_.get();
+    while( input_.size() - consumed >= FRAME_HEADER_SIZE )
+    {
+        FrameHeader header;
+        if( !decode_frame_header(buffer + consumed, &header) ||
+            (window_FrameType != header.type_ && offset_FrameType != header.type_ &&
+             retransmit_FrameType != header.type_ && signature_FrameType != header.type_ &&
+             have_FrameType != header.type_ && filter_FrameType != header.type_ && added_FrameType != header.type_) )
+            throw Exception("Garbled frame received from the server");
+
+        // the signatures are taken when the whole frame is received
+        u32 payload = 0;
+        if( signature_FrameType == header.type_ )
+        {
+            if( header.length_ < FRAME_SIGNATURE_HEAD ||
+                header.length_ > FRAME_SIGNATURE_HEAD + FRAME_SIGNATURE_BLOCKS * DELTA_SIGNATURE_SIZE ||
+                0 != (header.length_ - FRAME_SIGNATURE_HEAD) % DELTA_SIGNATURE_SIZE )
+                throw Exception("Garbled frame received from the server");
+            if( input_.size() - consumed - FRAME_HEADER_SIZE < header.length_ )
+                break;
+            payload = (u32)header.length_;
+        }
+        else if( have_FrameType == header.type_ )
+        {
+            if( header.length_ <= FRAME_CHUNKS_HEAD || header.length_ > FRAME_CHUNKS_HEAD + (FRAME_CHUNKS_COUNT + 7) / 8 )
+                throw Exception("Garbled frame received from the server");
+            if( input_.size() - consumed - FRAME_HEADER_SIZE < header.length_ )
+                break;
+            payload = (u32)header.length_;
+        }
+        else if( filter_FrameType == header.type_ || added_FrameType == header.type_ )
+        {
+            if( FRAME_CONNECTION_STREAM != header.stream_ ||
+                (filter_FrameType == header.type_ &&
+                 (header.length_ < FRAME_FILTER_HEAD || header.length_ > FRAME_FILTER_HEAD + DEF_STREAM_QUANTUM)) ||
+                (added_FrameType == header.type_ &&
+                 (0 == header.length_ || header.length_ > FRAME_ADDED_KEYS * 8 || 0 != header.length_ % 8)) )
+                throw Exception("Garbled frame received from the server");
+            if( input_.size() - consumed - FRAME_HEADER_SIZE < header.length_ )
+                break;
+            payload = (u32)header.length_;
+        }
+        const u8* body = buffer + consumed + FRAME_HEADER_SIZE;
+        consumed += FRAME_HEADER_SIZE + payload;
+
+        if( filter_FrameType == header.type_ )
+        {
+            // the first bytes of filter make it anew
+            u32 bits = body[0];
+            u32 hashes = body[1];
+            u64 offset = frame::get64(body + 2);
+            if( 0 == offset && bits >= CDC_FILTER_MIN_BITS && bits <= CDC_FILTER_MAX_BITS &&
+                hashes > 0 && hashes <= CDC_FILTER_MAX_HASHES )
+                filter_.reset(bits, hashes);
+            if( bits != filter_.bits() || hashes != filter_.hashes() ||
+                !filter_.load(offset, body + FRAME_FILTER_HEAD, payload - FRAME_FILTER_HEAD) )
+                throw Exception("Invalid chunk filter received from the server");
+            continue;
+        }
+        if( added_FrameType == header.type_ )
+        {
+            if( !filter_.complete() )
+                throw Exception("Invalid chunk filter received from the server");
+            for(u32 pos = 0; pos < payload; pos += 8)
+                filter_.add(frame::get64(body + pos));
+            continue;
+        }
+
+        // the late WINDOW frames of sent files are dropped
+        for(StreamsT::iterator It = streams_.begin(); It != streams_.end(); ++It)
+        {
+            SendStream* stream = *It;
+            if( stream->id_ != header.stream_ )
+                continue;
+
+            // the offsets of stripe are counted from its start
+            i64 begin = stream->striped_ ? (i64)stream->stripe_.offset_ : 0;
+            if( window_FrameType == header.type_ )
+                stream->window_ += header.length_;
+            else if( signature_FrameType == header.type_ )
+            {
+                if( !stream->waitSignatures_ )
+                    throw Exception("Unexpected signatures of \"" + stream->file_->path() + "\" received from the server");
+                signed_blocks(stream, body, payload);
+            }
+            else if( have_FrameType == header.type_ )
+            {
+                if( NULL == stream->chunks_ ||
+                    !stream->chunks_->answered((i64)frame::get64(body), body + FRAME_CHUNKS_HEAD, payload - FRAME_CHUNKS_HEAD) )
+                    throw Exception("Unexpected chunks of \"" + stream->file_->path() + "\" received from the server");
+            }
+            else if( retransmit_FrameType == header.type_ )
+            {
+                if( !stream->checksummed_ || header.length_ > (u64)(stream->end_ - begin) )
+                    throw Exception("Invalid retransmit of \"" + stream->file_->path() + "\" received from the server");
+                stream->retransmit_ = begin + (i64)header.length_;
+                // the leaves before the corrupted one are hashed already
+                stream->leaf_ = (0 != (header.flags_ & leaf_FrameFlag));
+                if( stream->leaf_ && (NULL == stream->hash_ || stream->retransmit_ < stream->hashFrom_ ||
+                                      0 != (stream->retransmit_ - stream->hashFrom_) % TREE_HASH_LEAF) )
+                    throw Exception("Invalid leaf of \"" + stream->file_->path() + "\" received from the server");
+                if( 0 == stream->frameLeft_ )
+                    go_back(stream);
+            }
+            else if( stream->waitOffset_ )
+            {
+                if( header.length_ > (u64)stream->file_->size() )
+                    throw Exception("Invalid offset of \"" + stream->file_->path() + "\" received from the server");
+                stream->file_->seek( (i64)header.length_, SEEK_SET );
+                stream->hashFrom_ = (i64)header.length_;
+                stream->waitOffset_ = false;
+            }
+            else if( stream->ended_ )
+            {
+                if( header.length_ != (u64)(stream->end_ - begin) )
+                    throw Exception("Invalid end of \"" + stream->file_->path() + "\" received from the server");
+                stream->ended_ = false;
+                stream->confirmed_ = true;
+            }
+            break;
+        }
+    }
+
+    if( consumed == input_.size() )
+        input_.clear();
+    else if( 0 < consumed )
+        input_.erase(consumed);
+}
+
+void SendStreams::signed_blocks(SendStream* stream, const u8* data, u32 size)
+{
+    u32 blockSize = frame::get32(data);
+    i64 fileSize = (i64)frame::get64(data + 4);
+    BlockSignatures& signatures = stream->delta_->signatures();
+
+    // the first frame gives the blocks of file, the others go on with them
+    if( 0 == signatures.count() )
+    {
+        if( blockSize < DELTA_MIN_BLOCK || blockSize > DELTA_MAX_BLOCK || 0 != (blockSize & (blockSize - 1)) ||
+            fileSize < 0 || (u64)fileSize / blockSize >= 0xffffffff )
+            throw Exception("Invalid signatures of \"" + stream->file_->path() + "\" received from the server");
+        signatures.reset(blockSize, fileSize);
+    }
+    if( blockSize != signatures.block_size() || fileSize != signatures.size() ||
+        !signatures.add(data + FRAME_SIGNATURE_HEAD, (size - FRAME_SIGNATURE_HEAD) / DELTA_SIGNATURE_SIZE) )
+        throw Exception("Invalid signatures of \"" + stream->file_->path() + "\" received from the server");
+
+    if( signatures.count() == signatures.blocks() )
+    {
+        stream->delta_->index();
+        stream->waitSignatures_ = false;
+    }
+}
+
+void SendStreams::rewind(SendStream* stream)
+{
+    MGuard g(lock_);
+    go_back(stream);
+}
+
+void SendStreams::go_back(SendStream* stream)
+{
+    // the server drops all the payload sent after the offset, so its window is given back
+    i64 sent = stream->file_->tell();
+    if( sent > stream->retransmit_ )
+        stream->window_ += (u64)(sent - stream->retransmit_);
+    stream->file_->seek( stream->retransmit_, SEEK_SET );
+    if( stream->pack_ ) {
+        stream->pack_->clear();
+        stream->probeFrom_ = 0;
+    }
+    if( stream->leaf_ )
+    {
+        // the copied blocks may be what mismatches, e.g. the server's file is changed, so the rest goes by literals
+        if( stream->delta_ )
+            stream->delta_->clear();
+        if( stream->chunks_ )
+            stream->chunks_->clear();
+        stream->hash_->rewind( (u64)(stream->retransmit_ - stream->hashFrom_) );
+        stream->leavesSent_ = min(stream->leavesSent_, stream->hash_->ready());
+        stream->leaf_ = false;
+    }
+    stream->retransmit_ = -1;
+    stream->resent_ = true;
+    stream->ended_ = false;
+    stream->crc_ = 0;
+}
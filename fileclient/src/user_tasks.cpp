@@ -1,5 +1,7 @@
 #include "user_tasks.h"
 #include "notify_base.h"
+#include "frame.h"
+#include "crc32c.h"
 
 using namespace std;
 
@@ -37,10 +39,12 @@ void ConnectionTask::run()
             connection_->connect(addr_, port_);
         }
         catch(const Exception& ex) {
+            // the task is repeated by the reconnecting interval with the new socket
             notifyMgr_->warning(get_name() + " - WARNING: " + ex.what());
             notifyMgr_->debug(get_name() + " - WARNING: " + ex.what());
+            connection_->close();
+            return;
         }
-        factory_->destroy_task(this);
     }
     else if( s == NULL ) // first connect
     { 
@@ -78,17 +82,33 @@ void ConnectionTask::run()
 
 /**************************************************************/
 SendingTask::SendingTask( const std::string& name,
-                          File* sendingFile,
+                          SendStreams* streams,
                           TaskFactory* factory,
                           NotifyBase* notifyMgr,
                           TCPSockClient* connection,
-                          u32 packages_size)
+                          u32 packages_size,
+                          u32 sendfile_segment,
+                          ZeroCopySender* sender,
+                          HashWorkers* hashers,
+                          PackWorkers* packers,
+                          Compression compression,
+                          bool delta,
+                          bool dedup,
+                          WireProtocol protocol)
     : Task(name),
-    sendingFile_(sendingFile),
+    shutdown_(false),
+    streams_(streams),
     factory_(factory),
     notifyMgr_(notifyMgr),
-    shutdown_(false),
-    packages_size_(packages_size)
+    packages_size_(packages_size),
+    sendfile_segment_(sendfile_segment),
+    sender_(sender),
+    hashers_(hashers),
+    packers_(packers),
+    compression_(compression),
+    delta_(delta),
+    dedup_(dedup),
+    protocol_(protocol)
 {
     connection_.reset( connection );
 }
@@ -107,79 +127,566 @@ void SendingTask::run()
     if( connection_.get() && !connection_->is_open() ) {
         notifyMgr_->debug( get_name() + " - WARNING: session was closed. Kill me, please!" );
         notifyMgr_->warning( get_name() + " - WARNING: session was closed. Kill me, please!" );
+        // the files are given up, so the next one starts the sending tasks chain again
+        streams_->clear();
         factory_->destroy_task( this );
         return;
     }
 
-    u8* buf  = NULL;
-    i32 read = 0;
+    string exc;
+    try {
+        // the legacy protocol has no streams, so its files are sent one by one
+        SendStream* stream = NULL;
+        if( frames_WireProtocol == protocol_ ) {
+            receive_windows();
+            stream = streams_->next(true);
+        }
+        else
+            stream = streams_->front();
+
+        if( stream )
+            send_package(stream);
+        else if( streams_->finish() )
+            return; // stop the sending tasks chain
+        else {
+            // all the streams have sent their windows, the server grants more as it writes the files
+            struct timeval timeout = { 0, DEF_WINDOW_WAIT * 1000 };
+            connection_->untilReadyToRead(&timeout);
+        }
+    }
+    catch(const Exception& ex) {
+        exc = get_name() + " - ERROR: " + ex.what();
+    }
+    g.release();
+
+    if( exc.empty() ) {
+        // activate the next sending tasks
+        Task* task = factory_->create_task(send_TaskSpec, connection_.get());
+        if( task == NULL )
+            connection_.abandon();
+    }
+    else if( frames_WireProtocol == protocol_ ) {
+        notifyMgr_->debug( exc );
+        notifyMgr_->error( exc );
+        // the files go on from the offsets the server has when the connection is restored
+        streams_->interrupt();
+        connection_->close();
+        factory_->create_task(connect_TaskSpec, connection_.get());
+    }
+    else {
+        notifyMgr_->debug( exc );
+        notifyMgr_->error( exc );
+        // the server can't tell the rest of files from the garbage now
+        streams_->clear();
+    }
+}
+
+void SendingTask::send_package(SendStream* stream)
+{
+    File* file = stream->file_;
+    bool frames = (frames_WireProtocol == protocol_);
     string tag_inside;
 
-    static bool filePartSent = false;
+    // sending first tag
+    if( !stream->started_ )
+    {
+        stream->started_ = true;
+        stream->checksummed_ = frames;
+        if( frames ) {
+            // the stream is hashed anew when it starts again
+            delete stream->hash_;
+            stream->hash_ = new TreeHash(hashers_);
+            stream->leavesSent_ = 0;
+        }
+        // the literals of delta and dedup streams are not packed, the zero-copy modes send the pages of file as they are
+        bool delta = frames && delta_ && !stream->striped_;
+        bool dedup = frames && dedup_ && !stream->striped_ && !delta;
+        stream->compressed_ = frames && none_Compression != compression_ && 0 == sendfile_segment_ && NULL == sender_ &&
+                              !delta && !dedup;
+        string newfile = file->path();
+        u16 flags = windowed_FrameFlag | checksummed_FrameFlag | hashed_FrameFlag;
+        delete stream->delta_;
+        stream->delta_ = NULL;
+        if( delta ) {
+            flags |= delta_FrameFlag;
+            stream->delta_ = new DeltaMatcher(DEF_STREAM_QUANTUM);
+        }
+        delete stream->chunks_;
+        stream->chunks_ = NULL;
+        if( dedup ) {
+            flags |= dedup_FrameFlag;
+            stream->chunks_ = new ChunkQueue();
+        }
+        if( stream->compressed_ ) {
+            // the chunks read ahead are dropped when the stream starts again
+            flags |= compressed_FrameFlag;
+            delete stream->pack_;
+            stream->pack_ = new PackPipeline(packers_, high_Compression == compression_);
+        }
+        if( frames && stream->striped_ ) {
+            // the stripe is sent again from its start after the connection is lost
+            file->seekRegion( (i64)stream->stripe_.offset_ );
+            tag_inside = start_frame(stream->id_, newfile, (u64)file->size(), flags, NULL, &stream->stripe_);
+        }
+        else if( stream->delta_ ) {
+            // the server answers with the signatures of its file, so the content waits for them
+            file->seek(0, SEEK_SET);
+            tag_inside = start_frame(stream->id_, newfile, (u64)file->size(), flags);
+            stream->waitSignatures_ = true;
+            connection_->send(tag_inside.c_str(), tag_inside.length());
+            return;
+        }
+        else if( stream->chunks_ ) {
+            // the server answers which of the first chunks it has, so the content waits for it
+            file->seek(0, SEEK_SET);
+            tag_inside = start_frame(stream->id_, newfile, (u64)file->size(), flags);
+            tag_inside += chunk_frames(stream);
+            connection_->send(tag_inside.c_str(), tag_inside.length());
+            return;
+        }
+        else if( frames && file->size() > FRAME_IDENTITY_PREFIX ) {
+            // the server answers with the offset it has, so the content waits for it
+            FileIdentity identity;
+            identify(file, &identity);
+            tag_inside = start_frame(stream->id_, newfile, (u64)file->size(), flags, &identity);
+            stream->waitOffset_ = true;
+            connection_->send(tag_inside.c_str(), tag_inside.length());
+            return;
+        }
+        else if( frames ) {
+            // the small file is sent again entirely, so it doesn't wait for the offset
+            tag_inside = start_frame(stream->id_, newfile, (u64)file->size(), flags);
+        }
+        else {
+            tag_inside = TAG_START_CONTENT;
+            tag_inside += newfile + "/>";
+            tag_inside += TAG_CONTENT_SIZE;
+            tag_inside += tostring(file->size()) + "/>";
+        }
+    }
+
     // sending last tag
-    if( sendingFile_->eof() && filePartSent ) 
+    i64 rest = stream->end_ - file->tell();
+    if( rest <= 0 && !stream->confirmed_ )
     {
-        filePartSent = false;
-        tag_inside = TAG_FINISH_CONTENT;
-        connection_->send(tag_inside.c_str(), tag_inside.length()+1);
+        file->dropCache(file->tell(), true);
+        if( stream->hash_ ) {
+            // the server compares all the leaves when the file ends
+            u8 root[TREE_HASH_SIZE];
+            stream->hash_->finish(root);
+            tag_inside += leaf_frames(stream);
+        }
+        if( frames )
+            tag_inside += frame_header(end_FrameType, stream->id_, 0);
+        else
+            tag_inside.append(TAG_FINISH_CONTENT, strlen(TAG_FINISH_CONTENT) + 1);
+        connection_->send(tag_inside.c_str(), tag_inside.length());
 
-        string msg = get_name() + " - INFO: \"" + sendingFile_->path() + 
+        // the server confirms the checksummed file or asks for its corrupted payload again
+        if( stream->checksummed_ ) {
+            stream->ended_ = true;
+            return;
+        }
+    }
+    if( rest <= 0 )
+    {
+        string msg = get_name() + " - INFO: \"" + file->path() + 
             "\" is sucesfully sent to host " + connection_->getTarget();
+        if( stream->striped_ )
+            msg = get_name() + " - INFO: stripe " + tostring(stream->stripe_.offset_) + "+" + tostring(stream->stripe_.length_) +
+                " of \"" + file->path() + "\" is sucesfully sent to host " + connection_->getTarget();
+        if( stream->compressed_ )
+            msg += " (compressed " + tostring(stream->rawBytes_) + " to " + tostring(stream->packedBytes_) + " bytes)";
+        if( stream->delta_ )
+            msg += " (delta, copied " + tostring(stream->copiedBytes_) + " of " + tostring((u64)stream->end_) + " bytes)";
+        if( stream->chunks_ )
+            msg += " (dedup, referenced " + tostring(stream->referencedBytes_) + " of " + tostring((u64)stream->end_) + " bytes)";
+        if( stream->hash_ ) {
+            u8 root[TREE_HASH_SIZE];
+            stream->hash_->finish(root);
+            i64 begin = stream->striped_ ? (i64)stream->stripe_.offset_ : 0;
+            msg += " (BLAKE3 " + (stream->hashFrom_ > begin ? "from " + tostring((u64)stream->hashFrom_) + " " : string()) +
+                TreeHash::hex(root) + ")";
+        }
         notifyMgr_->notify(msg);
-        // stop the sending tasks chain
+        streams_->remove(stream);
         return;
     }
 
-    // sending first tag
-    if( !filePartSent && (filePartSent = true))
+    // the DATA frame is sent by several packages, the other streams go on after its end
+    u64 portion = (u64)rest;
+    bool packing = false;
+    u16 flags = 0;
+    if( frames )
     {
-        string newfile = sendingFile_->path();
-
-        tag_inside = TAG_START_CONTENT;
-        tag_inside += newfile + "/>";
-        tag_inside += TAG_CONTENT_SIZE;
-        tag_inside += tostring(sendingFile_->size()) + "/>";
+        if( 0 == stream->frameLeft_ )
+        {
+            u64 length = min(portion, min((u64)DEF_STREAM_QUANTUM, stream->window_));
+            flags = stream->resent_ ? resent_FrameFlag : 0;
+            // the delta stream sends the literals up to the next blocks the server has, the blocks go by COPY frame
+            if( stream->delta_ )
+            {
+                u32 block = 0;
+                u32 size = 0;
+                u32 literals = stream->delta_->next(file, file->tell(), stream->end_, &block, &size);
+                if( 0 == literals ) {
+                    send_copy(stream, flags, tag_inside, block, size);
+                    return;
+                }
+                length = min(length, (u64)literals);
+            }
+            // the dedup stream announces its chunks ahead and sends the literals up to the next chunk
+            // the server has, the chunk goes by REFERENCE frame
+            if( stream->chunks_ )
+            {
+                tag_inside += chunk_frames(stream);
+                u64 literals = 0;
+                const ChunkQueue::Chunk* chunk = NULL;
+                if( !stream->chunks_->next(file->tell(), &literals, &chunk) ) {
+                    // the data waits for the answer to the chunks
+                    if( !tag_inside.empty() )
+                        connection_->send(tag_inside.c_str(), tag_inside.length());
+                    return;
+                }
+                if( chunk ) {
+                    send_reference(stream, flags, tag_inside, *chunk);
+                    return;
+                }
+                length = min(length, literals);
+            }
+            // the chunk of compressed stream is sent at once, its length is known when it is packed
+            packing = stream->compressed_;
+            if( !packing )
+                tag_inside += frame_header(data_FrameType, stream->id_, length, flags);
+            stream->frameLeft_ = length;
+            stream->window_ -= length;
+            stream->resent_ = false;
+        }
+        portion = stream->frameLeft_;
     }
 
-    // sending on any case
-    buf = new u8[packages_size_+tag_inside.length()+1];
-    if( !tag_inside.empty() )
-        memcpy(buf, tag_inside.c_str(), tag_inside.length() );
-    try {
-        read = fread(buf+tag_inside.length(), 1, packages_size_, sendingFile_->handle());
+    i64 sent = 0;
+    if( packing )
+        sent = send_packed(stream, flags, tag_inside);
+    else if( sendfile_segment_ )
+    {
+        // the start tag goes out in one segment with the file data that follows it
+        if( !tag_inside.empty() )
+            connection_->send(tag_inside.c_str(), tag_inside.length(), true);
+        i64 offset = file->tell();
+        sent = send_segment(file, min(portion, (u64)sendfile_segment_));
+        if( stream->checksummed_ && sent > 0 )
+            stream->crc_ = checksum(stream, offset, sent, stream->crc_);
     }
-    catch(...){}
-    g.release();
-
-    string exc;
-    if( read > 0 )
+    else
     {
+        u32 package = (u32)min(portion, (u64)packages_size_);
+        u8* buf = NULL;
+        if( sender_ ) {
+            // the pooled buffer is reused when the kernel releases it
+            buf = sender_->get_buffer();
+            if( package > sender_->buffer_size() - tag_inside.length() )
+                package = sender_->buffer_size() - tag_inside.length();
+        }
+        else
+            buf = new u8[package+tag_inside.length()+1];
+        if( !tag_inside.empty() )
+            memcpy(buf, tag_inside.c_str(), tag_inside.length() );
+
+        i32 write = 0;
         try {
-            i32 write = read + tag_inside.length();
-            read = connection_->send(buf, write);
-            if( read > 0 ){
-                notifyMgr_->debug( get_name() + " - NOTE: sent " + tostring(read) + " bytes.");
-                notifyMgr_->notify( get_name() + " - NOTE: sent " + tostring(read) + " bytes.");
+            i64 offset = file->tell();
+            i32 read = fread(buf+tag_inside.length(), 1, package, file->handle());
+            if( read <= 0 )
+                throw Exception("Can't read \"" + file->path() + "\"");
+            if( stream->checksummed_ )
+                stream->crc_ = crc32c(buf+tag_inside.length(), (u32)read, stream->crc_);
+            if( stream->hash_ )
+                hash_payload(stream, offset, buf+tag_inside.length(), (u32)read);
+
+            write = read + tag_inside.length();
+            if( sender_ ) {
+                u8* sending = buf;
+                buf = NULL;
+                sender_->send(sending, write);
             }
-            else if( write > 0 )
-                sendingFile_->seek( -write, SEEK_CUR );
+            else if( connection_->send(buf, write) <= 0 )
+                throw Exception("Can't send to host " + connection_->getTarget());
+            sent = read;
         }
-        catch(const Exception& ex) {
-            exc = get_name() + " - ERROR: " + ex.what();
+        catch(...) {
+            if( buf && sender_ )
+                sender_->put_buffer(buf);
+            else if( buf )
+                delete[] buf;
+            throw;
         }
+        if( buf )
+            delete[] buf;
+
+        // the sent pages are not needed anymore
+        file->dropCache(file->tell());
+        notifyMgr_->debug( get_name() + " - NOTE: sent " + tostring(write) + " bytes.");
+        notifyMgr_->notify( get_name() + " - NOTE: sent " + tostring(write) + " bytes.");
     }
 
-    if( buf )
-        delete[] buf;
+    if( frames )
+        stream->frameLeft_ -= (u64)sent;
 
-    if( exc.empty() ) {
-        // activate the next sending tasks
-        Task* task = factory_->create_task(send_TaskSpec, connection_.get());
-        if( task == NULL )
-            connection_.abandon();
+    // the server writes the payload of DATA frame when its checksum comes
+    if( stream->checksummed_ && 0 == stream->frameLeft_ )
+    {
+        string check = frame_header(checksum_FrameType, stream->id_, stream->crc_);
+        if( stream->hash_ )
+            check += leaf_frames(stream);
+        connection_->send(check.c_str(), check.length());
+        stream->crc_ = 0;
+        if( stream->retransmit_ >= 0 )
+            streams_->rewind(stream);
     }
-    else {
-        notifyMgr_->debug( exc );
-        notifyMgr_->error( exc );
+}
+
+i64 SendingTask::send_segment(File* file, u64 count)
+{
+    i64 offset = file->tell();
+#ifdef WIN32
+    i32 fd = _fileno( file->handle() );
+#else
+    i32 fd = fileno( file->handle() );
+#endif
+    i64 sent = connection_->sendfile( fd, offset, count );
+    if( sent > 0 )
+    {
+        file->seek( sent, SEEK_CUR );
+        // the sent pages are not needed anymore
+        file->dropCache( offset + sent );
+        notifyMgr_->debug( get_name() + " - NOTE: sent " + tostring((u64)sent) + " bytes.");
+        notifyMgr_->notify( get_name() + " - NOTE: sent " + tostring((u64)sent) + " bytes.");
+        return sent;
+    }
+    return 0;
+}
+
+u32 SendingTask::checksum(SendStream* stream, i64 offset, i64 count, u32 crc)
+{
+    // the pages are in the system cache yet
+    File* file = stream->file_;
+    u8 buffer[65536];
+    file->seek(offset, SEEK_SET);
+    while( count > 0 )
+    {
+        u32 read = fread(buffer, 1, (u32)min(count, (i64)sizeof(buffer)), file->handle());
+        if( 0 == read )
+            throw Exception("Can't read \"" + file->path() + "\"");
+        crc = crc32c(buffer, read, crc);
+        if( stream->hash_ )
+            hash_payload(stream, offset, buffer, read);
+        offset += read;
+        count -= read;
+    }
+    return crc;
+}
+
+i64 SendingTask::send_packed(SendStream* stream, u16 flags, const string& tag_inside)
+{
+    File* file = stream->file_;
+    PackPipeline* pack = stream->pack_;
+
+    // the workers pack the chunks read ahead while the previous ones are sent
+    while( pack->size() < PACK_DEPTH )
+    {
+        i64 from = pack->size() ? pack->end() : file->tell();
+        if( from >= stream->end_ )
+            break;
+        pack->read(file, from, (u32)min((i64)DEF_STREAM_QUANTUM, stream->end_ - from), 0 == stream->rawFrames_);
+        if( stream->rawFrames_ > 0 )
+            --stream->rawFrames_;
+    }
+
+    const PackPipeline::Chunk* chunk = pack->front();
+    u32 length = chunk->data_.size();
+    assert( chunk->offset_ == file->tell() && length == stream->frameLeft_ );
+    if( stream->hash_ )
+        hash_payload(stream, chunk->offset_, chunk->data_.get(), length);
+
+    // the packed chunk must save a sixteenth of the data at least, otherwise the frame is sent raw
+    u32 head = (u32)tag_inside.length() + FRAME_HEADER_SIZE;
+    Message frame(head + length);
+    memcpy(frame.get(), tag_inside.data(), tag_inside.length());
+    u8* payload = frame.get() + head;
+    u32 packed = chunk->packed(payload, length - length / 16);
+    if( packed )
+    {
+        flags |= packed_FrameFlag;
+        stream->rawSkip_ = 1;
+    }
+    else
+    {
+        memcpy(payload, chunk->data_.get(), length);
+        packed = length;
+        // the incompressible data is probed less and less often, the chunks read ahead
+        // before the skip fail with no count
+        if( chunk->probe_ && chunk->offset_ >= stream->probeFrom_ ) {
+            stream->rawFrames_ = stream->rawSkip_;
+            stream->rawSkip_ = min(stream->rawSkip_ * 2, (u32)DEF_COMPRESS_SKIP);
+            stream->probeFrom_ = pack->end();
+        }
+    }
+    FrameHeader header = { FRAME_VERSION, (u8)data_FrameType, flags, stream->id_, packed };
+    encode_frame_header(header, frame.get() + tag_inside.length());
+    stream->crc_ = crc32c(payload, packed, stream->crc_);
+    pack->pop();
+
+    u32 write = head + packed;
+    if( connection_->send(frame.get(), write) <= 0 )
+        throw Exception("Can't send to host " + connection_->getTarget());
+    file->seek( file->tell() + length, SEEK_SET );
+    stream->rawBytes_ += length;
+    stream->packedBytes_ += packed;
+
+    // the sent pages are not needed anymore
+    file->dropCache(file->tell());
+    notifyMgr_->debug( get_name() + " - NOTE: sent " + tostring(write) + " bytes.");
+    notifyMgr_->notify( get_name() + " - NOTE: sent " + tostring(write) + " bytes.");
+    return length;
+}
+
+void SendingTask::send_copy(SendStream* stream, u16 flags, const string& tag_inside, u32 block, u32 size)
+{
+    File* file = stream->file_;
+    i64 offset = file->tell();
+    assert( size <= stream->window_ );
+    if( stream->hash_ )
+        hash_payload(stream, offset, stream->delta_->data(offset), size);
+
+    u8 payload[FRAME_COPY_SIZE];
+    frame::put32(payload, block);
+    frame::put32(payload + 4, size);
+    string frames = tag_inside + frame_header(copy_FrameType, stream->id_, FRAME_COPY_SIZE, flags);
+    frames.append((const char*)payload, FRAME_COPY_SIZE);
+    if( stream->hash_ )
+        frames += leaf_frames(stream);
+    if( connection_->send(frames.c_str(), frames.length()) <= 0 )
+        throw Exception("Can't send to host " + connection_->getTarget());
+
+    file->seek( offset + size, SEEK_SET );
+    stream->window_ -= size;
+    stream->resent_ = false;
+    stream->copiedBytes_ += size;
+    notifyMgr_->debug( get_name() + " - NOTE: copied " + tostring(size) + " bytes.");
+    notifyMgr_->notify( get_name() + " - NOTE: copied " + tostring(size) + " bytes.");
+}
+
+void SendingTask::send_reference(SendStream* stream, u16 flags, const string& tag_inside, const ChunkQueue::Chunk& chunk)
+{
+    File* file = stream->file_;
+    i64 offset = file->tell();
+    assert( chunk.offset_ == offset && chunk.size_ <= stream->window_ );
+    if( stream->hash_ )
+    {
+        Message data(chunk.size_);
+        file->read(data.get(), chunk.size_);
+        hash_payload(stream, offset, data.get(), chunk.size_);
+    }
+
+    u8 record[CDC_RECORD_SIZE];
+    Chunker::encode(chunk.name_, chunk.size_, record);
+    string frames = tag_inside + frame_header(reference_FrameType, stream->id_, CDC_RECORD_SIZE, flags);
+    frames.append((const char*)record, CDC_RECORD_SIZE);
+    if( stream->hash_ )
+        frames += leaf_frames(stream);
+    if( connection_->send(frames.c_str(), frames.length()) <= 0 )
+        throw Exception("Can't send to host " + connection_->getTarget());
+
+    file->seek( offset + chunk.size_, SEEK_SET );
+    stream->window_ -= chunk.size_;
+    stream->resent_ = false;
+    stream->referencedBytes_ += chunk.size_;
+    notifyMgr_->debug( get_name() + " - NOTE: referenced " + tostring(chunk.size_) + " bytes.");
+    notifyMgr_->notify( get_name() + " - NOTE: referenced " + tostring(chunk.size_) + " bytes.");
+}
+
+string SendingTask::chunk_frames(SendStream* stream)
+{
+    // the chunks are cut ahead of the sent data, so the server answers before the data comes to them
+    ChunkQueue* chunks = stream->chunks_;
+    i64 ahead = chunks->announced() - stream->file_->tell();
+    if( chunks->announced() >= stream->end_ || ahead >= DEF_DEDUP_AHEAD )
+        return string();
+
+    // the server doesn't answer the chunks none of which passes its filter
+    i64 offset = chunks->announced();
+    string records;
+    bool asked = false;
+    u32 count = chunks->announce(stream->file_, stream->end_, FRAME_CHUNKS_COUNT, (u64)(DEF_DEDUP_AHEAD - ahead),
+                                 streams_->filter(), &records, &asked);
+    if( 0 == count )
+        return string();
+
+    u8 head[FRAME_CHUNKS_HEAD];
+    frame::put64(head, (u64)offset);
+    string frames = frame_header(chunks_FrameType, stream->id_, FRAME_CHUNKS_HEAD + records.length(),
+                                 asked ? 0 : filtered_FrameFlag);
+    frames.append((const char*)head, FRAME_CHUNKS_HEAD);
+    frames += records;
+    return frames;
+}
+
+void SendingTask::hash_payload(SendStream* stream, i64 offset, const u8* data, u32 size)
+{
+    i64 hashed = stream->hashFrom_ + (i64)stream->hash_->size();
+    assert( offset <= hashed );
+    if( offset + size <= hashed )
+        return;
+    u32 skip = (u32)(hashed - offset);
+    stream->hash_->update(data + skip, size - skip);
+}
+
+string SendingTask::leaf_frames(SendStream* stream)
+{
+    string frames;
+    u8 cv[TREE_HASH_SIZE];
+    u32 ready = stream->hash_->ready();
+    for(; stream->leavesSent_ < ready; ++stream->leavesSent_)
+    {
+        stream->hash_->leaf(stream->leavesSent_, cv);
+        frames += frame_header(hash_FrameType, stream->id_, TREE_HASH_SIZE);
+        frames.append((const char*)cv, TREE_HASH_SIZE);
+    }
+    return frames;
+}
+
+void SendingTask::identify(File* file, FileIdentity* identity)
+{
+    u8 buffer[8192];
+    u64 hash = frame_hash(NULL, 0);
+    u32 left = FRAME_IDENTITY_PREFIX;
+    file->seek(0, SEEK_SET);
+    while( left > 0 )
+    {
+        u32 read = fread(buffer, 1, min(left, (u32)sizeof(buffer)), file->handle());
+        if( 0 == read )
+            throw Exception("Can't read \"" + file->path() + "\"");
+        hash = frame_hash(buffer, read, hash);
+        left -= read;
+    }
+    file->seek(0, SEEK_SET);
+
+    identity->mtime_ = file->mtime();
+    identity->hash_ = hash;
+}
+
+void SendingTask::receive_windows()
+{
+    // the server sends nothing but WINDOW and OFFSET frames, they are read as they come
+    u8 buffer[1024];
+    s32 available = connection_->availableToRead();
+    while( available > 0 )
+    {
+        s32 received = connection_->recv(buffer, min(available, (s32)sizeof(buffer)));
+        if( received <= 0 )
+            break;
+        streams_->received(buffer, (u32)received);
+        available -= received;
     }
 }
@@ -0,0 +1,135 @@
+#ifndef __chunk_store_h__
+#define __chunk_store_h__
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "common_types.h"
+#include "message.h"
+#include "mutex.h"
+#include "refcounted.h"
+#include "file.h"
+#include "chunker.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The content-addressed store of the chunks of deduplicated files. Every chunk is kept once as
+// "<dir>/<first byte of name>/<name>" however many files have it. The file refers to its chunks by
+// "<file>.chunks" next to it, the chunks count the files referring to them. The index of chunks with
+// their counts is the journal "<dir>/index" of records: name(32), size(4) and the change of count(4).
+// It is written anew when the store is opened, then the chunks which no file refers to are removed.
+// The Bloom filter of the chunk names is published to the senders, the chunks stored later are added
+// to it, so the senders get the keys added since they got the filter. The filter is made anew and larger
+// when the store outgrows it, its generation tells the senders to get it again.
+// @note The store is shared by the workers, it is thread-safe.
+class ChunkStore
+{
+public:
+    /*  The published filter of chunk names, it is shared by the connections and never changed */
+    struct Filter : public RefCounted
+    {
+        u32 generation_;        /* the filter made anew has the next generation */
+        u32 bits_;              /* log2 of the bits of filter */
+        u32 hashes_;            /* the bits per key */
+        std::vector<u8> data_;  /* the bytes of filter */
+        u64 keys_;              /* the keys added to the generation before the filter is taken */
+    };
+
+    /*  Opens the store in the directory, it is created if there is none
+        @throw Exception if the store can't be read or written
+    */
+    ChunkStore(const std::string& dir);
+    ~ChunkStore();
+
+    /*  Returns true if the store has the chunk */
+    bool has(const u8* name) const;
+
+    /*  Reads the chunk
+        @param data - set to the data of chunk
+        @Returns false if there is no chunk of the size
+        @throw Exception if the chunk can't be read
+    */
+    bool read(const u8* name, u32 size, Message* data) const;
+
+    /*  Stores the chunk if there is none with its name, no file refers to it yet. The chunk file is
+        written out of the lock, its journal record is flushed with the references of the file by refer().
+        @throw Exception if the chunk can't be written
+    */
+    void put(const u8* name, const u8* data, u32 size);
+
+    /*  Makes the file refer to its chunks in the store, the chunks of its previous content are released
+        @param records - the records of chunks of the file, the ones the store has not are skipped
+        @throw Exception if the references can't be written
+    */
+    void refer(const std::string& path, const std::string& records);
+
+    const std::string& dir() const
+    { return dir_; }
+
+    /*  Returns the number of chunks in the store */
+    u64 chunks() const;
+
+    /*  Returns the data of the chunks in the store */
+    u64 bytes() const;
+
+    /*  Returns the filter of chunk names to publish, the keys added after it are got by added().
+        It is taken anew when its generation is made or many keys are added since it is taken.
+    */
+    RefCountedPtr<Filter> filter() const;
+
+    /*  Appends the keys added to the filter of the generation after the first 'from' ones
+        @param from - set to the number of keys added by now
+        @Returns false if the filter is made anew, the sender gets it again then
+    */
+    bool added(u32 generation, u64* from, std::vector<u64>* keys) const;
+
+private:
+    ChunkStore(const ChunkStore&);
+    ChunkStore& operator=(const ChunkStore&);
+
+    struct Name
+    {
+        u8 hash_[CDC_HASH_SIZE];
+
+        bool operator<(const Name& other) const
+        { return memcmp(hash_, other.hash_, CDC_HASH_SIZE) < 0; }
+    };
+
+    struct Entry
+    {
+        Entry() : size_(0), refs_(0) {}
+
+        u32 size_;
+        i32 refs_;          /* the files referring to the chunk */
+    };
+    typedef std::map<Name,Entry> IndexT;
+    typedef std::set<Name> NamesT;
+
+    static Name name(const u8* hash);
+
+    /*  Returns the path of chunk file */
+    std::string chunk_path(const Name& name) const;
+
+    /*  Replays the journal and writes it anew without the chunks which no file refers to */
+    void load();
+
+    /*  Appends the record to the journal */
+    void journal(const Name& name, u32 size, i32 refs);
+
+    /*  Makes the filter anew for the chunks of index, it has room for as many chunks again */
+    void make_filter();
+
+    mutable Mutex lock_;
+    std::string dir_;
+    IndexT index_;
+    NamesT writing_;        /* the chunks whose files are being written, they are not in the index yet */
+    u64  bytes_;
+    File log_;              /* the journal opened for appending */
+    ChunkFilter filter_;
+    u32  generation_;       /* the filter is made anew when the store is opened or outgrows it */
+    std::vector<u64> added_;    /* the keys of chunks stored since the filter is made */
+    mutable RefCountedPtr<Filter> published_; /* the filter taken for the senders, NULL if it is not taken yet */
+};
+
+#endif /* __chunk_store_h__ */
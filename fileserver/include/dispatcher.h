@@ -3,11 +3,55 @@
 
 #include "fileserver.h"
 #include "timer.h"
+#include "reactor.h"
+#include "uring_receiver.h"
+#include "write_behind.h"
+#include "sync_policy.h"
 #include "task.h"
 #include "file.h"
+#include "rawfile.h"
+#include "aligned_pool.h"
+#include "recv_stream.h"
+#include "pack_pipeline.h"
+#include "chunk_store.h"
 #include "notify_base.h"
 
 #include <iostream>
+#include <vector>
+
+//////////////////////////////////////////////////////////////
+// Server settings (given by command line options)
+struct ServerOptions
+{
+    ServerOptions()
+        : workers_(DEF_RECV_WORKERS),
+        engine_(copy_RecvEngine),
+        diskThreads_(DEF_DISK_THREADS),
+        hashThreads_(DEF_HASH_THREADS),
+        packThreads_(DEF_PACK_THREADS),
+        writeQueue_(DEF_WRITE_QUEUE_LIMIT),
+        durability_(none_Durability),
+        syncBytes_(DEF_SYNC_BYTES),
+        syncInterval_(DEF_SYNC_INTERVAL),
+        preallocate_(false),
+        direct_(false),
+        cache_(keep_CachePolicy)
+    {}
+
+    u16 workers_;           /* Number of receiving event loops (0 means the number of processors) */
+    RecvEngine engine_;     /* The way of payload receiving */
+    u16 diskThreads_;       /* Number of write-behind disk threads (0 means no write-behind) */
+    u16 hashThreads_;       /* Number of threads hashing the received files (0 means hashing by receivers) */
+    u16 packThreads_;       /* Number of threads unpacking the compressed frames (0 means unpacking by receivers) */
+    u32 writeQueue_;        /* Write-behind queue limit of one file, the connection stops reading on it */
+    Durability durability_; /* When the received data is forced to the disk */
+    u64 syncBytes_;         /* Periodic durability: bytes between synchronizations (0 - no limit) */
+    u64 syncInterval_;      /* Periodic durability: milliseconds between synchronizations (0 - no limit) */
+    bool preallocate_;      /* Allocate the disk space of whole file before receiving, otherwise the file is sparse */
+    bool direct_;           /* Write the files bypassing the system cache (O_DIRECT), copy engine only */
+    CachePolicy cache_;     /* Whether the written pages are dropped from the system cache */
+    std::string store_;     /* The directory of chunk store of deduplicated files (empty means no deduplication) */
+};
 
 //////////////////////////////////////////////////////////////
 // Dispatcher thread class
@@ -16,7 +60,7 @@ class Dispatcher : public Thread,
                    public NotifyBase
 {
 public:
-    Dispatcher(u16 serverPort, const IPAddress& serverHost);
+    Dispatcher(u16 serverPort, const IPAddress& serverHost, const ServerOptions& options);
     ~Dispatcher();
 
     void shutdown();
@@ -25,7 +69,10 @@ public:
     Task* create_task(TaskSpec type, TCPSockClient* conn);
     void destroy_task(Task* task);
     /* no need for server */
-    void newlink_task(TaskSpec type, TCPSockClient* conn) {}
+    void newlink_task(TaskSpec, TCPSockClient*) {}
+
+    /*  Reports the metrics to the log and to the console if 'console' is true */
+    void report_metrics(bool console);
 
 protected:
     virtual void run();
@@ -98,14 +145,43 @@ protected:
     }
 
 private:
+    /*  Receiving worker: the event loop and the state of connections which it owns */
+    struct Worker
+    {
+        Worker(const std::string& name, CachePolicy cache) 
+            : reactor_(name),
+            files_(cache)
+        {}
+
+        Reactor  reactor_;  /* Recv tasks events demultiplexer
+                               The task runs in reactor thread only when its connection is readable
+                            */
+        FilePool files_;    /* Received files of the connection streams */
+        std::auto_ptr<UringReceiver> uring_; /* Payload receiver for io_uring engine, otherwise NULL */
+    };
+    typedef std::vector<Worker*> WorkersT;
+
+    /*  Returns the least loaded worker, the equally loaded ones are chosen in round-robin order */
+    Worker* choose_worker();
+
     std::auto_ptr<FileServer> server_;
-    Timer runner_;      /* Recv tasks async executor
-                           Running the each task are subsequent in separate thread
-                        */
+    WorkersT workers_;  /* Receiving workers, each one runs in its own thread */
+    RecvEngine engine_; /* The payload receiving engine in use */
+    SyncPolicy sync_;   /* Durability of the received files */
+    bool     preallocate_; /* Disk space of the received files is allocated in advance */
+    std::auto_ptr<AlignedPool> directPool_; /* Buffers of direct writing, NULL when the files are cached */
+    CachePolicy cache_; /* System cache policy of the received files */
+    std::auto_ptr<WriteBehind> writer_; /* Disk writing stage, NULL when receivers write by themselves */
+    StripedFiles stripes_; /* Files received over several connections, the connections may go to different workers */
+    HashWorkers hashers_; /* Threads hashing the leaves of received files, they are shared by the workers */
+    PackWorkers packers_; /* Threads unpacking the blocks of compressed frames, they are shared by the workers */
+    std::auto_ptr<ChunkStore> store_; /* Chunks of deduplicated files, NULL when the files are not deduplicated */
+    u64      reported_; /* Written bytes at the last metrics report */
+    u16      next_;     /* The first worker to check at next choosing */
+    Timer    timer_;    /* Executor for the real timers only */
 
     bool     shutdown_; /* The flag for dispatcher stopping */
     Mutex    lock_;     /* For safe stopping of dispatcher owner thread */
-    Fd2FileT fd2file_;  /* Linkage connection to choosen file */
 };
 
 #endif /* __dispatcher_h__  */
@@ -7,7 +7,31 @@
 #define DEF_RECONNECT_INTERVAL  8000
 #define DEF_SENDING_INTERVAL    0
 #define DEF_PACKAGE_SIZE        60000
+#define DEF_SENDFILE_SEGMENT    4194304 /* zero-copy sending without pacing: bytes sent by one task */
+#define DEF_ZEROCOPY_BUFFERS    16    /* MSG_ZEROCOPY sending: buffers in flight per connection */
+#define DEF_WINDOW_WAIT         100   /* milliseconds the sender waits for WINDOW frames */
 #define DEF_RECVBUFFER_SIZE     65535 /* the maximum value of window size. */
+#define DEF_RECV_WORKERS        0     /* the number of processors */
+#define DEF_URING_DEPTH         8     /* io_uring chunks in flight per worker */
+#define DEF_URING_CHUNK_SIZE    262144
+#define DEF_SPLICE_PIPE_SIZE    1048576 /* the pipe capacity for splice engine */
+#define DEF_DISK_THREADS        2     /* write-behind disk threads, 0 means writing by receivers */
+#define DEF_WRITE_QUEUE_LIMIT   8388608 /* write-behind queue size of one file in bytes */
+#define DEF_METRICS_INTERVAL    10000 /* metrics logging period in milliseconds */
+#define DEF_SYNC_BYTES          67108864 /* periodic durability: bytes between fdatasync() */
+#define DEF_SYNC_INTERVAL       1000  /* periodic durability: milliseconds between fdatasync() */
+#define DEF_DIRECT_CHUNK_SIZE   1048576 /* direct writing: the size of aligned buffer written at once */
+#define DEF_DIRECT_POOL_SIZE    64    /* direct writing: free aligned buffers kept for reuse */
+#define DEF_MAX_STREAMS         64    /* files sent over one connection at once */
+#define DEF_STREAM_WINDOW       4194304 /* flow control: the payload of stream sent ahead of WINDOW frames */
+#define DEF_STREAM_QUANTUM      1048576 /* the payload of stream sent in one DATA frame before the next stream */
+#define DEF_FILE_STRIPES        1     /* connections one file is sent over at once */
+#define DEF_MAX_STRIPES         16    /* the most connections of one striped file */
+#define DEF_MAX_RETRANSMITS     8     /* checksummed streams: the corrupted DATA frames before the file is given up */
+#define DEF_HASH_THREADS        2     /* tree hash: threads hashing the leaves of files, 0 means hashing by the transfer threads */
+#define DEF_COMPRESS_SKIP       16    /* compression: the most DATA frames sent raw after the incompressible one */
+#define DEF_PACK_THREADS        4     /* compression: threads packing and unpacking LZ4 blocks, 0 means packing by the transfer threads */
+#define DEF_DEDUP_AHEAD         16777216 /* dedup: the data of chunks announced ahead of the sent data */
 
 #define TAG_START_CONTENT       ("<Hello. You must create the new file ")
 #define TAG_CONTENT_SIZE        ("<Size of file is ")
@@ -17,6 +41,9 @@
 // Forward classes declaration
 class TCPSockClient;
 class File;
+class RawFile;
+class ZeroCopySender;
+class SendStreams;
 class Task;
 
 /////////////////////////////////////////////////////////////
@@ -27,11 +54,48 @@ enum TaskSpec {
     recv_TaskSpec = 3,
 };
 
+// Server receiving engine
+enum RecvEngine {
+    copy_RecvEngine = 1,   /* recv() to user buffer and fwrite() */
+    uring_RecvEngine = 2,  /* io_uring linked recv and write */
+    splice_RecvEngine = 3, /* splice() from socket to file through the pipe */
+};
+
+// Client sending mode
+enum SendMode {
+    copy_SendMode = 1,     /* fread() to user buffer and send() */
+    sendfile_SendMode = 2, /* sendfile() from file to socket */
+    zerocopy_SendMode = 3, /* fread() to pooled buffer and send() with MSG_ZEROCOPY */
+};
+
+// Wire protocol of the connection
+enum WireProtocol {
+    legacy_WireProtocol = 1,  /* text tags around the raw content of file */
+    frames_WireProtocol = 2,  /* binary length-prefixed frames, see frame.h */
+};
+
+// Compression of DATA frames
+enum Compression {
+    none_Compression = 1,  /* the payload is sent raw */
+    fast_Compression = 2,  /* LZ4 with one hash probe per position, for the speed */
+    high_Compression = 3,  /* LZ4 with hash chains and lazy matching, for the ratio */
+};
+
+// Received data durability
+enum Durability {
+    none_Durability = 1,     /* left to the page cache */
+    periodic_Durability = 2, /* synchronized every N bytes or T milliseconds */
+    finish_Durability = 3,   /* synchronized when the file is received */
+};
+
 // Sockets objects container (key is socket fd)
 typedef std::map<u32,RefCountedPtr<TCPSockClient>> Fd2SocketT;
 
-// File objects container (key is socket fd)
-typedef std::map<u32,std::auto_ptr<File>> Fd2FileT;
+// Sent files container (key is socket fd)
+typedef std::map<u32,std::auto_ptr<SendStreams>> Fd2StreamsT;
+
+// Zero-copy senders container (key is socket fd)
+typedef std::map<u32,std::auto_ptr<ZeroCopySender>> Fd2SenderT;
 
 //////////////////////////////////////////////////////////////
 // Creator for asyncronious actions
@@ -0,0 +1,242 @@
+#ifndef __frame_h__
+#define __frame_h__
+
+#include <string>
+#include "common_types.h"
+
+/////////////////////////////////////////////////////////////
+// Binary frames protocol. Every frame is the fixed header followed by 'length' bytes of payload,
+// the numbers are in network byte order:
+//
+//   magic(2) | version(1) | type(1) | flags(2) | reserved(2) | stream(4) | length(8)
+//
+// The receiver reads the headers only, so the payload is never scanned for the tags. The frames of
+// several files are interleaved over one connection, each file has its own stream. A file is sent as
+// START frame, DATA frames with the content and END frame, the flags of START frame add the rest.
+//
+// The frames of the sender:
+//   START       file size(8), the identity (resume), the stripe (striped) and the name of file.
+//   DATA        the next payload of stream. 'packed': the LZ4 blocks of at most DEF_STREAM_QUANTUM bytes
+//               of data, each follows its data size(4) and block size(4) (see pack_pipeline.h).
+//               'resent': the payload goes on from the offset of the last RETRANSMIT frame.
+//   CHECKSUM    follows DATA frame of checksummed stream, 'length' is CRC32C of its payload as sent.
+//   HASH        the BLAKE3 chaining value of the next leaf of hashed stream, the leaves are TREE_HASH_LEAF
+//               bytes from the first DATA frame and the last ones go before END frame.
+//   COPY        first block(4) and size(4) of at most DEF_STREAM_QUANTUM bytes of blocks of the receiver's
+//               file which go one after another in it, they take the window as DATA frame does.
+//   CHUNKS      offset(8) of the first chunk followed by the hash and size(4) of every next chunk.
+//               'filtered': none of the chunks passes the receiver's filter, it doesn't answer.
+//   REFERENCE   the hash and size(4) of the chunk of receiver's store sent instead of its data.
+//   END         the file is sent entirely.
+// COPY and REFERENCE frames go on after RETRANSMIT frame with 'resent' flag as DATA frame does.
+//
+// The frames of the receiver:
+//   WINDOW      the windowed stream may send 'length' more bytes of payload.
+//   OFFSET      the receiver has the first 'length' bytes of the resumable stream, the sender goes on
+//               from there; it confirms the end of checksummed stream, the sender keeps the file until it.
+//   RETRANSMIT  the receiver dropped the payload from 'length' offset up to the frame with 'resent' flag.
+//               'leaf': the tree hash mismatches from the leaf at the offset, the sender hashes it again.
+//   SIGNATURE   block size(4) and file size(8) followed by the weak checksum and the strong hash of the
+//               next blocks of receiver's file (see delta_signature.h).
+//   HAVE        offset(8) of CHUNKS frame followed by the bits of its chunks the receiver's store has.
+//   FILTER      stream 0: log2 of the bits(1), the bits per key(1) and the offset(8) followed by the bytes
+//               of the Bloom filter of receiver's chunk store. The frame at offset 0 starts the filter anew,
+//               the receiver sends a larger one when its store outgrows the filter.
+//   ADDED       stream 0: the keys(8) of the chunks stored since the last FILTER or ADDED frame.
+//
+// The flags of START frame:
+//   windowed    the stream sends the initial window of payload and then the bytes granted by WINDOW frames.
+//   resume      the START carries the identity of file (modification time and the hash of its beginning).
+//               The receiver keeps the received part when the connection is lost and answers with OFFSET.
+//   striped     the stream carries one range of the file, the receiver puts the ranges of one transfer
+//               together. The large file is sent by stripes over several connections at once.
+//   checksummed every DATA frame is followed by CHECKSUM frame. The receiver writes the payload only if
+//               its CRC32C matches, otherwise it answers with RETRANSMIT frame. The end of stream is
+//               confirmed by OFFSET frame.
+//   hashed      the checksummed stream sends HASH frames. The receiver hashes the payload too and compares
+//               the leaves at the end, the mismatched ones are asked by RETRANSMIT frame with 'leaf' flag.
+//   compressed  the checksummed stream may send packed DATA frames. CHECKSUM frame covers the packed payload,
+//               the receiver unpacks it in parallel and counts the unpacked size in the window.
+//   delta       the hashed stream replaces the receiver's file of the same name. The receiver answers with
+//               SIGNATURE frames of its file, the sender waits for all of them and sends its data by DATA
+//               frames with the literals and COPY frames. The receiver writes the new file next to the old
+//               one and puts it in place when the tree hash matches.
+//   dedup       the hashed stream announces its content-defined chunks (see chunker.h) by CHUNKS frames
+//               ahead of the data, the receiver answers with HAVE frames. The sender waits for the answer
+//               and sends the chunks the receiver has by REFERENCE frames. The receiver starts sending the
+//               filter of its store with the first HAVE frame of connection, the next HAVE frames may go
+//               between its FILTER frames. Once the filter is sent, ADDED frame goes before the later HAVE
+//               frames (or the whole filter again if it is made anew), then the sender waits only for the
+//               chunks which pass the filter.
+#define FRAME_MAGIC         0x4654  /* "FT", the legacy text protocol starts with '<' */
+#define FRAME_VERSION       1
+#define FRAME_HEADER_SIZE   20
+#define FRAME_MAX_NAME      1024    /* the longest file name in START frame */
+#define FRAME_FILE_STREAM   1       /* the first stream of connection */
+#define FRAME_CONNECTION_STREAM 0   /* the frames of the connection as a whole */
+#define FRAME_IDENTITY_SIZE 16      /* mtime(8) and hash(8) of the resumable file in START frame */
+#define FRAME_IDENTITY_PREFIX 65536 /* the beginning of file which is hashed for its identity */
+#define FRAME_STRIPE_SIZE   28      /* transfer(8), offset(8), length(8) and count(4) of the stripe in START frame */
+#define FRAME_STRIPE_ALIGNMENT 1048576 /* the stripes start at its multiples, the last one ends with the file */
+#define FRAME_SIGNATURE_HEAD 12     /* block size(4) and file size(8) before the signatures in SIGNATURE frame */
+#define FRAME_SIGNATURE_BLOCKS 4096 /* the most signatures in one SIGNATURE frame */
+#define FRAME_COPY_SIZE     8       /* first block(4) and size(4) of the copied blocks in COPY frame */
+#define FRAME_CHUNKS_HEAD   8       /* offset(8) of the first chunk in CHUNKS and HAVE frames */
+#define FRAME_CHUNKS_COUNT  1024    /* the most chunks in one CHUNKS frame */
+#define FRAME_FILTER_HEAD   10      /* log2 of the bits(1), the bits per key(1) and offset(8) in FILTER frame */
+#define FRAME_ADDED_KEYS    65536   /* the most keys in one ADDED frame */
+
+enum FrameType {
+    start_FrameType = 1, /* size and name of the new file */
+    data_FrameType = 2,  /* content of the file */
+    end_FrameType = 3,   /* the file is sent entirely */
+    window_FrameType = 4, /* the receiver allows 'length' more bytes of the stream */
+    offset_FrameType = 5, /* the receiver has the first 'length' bytes of the resumable or checksummed stream */
+    checksum_FrameType = 6, /* CRC32C of the payload of previous DATA frame of the stream is 'length' */
+    retransmit_FrameType = 7, /* the receiver dropped the payload of stream from 'length' offset */
+    hash_FrameType = 8,  /* the chaining value of the next leaf of hashed stream, TREE_HASH_SIZE bytes */
+    signature_FrameType = 9, /* the signatures of the next blocks of receiver's file of delta stream */
+    copy_FrameType = 10, /* the next data of delta stream is the blocks of receiver's file */
+    chunks_FrameType = 11, /* the next chunks of dedup stream */
+    have_FrameType = 12, /* the chunks of the last CHUNKS frame the receiver has */
+    reference_FrameType = 13, /* the next data of dedup stream is the chunk of receiver's store */
+    filter_FrameType = 14, /* the next bytes of the filter of receiver's chunk store */
+    added_FrameType = 15, /* the keys of the chunks stored since the last FILTER or ADDED frame */
+};
+
+enum FrameFlag {
+    windowed_FrameFlag = 0x0001, /* START: the sender waits for WINDOW frames */
+    resume_FrameFlag = 0x0002,   /* START: the file identity follows the size, the sender waits for OFFSET frame */
+    striped_FrameFlag = 0x0004,  /* START: the stream carries one stripe of the file, it follows the identity */
+    checksummed_FrameFlag = 0x0008, /* START: every DATA frame is followed by CHECKSUM frame */
+    resent_FrameFlag = 0x0010,   /* DATA, COPY, REFERENCE: the payload goes on from the offset of last RETRANSMIT frame */
+    hashed_FrameFlag = 0x0020,   /* START: the checksummed stream sends HASH frames */
+    leaf_FrameFlag = 0x0040,     /* RETRANSMIT: the tree hash mismatches from the leaf at the offset */
+    compressed_FrameFlag = 0x0080, /* START: the checksummed stream may send packed DATA frames */
+    packed_FrameFlag = 0x0100,   /* DATA: the payload is the packed chunk of LZ4 blocks */
+    delta_FrameFlag = 0x0200,    /* START: the hashed stream is sent against the receiver's file by COPY frames */
+    dedup_FrameFlag = 0x0400,    /* START: the hashed stream refers to the chunks of receiver's store by REFERENCE frames */
+    filtered_FrameFlag = 0x0800, /* CHUNKS: none of the chunks passes the receiver's filter, it doesn't answer */
+};
+
+/* The identity of resumable file, the receiver goes on with the file only if it is the same */
+struct FileIdentity
+{
+    i64 mtime_;         /* the modification time in seconds since the epoch */
+    u64 hash_;          /* FNV-1a hash of the first FRAME_IDENTITY_PREFIX bytes */
+};
+
+/* The range of file sent over one of the connections */
+struct FileStripe
+{
+    u64 transfer_;      /* the stripes of one file have the same transfer id chosen by the sender */
+    u64 offset_;
+    u64 length_;
+    u32 count_;         /* the number of stripes of the file */
+};
+
+struct FrameHeader
+{
+    u8  version_;
+    u8  type_;
+    u16 flags_;
+    u32 stream_;
+    u64 length_;
+};
+
+namespace frame {
+    inline void put16(u8* ptr, u16 value) {
+        ptr[0] = (u8)(value >> 8); ptr[1] = (u8)value;
+    }
+    inline void put32(u8* ptr, u32 value) {
+        put16(ptr, (u16)(value >> 16)); put16(ptr+2, (u16)value);
+    }
+    inline void put64(u8* ptr, u64 value) {
+        put32(ptr, (u32)(value >> 32)); put32(ptr+4, (u32)value);
+    }
+    inline u16 get16(const u8* ptr) {
+        return (u16)((ptr[0] << 8) | ptr[1]);
+    }
+    inline u32 get32(const u8* ptr) {
+        return ((u32)get16(ptr) << 16) | get16(ptr+2);
+    }
+    inline u64 get64(const u8* ptr) {
+        return ((u64)get32(ptr) << 32) | get32(ptr+4);
+    }
+}
+
+/* Writes the header to the buffer of FRAME_HEADER_SIZE bytes */
+inline void encode_frame_header(const FrameHeader& header, u8* buffer)
+{
+    frame::put16(buffer, FRAME_MAGIC);
+    buffer[2] = header.version_;
+    buffer[3] = header.type_;
+    frame::put16(buffer+4, header.flags_);
+    frame::put16(buffer+6, 0);
+    frame::put32(buffer+8, header.stream_);
+    frame::put64(buffer+12, header.length_);
+}
+
+/*  Reads the header from the buffer of FRAME_HEADER_SIZE bytes
+    @Returns false if the buffer doesn't start with the frame magic
+*/
+inline bool decode_frame_header(const u8* buffer, FrameHeader* header)
+{
+    if( FRAME_MAGIC != frame::get16(buffer) )
+        return false;
+    header->version_ = buffer[2];
+    header->type_ = buffer[3];
+    header->flags_ = frame::get16(buffer+4);
+    header->stream_ = frame::get32(buffer+8);
+    header->length_ = frame::get64(buffer+12);
+    return true;
+}
+
+/* Returns the encoded header of frame with the payload of 'length' bytes */
+inline std::string frame_header(FrameType type, u32 stream, u64 length, u16 flags = 0)
+{
+    FrameHeader header = { FRAME_VERSION, (u8)type, flags, stream, length };
+    u8 buffer[FRAME_HEADER_SIZE];
+    encode_frame_header(header, buffer);
+    return std::string((const char*)buffer, FRAME_HEADER_SIZE);
+}
+
+/* Returns FNV-1a hash of the data continuing the 'hash' of previous data */
+inline u64 frame_hash(const u8* data, u32 size, u64 hash = 0xcbf29ce484222325ULL)
+{
+    for(u32 i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+/*  Returns the encoded START frame of file
+    @param identity - the file is resumable if it is given
+    @param stripe - the stream carries the stripe of file if it is given
+*/
+inline std::string start_frame(u32 stream, const std::string& name, u64 size, u16 flags = 0,
+                               const FileIdentity* identity = NULL, const FileStripe* stripe = NULL)
+{
+    u8 buffer[8 + FRAME_IDENTITY_SIZE + FRAME_STRIPE_SIZE];
+    u32 length = 8;
+    frame::put64(buffer, size);
+    if( identity )
+    {
+        frame::put64(buffer + length, (u64)identity->mtime_);
+        frame::put64(buffer + length + 8, identity->hash_);
+        length += FRAME_IDENTITY_SIZE;
+        flags |= resume_FrameFlag;
+    }
+    if( stripe )
+    {
+        frame::put64(buffer + length, stripe->transfer_);
+        frame::put64(buffer + length + 8, stripe->offset_);
+        frame::put64(buffer + length + 16, stripe->length_);
+        frame::put32(buffer + length + 24, stripe->count_);
+        length += FRAME_STRIPE_SIZE;
+        flags |= striped_FrameFlag;
+    }
+    return frame_header(start_FrameType, stream, length + name.length(), flags) + 
+           std::string((const char*)buffer, length) + name;
+}
+
+#endif /* __frame_h__ */
@@ -0,0 +1,173 @@
+#ifndef __recv_stream_h__
+#define __recv_stream_h__
+
+#include <vector>
+#include <map>
+#include <set>
+
+#include "filetransfer_defines.h"
+#include "frame.h"
+#include "sync_policy.h"
+#include "rawfile.h"
+#include "aligned_pool.h"
+#include "message.h"
+#include "mutex.h"
+#include "tree_hash.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The identity of resumable file with its payload which is on the disk. It is kept next to
+// the file as "<file>.resume" while the file is not received to the end, so the sender goes on
+// from the committed offset when it comes again after the connection is lost.
+struct ResumePoint
+{
+    i64 size_;
+    FileIdentity identity_;
+    i64 committed_;     /* the received payload which is written to the file */
+
+    /*  Reads the point of file
+        @Returns false if there is no point or it is damaged
+    */
+    bool load(const std::string& path);
+
+    /*  Writes the point of file
+        @throw Exception
+    */
+    void save(const std::string& path) const;
+
+    /*  Returns true if the point belongs to the same file of sender */
+    bool same(const ResumePoint& other) const;
+
+    /*  Removes the point of file if it exists */
+    static void drop(const std::string& path);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The file being received on a stream of connection. The legacy clients send
+// one file at once, so their connection has the only stream.
+class RecvStream
+{
+public:
+    /*  @param directPool - the pool of aligned buffers if the file is written directly */
+    RecvStream(u32 id, RawFile* file, AlignedPool* directPool);
+    ~RecvStream();
+
+    u32 id_;
+    RawFile* file_;         /* the file of the worker pool */
+    i64  size_;             /* the announced size of file */
+    i64  received_;         /* the payload parsed or moved bypassing the parser by now */
+
+    bool windowed_;         /* the sender waits for WINDOW frames to send more */
+    u64  window_;           /* windowed: the payload the sender is allowed to send */
+    u64  credit_;           /* windowed: the received payload which is not granted back yet */
+    bool blocked_;          /* windowed: its write queue is full, so the credit is held */
+
+    bool resumable_;        /* the received part of file is kept when the connection is lost */
+    ResumePoint resume_;    /* resumable: the identity of file */
+
+    bool striped_;          /* the stream carries one stripe of the file, 'size_' is the stripe length */
+    FileStripe stripe_;     /* striped: the range of file */
+
+    bool checksummed_;      /* the payload of DATA frame is written when CHECKSUM frame confirms it */
+    bool checking_;         /* checksummed: DATA frame is received, its CHECKSUM frame is expected */
+    bool dropping_;         /* checksummed: the payload is dropped until it is sent again from 'received_' */
+    Message chunk_;         /* checksummed: the payload of DATA frame being checked */
+    u32  crc_;              /* checksummed: CRC32C of the chunk */
+    u32  retransmits_;      /* checksummed: the corrupted DATA frames and leaves by now */
+    bool compressed_;       /* checksummed: DATA frames may be packed by LZ4 */
+    bool packed_;           /* compressed: the chunk is LZ4 block of the data */
+
+    bool delta_;            /* hashed: the file takes the place of 'target_' when it is received */
+    std::string target_;    /* delta: the path of file being replaced */
+    RawFile* basis_;        /* delta: the file being replaced, its blocks are copied, NULL if there is none */
+    u32  basisBlock_;       /* delta: the block size of its signatures */
+    i64  basisSize_;        /* delta: the signed size of file being replaced */
+    u64  copied_;           /* delta: the payload copied from the file being replaced */
+
+    bool dedup_;            /* hashed: the sender refers to the chunks of store by REFERENCE frames */
+    i64  announced_;        /* dedup: the end of chunks announced by CHUNKS frames */
+    std::string chunks_;    /* dedup: the records of announced chunks, the file refers to them at the end */
+    std::map<i64,u32> missing_; /* dedup: the chunks which the store has not (key is offset, value is record) */
+    Message gather_;        /* dedup: the data of missing chunk being received */
+    i64  gatherAt_;         /* dedup: the offset of gathered data, -1 if there is none */
+    u64  referenced_;       /* dedup: the payload written from the store */
+
+    TreeHash* hash_;        /* the tree hash of checked payload, NULL if the stream is not hashed */
+    i64  hashFrom_;         /* hashed: the payload received before the stream started, it is not hashed */
+    std::string peerLeaves_; /* hashed: the chaining values of leaves received from the sender */
+
+    AlignedPool* directPool_; /* NULL when the file is written through the system cache */
+    u8*  directBuffer_;     /* the aligned buffer being filled, NULL if there is no data */
+    u32  directSize_;       /* the size of data in the buffer */
+    i64  directOffset_;     /* the file offset of buffer */
+
+    SyncState sync_;        /* Synchronization state of the data written by the task itself */
+    u32  jobs_;             /* the disk jobs of stream being run, the file is closed when they are done */
+
+private:
+    RecvStream(const RecvStream&);
+    RecvStream& operator=(const RecvStream&);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Received files of the worker. They are reused by the streams of its connections
+// and never deleted before the worker, since the write-behind queues refer to them.
+class FilePool
+{
+public:
+    FilePool(CachePolicy cache);
+    ~FilePool();
+
+    /*  Returns a free file */
+    RawFile* acquire();
+
+    /*  Gives the file back, it is closed if it is still opened */
+    void release(RawFile* file);
+
+private:
+    typedef std::vector<RawFile*> FilesT;
+
+    Mutex  lock_;
+    FilesT all_;
+    FilesT free_;
+    CachePolicy cache_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The files received by stripes over several connections at once, the connections may
+// belong to different workers. The first stripe of transfer creates the file, the others
+// open it, so each stripe writes its range at its offsets by its own descriptor.
+class StripedFiles
+{
+public:
+    StripedFiles();
+    ~StripedFiles();
+
+    /*  Opens the file of stripe, it is created by the first stripe of transfer
+        @param direct - the file bypasses the system cache
+        @param preallocate - the disk space of whole file is allocated when it is created
+        @throw Exception if the stripe doesn't match the other stripes of transfer
+    */
+    void open(RawFile* file, const std::string& path, i64 size, const FileStripe& stripe,
+              bool direct, bool preallocate);
+
+    /*  Accounts the received stripe
+        @param size - set to the size of file when it is complete
+        @Returns true if all the stripes of its file are received
+    */
+    bool received(const FileStripe& stripe, i64* size);
+
+private:
+    struct Transfer
+    {
+        std::string path_;
+        i64  size_;
+        u32  count_;
+        std::set<u64> received_;  /* the offsets of received stripes, the sent again ones are counted once */
+    };
+    typedef std::map<u64,Transfer> TransfersT;
+
+    Mutex lock_;
+    TransfersT transfers_;  /* the files which are not received entirely (key is transfer id) */
+};
+
+#endif /* __recv_stream_h__ */
@@ -2,64 +2,290 @@
 #define __server_parser_h__
 
 #include "filetransfer_defines.h"
+#include "frame.h"
 #include "message.h"
 #include "mutex.h"
+#include "recv_stream.h"
+#include "pack_pipeline.h"
+#include "delta_signature.h"
+#include "chunk_store.h"
+#include "write_behind.h"
 
 ////////////////////////////////////////////////////////////////////////////////
-typedef std::vector<Message> RawMessagesT;
+// The disk work of stream which the receiving task runs off the reactor thread,
+// the parser takes its result when it is done
+class StreamJob : public WriteBehind::Job
+{
+public:
+    enum Kind {
+        sign_Kind = 1,      /* the signatures of the file replaced by delta stream */
+        read_Kind = 2,      /* the payload of COPY or REFERENCE frame, the frames after it wait for the data */
+        store_Kind = 3,     /* the received chunk of dedup stream which the store has not */
+    };
+
+    StreamJob(Kind kind, RecvStream* stream);
+
+    Kind kind_;
+    RecvStream* stream_;
+    RawFile* file_;         /* sign, read: the file being replaced, NULL if there is none */
+    ChunkStore* store_;     /* read, store: the chunk store, the chunk is read from it if there is no file */
+    u8   record_[CDC_RECORD_SIZE]; /* read, store: the record of chunk */
+    i64  offset_;           /* read: the offset of blocks in the file being replaced */
+    u32  length_;           /* read: the size of payload */
+    u32  block_;            /* sign: the block size of signatures */
+    i64  size_;             /* sign: the signed size of file */
+    Message data_;          /* sign: the encoded signatures, read: the payload, store: the data of chunk */
+
+protected:
+    /* WriteBehind::Job implementation */
+    virtual void run();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The payload of stream, the package without data marks the start or the end of its file
+struct RawPackage
+{
+    explicit RawPackage(RecvStream* stream = NULL)
+        : stream_(stream), end_(false), started_(false), retransmit_(false), leaf_(false), delta_(false), have_(false),
+        job_(NULL)
+    {}
 
-class BufferParser
+    RecvStream* stream_;
+    Message data_;
+    bool end_;          /* the file is received entirely, the stream is given up by the parser */
+    bool started_;      /* the resumable file is started, the sender waits for its offset */
+    bool retransmit_;   /* the checksum of DATA frame mismatches, the sender goes on from the received payload */
+    bool leaf_;         /* retransmit: the tree hash mismatches, the payload from the received one is written again */
+    bool delta_;        /* the delta stream is started, the data is the signatures of the file it replaces */
+    bool have_;         /* the chunks of dedup stream are announced, the data is the answer of HAVE frame,
+                           it is empty if the sender doesn't wait for it */
+    StreamJob* job_;    /* the disk work of stream, the task runs it and gives it back to the parser when it is done */
+};
+typedef std::vector<RawPackage> RawPackagesT;
+
+/*  Appends the package of stream, the caller sets its data and kind */
+inline RawPackage& push_package(RawPackagesT* packages, RecvStream* stream)
+{
+    packages->push_back( RawPackage(stream) );
+    return packages->back();
+}
+typedef std::vector<RecvStream*> RecvStreamsT;
+
+// Parser of the data stream of one connection. It keeps the state between the
+// receivings, so the tags, frames and payload may be split by any recv() boundaries.
+class StreamParser
 {
 public:
-    /*  Parser splits the data from connection on 'splitBy' parts if it is nonzero */
-    BufferParser(u16 splitBy, File* recvFile);
+    /*  The files of new streams are taken from 'files'.
+        The stripes of files received over several connections are put together by 'stripes'.
+        The disk space of new file is allocated at once if 'preallocate' is true.
+        The new file bypasses the system cache if 'directPool' is given.
+    */
+    StreamParser(FilePool* files, StripedFiles* stripes, AlignedPool* directPool, bool preallocate);
+    virtual ~StreamParser();
 
-    /*  Search for the packages in the buffer.
-        @param packages - container where recevied packages will be located (only one in current implementation)
-        @param done - end of file is received
-        @Returns the number of packages.
+    /*  Parses the buffer, the payload is taken as is.
+        It stops at the header which is not received entirely.
+        @param packages - container where received packages will be located
+        @Returns the number of consumed bytes, the rest must be given again with the following data
+        @throw GarbledMsgReceivedException if the stream is malformed
     */
-    u16 operator()(const u8* buffer,
-                   u32 bufferSize,
-                   RawMessagesT* packages,
-                   bool* done) const;
+    virtual u32 parse(const u8* buffer, u32 bufferSize, RawPackagesT* packages) = 0;
 
-    /* Auxiliary classes that represens execeptions that takes place during 
-       handling of the garbled or zero messages.
+    /*  Returns the stream of payload which may be received bypassing the parser
+        (by splice or io_uring) or NULL if the next bytes are not a payload or it must be checked
+    */
+    virtual RecvStream* data_stream() const = 0;
+
+    /*  Returns the payload bytes of data_stream() which may be received bypassing the parser */
+    virtual u64 data_left() const = 0;
+
+    /*  Accounts the payload received bypassing the parser */
+    virtual void skip(u64 bytes) = 0;
+
+    /*  Gives up the streams which are not ended yet, the caller owns them then */
+    virtual void detach(RecvStreamsT* streams) = 0;
+
+    /*  Takes the result of done job, the packages of its stream are appended.
+        The legacy protocol has no jobs.
+        @throw Exception if the job is failed
+    */
+    virtual void finish(StreamJob* job, RawPackagesT* packages);
+
+    /* Auxiliary class that represens exeception that takes place during
+       handling of the garbled stream.
     */
     class GarbledMsgReceivedException : public Exception {
     public: GarbledMsgReceivedException(const std::string& aReason) : Exception(aReason) {}
         inline const std::string& reason() const { return m_reason; }
     };
-    class ZeroMsgReceivedException : public Exception {
-    public: ZeroMsgReceivedException(const std::string& aReason) : Exception(aReason) {}
-        inline const std::string& reason() const { return m_reason; }
-    };
+
+protected:
+    /*  Creates the stream with the received file without the path of sender.
+        The resumable file goes on from its committed offset if it is the same file of sender,
+        otherwise the file is created anew.
+        @param resume - the identity of resumable file, NULL if the file is not resumable
+        @param stripe - the range of file the stream carries, NULL if it carries the whole file
+        @param delta - the file is received next to the existing one, which is kept to copy its blocks
+    */
+    RecvStream* create_stream(u32 id, std::string path, i64 sizeOfFile, const FileIdentity* resume = NULL,
+                              const FileStripe* stripe = NULL, bool delta = false);
+
+    FilePool*    files_;
+    StripedFiles* stripes_; /* NULL if the protocol has no stripes */
+    AlignedPool* directPool_;
+    bool  preallocate_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Parser of the legacy text tags around the raw content of file
+class BufferParser : public StreamParser
+{
+public:
+    BufferParser(FilePool* files, AlignedPool* directPool = NULL, bool preallocate = false);
+    virtual ~BufferParser();
+
+    /* StreamParser implementation, the files are received one by one */
+    virtual u32 parse(const u8* buffer, u32 bufferSize, RawPackagesT* packages);
+    virtual RecvStream* data_stream() const;
+    virtual u64 data_left() const;
+    virtual void skip(u64 bytes);
+    virtual void detach(RecvStreamsT* streams);
 
 protected:
     /*  Parse start tags in incoming buffer
-        @Returns the number of parsed bytes in start tag or -1 when buffer is empty
+        @Returns the number of parsed bytes in start tag or 0 when the tags are not received entirely
     */
-    u16 parseStartTags(const s8* buffer, u32 bufferSize, std::string* path, u32* sizeOfFile) const;
+    u32 parseStartTags(const s8* buffer, u32 bufferSize, std::string* path, i64* sizeOfFile) const;
+
+    /*  Prints the number of received bytes over the previous one */
+    void progress();
 
 private:
-    u16   splitBy_;
-    File* recvFile_;
+    enum State {
+        header_State = 1,   /* waiting for the start tags */
+        body_State = 2,     /* receiving the content of file */
+        trailer_State = 3,  /* waiting for the finish tag */
+    };
+    State state_;
+    RecvStream* stream_;    /* the stream of receiving file, NULL between the files */
+    u32   trailerMatched_;  /* the bytes of finish tag received by now */
+    i64   printed_;         /* the number of bytes on the console */
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Parser of the binary frames, the files of several streams are received at once
+class FrameParser : public StreamParser
+{
+public:
+    /*  The leaves of hashed streams are hashed by 'hashers', the packed frames are unpacked by 'packers'.
+        The chunks of dedup streams are looked up in 'store', they are never found if it is NULL.
+    */
+    FrameParser(FilePool* files, StripedFiles* stripes, HashWorkers* hashers, PackWorkers* packers,
+                ChunkStore* store = NULL, AlignedPool* directPool = NULL, bool preallocate = false);
+    virtual ~FrameParser();
+
+    /* StreamParser implementation, the payload of DATA frames is never looked into */
+    virtual u32 parse(const u8* buffer, u32 bufferSize, RawPackagesT* packages);
+    virtual RecvStream* data_stream() const;
+    virtual u64 data_left() const;
+    virtual void skip(u64 bytes);
+    virtual void detach(RecvStreamsT* streams);
+    virtual void finish(StreamJob* job, RawPackagesT* packages);
+
+protected:
+    /*  Creates the stream announced by START frame
+        @Returns the new stream
+    */
+    RecvStream* start(const FrameHeader& header, const u8* payload);
+
+    /*  Passes the checked DATA frame on if its checksum is 'crc', otherwise the stream
+        drops the payload until it is sent again
+        @throw GarbledMsgReceivedException if the file is corrupted too many times
+    */
+    void check(RecvStream* stream, u32 crc, RawPackagesT* packages);
+
+    /*  Passes the blocks of the replaced file on as the payload of delta stream, the frames
+        after them are parsed when a disk thread reads them
+        @throw GarbledMsgReceivedException if the blocks are not in the file or exceed the stream
+    */
+    void copy(RecvStream* stream, u32 block, u32 size, RawPackagesT* packages);
+
+    /*  Answers which of the chunks announced by CHUNKS frame the store has
+        @param payload - the offset of the first chunk followed by their records
+        @param asked - false if the sender doesn't wait for the answer, the chunks are taken only
+        @throw GarbledMsgReceivedException if the chunks don't follow the announced ones or exceed the file
+    */
+    void announce(RecvStream* stream, const u8* payload, u32 size, bool asked, RawPackagesT* packages);
+
+    /*  Passes the chunk of store on as the payload of dedup stream, the frames after it
+        are parsed when a disk thread reads it
+        @throw GarbledMsgReceivedException if the chunk exceeds the stream
+    */
+    void refer(RecvStream* stream, const u8* record, RawPackagesT* packages);
+
+    /*  Gathers the checked data of the chunks which the store has not, the complete ones are stored
+        by a disk thread
+        @param offset - the offset of data in the stream
+    */
+    void collect(RecvStream* stream, i64 offset, const u8* data, u32 size, RawPackagesT* packages);
+
+    /*  Replaces the checked chunk of packed DATA frame with its data
+        @Returns false if the block is malformed or its data exceeds the stream, it is dropped as corrupted then
+    */
+    bool unpack(RecvStream* stream);
+
+    /*  Compares the tree hash of ended stream with the leaves of sender, the payload is asked again
+        from the first mismatched leaf
+        @param root - TREE_HASH_SIZE bytes of the hash of stream payload
+        @Returns true if the hashes match
+        @throw GarbledMsgReceivedException if the file is corrupted too many times
+    */
+    bool verify(RecvStream* stream, u8* root, RawPackagesT* packages);
+
+private:
+    typedef std::map<u32,RecvStream*> StreamsT;
+
+    StreamsT    streams_;   /* the started streams (key is stream id) */
+    RecvStream* current_;   /* the stream of current DATA frame */
+    bool  reading_;         /* the payload of COPY or REFERENCE frame is being read, the next frames wait for it */
+    u64   dataLeft_;        /* the payload of current DATA frame not received yet */
+    HashWorkers* hashers_;
+    PackWorkers* packers_;
+    ChunkStore* store_;     /* NULL if the chunks of dedup streams are not kept */
+    Message unpacked_;      /* the data of packed DATA frame, it is swapped with the chunk */
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 class NotifyBase;
 
-class BufferReceiver 
+class BufferReceiver
 {
 public:
     BufferReceiver(TCPSockClient* connection, NotifyBase* notifyMgr);
     ~BufferReceiver();
 
-    int receive(const BufferParser& parser, RawMessagesT* messages, bool* done);
+    /*  Receives the available data and parses it, the incomplete header
+        is kept for the next receiving. The data received earlier is parsed first.
+        @Returns the number of payload bytes parsed, 0 when nothing is parsed yet
+        or -1 when the connection would block.
+        @throw Exception if the stream is malformed
+    */
+    int receive(StreamParser& parser, RawPackagesT* packages);
+
+    /*  Receives the first bytes of connection and keeps them for the parser
+        @Returns the first received byte or -1 when the connection would block
+    */
+    int peek();
+
     void clear();
 
 private:
+    /*  Parses the kept data and removes the consumed bytes
+        @Returns the number of payload bytes parsed
+    */
+    int parse(StreamParser& parser, RawPackagesT* packages);
+
     Mutex lock_;            /* protect buffer */
     Message buffer_;        /* contains the data received earlier (if any) */
     NotifyBase* notifyMgr_; /* notification manager */
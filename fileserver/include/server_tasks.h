@@ -3,12 +3,17 @@
 
 #include "dispatcher.h"
 #include "server_parser.h"
+#include "uring_receiver.h"
+#include "splice_receiver.h"
+
+#include <list>
+#include <vector>
 
 class BufferReceiver;
 
 ////////////////////////////////////////////////////////////////////////////
-// Performs data receieving 
-class RecvTask : public Task, public RefCounted
+// Performs data receieving, the files of connection streams are received at once
+class RecvTask : public Task, public RefCounted, public UringOwner
 {
     friend class Dispatcher;
 protected:
@@ -16,20 +21,205 @@ protected:
              TaskFactory* factory,
              NotifyBase* notifyMgr,
              TCPSockClient* connection,
-             File* recvFile);
+             FilePool* files,
+             StripedFiles* stripes,
+             HashWorkers* hashers,
+             PackWorkers* packers,
+             ChunkStore* store,
+             UringReceiver* uring,
+             SpliceReceiver* splice,
+             WriteBehind* writer,
+             Reactor* reactor,
+             const SyncPolicy& sync,
+             bool preallocate,
+             AlignedPool* directPool);
     ~RecvTask();
 
     virtual void run();
 
+    /* UringOwner implementation */
+    virtual void payload_done(i64 written, const std::string& error);
+
 private:
+    typedef std::list<RecvStream*> StreamListT;
+    typedef std::list<StreamJob*> JobListT;
+
+    /*  Reads the connection until it would block or the payload is given to io_uring */
+    void receive();
+
+    /*  Handles the packages of the parser in their order, their jobs are submitted first */
+    void handle(RawPackagesT* packages);
+
+    /*  Runs the job by a disk thread, the task runs it by itself if there are none */
+    void submit(StreamJob* job);
+
+    /*  Returns true if the job is done, the job run by the task itself is done at once */
+    bool done(StreamJob* job) const;
+
+    /*  Gives the done jobs back to the parser
+        @param packages - container where the packages of their streams will be located
+    */
+    void finish_jobs(RawPackagesT* packages);
+
+    /*  Gives up the jobs being run, the disk threads don't refer to their streams then */
+    void cancel_jobs();
+
+    /*  Moves the file position of stream over the payload received bypassing the parser */
+    void bypassed(RecvStream* stream, i64 bytes);
+
+    /*  Writes the data at the file position of stream through the write-behind queue if any
+        @Returns false if the queue is full
+    */
+    bool write(RecvStream* stream, const u8* data, u32 size);
+
+    /*  Collects the data in the aligned buffer of stream, the full one is written at its offset
+        @Returns false if the queue is full
+    */
+    bool write_direct(RecvStream* stream, const u8* data, u32 size);
+
+    /*  Writes the collected data padded up to the alignment
+        @Returns false if the queue is full
+    */
+    bool flush_direct(RecvStream* stream);
+
+    /*  Moves the file position of stream back to its received payload, the payload
+        after it is written again
+    */
+    void rewrite(RecvStream* stream);
+
+    /*  Accounts the data written by the task itself at the offset, synchronizes the file
+        if it is due and drops the written back pages according to the cache policy
+    */
+    void written(RecvStream* stream, i64 offset, u64 bytes);
+
+    /*  Accounts the payload of windowed stream as taken, the window is granted back
+        in large pieces while the write queue of stream has room
+    */
+    void credit(RecvStream* stream, u64 bytes);
+
+    /*  Queues SIGNATURE frames of the file replaced by delta stream
+        @param signatures - the encoded signatures of its blocks
+    */
+    void sign(RecvStream* stream, const Message& signatures);
+
+    /*  Starts sending the filter of chunk store at the first time or when it is made anew,
+        otherwise queues ADDED frame of the chunks stored since the previous time
+    */
+    void publish();
+
+    /*  Queues the next FILTER frames while the unsent replies are less than a quantum,
+        the keys stored meanwhile are published when the whole filter is queued
+    */
+    void queue_filter();
+
+    /*  Queues ADDED frames of the keys */
+    void queue_added(const std::vector<u64>& keys);
+
+    /*  Checks the write queues of the blocked streams, their credit is granted if they have room */
+    void unblock_streams();
+
+    /*  Sends the pending replies until the connection would block, the task waits for
+        the writable connection while some of them are left
+        @throw Exception
+    */
+    void send_replies();
+
+    /*  Closes the files of the ended streams when all their data is written
+        @Returns false if the file is not closed yet, the task is resumed when it is written
+    */
+    bool close_streams();
+
+    /*  Closes the file of ended stream when all its data is written,
+        the striped file is completed by its last received stripe,
+        the file of delta stream takes the place of the old one
+    */
+    bool close_stream(RecvStream* stream);
+
+    /*  Deletes the stream which is not received to the end, the new file of delta stream is removed */
+    void abandon_stream(RecvStream* stream);
+
+    /*  Saves the resume points of the resumable streams of lost connection when their data is written
+        @Returns false if the data is not written yet, the task is resumed when it is
+    */
+    bool commit_streams();
+
+    /*  Reports the error and shuts the connection down, the task is destroyed when the received part
+        of the resumable files is committed
+    */
+    void fail(const std::string& reason);
+
+    /*  Detaches the task from the reactor and closes the connection. The descriptor is released
+        after the task is detached, so the next connection can't get it while the task is attached to it.
+    */
+    void destroy();
+
     Mutex lock_;
     bool shutdown_;
+    bool failed_;           /* the connection is closed, the task only commits the resumable streams */
+
+    UringReceiver* uring_;  /* NULL when the payload is received by the task itself */
+    bool uringBusy_;        /* the payload is being received by io_uring */
+    std::auto_ptr<SpliceReceiver> splice_; /* not NULL when the payload is spliced to the file */
+
+    WriteBehind* writer_;   /* NULL when the task writes the file by itself */
+    Reactor* reactor_;      /* The reactor which runs the task */
+    RecvStream* paused_;    /* the connection is not read until the write queue of this stream has room */
+    StreamListT blocked_;   /* the windowed streams which wait for the room in their write queues */
+    StreamListT closing_;   /* the ended streams, their files are closed when written */
+    StreamListT committing_; /* the resumable streams of lost connection, they are committed when written */
+    JobListT jobs_;         /* the disk jobs of streams, the task is resumed when they are done */
+    StreamJob* reading_;    /* the connection is not read until this job reads the payload of frame */
+    std::string replies_;   /* WINDOW, OFFSET, SIGNATURE, HAVE and FILTER frames which are not sent yet */
+    size_t repliesSent_;    /* the bytes of replies_ which are sent already */
+    bool writable_;         /* the task is run when the connection becomes writable */
+    RefCountedPtr<ChunkStore::Filter> filter_; /* the filter being sent, NULL when it is queued entirely */
+    size_t filterQueued_;   /* the bytes of filter_ which are queued already */
+    bool published_;        /* the filter of chunk store is sent */
+    u32  publishedGeneration_; /* the generation of sent filter, the sender gets the filter made anew again */
+    u64  publishedKeys_;    /* the keys added to the generation which the sender knows of */
 
-    File* recvFile_;
+    SyncPolicy sync_;       /* Durability policy */
+    bool preallocate_;      /* The disk space of file is allocated when it is created */
+    AlignedPool* directPool_; /* NULL when the file is written through the system cache */
+
+    FilePool* files_;       /* the files of worker */
+    StripedFiles* stripes_; /* the files received over several connections */
+    HashWorkers* hashers_;  /* the threads hashing the leaves of hashed streams */
+    PackWorkers* packers_;  /* the threads unpacking the compressed frames */
+    ChunkStore* store_;     /* the chunks of deduplicated files, NULL if there is no store */
     TaskFactory* factory_;
     NotifyBase* notifyMgr_;
     RefCountedPtr<TCPSockClient> connection_;
     BufferReceiver receiver_;
+    std::auto_ptr<StreamParser> parser_; /* the parser of client protocol, it is chosen by the first bytes */
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Handles io_uring completions of the receiving worker
+class UringTask : public Task
+{
+    friend class Dispatcher;
+protected:
+    UringTask(const std::string& name, UringReceiver* uring);
+
+    virtual void run();
+
+private:
+    UringReceiver* uring_;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Reports the server metrics periodically
+class MetricsTask : public Task
+{
+    friend class Dispatcher;
+protected:
+    MetricsTask(const std::string& name, Dispatcher* dispatcher);
+
+    virtual void run();
+
+private:
+    Dispatcher* dispatcher_;
 };
 
 #endif /* __server_tasks_h__ */
@@ -0,0 +1,35 @@
+#ifndef __splice_receiver_h__
+#define __splice_receiver_h__
+
+#include "filetransfer_defines.h"
+#include "socket.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Moves the file payload from the socket to the file through the pipe with splice(),
+// so the data never gets to the user space.
+class SpliceReceiver
+{
+public:
+    /*  Checks if splice() is available on the platform */
+    static bool isSupported();
+
+    /*  @throw system_exception if the pipe can't be created */
+    SpliceReceiver();
+    ~SpliceReceiver();
+
+    /*  Moves up to 'length' bytes from the nonblocking socket to the file at 'offset'.
+        @Returns the number of bytes written to the file or -1 when the socket would block
+        before anything is written.
+        @throw Exception on EOF or error
+    */
+    i64 receive(SD sock, i32 fileFd, i64 offset, i64 length);
+
+private:
+    SpliceReceiver(const SpliceReceiver&);
+    SpliceReceiver& operator=(const SpliceReceiver&);
+
+    i32 pipe_[2];
+    u32 buffered_;  /* bytes in the pipe that are not written to the file yet */
+};
+
+#endif /* __splice_receiver_h__ */
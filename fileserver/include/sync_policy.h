@@ -0,0 +1,50 @@
+#ifndef __sync_policy_h__
+#define __sync_policy_h__
+
+#include "filetransfer_defines.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Synchronization state of one received file
+struct SyncState
+{
+    SyncState()
+        : unsynced_(0),
+        syncedAt_(0)
+    {}
+
+    u64 unsynced_;  /* bytes written since the last synchronization */
+    u64 syncedAt_;  /* time of the last synchronization (or the first writing) */
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Durability policy: when the received data is forced to the disk.
+//  none     - the data is left to the system page cache, the file is just closed
+//  periodic - fdatasync() after every 'bytes' written or 'interval' passed, and at finish
+//  finish   - fdatasync() once the whole file is received
+class SyncPolicy
+{
+public:
+    SyncPolicy(Durability mode = none_Durability, u64 bytes = 0, u64 interval = 0);
+
+    /*  Accounts the written bytes
+        @Returns true if the file must be synchronized now
+    */
+    bool written(SyncState* state, u64 bytes) const;
+
+    /*  Resets the state after synchronization */
+    void synced(SyncState* state) const;
+
+    /*  Returns true if the file must be synchronized before it is closed */
+    bool at_finish() const
+    { return mode_ != none_Durability; }
+
+    Durability mode() const
+    { return mode_; }
+
+private:
+    Durability mode_;
+    u64 bytes_;
+    u64 interval_;
+};
+
+#endif /* __sync_policy_h__ */
@@ -0,0 +1,101 @@
+#ifndef __uring_receiver_h__
+#define __uring_receiver_h__
+
+#include "filetransfer_defines.h"
+#include "ioring.h"
+#include "socket.h"
+#include "sync_policy.h"
+
+#include <string>
+#include <vector>
+#include <list>
+
+////////////////////////////////////////////////////////////////////////////////
+// The party that gives the file payload to receive by UringReceiver
+class UringOwner
+{
+public:
+    virtual ~UringOwner() {}
+
+    /*  Called in the worker thread when the payload is received and written to the file.
+        @param written - the number of bytes written
+        @param error - the failure reason or empty string on success
+    */
+    virtual void payload_done(i64 written, const std::string& error) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Receives the file payloads with io_uring: each socket read is linked with
+// the file write from the same registered buffer, so the data goes to the disk
+// without the parser and stdio copies and without the system call per chunk.
+// @note Must be used by one thread (the worker reactor thread).
+class UringReceiver
+{
+public:
+    /*  @param depth - the number of registered buffers (chunks in flight)
+        @param chunkSize - the size of one buffer
+        @param sync - the durability policy, the periodic synchronization is queued to the ring
+        @throw system_exception if io_uring is not available
+    */
+    UringReceiver(u16 depth, u32 chunkSize, const SyncPolicy& sync);
+    ~UringReceiver();
+
+    /*  Starts receiving of 'length' bytes from the socket to the file at 'offset' */
+    void receive(UringOwner* owner, SD sock, i32 fileFd, i64 offset, i64 length);
+
+    /*  Forgets the owner, its requests in flight are completed silently */
+    void abandon(UringOwner* owner);
+
+    /*  Handles all the available completions */
+    void complete();
+
+    /*  Returns the ring descriptor, it is readable when completions are available */
+    i32 get_fd() const
+    { return ring_.get_fd(); }
+
+private:
+    struct Transfer
+    {
+        UringOwner* owner_;
+        SD   sock_;
+        i32  fileFd_;
+        i64  offset_;     /* file offset of the next read chunk */
+        i64  remaining_;  /* bytes to read from the socket */
+        i64  written_;    /* bytes written to the file */
+        u16  inflight_;   /* buffers owned by the transfer */
+        bool reading_;    /* socket read is in flight */
+        bool syncing_;    /* file synchronization is in flight */
+        SyncState sync_;
+        std::string error_;
+    };
+
+    struct Buffer
+    {
+        u8*  data_;
+        u32  length_;     /* the requested length */
+        u32  retry_;      /* bytes to write when the linked write is cancelled by short read */
+        i64  offset_;
+        Transfer* transfer_;
+    };
+    typedef std::list<Transfer*> TransfersT;
+
+    /*  Queues the next read-write chain of the transfer if possible */
+    void pump(Transfer* transfer);
+
+    /*  Calls owner back and forgets the transfer if it has nothing in flight */
+    bool finish(Transfer* transfer);
+
+    void on_read(u16 index, i32 result);
+    void on_write(u16 index, i32 result);
+    void on_sync(Transfer* transfer, i32 result);
+
+    std::vector<u8> memory_; /* registered buffers, they are released after the ring is closed */
+    IoRing ring_;
+    u32    chunkSize_;
+    SyncPolicy sync_;
+    std::vector<Buffer> buffers_;
+    std::vector<u16>    free_;
+    TransfersT transfers_;
+};
+
+#endif /* __uring_receiver_h__ */
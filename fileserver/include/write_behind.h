@@ -0,0 +1,246 @@
+#ifndef __write_behind_h__
+#define __write_behind_h__
+
+#include "filetransfer_defines.h"
+#include "thread.h"
+#include "condition.h"
+#include "message.h"
+#include "sync_policy.h"
+
+#include <map>
+#include <list>
+#include <vector>
+
+class Reactor;
+class AlignedPool;
+
+////////////////////////////////////////////////////////////////////////////////
+// Write-behind stage between the network receiving and the disk.
+// The receiving tasks put the data on the per-file queues and the pool of disk
+// threads writes them at their offsets. When the file queue exceeds the limit
+// the receiving task stops reading its connection (so the TCP window closes and
+// the sender slows down) until the queue is halved, then the task is resumed
+// by its reactor. The disk threads also synchronize the files according to
+// the durability policy and run the other disk work of receiving tasks (jobs),
+// which would stall the reactor thread otherwise.
+class WriteBehind
+{
+public:
+    /*  The disk work of receiving task, the task is resumed by its reactor when it is done */
+    class Job
+    {
+    public:
+        Job();
+        virtual ~Job();
+
+        /*  Does the work, its exception is kept as the error of job */
+        void execute();
+
+        /*  Returns the error of done job, it is empty if the job succeeded */
+        const std::string& error() const { return error_; }
+
+    protected:
+        /*  Does the work in a disk thread or in the reactor thread if there are no disk threads
+            @throw Exception
+        */
+        virtual void run() = 0;
+
+        volatile bool cancelled_; /* the task gave the job up, so the long work may stop early */
+
+    private:
+        friend class WriteBehind;
+        std::string error_;
+        bool done_;         /* the job is run, the disk threads don't refer to it anymore */
+        Reactor* reactor_;  /* the task waiting for the job */
+        Task* task_;
+    };
+
+    /*  Queue metrics */
+    struct Stats
+    {
+        u64 queuedBytes_;       /* bytes waiting for the disk */
+        u32 queuedChunks_;      /* chunks waiting for the disk */
+        u64 peakQueuedBytes_;   /* the maximum of queued bytes */
+        u64 writtenBytes_;      /* bytes written to the disk */
+        u32 blockedNow_;        /* connections that stopped reading on full queue */
+        u32 blockings_;         /* times connections stopped reading on full queue */
+        u64 blockedTime_;       /* total time in milliseconds of stopped reading */
+        u32 syncs_;             /* fdatasync() calls */
+    };
+
+    /*  @param threads - the number of disk threads
+        @param limit - the queue size of one file in bytes
+        @param sync - the durability policy
+    */
+    WriteBehind(u16 threads, u32 limit, const SyncPolicy& sync);
+    ~WriteBehind();
+
+    /*  Writes all the queued data and stops the disk threads */
+    void stop();
+
+    /*  Queues the data to write to the file at the offset.
+        @param reactor, task - the receiving task to resume when the file queue has room again
+        @Returns false if the file queue is full, so the task must stop reading until it is resumed.
+        @throw Exception if the previous writing to the file is failed
+    */
+    bool write(RawFile* file, const u8* data, u32 size, i64 offset, Reactor* reactor, Task* task);
+
+    /*  Queues the buffer of pool without copying, it is given back to the pool when it is written.
+        The aligned buffers of direct file are written as they are.
+        @see write
+    */
+    bool write(RawFile* file, u8* buffer, AlignedPool* pool, u32 size, i64 offset, Reactor* reactor, Task* task);
+
+    /*  Checks if the file queue has room, otherwise the task is resumed when it has.
+        @throw Exception if the writing to the file is failed
+    */
+    bool ready(RawFile* file, Reactor* reactor, Task* task);
+
+    /*  Checks if all the queued data of file is written (and synchronized if the policy
+        requires it at finish), otherwise the task is resumed when it is.
+        @throw Exception if the writing to the file is failed
+    */
+    bool flushed(RawFile* file, Reactor* reactor, Task* task);
+
+    /*  Marks the file as written bypassing the queue, so it is synchronized at finish */
+    void touch(RawFile* file);
+
+    /*  Queues the job for a disk thread, the jobs go before the writings since the connections
+        wait for them
+        @param reactor, task - the receiving task to resume when the job is done
+    */
+    void submit(Job* job, Reactor* reactor, Task* task);
+
+    /*  Returns true if the job is done, so it may be deleted */
+    bool done(const Job* job) const;
+
+    /*  Drops the queued job or waits until the running one is done, so it may be deleted */
+    void cancel(Job* job);
+
+    /*  Forgets the task, so it is not resumed anymore */
+    void forget(Task* task);
+
+    /*  Drops the state of the file which is not received to the end, so it may be closed and reused.
+        @Returns false if the disk threads still have its data
+    */
+    bool abandon(RawFile* file);
+
+    /*  Returns the current metrics */
+    Stats get_stats() const;
+
+private:
+    struct Chunk
+    {
+        i64 offset_;
+        const u8* data_;
+        u32 size_;
+        Message copy_;      /* the copied data */
+        AlignedPool* pool_; /* the owner of data if it is not copied */
+    };
+    typedef std::list<Chunk*> ChunksT;
+
+    struct FileQueue
+    {
+        RawFile* file_;
+        ChunksT  chunks_;
+        u64  bytes_;        /* queued and being written bytes */
+        bool busy_;         /* a disk thread writes the queue now */
+        bool scheduled_;    /* the queue is in the ready list */
+        std::string error_;
+        Reactor* reactor_;  /* the task waiting for the queue */
+        Task* waiter_;
+        bool waitFlushed_;  /* the task waits for the empty queue, otherwise for the room */
+        u64  blockedSince_; /* time when the task stopped reading on full queue, 0 if not */
+        SyncState sync_;    /* it is used by the disk thread that writes the queue */
+        bool syncPending_;  /* the file must be synchronized once the queue is written */
+        bool synced_;       /* nothing is written since the last synchronization */
+    };
+    typedef std::map<RawFile*, FileQueue*> QueuesT;
+    typedef std::list<FileQueue*> ReadyT;
+    typedef std::list<Job*> JobsT;
+
+    class DiskThread : public Thread
+    {
+    public:
+        DiskThread(const std::string& name, WriteBehind* owner);
+    protected:
+        virtual void run();
+    private:
+        WriteBehind* owner_;
+    };
+    typedef std::vector<DiskThread*> ThreadsT;
+    friend class DiskThread;
+
+    /*  The disk thread routine */
+    void drain();
+
+    /*  Runs the job and resumes its task
+        @note Synchronized, the job is run unlocked
+    */
+    void run_job(Job* job);
+
+    /*  Writes the chunks, the contiguous ones are written by one system call
+        @Returns the number of written bytes
+        @throw Exception
+    */
+    u64 write_chunks(RawFile* file, const ChunksT& chunks);
+
+    /*  Writes the contiguous buffers at the offset and accounts them for the cache policy
+        @Returns the number of written bytes
+        @throw Exception
+    */
+    u64 write_range(RawFile* file, const std::vector<struct iovec>& iov, i64 offset);
+
+    /*  Puts the chunk on the file queue
+        @Returns false if the queue is full
+        @note Non-synchronized
+    */
+    bool enqueue(RawFile* file, Chunk* chunk, Reactor* reactor, Task* task);
+
+    /*  Frees the chunk with its data */
+    static void release(Chunk* chunk);
+
+    /*  Schedules the queue for a disk thread if it is not scheduled yet
+        @note Non-synchronized
+    */
+    void schedule(FileQueue* queue);
+
+    /*  Returns true if all the data of queue is on the disk according to the policy
+        @note Non-synchronized
+    */
+    bool is_flushed(const FileQueue* queue) const;
+
+    /*  Returns the existing or new file queue and checks its error
+        @note Non-synchronized
+    */
+    FileQueue* get_queue(RawFile* file);
+
+    /*  Registers the waiter
+        @note Non-synchronized
+    */
+    void wait(FileQueue* queue, Reactor* reactor, Task* task, bool flushed);
+
+    /*  Stops waiting of the room, counts the blocked time
+        @note Non-synchronized
+    */
+    void unblock(FileQueue* queue);
+
+    /*  Resumes the waiter if the queue state is what it waits for
+        @note Non-synchronized
+    */
+    void notify_waiter(FileQueue* queue);
+
+    mutable Mutex lock_;
+    Condition cond_;
+    Condition jobDone_; /* the running job is done, it is waited for when it is cancelled */
+    u32      limit_;
+    SyncPolicy sync_;
+    bool     stopping_;
+    QueuesT  queues_;
+    ReadyT   ready_;
+    JobsT    jobs_;     /* the jobs which are not run yet */
+    ThreadsT threads_;
+    Stats    stats_;
+};
+
+#endif /* __write_behind_h__ */
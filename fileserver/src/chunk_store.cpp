@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "chunk_store.h"
+#include "tree_hash.h"
+
+using namespace std;
+
+#define STORE_INDEX         "index"
+#define STORE_RECORD_SIZE   40          /* the name(32), the size(4) and the change of count(4) */
+#define RECIPE_SUFFIX       ".chunks"
+#define FILTER_BITS_PER_CHUNK 16    /* the filter is sized for the chunks of store doubled at least */
+#define FILTER_MIN_BITS_PER_CHUNK 8 /* the filter is made anew below it, 2% of the chunks pass it falsely then */
+#define FILTER_HASHES       6
+#define FILTER_STALE_KEYS   65536   /* the published filter is taken anew after as many keys are added to it */
+
+namespace {
+
+inline void put32(u8* ptr, u32 value)
+{
+    ptr[0] = (u8)(value >> 24); ptr[1] = (u8)(value >> 16); ptr[2] = (u8)(value >> 8); ptr[3] = (u8)value;
+}
+
+inline u32 get32(const u8* ptr)
+{
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) | ((u32)ptr[2] << 8) | ptr[3];
+}
+
+/*  Reads the whole file, it is empty if there is none */
+string read_all(const string& path)
+{
+    string data;
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( NULL == file )
+        return data;
+    char buffer[65536];
+    size_t length;
+    while( 0 < (length = fread( buffer, 1, sizeof(buffer), file )) )
+        data.append( buffer, length );
+    fclose( file );
+    return data;
+}
+
+/*  Writes the file anew, it is replaced at once */
+void write_all(const string& path, const string& data)
+{
+    string temp = path + ".tmp";
+    {
+        File file( temp, "wb" );
+        if( !data.empty() )
+            file.write( data.data(), (u32)data.size(), true );
+    }
+    File::replace( temp, path );
+}
+
+/*  Returns the directory of chunks beginning with the byte */
+string byte_dir(u32 value)
+{
+    static const char digits[] = "0123456789abcdef";
+    string text;
+    text += digits[(value >> 4) & 0x0f];
+    text += digits[value & 0x0f];
+    return text;
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+ChunkStore::ChunkStore(const string& dir)
+    : dir_(dir),
+    bytes_(0),
+    generation_(0)
+{
+    File::createDirectory( dir_ );
+    for(u32 i = 0; i < 256; ++i)
+        File::createDirectory( dir_ + "/" + byte_dir(i) );
+    load();
+}
+
+ChunkStore::~ChunkStore()
+{
+}
+
+bool ChunkStore::has(const u8* name) const
+{
+    MGuard g(lock_);
+    return index_.end() != index_.find( ChunkStore::name(name) );
+}
+
+bool ChunkStore::read(const u8* name, u32 size, Message* data) const
+{
+    Name key = ChunkStore::name(name);
+    {
+        MGuard g(lock_);
+        IndexT::const_iterator It = index_.find( key );
+        if( index_.end() == It || It->second.size_ != size )
+            return false;
+    }
+
+    // the chunks are removed when the store is opened only, so the file stays
+    data->reserve( size );
+    data->resize( size );
+    File file( chunk_path(key), "rb" );
+    file.read( data->get(), size );
+    return true;
+}
+
+void ChunkStore::put(const u8* name, const u8* data, u32 size)
+{
+    Name key = ChunkStore::name(name);
+    {
+        MGuard g(lock_);
+        // the chunk received by several streams at once is written by the first one
+        if( index_.end() != index_.find( key ) || !writing_.insert( key ).second )
+            return;
+    }
+
+    // the other streams look the store up while the chunk is written
+    string path = chunk_path(key);
+    try {
+        {
+            File file( path + ".tmp", "wb" );
+            file.write( data, size, true );
+        }
+        File::replace( path + ".tmp", path );
+    }
+    catch(...) {
+        MGuard g(lock_);
+        writing_.erase( key );
+        throw;
+    }
+
+    MGuard g(lock_);
+    writing_.erase( key );
+    Entry& entry = index_[key];
+    entry.size_ = size;
+    bytes_ += size;
+    // the chunk which no file refers to is dropped at opening, so its record may be lost by a crash
+    journal( key, size, 0 );
+
+    u64 filterKey = ChunkFilter::key(name);
+    filter_.add( filterKey );
+    added_.push_back( filterKey );
+    // the senders would wait for the answers of the chunks falsely passing the full filter
+    if( filter_.bits() < CDC_FILTER_MAX_BITS &&
+        (u64)index_.size() * FILTER_MIN_BITS_PER_CHUNK > ((u64)1 << filter_.bits()) )
+        make_filter();
+}
+
+void ChunkStore::refer(const string& path, const string& records)
+{
+    MGuard g(lock_);
+
+    // the new chunks are counted before the old ones are released, so the shared ones never drop to 0
+    string recipe;
+    const u8* data = (const u8*)records.data();
+    for(size_t pos = 0; pos + CDC_RECORD_SIZE <= records.size(); pos += CDC_RECORD_SIZE)
+    {
+        IndexT::iterator It = index_.find( name(data + pos) );
+        if( index_.end() == It || It->second.size_ != Chunker::record_size(data + pos) )
+            continue;
+        ++It->second.refs_;
+        journal( It->first, It->second.size_, 1 );
+        recipe.append( records, pos, CDC_RECORD_SIZE );
+    }
+
+    string old = read_all( path + RECIPE_SUFFIX );
+    data = (const u8*)old.data();
+    for(size_t pos = 0; pos + CDC_RECORD_SIZE <= old.size(); pos += CDC_RECORD_SIZE)
+    {
+        IndexT::iterator It = index_.find( name(data + pos) );
+        if( index_.end() == It )
+            continue;
+        --It->second.refs_;
+        journal( It->first, It->second.size_, -1 );
+    }
+    log_.flush();
+
+    if( recipe.empty() )
+        remove( (path + RECIPE_SUFFIX).c_str() );
+    else
+        write_all( path + RECIPE_SUFFIX, recipe );
+}
+
+u64 ChunkStore::chunks() const
+{
+    MGuard g(lock_);
+    return index_.size();
+}
+
+u64 ChunkStore::bytes() const
+{
+    MGuard g(lock_);
+    return bytes_;
+}
+
+RefCountedPtr<ChunkStore::Filter> ChunkStore::filter() const
+{
+    MGuard g(lock_);
+    // the connections share the taken filter, the keys added since then go by ADDED frames
+    if( !published_ || published_->generation_ != generation_ ||
+        published_->keys_ + FILTER_STALE_KEYS <= added_.size() )
+    {
+        Filter* filter = new Filter();
+        filter->generation_ = generation_;
+        filter->bits_ = filter_.bits();
+        filter->hashes_ = filter_.hashes();
+        filter->data_ = filter_.data();
+        filter->keys_ = added_.size();
+        published_.reset( filter, false );
+    }
+    return published_;
+}
+
+bool ChunkStore::added(u32 generation, u64* from, vector<u64>* keys) const
+{
+    MGuard g(lock_);
+    if( generation != generation_ )
+        return false;
+    if( *from < added_.size() )
+        keys->insert( keys->end(), added_.begin() + (size_t)*from, added_.end() );
+    *from = added_.size();
+    return true;
+}
+
+ChunkStore::Name ChunkStore::name(const u8* hash)
+{
+    Name name;
+    memcpy(name.hash_, hash, CDC_HASH_SIZE);
+    return name;
+}
+
+string ChunkStore::chunk_path(const Name& name) const
+{
+    return dir_ + "/" + byte_dir(name.hash_[0]) + "/" + TreeHash::hex(name.hash_);
+}
+
+void ChunkStore::load()
+{
+    // the record cut by a crash is the last one, it is dropped
+    string path = dir_ + "/" + STORE_INDEX;
+    string records = read_all( path );
+    const u8* data = (const u8*)records.data();
+    for(size_t pos = 0; pos + STORE_RECORD_SIZE <= records.size(); pos += STORE_RECORD_SIZE)
+    {
+        Entry& entry = index_[ name(data + pos) ];
+        entry.size_ = get32(data + pos + CDC_HASH_SIZE);
+        entry.refs_ += (i32)get32(data + pos + CDC_HASH_SIZE + 4);
+    }
+
+    // the chunks which no file refers to are left by the interrupted transfers or the replaced files
+    string compacted;
+    for(IndexT::iterator It = index_.begin(); It != index_.end(); )
+    {
+        if( It->second.refs_ <= 0 )
+        {
+            remove( chunk_path(It->first).c_str() );
+            index_.erase( It++ );
+            continue;
+        }
+        u8 record[STORE_RECORD_SIZE];
+        memcpy(record, It->first.hash_, CDC_HASH_SIZE);
+        put32(record + CDC_HASH_SIZE, It->second.size_);
+        put32(record + CDC_HASH_SIZE + 4, (u32)It->second.refs_);
+        compacted.append( (const char*)record, STORE_RECORD_SIZE );
+        bytes_ += It->second.size_;
+        ++It;
+    }
+    write_all( path, compacted );
+    log_.open( path, "ab" );
+
+    // the filter is not shrunk as the chunks are removed, so it is sized here for the ones left
+    make_filter();
+}
+
+void ChunkStore::journal(const Name& name, u32 size, i32 refs)
+{
+    u8 record[STORE_RECORD_SIZE];
+    memcpy(record, name.hash_, CDC_HASH_SIZE);
+    put32(record + CDC_HASH_SIZE, size);
+    put32(record + CDC_HASH_SIZE + 4, (u32)refs);
+    log_.write( record, STORE_RECORD_SIZE );
+}
+
+void ChunkStore::make_filter()
+{
+    u32 bits = CDC_FILTER_MIN_BITS;
+    while( bits < CDC_FILTER_MAX_BITS && ((u64)1 << bits) < (u64)index_.size() * FILTER_BITS_PER_CHUNK )
+        ++bits;
+    filter_.reset( bits, FILTER_HASHES );
+    for(IndexT::const_iterator It = index_.begin(); It != index_.end(); ++It)
+        filter_.add( ChunkFilter::key(It->first.hash_) );
+    added_.clear();
+    ++generation_;
+}
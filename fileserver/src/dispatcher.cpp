@@ -4,16 +4,102 @@
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////
-Dispatcher::Dispatcher(u16 serverPort, const IPAddress& serverHost)
+Dispatcher::Dispatcher(u16 serverPort, const IPAddress& serverHost, const ServerOptions& options)
     : Thread("FileServer"),
+    sync_(options.durability_, options.syncBytes_, options.syncInterval_),
+    preallocate_(options.preallocate_),
+    cache_(options.cache_),
+    hashers_(options.hashThreads_),
+    packers_(options.packThreads_),
+    reported_(0),
+    next_(0),
     shutdown_(false)
 {
     IPAddress::init();
 
+    if( options.diskThreads_ > 0 )
+        writer_.reset( new WriteBehind(options.diskThreads_, options.writeQueue_, sync_) );
+    if( !options.store_.empty() )
+        store_.reset( new ChunkStore(options.store_) );
+
+    u16 workers = options.workers_;
+    if( workers == 0 )
+        workers = Thread::getNumberOfProcessors();
+    RecvEngine engine = options.engine_;
+    if( engine == uring_RecvEngine && !IoRing::isSupported() ) {
+        warning( "WARNING: io_uring is not supported by the system, so the copy receiving engine is used" );
+        engine = copy_RecvEngine;
+    }
+    if( engine == splice_RecvEngine && !SpliceReceiver::isSupported() ) {
+        warning( "WARNING: splice() is not supported by the system, so the copy receiving engine is used" );
+        engine = copy_RecvEngine;
+    }
+
+    for(u16 i = 0; i < workers; ++i)
+        workers_.push_back( new Worker("Reactor-" + tostring((u32)i), cache_) );
+
+    // the workers run the same engine, so io_uring is given up on all of them if one can't set it up
+    if( engine == uring_RecvEngine )
+    {
+        vector<UringTask*> tasks;
+        try {
+            for(u16 i = 0; i < workers; ++i)
+            {
+                Worker* worker = workers_[i];
+                worker->uring_.reset( new UringReceiver(DEF_URING_DEPTH, DEF_URING_CHUNK_SIZE, sync_) );
+                tasks.push_back( new UringTask("uringtask-" + tostring((u32)i), worker->uring_.get()) );
+                worker->reactor_.attach( worker->uring_->get_fd(), tasks.back() );
+            }
+        }
+        catch(const Exception& ex) {
+            warning( "WARNING: io_uring setup is failed (" + ex.reason() + "), so the copy receiving engine is used" );
+            for(size_t i = 0; i < tasks.size(); ++i) {
+                workers_[i]->reactor_.detach( tasks[i], true );
+                delete tasks[i];
+            }
+            for(u16 i = 0; i < workers; ++i)
+                workers_[i]->uring_.reset();
+            engine = copy_RecvEngine;
+        }
+    }
+
+    if( options.direct_ )
+    {
+        if( engine == copy_RecvEngine )
+            directPool_.reset( new AlignedPool(DEF_DIRECT_CHUNK_SIZE, DIRECT_IO_ALIGNMENT, DEF_DIRECT_POOL_SIZE) );
+        else
+            warning( "WARNING: direct writing is supported by the copy receiving engine only, so the files are cached" );
+    }
+    engine_ = engine;
+
     server_.reset( new FileServer(serverPort, serverHost, this, this) );
+    if( writer_.get() )
+        timer_.schedule( new MetricsTask("metrics", this), DEF_METRICS_INTERVAL, DEF_METRICS_INTERVAL );
     start();
 
     string msg = "\nFileServer is started on \"" + serverHost.getHostName() + ":" + tostring(serverPort) + "\"";
+    msg += " with " + tostring((u32)workers) + " receiving workers";
+    msg += (engine == uring_RecvEngine) ? " (io_uring)" : (engine == splice_RecvEngine) ? " (splice)" : "";
+    if( writer_.get() )
+        msg += ", " + tostring((u32)options.diskThreads_) + " disk threads";
+    if( hashers_.threads() > 0 )
+        msg += ", " + tostring((u32)hashers_.threads()) + " hashing threads";
+    if( packers_.threads() > 0 )
+        msg += ", " + tostring((u32)packers_.threads()) + " unpacking threads";
+    if( sync_.mode() == periodic_Durability )
+        msg += ", fdatasync every " + tostring(options.syncBytes_) + " bytes or " + tostring(options.syncInterval_) + " ms";
+    else if( sync_.mode() == finish_Durability )
+        msg += ", fdatasync at the end of file";
+    if( preallocate_ )
+        msg += ", files are preallocated";
+    if( store_.get() )
+        msg += ", chunk store \"" + store_->dir() + "\" (" + tostring(store_->chunks()) + " chunks, " +
+               tostring(store_->bytes()) + " bytes)";
+    if( directPool_.get() )
+        msg += ", direct writing";
+    else if( cache_ == drop_CachePolicy )
+        msg += ", written pages are dropped from the system cache";
+    msg += "\n\tpress 'S' to show the disk queue statistics";
     msg += "\n\tpress'Q' or 'Esc' to FileServer exit";
     notify(msg);
     debug(msg);
@@ -27,15 +113,27 @@ Dispatcher::~Dispatcher()
 
 void Dispatcher::shutdown()
 {
-    runner_.cancel();
-    runner_.join();
+    WorkersT::iterator It = workers_.begin();
+    for(; It != workers_.end(); ++It) {
+        (*It)->reactor_.cancel();
+        (*It)->reactor_.join();
+    }
+    timer_.cancel();
+    timer_.join();
+
+    // the queued data is written before the files are closed
+    if( writer_.get() )
+        writer_->stop();
 
     MGuard guard( lock_ );
     shutdown_ = true;
 
     server_->stop();
     server_->join();
-    fd2file_.clear();
+
+    for(It = workers_.begin(); It != workers_.end(); ++It)
+        delete *It;
+    workers_.clear();
 
     cancel();
 }
@@ -56,6 +154,9 @@ void Dispatcher::run()
         case SC_ESC:
             ch = 'Q';
             break;
+        case 'S':
+            report_metrics(true);
+            break;
         case 0:
             break;
         default:
@@ -78,13 +179,41 @@ Task* Dispatcher::create_task(TaskSpec type, TCPSockClient* conn)
     if( type == recv_TaskSpec )
     {
         u32 fd = conn->get_fd();
-        if( fd2file_.end() == fd2file_.find(fd) )
-            fd2file_.insert( Fd2FileT::value_type(fd,new File()) );
+        Worker* worker = choose_worker();
+
+        SpliceReceiver* splice = NULL;
+        if( engine_ == splice_RecvEngine )
+        {
+            try {
+                splice = new SpliceReceiver();
+            }
+            catch(const Exception& ex) {
+                warning( "WARNING: " + ex.reason() + ", so the connection is received by copying" );
+            }
+        }
 
         RecvTask* task = new RecvTask("recvtask-" + tostring(fd),
                                       this, this, conn,
-                                      fd2file_[fd].get());
-        runner_.schedule(task,0,0);
+                                      &worker->files_,
+                                      &stripes_,
+                                      &hashers_,
+                                      &packers_,
+                                      store_.get(),
+                                      worker->uring_.get(),
+                                      splice,
+                                      writer_.get(),
+                                      &worker->reactor_,
+                                      sync_,
+                                      preallocate_,
+                                      directPool_.get());
+        try {
+            worker->reactor_.attach(fd, task);
+        }
+        catch(const Exception& ex) {
+            error( "ERROR: " + ex.reason() );
+            delete task;
+            return NULL;
+        }
         return task;
     }
     return NULL;
@@ -92,6 +221,50 @@ Task* Dispatcher::create_task(TaskSpec type, TCPSockClient* conn)
 
 void Dispatcher::destroy_task( Task* task )
 {
-    runner_.cancel(task);
+    WorkersT::iterator It = workers_.begin();
+    for(; It != workers_.end(); ++It)
+        if( (*It)->reactor_.detach(task) )
+            break;
+}
+
+Dispatcher::Worker* Dispatcher::choose_worker()
+{
+    Worker* chosen = NULL;
+    u32 minLoad = 0;
+    for(u16 i = 0; i < workers_.size(); ++i)
+    {
+        Worker* worker = workers_[(next_ + i) % workers_.size()];
+        u32 load = worker->reactor_.size();
+        if( chosen == NULL || load < minLoad )
+        {
+            chosen = worker;
+            minLoad = load;
+        }
+    }
+    next_ = (next_ + 1) % workers_.size();
+    return chosen;
 }
 
+
+void Dispatcher::report_metrics(bool console)
+{
+    if( NULL == writer_.get() ) {
+        if( console )
+            notify("Disk queue is not used (--disk-threads=0)");
+        return;
+    }
+
+    WriteBehind::Stats stats = writer_->get_stats();
+    if( !console && stats.writtenBytes_ == reported_ && stats.queuedBytes_ == 0 )
+        return;
+    reported_ = stats.writtenBytes_;
+
+    string msg = "Disk queue: " + tostring(stats.queuedBytes_) + " bytes in " + tostring(stats.queuedChunks_) + " chunks";
+    msg += " (peak " + tostring(stats.peakQueuedBytes_) + " bytes), written " + tostring(stats.writtenBytes_) + " bytes";
+    msg += "; blocked connections " + tostring(stats.blockedNow_) + ", blockings " + tostring(stats.blockings_);
+    msg += ", blocked time " + tostring(stats.blockedTime_) + " ms";
+    msg += "; fdatasync calls " + tostring(stats.syncs_);
+    if( console )
+        notify(msg);
+    debug(msg);
+}
@@ -8,21 +8,103 @@
 
 using namespace std;
 
+namespace {
+
+/*  Returns the number of the option, the default one if the option is not given
+    @throw Exception if it is not a number in the range
+*/
+u64 number_option(OptionsT& args, const string& name, u64 low, u64 high, u64 value)
+{
+    if( args.end() == args.find(name) )
+        return value;
+    if( !atou64(args[name], &value) || value < low || value > high )
+        throw Exception("invalid " + name + " \"" + args[name] + "\" (" + tostring(low) + " to " + tostring(high) +
+                        " is expected)");
+    return value;
+}
+
+} // namespace
+
 //////////////////////////////////////////////////////////////////////////////////////////
 //  Application main
-int main()
+int main(int argc, char* argv[])
 {
     IPAddress::init();
     u16 listenPort = 0;
     try 
     {
+        OptionsT args;
+        parse_options(argc, argv, &args);
+
+        ServerOptions options;
+        options.workers_ = (u16)number_option(args, "workers", 0, 1024, options.workers_);
+        options.diskThreads_ = (u16)number_option(args, "disk-threads", 0, 256, options.diskThreads_);
+        options.hashThreads_ = (u16)number_option(args, "hash-threads", 0, 256, options.hashThreads_);
+        options.packThreads_ = (u16)number_option(args, "pack-threads", 0, 256, options.packThreads_);
+        // the queue of file takes one frame of payload at least
+        options.writeQueue_ = (u32)number_option(args, "write-queue", DEF_STREAM_QUANTUM, 0xffffffff, options.writeQueue_);
+        if( args.end() != args.find("durability") )
+        {
+            if( args["durability"] == "none" )
+                options.durability_ = none_Durability;
+            else if( args["durability"] == "periodic" )
+                options.durability_ = periodic_Durability;
+            else if( args["durability"] == "finish" )
+                options.durability_ = finish_Durability;
+            else
+                throw Exception("unknown durability \"" + args["durability"] + "\" (none, periodic or finish are expected)");
+        }
+        if( args.end() != args.find("sync-mb") )
+            options.syncBytes_ = number_option(args, "sync-mb", 0, 1048576, 0) * 1024 * 1024;
+        options.syncInterval_ = number_option(args, "sync-ms", 0, 86400000, options.syncInterval_);
+        if( args.end() != args.find("preallocate") )
+        {
+            if( args["preallocate"] == "yes" )
+                options.preallocate_ = true;
+            else if( args["preallocate"] == "no" )
+                options.preallocate_ = false;
+            else
+                throw Exception("unknown preallocate value \"" + args["preallocate"] + "\" (yes or no are expected)");
+        }
+        if( args.end() != args.find("direct") )
+        {
+            if( args["direct"] == "yes" )
+                options.direct_ = true;
+            else if( args["direct"] == "no" )
+                options.direct_ = false;
+            else
+                throw Exception("unknown direct value \"" + args["direct"] + "\" (yes or no are expected)");
+        }
+        if( args.end() != args.find("cache") )
+        {
+            if( args["cache"] == "keep" )
+                options.cache_ = keep_CachePolicy;
+            else if( args["cache"] == "drop" )
+                options.cache_ = drop_CachePolicy;
+            else
+                throw Exception("unknown cache policy \"" + args["cache"] + "\" (keep or drop are expected)");
+        }
+        if( args.end() != args.find("engine") )
+        {
+            if( args["engine"] == "uring" )
+                options.engine_ = uring_RecvEngine;
+            else if( args["engine"] == "splice" )
+                options.engine_ = splice_RecvEngine;
+            else if( args["engine"] == "copy" )
+                options.engine_ = copy_RecvEngine;
+            else
+                throw Exception("unknown receiving engine \"" + args["engine"] + "\" (copy, uring or splice are expected)");
+        }
+        if( args.end() != args.find("dedup") )
+            options.store_ = args["dedup"];
+
         cout << "\nPlease specify the server listen port: ";
         cin  >> listenPort;
         if( listenPort == 0 )
             listenPort = 80;
 
         IPAddress local = IPAddress::getLocalHost();
-        Dispatcher dispatcher(listenPort, local);
+        Dispatcher dispatcher(listenPort, local, options);
         dispatcher.join();
     }
     catch(const Exception& ex)
@@ -46,9 +128,9 @@ FileServer::FileServer(u16 port,
                        NotifyBase* notifyMgr)
     : Thread("FileServer"), 
     TCPSockServer(port, &host, true),
+    running_(true),
     factory_(factory),
-    notifyMgr_(notifyMgr),
-    running_(true)
+    notifyMgr_(notifyMgr)
 {
     start();
 }
@@ -0,0 +1,198 @@
+#include <stdio.h>
+
+#include "recv_stream.h"
+#include "useful.h"
+
+using namespace std;
+
+#define RESUME_SUFFIX ".resume"
+
+/////////////////////////////////////////////////////////////////////////
+bool ResumePoint::load(const string& path)
+{
+    FILE* file = fopen( (path + RESUME_SUFFIX).c_str(), "r" );
+    if( NULL == file )
+        return false;
+
+    char buffer[128] = {0};
+    size_t length = fread( buffer, 1, sizeof(buffer) - 1, file );
+    fclose( file );
+
+    // "size mtime hash committed"
+    u64 values[4] = {0};
+    string text( buffer, length );
+    string::size_type pos = 0;
+    for(u32 i = 0; i < 4; ++i)
+    {
+        string::size_type end = text.find_first_of( " \n", pos );
+        if( string::npos == end || !atou64(text.substr(pos, end - pos), &values[i]) )
+            return false;
+        pos = end + 1;
+    }
+
+    size_ = (i64)values[0];
+    identity_.mtime_ = (i64)values[1];
+    identity_.hash_ = values[2];
+    committed_ = (i64)values[3];
+    return 0 <= size_ && 0 <= committed_ && committed_ <= size_;
+}
+
+void ResumePoint::save(const string& path) const
+{
+    string text = tostring((u64)size_) + " " + tostring((u64)identity_.mtime_) + " " +
+                  tostring(identity_.hash_) + " " + tostring((u64)committed_) + "\n";
+
+    FILE* file = fopen( (path + RESUME_SUFFIX).c_str(), "w" );
+    if( NULL == file )
+        throw Exception("Can't write the resume point of \"" + path + "\"");
+    size_t written = fwrite( text.c_str(), 1, text.length(), file );
+    if( 0 != fclose( file ) || written != text.length() )
+        throw Exception("Can't write the resume point of \"" + path + "\"");
+}
+
+bool ResumePoint::same(const ResumePoint& other) const
+{
+    return size_ == other.size_ && identity_.mtime_ == other.identity_.mtime_ &&
+           identity_.hash_ == other.identity_.hash_;
+}
+
+void ResumePoint::drop(const string& path)
+{
+    remove( (path + RESUME_SUFFIX).c_str() );
+}
+
+/////////////////////////////////////////////////////////////////////////
+RecvStream::RecvStream(u32 id, RawFile* file, AlignedPool* directPool)
+    : id_(id),
+    file_(file),
+    size_(0),
+    received_(0),
+    windowed_(false),
+    window_(0),
+    credit_(0),
+    blocked_(false),
+    resumable_(false),
+    striped_(false),
+    checksummed_(false),
+    checking_(false),
+    dropping_(false),
+    crc_(0),
+    retransmits_(0),
+    compressed_(false),
+    packed_(false),
+    delta_(false),
+    basis_(NULL),
+    basisBlock_(0),
+    basisSize_(0),
+    copied_(0),
+    dedup_(false),
+    announced_(0),
+    gatherAt_(-1),
+    referenced_(0),
+    hash_(NULL),
+    hashFrom_(0),
+    directPool_(directPool),
+    directBuffer_(NULL),
+    directSize_(0),
+    directOffset_(0),
+    jobs_(0)
+{}
+
+RecvStream::~RecvStream()
+{
+    delete basis_;
+    delete hash_;
+    if( directBuffer_ )
+        directPool_->put( directBuffer_ );
+}
+
+/////////////////////////////////////////////////////////////////////////
+FilePool::FilePool(CachePolicy cache)
+    : cache_(cache)
+{}
+
+FilePool::~FilePool()
+{
+    MGuard g(lock_);
+    for(FilesT::iterator It = all_.begin(); It != all_.end(); ++It)
+        delete *It;
+}
+
+RawFile* FilePool::acquire()
+{
+    MGuard g(lock_);
+    if( !free_.empty() )
+    {
+        RawFile* file = free_.back();
+        free_.pop_back();
+        return file;
+    }
+
+    RawFile* file = new RawFile();
+    file->setCachePolicy( cache_ );
+    all_.push_back( file );
+    return file;
+}
+
+void FilePool::release(RawFile* file)
+{
+    file->close();
+
+    MGuard g(lock_);
+    free_.push_back( file );
+}
+
+/////////////////////////////////////////////////////////////////////////
+StripedFiles::StripedFiles()
+{}
+
+StripedFiles::~StripedFiles()
+{}
+
+void StripedFiles::open(RawFile* file, const string& path, i64 size, const FileStripe& stripe,
+                        bool direct, bool preallocate)
+{
+    // the other stripes wait until the file is created and sized
+    MGuard g(lock_);
+    TransfersT::iterator It = transfers_.find(stripe.transfer_);
+    if( It != transfers_.end() )
+    {
+        const Transfer& transfer = It->second;
+        if( transfer.path_ != path || transfer.size_ != size || transfer.count_ != stripe.count_ )
+            throw Exception("Stripe of \"" + path + "\" doesn't match the transfer of \"" + transfer.path_ + "\"");
+
+        file->open(path, "rb+", direct);
+        if( !file->isOpened() )
+            throw Exception("\nCan't open file \"" + path + "\" for writing");
+        return;
+    }
+
+    ResumePoint::drop(path);
+    file->open(path, "wb+", direct);
+    if( !file->isOpened() )
+        throw Exception("\nCan't open file \"" + path + "\" for writing");
+    file->resize(size);
+    if( preallocate )
+        file->allocate(size);
+
+    Transfer& transfer = transfers_[stripe.transfer_];
+    transfer.path_ = path;
+    transfer.size_ = size;
+    transfer.count_ = stripe.count_;
+}
+
+bool StripedFiles::received(const FileStripe& stripe, i64* size)
+{
+    MGuard g(lock_);
+    TransfersT::iterator It = transfers_.find(stripe.transfer_);
+    if( It == transfers_.end() )
+        return false;
+
+    // the transfer of interrupted stripe is kept, so the stripe sent again joins it
+    It->second.received_.insert(stripe.offset_);
+    if( It->second.received_.size() < It->second.count_ )
+        return false;
+    *size = It->second.size_;
+    transfers_.erase(It);
+    return true;
+}
@@ -1,138 +1,993 @@
+#include <algorithm>
+
 #include "server_parser.h"
 #include "dispatcher.h"
+#include "crc32c.h"
 #include <iostream>
 
 using namespace std;
 
+#define DELTA_SUFFIX ".delta"   /* the new file of delta stream is received next to the old one */
+
 /////////////////////////////////////////////////////////////////////////
-BufferParser::BufferParser(u16 splitBy, File* recvFile)
-    : splitBy_(splitBy),
-    recvFile_(recvFile)
+StreamJob::StreamJob(Kind kind, RecvStream* stream)
+    : kind_(kind),
+    stream_(stream),
+    file_(NULL),
+    store_(NULL),
+    offset_(0),
+    length_(0),
+    block_(0),
+    size_(0)
+{
+    memset(record_, 0, sizeof(record_));
+}
+
+void StreamJob::run()
+{
+    switch( kind_ )
+    {
+    case sign_Kind:
+    {
+        // the file is read entirely, so it takes as long as its reading
+        BlockSignatures blocks;
+        if( file_ )
+            blocks.compute(*file_, &cancelled_);
+        block_ = blocks.block_size();
+        size_ = blocks.size();
+        blocks.encode(&data_);
+        break;
+    }
+    case read_Kind:
+        data_.reserve( length_ );
+        data_.resize( length_ );
+        if( file_ ) {
+            if( file_->pread(data_.get(), length_, offset_) != length_ )
+                throw Exception("File \"" + file_->path() + "\" is cut while it is replaced");
+        }
+        else if( !store_->read(record_, length_, &data_) )
+            throw Exception("Chunk " + TreeHash::hex(record_) + " is not in the store");
+        break;
+    case store_Kind:
+    {
+        // the chunk of other data than announced is not stored, the tree hash tells what is wrong
+        u8 name[CDC_HASH_SIZE];
+        Chunker::hash(data_.get(), data_.size(), name);
+        if( 0 == memcmp(name, record_, CDC_HASH_SIZE) )
+            store_->put(name, data_.get(), data_.size());
+        break;
+    }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+StreamParser::StreamParser(FilePool* files, StripedFiles* stripes, AlignedPool* directPool, bool preallocate)
+    : files_(files),
+    stripes_(stripes),
+    directPool_(directPool),
+    preallocate_(preallocate)
+{}
+
+StreamParser::~StreamParser()
+{}
+
+void StreamParser::finish(StreamJob*, RawPackagesT*)
 {}
 
-u16 BufferParser::operator()(const u8* buffer,
-                             u32 bufferSize,
-                             RawMessagesT* messages,
-                             bool* done) const
+RecvStream* StreamParser::create_stream(u32 id, string path, i64 sizeOfFile, const FileIdentity* resume,
+                                        const FileStripe* stripe, bool delta)
 {
-    static u32 commonsize = 0;
-    *done = false;
+    string::size_type pos = path.find_last_of("\\/");
+    if( pos != string::npos && pos < path.length() )
+        path = path.substr(pos+1);
+
+    ResumePoint point;
+    point.size_ = sizeOfFile;
+    point.committed_ = 0;
+    if( resume )
+    {
+        // the received part is used only if it is left by the same file of sender
+        ResumePoint saved;
+        point.identity_ = *resume;
+        if( saved.load(path) && saved.same(point) && File::doesExist(path) )
+            point.committed_ = saved.committed_;
+        // the direct writing goes by the aligned buffers
+        if( directPool_ )
+            point.committed_ &= ~(i64)(directPool_->alignment() - 1);
+    }
+
+    RawFile* file = files_->acquire();
+    RawFile* basis = NULL;
+    try {
+        if( stripe )
+        {
+            // the file is created and sized by the first stripe of transfer
+            stripes_->open(file, path, sizeOfFile, *stripe, NULL != directPool_, preallocate_);
+            cout << "Receiving stripe " + tostring(stripe->offset_) + "+" + tostring(stripe->length_) +
+                    " of file \"" + path + "\"...\n";
+            file->seek((i64)stripe->offset_, SEEK_SET);
+        }
+        else
+        {
+            if( 0 < point.committed_ )
+            {
+                file->open(path,"rb+",NULL != directPool_);
+                // the file gets its size at creation, so it is changed by someone else if the size differs
+                if( file->isOpened() && file->size() != sizeOfFile ) {
+                    file->close();
+                    point.committed_ = 0;
+                }
+            }
+            if( 0 == point.committed_ )
+            {
+                // the previous point doesn't match the truncated file anymore
+                ResumePoint::drop(path);
+                file->open(delta ? path + DELTA_SUFFIX : path,"wb+",NULL != directPool_);
+            }
+            if( !file->isOpened() )
+                throw Exception("\nCan't open file \"" + path + "\" for writing");
+            // the old file stays in place until the new one is received
+            if( delta && File::doesExist(path) )
+            {
+                basis = new RawFile();
+                basis->open(path,"rb");
+            }
 
-    if( bufferSize == 0 )
-        throw ZeroMsgReceivedException("buffer size is 0");
-    if( buffer == NULL )
-        throw ZeroMsgReceivedException("buffer is <null>");
+            if( 0 < point.committed_ )
+            {
+                cout << "Resuming file \"" + path + "\" from " + tostring(point.committed_) + " bytes...\n";
+                file->seek(point.committed_, SEEK_SET);
+            }
+            else
+            {
+                cout << "Receiving file \"" + path + "\"" + (delta ? " by delta" : "") + "...\n";
+                file->resize(sizeOfFile);
+                // the sparse file gets its extents piece by piece as the data lands, so the parallel
+                // receivings fragment it; the file stays sparse if the file system can't preallocate
+                if( preallocate_ )
+                    file->allocate(sizeOfFile);
+            }
+        }
+    }
+    catch(...) {
+        delete basis;
+        files_->release(file);
+        throw;
+    }
 
-    if( !recvFile_->isOpened() )
+    RecvStream* stream = new RecvStream(id, file, directPool_);
+    stream->size_ = sizeOfFile;
+    stream->received_ = point.committed_;
+    if( resume )
+    {
+        stream->resumable_ = true;
+        stream->resume_ = point;
+    }
+    if( stripe )
     {
-        commonsize = 0;
+        stream->size_ = (i64)stripe->length_;
+        stream->striped_ = true;
+        stream->stripe_ = *stripe;
+    }
+    if( delta )
+    {
+        stream->delta_ = true;
+        stream->target_ = path;
+        stream->basis_ = basis;
+    }
+    return stream;
+}
 
-        string path;
-        u32 sizeOfFile = 0;
-        u16 firstTagBytes = parseStartTags((const s8*)buffer, bufferSize, &path, &sizeOfFile);
-        buffer += firstTagBytes;
-        bufferSize -= firstTagBytes;
-        
-        string::size_type pos = path.find_last_of("\\/");
-        if( pos != string::npos && pos < path.length() )
-            path = path.substr(pos+1);
+/////////////////////////////////////////////////////////////////////////
+BufferParser::BufferParser(FilePool* files, AlignedPool* directPool, bool preallocate)
+    : StreamParser(files, NULL, directPool, preallocate),
+    state_(header_State),
+    stream_(NULL),
+    trailerMatched_(0),
+    printed_(0)
+{}
 
-        recvFile_->open(path,"wb+");
-        if( !recvFile_->isOpened() )
-            throw Exception("\nCan't open file \"" + path + "\" for writing");
-        else
-            cout << "Receiving file \"" + path + "\"...\n";
+BufferParser::~BufferParser()
+{
+    // the stream is detached by the owner if it has to wait for the writings
+    if( stream_ )
+    {
+        files_->release(stream_->file_);
+        delete stream_;
+    }
+}
+
+u32 BufferParser::parse(const u8* buffer, u32 bufferSize, RawPackagesT* packages)
+{
+    u32 consumed = 0;
+    bool progressed = false;
+    while( consumed < bufferSize )
+    {
+        const u8* ptr = buffer + consumed;
+        u32 available = bufferSize - consumed;
+
+        if( header_State == state_ )
+        {
+            string path;
+            i64 sizeOfFile = 0;
+            u32 tagBytes = parseStartTags((const s8*)ptr, available, &path, &sizeOfFile);
+            if( 0 == tagBytes )
+                break;
 
-        recvFile_->resize(sizeOfFile);
+            stream_ = create_stream(0, path, sizeOfFile);
+            consumed += tagBytes;
+            printed_ = 0;
+            trailerMatched_ = 0;
+            state_ = (0 < sizeOfFile) ? body_State : trailer_State;
+        }
+        else if( body_State == state_ )
+        {
+            u64 left = data_left();
+            u32 portion = (left < available) ? (u32)left : available;
+            push_package( packages, stream_ ).data_.set(ptr, portion);
+            stream_->received_ += portion;
+            consumed += portion;
+            progressed = true;
+            if( stream_->received_ == stream_->size_ )
+                state_ = trailer_State;
+        }
+        else
+        {
+            // the finish tag with its terminating zero may come in pieces as well
+            u32 tagLen = strlen(TAG_FINISH_CONTENT) + 1;
+            u32 portion = min(tagLen - trailerMatched_, available);
+            if( memcmp(ptr, TAG_FINISH_CONTENT + trailerMatched_, portion) )
+                throw GarbledMsgReceivedException("Finish tag is not found after the content of \"" +
+                                                  stream_->file_->path() + "\"");
+            trailerMatched_ += portion;
+            consumed += portion;
+            if( trailerMatched_ == tagLen )
+            {
+                progress();
+                cout << "\nFile transfering \"" + stream_->file_->path() + "\" is done.\n\n";
+                push_package( packages, stream_ ).end_ = true;
+                stream_ = NULL;
+                state_ = header_State;
+                progressed = false;
+            }
+        }
     }
 
-    int decimal = commonsize;
+    if( progressed )
+        progress();
+    return consumed;
+}
+
+RecvStream* BufferParser::data_stream() const
+{
+    return (body_State == state_) ? stream_ : NULL;
+}
+
+u64 BufferParser::data_left() const
+{
+    return (body_State == state_) ? (u64)(stream_->size_ - stream_->received_) : 0;
+}
+
+void BufferParser::skip(u64 bytes)
+{
+    assert( bytes <= data_left() );
+    stream_->received_ += bytes;
+    if( stream_->received_ == stream_->size_ )
+        state_ = trailer_State;
+}
+
+void BufferParser::detach(RecvStreamsT* streams)
+{
+    if( stream_ )
+        streams->push_back(stream_);
+    stream_ = NULL;
+    state_ = header_State;
+}
+
+void BufferParser::progress()
+{
+    i64 decimal = printed_;
     // delete console numbers
     do{ decimal /= 10; cout << "\r";} while(decimal > 10);
-    // delete console " bytes" word 
+    // delete console " bytes" word
     do{ cout << "\r"; decimal++; } while(decimal < 6);
 
-    commonsize += bufferSize;
-    cout << commonsize << " bytes";
+    printed_ = stream_->received_;
+    cout << printed_ << " bytes";
+}
+
+u32 BufferParser::parseStartTags(const s8* buffer, u32 bufferSize, std::string* path, i64* sizeOfFile) const
+{
+    const s8* end = buffer + bufferSize;
+    const s8* closing = "/>";
+    const s8* ptr = buffer;
+
+    // the tags are checked as far as they are received, so the garbage is not waited for
+    u32 startTagLen = strlen(TAG_START_CONTENT);
+    if( 0 != memcmp(ptr, TAG_START_CONTENT, min(startTagLen, bufferSize)) )
+        throw GarbledMsgReceivedException("received buffer doesn't contain a filepath: invalid content \"" +
+                                           string().assign(ptr, min(startTagLen, bufferSize)) + "\"");
+    if( bufferSize < startTagLen )
+        return 0;
+
+    ptr += startTagLen;
+    const s8* eop = search(ptr, end, closing, closing + 2);
+    if( eop == end )
+    {
+        if( bufferSize >= DEF_RECVBUFFER_SIZE )
+            throw GarbledMsgReceivedException("transfering file has no path");
+        return 0;
+    }
+
+    path->assign(ptr, eop-ptr);
+    ptr = (eop+=2);
 
-    if( commonsize > recvFile_->size() ) 
+    u32 sizeTagLen = strlen(TAG_CONTENT_SIZE);
+    u32 rest = (u32)(end - ptr);
+    if( 0 != memcmp(ptr, TAG_CONTENT_SIZE, min(sizeTagLen, rest)) )
+        throw GarbledMsgReceivedException("received buffer doesn't contain the information with file size:"
+                                          " invalid content \"" + string().assign(ptr, min(sizeTagLen, rest)) + "\"");
+    if( rest < sizeTagLen )
+        return 0;
+
+    ptr += sizeTagLen;
+    if( end == (eop = search(ptr, end, closing, closing + 2)) )
     {
-        const u8* eop = buffer;
-        u16 finishTagLen = strlen(TAG_FINISH_CONTENT);
-        if( bufferSize < finishTagLen )
-            throw GarbledMsgReceivedException("Finish tag is not found in the received buffer from sock ");
+        if( bufferSize >= DEF_RECVBUFFER_SIZE )
+            throw GarbledMsgReceivedException("transfering file has no info size");
+        return 0;
+    }
+    string strSizeOfFile(ptr, eop-ptr);
+    eop += 2;
 
-        bufferSize -= finishTagLen+1;
+    // the images of virtual machines are far beyond 4 Gb
+    u64 size = 0;
+    if( !atou64(strSizeOfFile, &size) || size > (u64)((u64)-1 >> 1) )
+        throw GarbledMsgReceivedException("transfering file has invalid size \"" + strSizeOfFile + "\"");
+    *sizeOfFile = (i64)size;
+    return (u32)(eop-buffer);
+}
 
-        if( memcmp(buffer+bufferSize, TAG_FINISH_CONTENT,finishTagLen) )
-            throw GarbledMsgReceivedException("Finish tag is not found in the received buffer from sock ");
+/////////////////////////////////////////////////////////////////////////
+FrameParser::FrameParser(FilePool* files, StripedFiles* stripes, HashWorkers* hashers, PackWorkers* packers,
+                         ChunkStore* store, AlignedPool* directPool, bool preallocate)
+    : StreamParser(files, stripes, directPool, preallocate),
+    current_(NULL),
+    reading_(false),
+    dataLeft_(0),
+    hashers_(hashers),
+    packers_(packers),
+    store_(store)
+{}
 
-        cout << "\nFile transfering \"" + recvFile_->path() + "\" is done.\n\n";
-        *done = true;
-        commonsize = 0;
+FrameParser::~FrameParser()
+{
+    RecvStreamsT streams;
+    detach(&streams);
+    for(RecvStreamsT::iterator It = streams.begin(); It != streams.end(); ++It)
+    {
+        files_->release((*It)->file_);
+        delete *It;
     }
+}
 
-    if( splitBy_ ) {
-        u16 num = (u16)(bufferSize / splitBy_);
-        for(u16 i = 0; i < num; ++i) {
-            messages->push_back( Message(buffer+splitBy_*i, splitBy_) );
+u32 FrameParser::parse(const u8* buffer, u32 bufferSize, RawPackagesT* packages)
+{
+    u32 consumed = 0;
+    // the frames after COPY or REFERENCE frame wait for its payload
+    while( consumed < bufferSize && !reading_ )
+    {
+        const u8* ptr = buffer + consumed;
+        u32 available = bufferSize - consumed;
+
+        // the payload is passed on as is, only its length is counted
+        if( dataLeft_ > 0 )
+        {
+            u32 portion = (dataLeft_ < available) ? (u32)dataLeft_ : available;
+            if( current_->checksummed_ )
+            {
+                // the payload is kept until its checksum comes, the dropped one is skipped
+                if( !current_->dropping_ )
+                {
+                    current_->crc_ = crc32c(ptr, portion, current_->crc_);
+                    current_->chunk_.add(ptr, portion);
+                }
+                dataLeft_ -= portion;
+                consumed += portion;
+                continue;
+            }
+
+            push_package( packages, current_ ).data_.set(ptr, portion);
+            dataLeft_ -= portion;
+            current_->received_ += portion;
+            consumed += portion;
+            continue;
+        }
+
+        FrameHeader header;
+        if( available < FRAME_HEADER_SIZE )
+            break;
+        if( !decode_frame_header(ptr, &header) )
+            throw GarbledMsgReceivedException("invalid frame magic");
+        if( FRAME_VERSION != header.version_ )
+            throw GarbledMsgReceivedException("unsupported frame version " + tostring((u32)header.version_));
+        u16 known = 0;
+        if( start_FrameType == header.type_ )
+            known = windowed_FrameFlag | resume_FrameFlag | striped_FrameFlag | checksummed_FrameFlag | hashed_FrameFlag |
+                    compressed_FrameFlag | delta_FrameFlag | dedup_FrameFlag;
+        else if( data_FrameType == header.type_ )
+            known = resent_FrameFlag | packed_FrameFlag;
+        else if( copy_FrameType == header.type_ || reference_FrameType == header.type_ )
+            known = resent_FrameFlag;
+        else if( chunks_FrameType == header.type_ )
+            known = filtered_FrameFlag;
+        if( 0 != (header.flags_ & ~known) )
+            throw GarbledMsgReceivedException("unknown frame flags " + tostring((u32)header.flags_));
+
+        StreamsT::iterator It = streams_.find(header.stream_);
+        RecvStream* stream = (It != streams_.end()) ? It->second : NULL;
+        if( NULL == stream && start_FrameType != header.type_ )
+            throw GarbledMsgReceivedException("unknown stream " + tostring(header.stream_));
+
+        switch( header.type_ )
+        {
+        case start_FrameType:
+        {
+            if( stream )
+                throw GarbledMsgReceivedException("new file is started before the end of \"" +
+                                                  stream->file_->path() + "\"");
+            if( streams_.size() >= DEF_MAX_STREAMS )
+                throw GarbledMsgReceivedException("too many streams, the limit is " + tostring((u32)DEF_MAX_STREAMS));
+            if( (header.flags_ & resume_FrameFlag) && (header.flags_ & striped_FrameFlag) )
+                throw GarbledMsgReceivedException("the stripe of file can't be resumed");
+            if( (header.flags_ & hashed_FrameFlag) && !(header.flags_ & checksummed_FrameFlag) )
+                throw GarbledMsgReceivedException("the unchecked stream can't be hashed");
+            if( (header.flags_ & compressed_FrameFlag) && !(header.flags_ & checksummed_FrameFlag) )
+                throw GarbledMsgReceivedException("the unchecked stream can't be compressed");
+            if( (header.flags_ & delta_FrameFlag) &&
+                (!(header.flags_ & hashed_FrameFlag) || (header.flags_ & (resume_FrameFlag | striped_FrameFlag))) )
+                throw GarbledMsgReceivedException("the delta stream must be hashed and carry the whole file");
+            if( (header.flags_ & dedup_FrameFlag) &&
+                (!(header.flags_ & hashed_FrameFlag) ||
+                 (header.flags_ & (resume_FrameFlag | striped_FrameFlag | delta_FrameFlag))) )
+                throw GarbledMsgReceivedException("the dedup stream must be hashed and carry the whole file anew");
+            u64 fixed = 8;
+            if( header.flags_ & resume_FrameFlag )
+                fixed += FRAME_IDENTITY_SIZE;
+            if( header.flags_ & striped_FrameFlag )
+                fixed += FRAME_STRIPE_SIZE;
+            if( header.length_ <= fixed || header.length_ > fixed + FRAME_MAX_NAME )
+                throw GarbledMsgReceivedException("invalid length of START frame " + tostring(header.length_));
+            // the file name is taken when the whole frame is received
+            if( available - FRAME_HEADER_SIZE < header.length_ )
+                return consumed;
+            stream = start(header, ptr + FRAME_HEADER_SIZE);
+            consumed += (u32)header.length_;
+            if( stream->resumable_ )
+                push_package( packages, stream ).started_ = true;
+            if( stream->delta_ )
+            {
+                // the sender looks for the blocks of old file by their signatures, a disk thread computes them
+                StreamJob* job = new StreamJob(StreamJob::sign_Kind, stream);
+                job->file_ = stream->basis_;
+                push_package( packages, stream ).job_ = job;
+            }
+            break;
+        }
+        case data_FrameType:
+            if( (header.flags_ & packed_FrameFlag) && (!stream->compressed_ || header.length_ <= PACK_HEADER_SIZE) )
+                throw GarbledMsgReceivedException("invalid packed DATA frame of stream " + tostring(stream->id_));
+            if( stream->checksummed_ )
+            {
+                // the frames sent before the sender knows of the corrupted one are dropped
+                if( stream->dropping_ && !(header.flags_ & resent_FrameFlag) )
+                {
+                    current_ = stream;
+                    dataLeft_ = header.length_;
+                    break;
+                }
+                if( stream->checking_ )
+                    throw GarbledMsgReceivedException("DATA frame of stream " + tostring(stream->id_) +
+                                                      " goes before the checksum of previous one");
+                if( header.length_ > DEF_STREAM_QUANTUM )
+                    throw GarbledMsgReceivedException("DATA frame of checksummed stream " + tostring(stream->id_) +
+                                                      " is longer than " + tostring((u32)DEF_STREAM_QUANTUM) + " bytes");
+                stream->dropping_ = false;
+                stream->checking_ = true;
+                stream->packed_ = (0 != (header.flags_ & packed_FrameFlag));
+                stream->crc_ = 0;
+                stream->chunk_.reserve( (u32)header.length_ );
+                stream->chunk_.resize( 0 );
+                // the size of packed data is known when it is checked
+                if( stream->packed_ )
+                {
+                    current_ = stream;
+                    dataLeft_ = header.length_;
+                    break;
+                }
+            }
+            else if( header.flags_ & resent_FrameFlag )
+                throw GarbledMsgReceivedException("DATA frame of unchecked stream " + tostring(stream->id_) + " is resent");
+            if( header.length_ > (u64)(stream->size_ - stream->received_) )
+                throw GarbledMsgReceivedException("DATA frame exceeds the size of file \"" +
+                                                  stream->file_->path() + "\"");
+            if( stream->windowed_ )
+            {
+                if( header.length_ > stream->window_ )
+                    throw GarbledMsgReceivedException("DATA frame exceeds the window of stream " +
+                                                      tostring(stream->id_));
+                stream->window_ -= header.length_;
+            }
+            current_ = stream;
+            dataLeft_ = header.length_;
+            break;
+        case checksum_FrameType:
+            if( !stream->checksummed_ )
+                throw GarbledMsgReceivedException("CHECKSUM frame of unchecked stream " + tostring(stream->id_));
+            if( stream->dropping_ )
+                break;
+            if( !stream->checking_ )
+                throw GarbledMsgReceivedException("CHECKSUM frame of stream " + tostring(stream->id_) + " has no DATA frame");
+            check(stream, (u32)header.length_, packages);
+            break;
+        case hash_FrameType:
+        {
+            if( NULL == stream->hash_ )
+                throw GarbledMsgReceivedException("HASH frame of unhashed stream " + tostring(stream->id_));
+            if( TREE_HASH_SIZE != header.length_ )
+                throw GarbledMsgReceivedException("invalid length of HASH frame " + tostring(header.length_));
+            u64 leaves = ((u64)(stream->size_ - stream->hashFrom_) + TREE_HASH_LEAF - 1) / TREE_HASH_LEAF;
+            if( stream->peerLeaves_.size() / TREE_HASH_SIZE >= max(leaves, (u64)1) )
+                throw GarbledMsgReceivedException("HASH frame exceeds the leaves of stream " + tostring(stream->id_));
+            // the chaining value is taken when the whole frame is received
+            if( available - FRAME_HEADER_SIZE < header.length_ )
+                return consumed;
+            stream->peerLeaves_.append((const char*)ptr + FRAME_HEADER_SIZE, TREE_HASH_SIZE);
+            consumed += TREE_HASH_SIZE;
+            break;
+        }
+        case copy_FrameType:
+        {
+            if( !stream->delta_ )
+                throw GarbledMsgReceivedException("COPY frame of stream " + tostring(stream->id_) + " without delta");
+            if( FRAME_COPY_SIZE != header.length_ )
+                throw GarbledMsgReceivedException("invalid length of COPY frame " + tostring(header.length_));
+            // the blocks are taken when the whole frame is received
+            if( available - FRAME_HEADER_SIZE < header.length_ )
+                return consumed;
+            consumed += FRAME_COPY_SIZE;
+            // the frames sent before the sender knows of the corrupted one are dropped
+            if( stream->dropping_ && !(header.flags_ & resent_FrameFlag) )
+                break;
+            if( stream->checking_ )
+                throw GarbledMsgReceivedException("COPY frame of stream " + tostring(stream->id_) +
+                                                  " goes before the checksum of DATA frame");
+            stream->dropping_ = false;
+            copy(stream, frame::get32(ptr + FRAME_HEADER_SIZE), frame::get32(ptr + FRAME_HEADER_SIZE + 4), packages);
+            break;
+        }
+        case chunks_FrameType:
+        {
+            if( !stream->dedup_ )
+                throw GarbledMsgReceivedException("CHUNKS frame of stream " + tostring(stream->id_) + " without dedup");
+            if( header.length_ <= FRAME_CHUNKS_HEAD ||
+                header.length_ > FRAME_CHUNKS_HEAD + FRAME_CHUNKS_COUNT * CDC_RECORD_SIZE ||
+                0 != (header.length_ - FRAME_CHUNKS_HEAD) % CDC_RECORD_SIZE )
+                throw GarbledMsgReceivedException("invalid length of CHUNKS frame " + tostring(header.length_));
+            // the chunks are taken when the whole frame is received
+            if( available - FRAME_HEADER_SIZE < header.length_ )
+                return consumed;
+            announce(stream, ptr + FRAME_HEADER_SIZE, (u32)header.length_, 0 == (header.flags_ & filtered_FrameFlag),
+                     packages);
+            consumed += (u32)header.length_;
+            break;
+        }
+        case reference_FrameType:
+        {
+            if( !stream->dedup_ )
+                throw GarbledMsgReceivedException("REFERENCE frame of stream " + tostring(stream->id_) + " without dedup");
+            if( CDC_RECORD_SIZE != header.length_ )
+                throw GarbledMsgReceivedException("invalid length of REFERENCE frame " + tostring(header.length_));
+            // the chunk is taken when the whole frame is received
+            if( available - FRAME_HEADER_SIZE < header.length_ )
+                return consumed;
+            consumed += CDC_RECORD_SIZE;
+            // the frames sent before the sender knows of the corrupted one are dropped
+            if( stream->dropping_ && !(header.flags_ & resent_FrameFlag) )
+                break;
+            if( stream->checking_ )
+                throw GarbledMsgReceivedException("REFERENCE frame of stream " + tostring(stream->id_) +
+                                                  " goes before the checksum of DATA frame");
+            stream->dropping_ = false;
+            refer(stream, ptr + FRAME_HEADER_SIZE, packages);
+            break;
         }
-        return num;
+        case end_FrameType:
+        {
+            // the end sent after the corrupted frame comes again when the payload is resent
+            if( stream->checksummed_ && stream->dropping_ )
+                break;
+            if( stream->checking_ )
+                throw GarbledMsgReceivedException("END frame of stream " + tostring(stream->id_) +
+                                                  " goes before the checksum of DATA frame");
+            if( stream->received_ != stream->size_ )
+                throw GarbledMsgReceivedException("file \"" + stream->file_->path() + "\" is incomplete: " +
+                                                  tostring(stream->received_) + " of " + tostring(stream->size_) + " bytes");
+            // the corrupted leaves are received again, so the stream goes on
+            u8 root[TREE_HASH_SIZE];
+            if( stream->hash_ && !verify(stream, root, packages) )
+                break;
+            // the resumed file is hashed from the payload it goes on from
+            string hash;
+            if( stream->hash_ )
+                hash = " (BLAKE3 " + (stream->hashFrom_ > 0 ? "from " + tostring((u64)stream->hashFrom_) + " " : string()) +
+                       TreeHash::hex(root) + ")";
+            if( stream->striped_ )
+                cout << "Stripe " + tostring(stream->stripe_.offset_) + "+" + tostring(stream->stripe_.length_) +
+                        " of \"" + stream->file_->path() + "\" is received" + hash + ".\n";
+            else if( stream->delta_ )
+                cout << "File transfering \"" + stream->target_ + "\" is done by delta (" + tostring(stream->copied_) +
+                        " of " + tostring((u64)stream->size_) + " bytes copied)" + hash + ".\n\n";
+            else if( stream->dedup_ )
+                cout << "File transfering \"" + stream->file_->path() + "\" is done by dedup (" +
+                        tostring(stream->referenced_) + " of " + tostring((u64)stream->size_) + " bytes referenced)" +
+                        hash + ".\n\n";
+            else
+                cout << "File transfering \"" + stream->file_->path() + "\" is done" + hash + ".\n\n";
+            streams_.erase(It);
+            if( current_ == stream )
+                current_ = NULL;
+            push_package( packages, stream ).end_ = true;
+            break;
+        }
+        default:
+            throw GarbledMsgReceivedException("unknown frame type " + tostring((u32)header.type_));
+        }
+        consumed += FRAME_HEADER_SIZE;
     }
+    return consumed;
+}
 
-    if( bufferSize ) {
-        messages->push_back( Message(buffer, bufferSize) );
-        return 1;
+RecvStream* FrameParser::data_stream() const
+{
+    // the checksummed payload must be looked into before it is written
+    return (dataLeft_ > 0 && !current_->checksummed_) ? current_ : NULL;
+}
+
+u64 FrameParser::data_left() const
+{
+    // the frame headers are interleaved with the payload, so it goes by DATA frames
+    return dataLeft_;
+}
+
+void FrameParser::skip(u64 bytes)
+{
+    assert( bytes <= dataLeft_ );
+    dataLeft_ -= bytes;
+    current_->received_ += bytes;
+}
+
+void FrameParser::detach(RecvStreamsT* streams)
+{
+    for(StreamsT::iterator It = streams_.begin(); It != streams_.end(); ++It)
+        streams->push_back(It->second);
+    streams_.clear();
+    current_ = NULL;
+    reading_ = false;
+    dataLeft_ = 0;
+}
+
+RecvStream* FrameParser::start(const FrameHeader& header, const u8* payload)
+{
+    i64 sizeOfFile = (i64)frame::get64(payload);
+    if( sizeOfFile < 0 )
+        throw GarbledMsgReceivedException("invalid size of file " + tostring((u64)sizeOfFile));
+
+    u32 fixed = 8;
+    FileIdentity identity;
+    if( header.flags_ & resume_FrameFlag )
+    {
+        identity.mtime_ = (i64)frame::get64(payload + fixed);
+        identity.hash_ = frame::get64(payload + fixed + 8);
+        fixed += FRAME_IDENTITY_SIZE;
+    }
+
+    FileStripe stripe;
+    if( header.flags_ & striped_FrameFlag )
+    {
+        stripe.transfer_ = frame::get64(payload + fixed);
+        stripe.offset_ = frame::get64(payload + fixed + 8);
+        stripe.length_ = frame::get64(payload + fixed + 16);
+        stripe.count_ = frame::get32(payload + fixed + 24);
+        fixed += FRAME_STRIPE_SIZE;
+
+        // the direct writings of the neighbour stripes must not overlap
+        u64 end = stripe.offset_ + stripe.length_;
+        if( 0 == stripe.count_ || stripe.count_ > DEF_MAX_STRIPES || stripe.offset_ > (u64)sizeOfFile ||
+            stripe.length_ > (u64)sizeOfFile - stripe.offset_ || 0 != stripe.offset_ % FRAME_STRIPE_ALIGNMENT ||
+            (0 != end % FRAME_STRIPE_ALIGNMENT && end != (u64)sizeOfFile) )
+            throw GarbledMsgReceivedException("invalid stripe " + tostring(stripe.offset_) + "+" + tostring(stripe.length_) +
+                                              " of " + tostring(stripe.count_) + " stripes");
+    }
+
+    string path((const char*)payload + fixed, (string::size_type)header.length_ - fixed);
+    RecvStream* stream = create_stream(header.stream_, path, sizeOfFile,
+                                       (header.flags_ & resume_FrameFlag) ? &identity : NULL,
+                                       (header.flags_ & striped_FrameFlag) ? &stripe : NULL,
+                                       0 != (header.flags_ & delta_FrameFlag));
+    if( header.flags_ & windowed_FrameFlag )
+    {
+        stream->windowed_ = true;
+        stream->window_ = DEF_STREAM_WINDOW;
     }
-    return 0;
+    stream->checksummed_ = (0 != (header.flags_ & checksummed_FrameFlag));
+    stream->compressed_ = (0 != (header.flags_ & compressed_FrameFlag));
+    stream->dedup_ = (0 != (header.flags_ & dedup_FrameFlag));
+    if( header.flags_ & hashed_FrameFlag )
+    {
+        stream->hash_ = new TreeHash(hashers_);
+        stream->hashFrom_ = stream->received_;
+    }
+    streams_.insert( StreamsT::value_type(header.stream_, stream) );
+    return stream;
 }
 
-u16 BufferParser::parseStartTags(const s8* buffer, u32 bufferSize, std::string* path, u32* sizeOfFile) const
+void FrameParser::check(RecvStream* stream, u32 crc, RawPackagesT* packages)
 {
-    const char* ptr = buffer;
-    u32 startTagLen = strlen(TAG_START_CONTENT);
+    stream->checking_ = false;
+    // the packed payload passing the checksum may be corrupted still, it is sent again then
+    if( crc == stream->crc_ && (!stream->packed_ || unpack(stream)) )
+    {
+        if( 0 == stream->chunk_.size() )
+            return;
+        if( !stream->missing_.empty() )
+            collect(stream, stream->received_, stream->chunk_.get(), stream->chunk_.size(), packages);
+        stream->received_ += stream->chunk_.size();
+        if( stream->hash_ )
+            stream->hash_->update(stream->chunk_.get(), stream->chunk_.size());
+        push_package( packages, stream ).data_.swap( stream->chunk_ );
+        return;
+    }
 
-    if( bufferSize < startTagLen+2 )
-        throw GarbledMsgReceivedException("received buffer doesn't contain a filepath: length " + 
-                                          tostring(bufferSize) + " bytes");
+    if( ++stream->retransmits_ > DEF_MAX_RETRANSMITS )
+        throw GarbledMsgReceivedException("file \"" + stream->file_->path() + "\" is corrupted " +
+                                          tostring(stream->retransmits_) + " times");
+    cout << "Checksum of \"" + stream->file_->path() + "\" mismatches at " + tostring((u64)stream->received_) +
+            ", the payload is requested again.\n";
 
-    if( 0 != memcmp(ptr, TAG_START_CONTENT, startTagLen) )
-        throw GarbledMsgReceivedException("received buffer doesn't contain a filepath: invalid content \"" + 
-                                           string().assign(ptr, startTagLen) + "\"");
+    // the window of dropped payload is given back, the sender does the same when it goes back.
+    // The packed payload takes the window when it is unpacked.
+    if( stream->windowed_ && !stream->packed_ )
+        stream->window_ += stream->chunk_.size();
+    stream->chunk_.resize( 0 );
+    stream->dropping_ = true;
+    push_package( packages, stream ).retransmit_ = true;
+}
 
-    ptr += startTagLen;
-    const char* eop = strstr(ptr, "/>");
-    if( eop == NULL )
-        throw GarbledMsgReceivedException("transfering file has no path");
+void FrameParser::finish(StreamJob* job, RawPackagesT* packages)
+{
+    RecvStream* stream = job->stream_;
+    switch( job->kind_ )
+    {
+    case StreamJob::sign_Kind:
+    {
+        if( !job->error().empty() )
+            throw Exception("Signing \"" + stream->target_ + "\" is failed: " + job->error());
+        // the blocks are copied once the sender knows of them
+        stream->basisBlock_ = job->block_;
+        stream->basisSize_ = job->size_;
+        RawPackage& package = push_package( packages, stream );
+        package.data_.swap( job->data_ );
+        package.delta_ = true;
+        break;
+    }
+    case StreamJob::read_Kind:
+        if( !job->error().empty() )
+            throw Exception(job->error());
+        // the payload is hashed in the order of frames, so the frames after it are parsed now
+        reading_ = false;
+        stream->hash_->update(job->data_.get(), job->data_.size());
+        push_package( packages, stream ).data_.swap( job->data_ );
+        break;
+    case StreamJob::store_Kind:
+        // the sender sends the chunk again when another file has it
+        if( !job->error().empty() )
+            cout << "Chunk " + TreeHash::hex(job->record_) + " of \"" + stream->file_->path() + "\" is not stored: " +
+                    job->error() + "\n";
+        break;
+    }
+}
 
-    path->assign(ptr, eop-ptr);
-    ptr = (eop+=2);
+void FrameParser::copy(RecvStream* stream, u32 block, u32 size, RawPackagesT* packages)
+{
+    // the blocks must be in the signed file, their data must fit the file and the window of stream
+    u64 offset = (u64)block * stream->basisBlock_;
+    if( 0 == size || size > DEF_STREAM_QUANTUM || offset + size > (u64)stream->basisSize_ ||
+        size > (u64)(stream->size_ - stream->received_) || (stream->windowed_ && size > stream->window_) )
+        throw GarbledMsgReceivedException("invalid COPY frame of stream " + tostring(stream->id_) + ": " +
+                                          tostring(size) + " bytes of block " + tostring(block));
 
-    startTagLen = strlen(TAG_CONTENT_SIZE);
-    if( bufferSize < strlen(TAG_START_CONTENT)+startTagLen+4 )
-        throw GarbledMsgReceivedException("received buffer doesn't contain the information with file size:"
-                                          " length " + tostring(bufferSize) + " bytes");
+    if( stream->windowed_ )
+        stream->window_ -= size;
+    stream->received_ += size;
+    stream->copied_ += size;
 
-    if( 0 != memcmp(ptr, TAG_CONTENT_SIZE, startTagLen) )
-        throw GarbledMsgReceivedException("received buffer doesn't contain the information with file size:"
-                                          " invalid content \"" + string().assign(ptr, startTagLen) + "\"");
-    string strSizeOfFile;
-    ptr += startTagLen;
-    if( (NULL == (eop = strstr(ptr, "/>"))) || 
-        (0 == (strSizeOfFile = string(ptr,eop-ptr)).length()) )
+    StreamJob* job = new StreamJob(StreamJob::read_Kind, stream);
+    job->file_ = stream->basis_;
+    job->offset_ = (i64)offset;
+    job->length_ = size;
+    push_package( packages, stream ).job_ = job;
+    reading_ = true;
+}
+
+void FrameParser::announce(RecvStream* stream, const u8* payload, u32 size, bool asked, RawPackagesT* packages)
+{
+    // the chunks go one after another up to the end of file
+    i64 offset = (i64)frame::get64(payload);
+    u32 count = (size - FRAME_CHUNKS_HEAD) / CDC_RECORD_SIZE;
+    const u8* records = payload + FRAME_CHUNKS_HEAD;
+    i64 end = stream->announced_;
+    bool valid = (offset == stream->announced_);
+    for(u32 i = 0; valid && i < count; ++i)
     {
-        throw GarbledMsgReceivedException("transfering file has no info size");
+        u32 length = Chunker::record_size(records + i * CDC_RECORD_SIZE);
+        valid = (0 < length && length <= CDC_MAX_CHUNK && (i64)length <= stream->size_ - end);
+        end += length;
     }
-    eop += 2;
-    
-    *sizeOfFile = atol(strSizeOfFile.c_str());
-    return (eop-buffer);
+    if( !valid )
+        throw GarbledMsgReceivedException("invalid CHUNKS frame of stream " + tostring(stream->id_) + " at " +
+                                          tostring((u64)offset));
+
+    // the filtered chunks may be stored lately by another stream only, the sender sends them anyway
+    Message answer(asked ? FRAME_CHUNKS_HEAD + (count + 7) / 8 : 0);
+    if( asked ) {
+        memset(answer.get(), 0, answer.size());
+        frame::put64(answer.get(), (u64)offset);
+    }
+    u32 first = (u32)(stream->chunks_.size() / CDC_RECORD_SIZE);
+    for(u32 i = 0; i < count; ++i)
+    {
+        const u8* record = records + i * CDC_RECORD_SIZE;
+        if( store_ && store_->has(record) ) {
+            if( asked )
+                answer.get()[FRAME_CHUNKS_HEAD + i / 8] |= (u8)(1 << (i % 8));
+        }
+        else if( store_ )
+            stream->missing_[offset] = first + i;
+        offset += Chunker::record_size(record);
+    }
+    stream->chunks_.append((const char*)records, count * CDC_RECORD_SIZE);
+    stream->announced_ = offset;
+
+    RawPackage& package = push_package( packages, stream );
+    package.data_.swap( answer );
+    package.have_ = true;
+}
+
+void FrameParser::refer(RecvStream* stream, const u8* record, RawPackagesT* packages)
+{
+    // the chunk must fit the file and the window of stream
+    u32 size = Chunker::record_size(record);
+    if( 0 == size || size > CDC_MAX_CHUNK || size > (u64)(stream->size_ - stream->received_) ||
+        (stream->windowed_ && size > stream->window_) )
+        throw GarbledMsgReceivedException("invalid REFERENCE frame of stream " + tostring(stream->id_) + ": " +
+                                          tostring(size) + " bytes at " + tostring((u64)stream->received_));
+    if( NULL == store_ )
+        throw GarbledMsgReceivedException("REFERENCE frame of stream " + tostring(stream->id_) + " without chunk store");
+
+    if( stream->windowed_ )
+        stream->window_ -= size;
+    stream->received_ += size;
+    stream->referenced_ += size;
+
+    StreamJob* job = new StreamJob(StreamJob::read_Kind, stream);
+    job->store_ = store_;
+    memcpy(job->record_, record, CDC_RECORD_SIZE);
+    job->length_ = size;
+    push_package( packages, stream ).job_ = job;
+    reading_ = true;
+}
+
+void FrameParser::collect(RecvStream* stream, i64 offset, const u8* data, u32 size, RawPackagesT* packages)
+{
+    while( size > 0 )
+    {
+        // the gathered chunk goes on if the data follows it, otherwise the next missing chunk starts
+        if( stream->gatherAt_ < 0 || offset != stream->gatherAt_ + (i64)stream->gather_.size() )
+        {
+            stream->gatherAt_ = -1;
+            map<i64,u32>::iterator It = stream->missing_.lower_bound(offset);
+            if( stream->missing_.end() == It || It->first >= offset + (i64)size )
+                return;
+            u32 skipped = (u32)(It->first - offset);
+            offset += skipped;
+            data += skipped;
+            size -= skipped;
+            stream->gatherAt_ = offset;
+            stream->gather_.reserve( Chunker::record_size((const u8*)stream->chunks_.data() + It->second * CDC_RECORD_SIZE) );
+            stream->gather_.resize( 0 );
+        }
+
+        map<i64,u32>::iterator It = stream->missing_.find(stream->gatherAt_);
+        const u8* record = (const u8*)stream->chunks_.data() + It->second * CDC_RECORD_SIZE;
+        u32 length = Chunker::record_size(record);
+        u32 portion = min(size, length - stream->gather_.size());
+        stream->gather_.add(data, portion);
+        offset += portion;
+        data += portion;
+        size -= portion;
+        if( stream->gather_.size() < length )
+            continue;
+
+        // the chunk is hashed and written by a disk thread, the stream refers to it at the end
+        StreamJob* job = new StreamJob(StreamJob::store_Kind, stream);
+        job->store_ = store_;
+        memcpy(job->record_, record, CDC_RECORD_SIZE);
+        job->data_.swap( stream->gather_ );
+        push_package( packages, stream ).job_ = job;
+        stream->missing_.erase(It);
+        stream->gatherAt_ = -1;
+    }
+}
+
+bool FrameParser::unpack(RecvStream* stream)
+{
+    // the data must fit the file and the window of stream
+    u64 capacity = min((u64)DEF_STREAM_QUANTUM, (u64)(stream->size_ - stream->received_));
+    if( stream->windowed_ )
+        capacity = min(capacity, stream->window_);
+    if( !packers_->unpack(stream->chunk_.get(), stream->chunk_.size(), &unpacked_, (u32)capacity) )
+        return false;
+    stream->chunk_.swap( unpacked_ );
+    if( stream->windowed_ )
+        stream->window_ -= stream->chunk_.size();
+    return true;
+}
+
+bool FrameParser::verify(RecvStream* stream, u8* root, RawPackagesT* packages)
+{
+    TreeHash* hash = stream->hash_;
+    hash->finish(root);
+    u32 leaves = hash->ready();
+    if( stream->peerLeaves_.size() != (string::size_type)leaves * TREE_HASH_SIZE )
+        throw GarbledMsgReceivedException("stream " + tostring(stream->id_) + " has " +
+                                          tostring((u32)(stream->peerLeaves_.size() / TREE_HASH_SIZE)) +
+                                          " HASH frames of " + tostring(leaves) + " leaves");
+
+    u32 index = 0;
+    u8 cv[TREE_HASH_SIZE];
+    for(; index < leaves; ++index)
+    {
+        hash->leaf(index, cv);
+        if( 0 != memcmp(cv, stream->peerLeaves_.data() + index * TREE_HASH_SIZE, TREE_HASH_SIZE) )
+            break;
+    }
+    if( index == leaves )
+        return true;
+
+    if( ++stream->retransmits_ > DEF_MAX_RETRANSMITS )
+        throw GarbledMsgReceivedException("file \"" + stream->file_->path() + "\" is corrupted " +
+                                          tostring(stream->retransmits_) + " times");
+
+    // the payload from the leaf is received and hashed again, its window is given back as by the sender
+    i64 offset = stream->hashFrom_ + (i64)hash->rewind((u64)index * TREE_HASH_LEAF);
+    cout << "Tree hash of \"" + stream->file_->path() + "\" mismatches at leaf " + tostring(index) +
+            ", the payload is requested again from " + tostring((u64)offset) + ".\n";
+    if( stream->windowed_ )
+        stream->window_ += (u64)(stream->received_ - offset);
+    stream->received_ = offset;
+    stream->peerLeaves_.resize((string::size_type)index * TREE_HASH_SIZE);
+    stream->dropping_ = true;
+    RawPackage& package = push_package( packages, stream );
+    package.retransmit_ = true;
+    package.leaf_ = true;
+    return false;
 }
 
 /////////////////////////////////////////////////////////////////////////
 BufferReceiver::BufferReceiver(TCPSockClient* connection, NotifyBase* notifyMgr)
-    : connection_(connection),
-    notifyMgr_(notifyMgr)
+    : notifyMgr_(notifyMgr),
+    connection_(connection)
 {
     connection_->add_ref();
     connection_->set_nonblocking(true);
@@ -153,16 +1008,19 @@ void BufferReceiver::clear()
     }
 }
 
-int BufferReceiver::receive(const BufferParser& parser, RawMessagesT* messages, bool* done)
+int BufferReceiver::receive(StreamParser& parser, RawPackagesT* packages)
 {
     MGuard g(lock_);
 
+    // the rest of previous receiving may hold the whole packages, e.g. the next file
+    i32 parsed = parse(parser, packages);
+    if( 0 < parsed || !packages->empty() )
+        return parsed;
+
     i32 sz = buffer_.size();
     buffer_.reserve( sz + DEF_RECVBUFFER_SIZE );
 
-    u8* ptr = buffer_.get() + sz;
-    i32 nReceived = 0;
-    nReceived = connection_->recv(ptr, DEF_RECVBUFFER_SIZE);
+    i32 nReceived = connection_->recv(buffer_.get() + sz, DEF_RECVBUFFER_SIZE);
     if( 0 == nReceived ) {
         buffer_.clear();
         throw Exception("Connection is down (EOF recevied)");
@@ -173,34 +1031,52 @@ int BufferReceiver::receive(const BufferParser& parser, RawMessagesT* messages,
     }
 
     buffer_.resize(nReceived + sz);
+    return parse(parser, packages);
+}
 
-    try {
-        const u8* ptr = buffer_.get();
-        if( 0 == parser(ptr, buffer_.size(), messages, done) )
-            return -1;
+int BufferReceiver::parse(StreamParser& parser, RawPackagesT* packages)
+{
+    if( 0 == buffer_.size() )
+        return 0;
 
-        nReceived = 0;
-        RawMessagesT::iterator It = messages->begin();
-        for(; It != messages->end(); ++It )
-            nReceived += It->size();
-        clear();
+    RawPackagesT::size_type first = packages->size();
+    u32 consumed = 0;
+    try {
+        consumed = parser.parse(buffer_.get(), buffer_.size(), packages);
     }
-    catch(const BufferParser::GarbledMsgReceivedException& ex) {
-        string msg = "ERROR: Garbled buffer received (" + ex.reason() + ")";
-        notifyMgr_->error(msg);
-        notifyMgr_->debug(msg);
+    catch(const StreamParser::GarbledMsgReceivedException& ex) {
+        // there is no way to find the next header in the garbled stream
         buffer_.clear();
-        return -1;
+        throw Exception("Garbled buffer received (" + ex.reason() + ")");
     }
-    catch(const BufferParser::ZeroMsgReceivedException& ex)
+
+    if( consumed == buffer_.size() )
+        clear();
+    else if( 0 < consumed )
+        buffer_.erase(consumed);
+
+    i32 parsed = 0;
+    for(RawPackagesT::size_type i = first; i < packages->size(); ++i)
+        parsed += (*packages)[i].data_.size();
+    return parsed;
+}
+
+int BufferReceiver::peek()
+{
+    MGuard g(lock_);
+    if( 0 == buffer_.size() )
     {
-        string msg = "WARN: Zero buffer received (" + ex.reason() + ")";
-        notifyMgr_->warning(msg);
-        notifyMgr_->debug(msg);
-        buffer_.clear();
-        return -1;
+        buffer_.reserve( DEF_RECVBUFFER_SIZE );
+        i32 nReceived = connection_->recv(buffer_.get(), DEF_RECVBUFFER_SIZE);
+        if( 0 == nReceived ) {
+            buffer_.clear();
+            throw Exception("Connection is down (EOF recevied)");
+        }
+        else if( -1 == nReceived ) {
+            buffer_.clear();
+            return -1;
+        }
+        buffer_.resize(nReceived);
     }
-
-    assert(nReceived >= 0);
-    return nReceived;
+    return buffer_.get()[0];
 }
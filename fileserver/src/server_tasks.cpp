@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "server_tasks.h"
 #include "notify_base.h"
 
@@ -8,14 +10,46 @@ RecvTask::RecvTask( const std::string& name,
                     TaskFactory* factory,
                     NotifyBase* notifyMgr,
                     TCPSockClient* connection,
-                    File* recvFile)
+                    FilePool* files,
+                    StripedFiles* stripes,
+                    HashWorkers* hashers,
+                    PackWorkers* packers,
+                    ChunkStore* store,
+                    UringReceiver* uring,
+                    SpliceReceiver* splice,
+                    WriteBehind* writer,
+                    Reactor* reactor,
+                    const SyncPolicy& sync,
+                    bool preallocate,
+                    AlignedPool* directPool)
     : Task(name),
+    shutdown_(false),
+    failed_(false),
+    uring_(uring),
+    uringBusy_(false),
+    splice_(splice),
+    writer_(writer),
+    reactor_(reactor),
+    paused_(NULL),
+    reading_(NULL),
+    repliesSent_(0),
+    writable_(false),
+    filterQueued_(0),
+    published_(false),
+    publishedGeneration_(0),
+    publishedKeys_(0),
+    sync_(sync),
+    preallocate_(preallocate),
+    directPool_(directPool),
+    files_(files),
+    stripes_(stripes),
+    hashers_(hashers),
+    packers_(packers),
+    store_(store),
     factory_(factory),
     notifyMgr_(notifyMgr),
-    recvFile_(recvFile),
     connection_(connection),
-    receiver_(connection, notifyMgr),
-    shutdown_(false)
+    receiver_(connection, notifyMgr)
 {
     connection_->add_ref();
 }
@@ -24,6 +58,18 @@ RecvTask::~RecvTask()
 {
     MGuard g( lock_ );
     shutdown_ = true;
+    cancel_jobs();
+    if( uringBusy_ )
+        uring_->abandon( this );
+    if( writer_ )
+        writer_->forget( this );
+
+    RecvStreamsT streams( closing_.begin(), closing_.end() );
+    streams.insert( streams.end(), committing_.begin(), committing_.end() );
+    if( parser_.get() )
+        parser_->detach( &streams );
+    for(RecvStreamsT::iterator It = streams.begin(); It != streams.end(); ++It)
+        abandon_stream( *It );
 }
 
 void RecvTask::run()
@@ -31,6 +77,24 @@ void RecvTask::run()
     MGuard g( lock_ );
     if( shutdown_ ) return;
 
+    // the connection is read by io_uring now, it gives the connection back when payload is done,
+    // the replies go on meanwhile as the connection becomes writable
+    if( uringBusy_ ) {
+        try {
+            send_replies();
+        }
+        catch(const Exception&) // the payload fails too then
+        {}
+        return;
+    }
+
+    // the task is resumed by the write-behind queues of the streams being committed
+    if( failed_ ) {
+        if( commit_streams() )
+            destroy();
+        return;
+    }
+
     if( connection_.get() && !connection_->is_open() ) {
         notifyMgr_->debug( get_name() + " - WARNING: session was closed. Kill me, please!" );
         notifyMgr_->warning( get_name() + " - WARNING: session was closed. Kill me, please!" );
@@ -38,43 +102,646 @@ void RecvTask::run()
         return;
     }
 
-    RawMessagesT messages;
-    
-    string exmsg;
+    receive();
+}
+
+void RecvTask::receive()
+{
     try {
-        bool done = false;
-        if( 0 < receiver_.receive( BufferParser(0, recvFile_), &messages, &done) )
+        // the task is resumed by the write-behind queues, the disk jobs or the connection is readable
+        // or writable, the replies go on while the connection is paused too
+        close_streams();
+        send_replies();
+        if( paused_ )
+        {
+            if( !writer_->ready(paused_->file_, reactor_, this) )
+                return;
+            paused_ = NULL;
+        }
+        unblock_streams();
+        send_replies();
+
+        // the reactor is edge-triggered, so we read until the connection would block
+        i32 received = 0;
+        do
         {
-            for(RawMessagesT::const_iterator It = messages.begin(); 
-                It != messages.end(); ++It)
+            // the legacy clients start with the text tag, the others with the frame magic
+            if( NULL == parser_.get() )
+            {
+                i32 first = receiver_.peek();
+                if( -1 == first )
+                    return;
+                if( (FRAME_MAGIC >> 8) == first )
+                    parser_.reset( new FrameParser(files_, stripes_, hashers_, packers_, store_, directPool_, preallocate_) );
+                else
+                    parser_.reset( new BufferParser(files_, directPool_, preallocate_) );
+            }
+
+            RecvStream* stream = parser_->data_stream();
+            if( splice_.get() && stream )
+            {
+                // the payload goes from the socket to the file bypassing the user space,
+                // only the finish tag or the frame headers are left to the parser
+                i64 offset = stream->file_->tell();
+                i64 remaining = (i64)parser_->data_left();
+                i64 moved = splice_->receive( connection_->get_fd(), stream->file_->handle(), offset, remaining );
+                if( 0 < moved )
+                {
+                    bypassed( stream, moved );
+                    written( stream, offset, moved );
+                }
+                if( moved < remaining )
+                    break;
+            }
+
+            // the done jobs go on before the following frames, which wait for the payload being read
+            RawPackagesT packages;
+            finish_jobs( &packages );
+            if( NULL == reading_ )
+                received = receiver_.receive( *parser_, &packages );
+            handle( &packages );
+
+            close_streams();
+            if( paused_ || (reading_ && !done(reading_)) )
+                break;
+
+            stream = parser_->data_stream();
+            if( uring_ && stream )
             {
-                recvFile_->write(It->get(), It->size(), true);
+                // the rest of payload goes directly from the socket to the file
+                uringBusy_ = true;
+                uring_->receive( this, connection_->get_fd(), stream->file_->handle(),
+                                 stream->file_->tell(), (i64)parser_->data_left() );
+                break;
             }
         }
+        while( -1 != received );
 
-        if( done )
-            recvFile_->close();
+        send_replies();
     }
     catch(const Exception& ex) {
-        exmsg = get_name() + " - ERROR: " + ex.reason();
-        notifyMgr_->error(exmsg);
-        notifyMgr_->debug(exmsg);
+        fail( ex.reason() );
+    }
+}
+
+void RecvTask::handle(RawPackagesT* packages)
+{
+    // the jobs are taken at once, so they are not lost if a package fails
+    for(RawPackagesT::iterator It = packages->begin(); It != packages->end(); ++It)
+    {
+        if( It->job_ )
+            submit( It->job_ );
+    }
+
+    for(RawPackagesT::iterator It = packages->begin(); It != packages->end(); ++It)
+    {
+        RecvStream* stream = It->stream_;
+        if( It->job_ )
+            continue;
+        if( It->started_ )
+        {
+            // the sender goes on from the payload which is on the disk already
+            replies_ += frame_header(offset_FrameType, stream->id_, (u64)stream->received_);
+            continue;
+        }
+        if( It->delta_ )
+        {
+            // the sender waits for the signatures of old file to send the new one
+            sign( stream, It->data_ );
+            continue;
+        }
+        if( It->have_ )
+        {
+            // the sender waits for the answer to send the data of announced chunks
+            // unless none of them passes the filter
+            publish();
+            if( It->data_.size() ) {
+                replies_ += frame_header(have_FrameType, stream->id_, It->data_.size());
+                replies_.append( (const char*)It->data_.get(), It->data_.size() );
+            }
+            continue;
+        }
+        if( It->retransmit_ )
+        {
+            // the sender goes back to the payload which is checked already
+            if( It->leaf_ )
+                rewrite( stream );
+            replies_ += frame_header(retransmit_FrameType, stream->id_, (u64)stream->received_,
+                                     It->leaf_ ? leaf_FrameFlag : 0);
+            continue;
+        }
+        if( It->end_ )
+        {
+            // the sender keeps the checksummed file until it knows the file is not corrupted
+            if( stream->checksummed_ )
+                replies_ += frame_header(offset_FrameType, stream->id_, (u64)stream->size_);
+            closing_.push_back( stream );
+            continue;
+        }
+
+        // the windowed stream stops by itself, so the others are read on
+        if( !write(stream, It->data_.get(), It->data_.size()) )
+        {
+            if( stream->windowed_ && !stream->blocked_ )
+            {
+                stream->blocked_ = true;
+                blocked_.push_back( stream );
+            }
+            else if( !stream->windowed_ )
+                paused_ = stream;
+        }
+        credit( stream, It->data_.size() );
+    }
+}
+
+void RecvTask::submit(StreamJob* job)
+{
+    jobs_.push_back( job );
+    job->stream_->jobs_++;
+    if( StreamJob::read_Kind == job->kind_ )
+        reading_ = job;
+    if( writer_ )
+        writer_->submit( job, reactor_, this );
+    else
+        job->execute();
+}
+
+void RecvTask::finish_jobs(RawPackagesT* packages)
+{
+    JobListT::iterator It = jobs_.begin();
+    while( It != jobs_.end() )
+    {
+        if( !done(*It) ) {
+            ++It;
+            continue;
+        }
+        auto_ptr<StreamJob> job( *It );
+        It = jobs_.erase(It);
+        job->stream_->jobs_--;
+        if( reading_ == job.get() )
+            reading_ = NULL;
+        parser_->finish( job.get(), packages );
     }
+}
+
+bool RecvTask::done(StreamJob* job) const
+{
+    return NULL == writer_ || writer_->done(job);
+}
+
+void RecvTask::cancel_jobs()
+{
+    for(JobListT::iterator It = jobs_.begin(); It != jobs_.end(); ++It)
+    {
+        if( writer_ )
+            writer_->cancel( *It );
+        delete *It;
+    }
+    jobs_.clear();
+    reading_ = NULL;
+}
+
+void RecvTask::bypassed(RecvStream* stream, i64 bytes)
+{
+    stream->file_->seek( bytes, SEEK_CUR );
+    parser_->skip( bytes );
+    credit( stream, bytes );
+}
+
+bool RecvTask::write(RecvStream* stream, const u8* data, u32 size)
+{
+    if( directPool_ )
+        return write_direct(stream, data, size);
 
-    if( exmsg.empty() ) 
+    RawFile* file = stream->file_;
+    if( NULL == writer_ ) {
+        i64 offset = file->tell();
+        file->write(data, size);
+        written(stream, offset, size);
+        return true;
+    }
+
+    i64 offset = file->tell();
+    file->seek(size, SEEK_CUR);
+    return writer_->write(file, data, size, offset, reactor_, this);
+}
+
+bool RecvTask::write_direct(RecvStream* stream, const u8* data, u32 size)
+{
+    bool room = true;
+    while( size > 0 )
     {
-        // end of file received, so we set some delay for unblocked recv
-        if( messages.empty() )
-            Thread::sleep(200);
+        // the file is written sequentially from the start, so the buffers are aligned in it
+        if( NULL == stream->directBuffer_ ) {
+            stream->directBuffer_ = directPool_->get();
+            stream->directOffset_ = stream->file_->tell();
+        }
+
+        u32 portion = min(size, directPool_->buffer_size() - stream->directSize_);
+        memcpy(stream->directBuffer_ + stream->directSize_, data, portion);
+        stream->directSize_ += portion;
+        data += portion;
+        size -= portion;
+        stream->file_->seek(portion, SEEK_CUR);
+
+        if( stream->directSize_ == directPool_->buffer_size() && !flush_direct(stream) )
+            room = false;
+    }
+    return room;
+}
+
+bool RecvTask::flush_direct(RecvStream* stream)
+{
+    u32 align = directPool_->alignment();
+    u32 padded = (stream->directSize_ + align - 1) & ~(align - 1);
+    memset(stream->directBuffer_ + stream->directSize_, 0, padded - stream->directSize_);
+
+    u8* buffer = stream->directBuffer_;
+    stream->directBuffer_ = NULL;
+    stream->directSize_ = 0;
+
+    if( writer_ )
+        return writer_->write(stream->file_, buffer, directPool_, padded, stream->directOffset_, reactor_, this);
 
-        // activate the next recv tasks
-        Task* task = factory_->create_task(recv_TaskSpec, connection_.get());
-        if( task == NULL )
-            connection_.abandon();
+    try {
+        stream->file_->pwrite(buffer, padded, stream->directOffset_);
+    }
+    catch(const Exception&) {
+        directPool_->put(buffer);
+        throw;
+    }
+    directPool_->put(buffer);
+    written(stream, stream->directOffset_, padded);
+    return true;
+}
+
+void RecvTask::rewrite(RecvStream* stream)
+{
+    // the queued writings go first, so the payload written again overwrites the corrupted one
+    if( stream->directBuffer_ )
+        flush_direct(stream);
+    i64 begin = stream->striped_ ? (i64)stream->stripe_.offset_ : 0;
+    stream->file_->seek(begin + stream->received_, SEEK_SET);
+}
+
+void RecvTask::written(RecvStream* stream, i64 offset, u64 bytes)
+{
+    stream->file_->written(offset, bytes);
+
+    // the write-behind queue synchronizes the file at finish
+    if( writer_ )
+        writer_->touch(stream->file_);
+
+    if( sync_.written(&stream->sync_, bytes) )
+    {
+        stream->file_->sync();
+        sync_.synced(&stream->sync_);
     }
-    else 
+}
+
+void RecvTask::credit(RecvStream* stream, u64 bytes)
+{
+    if( !stream->windowed_ )
+        return;
+
+    stream->credit_ += bytes;
+    // the sender is granted a half of window at least, so the frames are rare
+    if( stream->blocked_ || stream->credit_ < DEF_STREAM_WINDOW / 2 )
+        return;
+
+    replies_ += frame_header(window_FrameType, stream->id_, stream->credit_);
+    stream->window_ += stream->credit_;
+    stream->credit_ = 0;
+}
+
+void RecvTask::sign(RecvStream* stream, const Message& signatures)
+{
+    u8 head[FRAME_SIGNATURE_HEAD];
+    frame::put32(head, stream->basisBlock_);
+    frame::put64(head + 4, (u64)stream->basisSize_);
+
+    // the file which doesn't exist has no signatures, it is sent by literals
+    u32 count = signatures.size() / DELTA_SIGNATURE_SIZE;
+    u32 first = 0;
+    do
     {
-        notifyMgr_->debug( get_name() + " - WARNING: has exception, so we suspend the connection.");
-        notifyMgr_->warning( get_name() + " - WARNING: has exception, so we suspend the connection.");
+        u32 portion = min(count - first, (u32)FRAME_SIGNATURE_BLOCKS);
+        replies_ += frame_header(signature_FrameType, stream->id_, FRAME_SIGNATURE_HEAD + portion * DELTA_SIGNATURE_SIZE);
+        replies_.append( (const char*)head, FRAME_SIGNATURE_HEAD );
+        if( portion )
+            replies_.append( (const char*)signatures.get() + first * DELTA_SIGNATURE_SIZE, portion * DELTA_SIGNATURE_SIZE );
+        first += portion;
     }
+    while( first < count );
+}
+
+void RecvTask::publish()
+{
+    // the keys stored while the filter is being sent follow it
+    if( NULL == store_ || filter_.get() )
+        return;
+
+    vector<u64> keys;
+    if( published_ && store_->added(publishedGeneration_, &publishedKeys_, &keys) )
+    {
+        queue_added( keys );
+        return;
+    }
+
+    // the sender drops its filter when it gets the new one from the start
+    filter_ = store_->filter();
+    filterQueued_ = 0;
+    published_ = true;
+    publishedGeneration_ = filter_->generation_;
+    publishedKeys_ = filter_->keys_;
+    queue_filter();
+}
+
+void RecvTask::queue_filter()
+{
+    // the large filter goes as the connection takes it, so it doesn't sit in the replies entirely
+    while( filter_.get() && replies_.length() - repliesSent_ < DEF_STREAM_QUANTUM )
+    {
+        const vector<u8>& data = filter_->data_;
+        if( filterQueued_ < data.size() )
+        {
+            u32 portion = (u32)min(data.size() - filterQueued_, (size_t)DEF_STREAM_QUANTUM);
+            u8 head[FRAME_FILTER_HEAD];
+            head[0] = (u8)filter_->bits_;
+            head[1] = (u8)filter_->hashes_;
+            frame::put64(head + 2, (u64)filterQueued_);
+            replies_ += frame_header(filter_FrameType, FRAME_CONNECTION_STREAM, FRAME_FILTER_HEAD + portion);
+            replies_.append( (const char*)head, FRAME_FILTER_HEAD );
+            replies_.append( (const char*)&data[filterQueued_], portion );
+            filterQueued_ += portion;
+            continue;
+        }
+
+        // the keys added after the filter is taken go on as usual, or the filter is made anew meanwhile
+        filter_.reset( NULL );
+        publish();
+    }
+}
+
+void RecvTask::queue_added(const vector<u64>& keys)
+{
+    for(size_t first = 0; first < keys.size(); first += FRAME_ADDED_KEYS)
+    {
+        size_t portion = min(keys.size() - first, (size_t)FRAME_ADDED_KEYS);
+        replies_ += frame_header(added_FrameType, FRAME_CONNECTION_STREAM, portion * 8);
+        for(size_t i = first; i < first + portion; ++i)
+        {
+            u8 key[8];
+            frame::put64(key, keys[i]);
+            replies_.append( (const char*)key, 8 );
+        }
+    }
+}
+
+void RecvTask::unblock_streams()
+{
+    StreamListT::iterator It = blocked_.begin();
+    while( It != blocked_.end() )
+    {
+        RecvStream* stream = *It;
+        if( !writer_->ready(stream->file_, reactor_, this) ) {
+            ++It;
+            continue;
+        }
+        stream->blocked_ = false;
+        It = blocked_.erase(It);
+        credit(stream, 0);
+    }
+}
+
+void RecvTask::send_replies()
+{
+    for(;;)
+    {
+        queue_filter();
+        if( repliesSent_ == replies_.length() )
+            break;
+        size_t left = min(replies_.length() - repliesSent_, (size_t)DEF_STREAM_QUANTUM);
+        s32 sent = connection_->send( replies_.data() + repliesSent_, (s32)left );
+        if( sent <= 0 )
+            break;
+        repliesSent_ += sent;
+    }
+
+    // the sent bytes are dropped when they are the most of buffer, so it is not moved on every send
+    if( repliesSent_ == replies_.length() ) {
+        replies_.clear();
+        repliesSent_ = 0;
+    }
+    else if( repliesSent_ > replies_.length() / 2 ) {
+        replies_.erase(0, repliesSent_);
+        repliesSent_ = 0;
+    }
+
+    // the sender may wait for the rest sending nothing, so the connection itself wakes the task up
+    bool waiting = !replies_.empty();
+    if( waiting != writable_ ) {
+        reactor_->watch_writable( this, waiting );
+        writable_ = waiting;
+    }
+}
+
+bool RecvTask::close_streams()
+{
+    while( !closing_.empty() )
+    {
+        RecvStream* stream = closing_.front();
+        if( !close_stream(stream) )
+            return false;
+
+        closing_.pop_front();
+        blocked_.remove(stream);
+        if( paused_ == stream )
+            paused_ = NULL;
+        files_->release(stream->file_);
+        delete stream;
+    }
+    return true;
+}
+
+bool RecvTask::close_stream(RecvStream* stream)
+{
+    // the jobs refer to the stream and its old file
+    if( stream->jobs_ )
+        return false;
+
+    RawFile* file = stream->file_;
+
+    // the unaligned tail is written padded, the padding is cut off once it is on the disk
+    if( stream->directBuffer_ )
+        flush_direct(stream);
+    if( writer_ && !writer_->flushed(file, reactor_, this) )
+        return false;
+
+    // the stripes are written by their own descriptors, the last one cuts the padding of file end
+    i64 size = file->tell();
+    bool complete = !stream->striped_ || stripes_->received(stream->stripe_, &size);
+    if( directPool_ && complete )
+        file->resize( size );
+
+    if( (NULL == writer_ || directPool_) && sync_.at_finish() )
+        file->sync();
+    sync_.synced(&stream->sync_);
+
+    file->dropCache();
+    file->close();
+    if( stream->resumable_ )
+        ResumePoint::drop( file->path() );
+    if( stream->delta_ )
+    {
+        delete stream->basis_;
+        stream->basis_ = NULL;
+        File::replace( file->path(), stream->target_ );
+    }
+    // the file keeps its chunks in the store, the chunks of its previous content are released
+    if( store_ && !stream->striped_ )
+    {
+        try {
+            store_->refer( stream->delta_ ? stream->target_ : file->path(), stream->chunks_ );
+        }
+        catch(const Exception& ex) {
+            notifyMgr_->warning( get_name() + " - WARNING: chunks of \"" + file->path() + "\" are not referred (" +
+                                 ex.reason() + ")" );
+        }
+    }
+    if( stream->striped_ && complete )
+        notifyMgr_->notify( "File transfering \"" + file->path() + "\" is done by " +
+                            tostring(stream->stripe_.count_) + " stripes.\n" );
+    return true;
+}
+
+void RecvTask::abandon_stream(RecvStream* stream)
+{
+    // the new file is not resumed, so the old one stays as it was
+    if( stream->delta_ )
+        remove( stream->file_->path().c_str() );
+    // the file is left opened if the disk threads still write it, the worker pool deletes it
+    if( NULL == writer_ || writer_->abandon(stream->file_) )
+        files_->release(stream->file_);
+    delete stream;
+}
+
+bool RecvTask::commit_streams()
+{
+    while( !committing_.empty() )
+    {
+        RecvStream* stream = committing_.front();
+        try {
+            if( writer_ && !writer_->flushed(stream->file_, reactor_, this) )
+                return false;
+
+            // the unaligned tail of direct file is not written, it is received again
+            stream->resume_.committed_ = stream->directBuffer_ ? stream->directOffset_ : stream->received_;
+            stream->file_->sync();
+            stream->resume_.save( stream->file_->path() );
+            notifyMgr_->notify( get_name() + " - NOTE: \"" + stream->file_->path() + "\" is kept with " +
+                                tostring(stream->resume_.committed_) + " bytes to resume." );
+        }
+        catch(const Exception& ex) {
+            notifyMgr_->error( get_name() + " - ERROR: " + ex.reason() );
+        }
+
+        committing_.pop_front();
+        abandon_stream( stream );
+    }
+    return true;
+}
+
+void RecvTask::payload_done(i64 written, const std::string& error)
+{
+    MGuard g( lock_ );
+    uringBusy_ = false;
+    if( shutdown_ ) return;
+
+    if( !error.empty() ) {
+        fail( error );
+        return;
+    }
+
+    try {
+        RecvStream* stream = parser_->data_stream();
+        bypassed( stream, written );
+        if( writer_ )
+            writer_->touch( stream->file_ );
+    }
+    catch(const Exception& ex) {
+        fail( ex.reason() );
+        return;
+    }
+
+    // the finish tag or the next frames are parsed as usual
+    receive();
+}
+
+void RecvTask::fail(const std::string& reason)
+{
+    string exmsg = get_name() + " - ERROR: " + reason;
+    notifyMgr_->error(exmsg);
+    notifyMgr_->debug(exmsg);
+
+    notifyMgr_->debug( get_name() + " - WARNING: has exception, so we close the connection.");
+    notifyMgr_->warning( get_name() + " - WARNING: has exception, so we close the connection.");
+
+    // the resumable files wait for their data to be written, the others are given up at once
+    failed_ = true;
+    paused_ = NULL;
+    blocked_.clear();
+    cancel_jobs();
+    RecvStreamsT streams;
+    if( parser_.get() )
+        parser_->detach( &streams );
+    for(RecvStreamsT::iterator It = streams.begin(); It != streams.end(); ++It)
+    {
+        if( (*It)->resumable_ )
+            committing_.push_back( *It );
+        else
+            abandon_stream( *It );
+    }
+
+    if( commit_streams() ) {
+        destroy();
+        return;
+    }
+    try {
+        connection_->shutdown( Socket::BOTH );
+    }
+    catch(...) // the peer is already gone
+    {}
+}
+
+void RecvTask::destroy()
+{
+    factory_->destroy_task( this );
+    try {
+        connection_->close();
+    }
+    catch(...) // the peer is already gone
+    {}
+}
+
+/**************************************************************/
+UringTask::UringTask( const std::string& name, UringReceiver* uring )
+    : Task(name),
+    uring_(uring)
+{}
+
+void UringTask::run()
+{
+    uring_->complete();
+}
+
+/**************************************************************/
+MetricsTask::MetricsTask( const std::string& name, Dispatcher* dispatcher )
+    : Task(name),
+    dispatcher_(dispatcher)
+{}
+
+void MetricsTask::run()
+{
+    dispatcher_->report_metrics(false);
 }
@@ -0,0 +1,89 @@
+#ifdef __linux
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "splice_receiver.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////
+#ifdef __linux
+
+bool SpliceReceiver::isSupported()
+{
+    return true;
+}
+
+SpliceReceiver::SpliceReceiver()
+    : buffered_(0)
+{
+    if( 0 != pipe(pipe_) )
+        throw system_exception("pipe", ERRNO);
+    fcntl( pipe_[1], F_SETPIPE_SZ, DEF_SPLICE_PIPE_SIZE ); /* the default size is used on failure */
+}
+
+SpliceReceiver::~SpliceReceiver()
+{
+    ::close( pipe_[0] );
+    ::close( pipe_[1] );
+}
+
+i64 SpliceReceiver::receive(SD sock, i32 fileFd, i64 offset, i64 length)
+{
+    i64 written = 0;
+    while( written < length )
+    {
+        if( buffered_ == 0 )
+        {
+            size_t chunk = (size_t)min<i64>(length - written, DEF_SPLICE_PIPE_SIZE);
+            ssize_t n = splice( sock, NULL, pipe_[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+            if( n == 0 )
+                throw Exception("Connection is down (EOF recevied)");
+            if( n < 0 )
+            {
+                if( EAGAIN == ERRNO || EWOULDBLOCK == ERRNO )
+                    break;
+                if( EINTR == ERRNO )
+                    continue;
+                throw system_exception("splice from socket", ERRNO);
+            }
+            buffered_ = (u32)n;
+        }
+
+        loff_t off = offset + written;
+        ssize_t n = splice( pipe_[0], NULL, fileFd, &off, buffered_, SPLICE_F_MOVE );
+        if( n <= 0 )
+        {
+            if( n < 0 && EINTR == ERRNO )
+                continue;
+            throw system_exception("splice to file", n < 0 ? ERRNO : ENOSPC);
+        }
+        buffered_ -= (u32)n;
+        written += n;
+    }
+    return (written == 0 && written < length) ? -1 : written;
+}
+
+#else /* __linux */
+
+bool SpliceReceiver::isSupported()
+{
+    return false;
+}
+
+SpliceReceiver::SpliceReceiver()
+    : buffered_(0)
+{
+    throw Exception("SpliceReceiver: splice() is not supported on this platform");
+}
+
+SpliceReceiver::~SpliceReceiver()
+{}
+
+i64 SpliceReceiver::receive(SD, i32, i64, i64)
+{
+    return -1;
+}
+
+#endif /* __linux */
@@ -0,0 +1,30 @@
+#include "sync_policy.h"
+#include "useful.h"
+
+/////////////////////////////////////////////////////////////////////////
+SyncPolicy::SyncPolicy(Durability mode, u64 bytes, u64 interval)
+    : mode_(mode),
+    bytes_(bytes),
+    interval_(interval)
+{}
+
+bool SyncPolicy::written(SyncState* state, u64 bytes) const
+{
+    if( mode_ != periodic_Durability || bytes == 0 )
+        return false;
+
+    u64 now = current_time();
+    if( state->unsynced_ == 0 )
+        state->syncedAt_ = now;
+    state->unsynced_ += bytes;
+
+    if( bytes_ && state->unsynced_ >= bytes_ )
+        return true;
+    return interval_ && (now - state->syncedAt_ >= interval_);
+}
+
+void SyncPolicy::synced(SyncState* state) const
+{
+    state->unsynced_ = 0;
+    state->syncedAt_ = current_time();
+}
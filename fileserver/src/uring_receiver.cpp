@@ -0,0 +1,218 @@
+#ifndef WIN32
+#   include <sys/uio.h>
+#   include <sys/socket.h>
+#endif
+
+#include "uring_receiver.h"
+
+using namespace std;
+
+/*  The request kind is kept in the lowest bits of the completion user data,
+    the rest is the buffer index for reading and writing or the transfer for synchronization */
+const u64 READ_REQUEST  = 0;
+const u64 WRITE_REQUEST = 1;
+const u64 SYNC_REQUEST  = 2;
+const u64 REQUEST_MASK  = 3;
+
+/////////////////////////////////////////////////////////////////////////
+UringReceiver::UringReceiver(u16 depth, u32 chunkSize, const SyncPolicy& sync)
+    : memory_(depth * chunkSize),
+    ring_(depth * 2 + 1),
+    chunkSize_(chunkSize),
+    sync_(sync)
+{
+    vector<struct iovec> iov(depth);
+    buffers_.resize(depth);
+    for(u16 i = 0; i < depth; ++i)
+    {
+        buffers_[i].data_ = &memory_[i * chunkSize];
+        buffers_[i].length_ = 0;
+        buffers_[i].retry_ = 0;
+        buffers_[i].offset_ = 0;
+        buffers_[i].transfer_ = NULL;
+        iov[i].iov_base = buffers_[i].data_;
+        iov[i].iov_len = chunkSize;
+        free_.push_back(depth - i - 1);
+    }
+
+    ring_.register_buffers(&iov[0], depth);
+}
+
+UringReceiver::~UringReceiver()
+{
+    for(TransfersT::iterator It = transfers_.begin(); It != transfers_.end(); ++It)
+        delete *It;
+}
+
+void UringReceiver::receive(UringOwner* owner, SD sock, i32 fileFd, i64 offset, i64 length)
+{
+    Transfer* transfer = new Transfer();
+    transfer->owner_ = owner;
+    transfer->sock_ = sock;
+    transfer->fileFd_ = fileFd;
+    transfer->offset_ = offset;
+    transfer->remaining_ = length;
+    transfer->written_ = 0;
+    transfer->inflight_ = 0;
+    transfer->reading_ = false;
+    transfer->syncing_ = false;
+    transfers_.push_back(transfer);
+
+    pump(transfer);
+    ring_.submit();
+}
+
+void UringReceiver::abandon(UringOwner* owner)
+{
+    TransfersT::iterator It = transfers_.begin();
+    for(; It != transfers_.end(); ++It)
+    {
+        if( (*It)->owner_ == owner )
+        {
+            (*It)->owner_ = NULL;
+            (*It)->remaining_ = 0;
+            if( (*It)->error_.empty() )
+                (*It)->error_ = "abandoned";
+            finish(*It);
+            return;
+        }
+    }
+}
+
+void UringReceiver::pump(Transfer* transfer)
+{
+    if( transfer->reading_ || transfer->remaining_ == 0 || !transfer->error_.empty() )
+        return;
+    if( free_.empty() || ring_.available() < 2 )
+        return;
+
+    u16 index = free_.back();
+    free_.pop_back();
+
+    Buffer& buf = buffers_[index];
+    buf.length_ = (u32)min<i64>(chunkSize_, transfer->remaining_);
+    buf.retry_ = 0;
+    buf.offset_ = transfer->offset_;
+    buf.transfer_ = transfer;
+
+    // the write starts only when the whole chunk is read
+    ring_.recv(transfer->sock_, buf.data_, buf.length_, MSG_WAITALL, ((u64)index << 2) | READ_REQUEST, true);
+    ring_.write_fixed(transfer->fileFd_, buf.data_, buf.length_, buf.offset_, index, ((u64)index << 2) | WRITE_REQUEST);
+
+    transfer->reading_ = true;
+    transfer->remaining_ -= buf.length_;
+    transfer->offset_ += buf.length_;
+    ++transfer->inflight_;
+}
+
+void UringReceiver::on_read(u16 index, i32 result)
+{
+    Buffer& buf = buffers_[index];
+    Transfer* transfer = buf.transfer_;
+    transfer->reading_ = false;
+
+    if( result == (i32)buf.length_ )
+        return;
+
+    // the short read cancels the linked write, so the chunk remainder is read again
+    u32 lost = buf.length_ - (result > 0 ? result : 0);
+    transfer->remaining_ += lost;
+    transfer->offset_ -= lost;
+
+    if( result > 0 )
+        buf.retry_ = result;
+    else if( result == 0 )
+        transfer->error_ = "Connection is down (EOF recevied)";
+    else
+        transfer->error_ = system_exception("io_uring recv", -result).reason();
+}
+
+void UringReceiver::on_write(u16 index, i32 result)
+{
+    Buffer& buf = buffers_[index];
+    Transfer* transfer = buf.transfer_;
+
+    if( result == -ECANCELED && buf.retry_ > 0 )
+    {
+        buf.length_ = buf.retry_;
+        buf.retry_ = 0;
+        if( ring_.write_fixed(transfer->fileFd_, buf.data_, buf.length_, buf.offset_, index, ((u64)index << 2) | WRITE_REQUEST) )
+            return;
+        result = -EBUSY;
+    }
+
+    if( result == (i32)buf.length_ )
+    {
+        transfer->written_ += result;
+        if( sync_.written(&transfer->sync_, result) && !transfer->syncing_ &&
+            ring_.fsync(transfer->fileFd_, true, (u64)transfer | SYNC_REQUEST) )
+        {
+            transfer->syncing_ = true;
+            ++transfer->inflight_;
+        }
+    }
+    else if( transfer->error_.empty() )
+    {
+        if( result == -ECANCELED )
+            transfer->error_ = "io_uring write is cancelled";
+        else if( result < 0 )
+            transfer->error_ = system_exception("io_uring write", -result).reason();
+        else
+            transfer->error_ = "io_uring write: disk is full";
+    }
+
+    buf.transfer_ = NULL;
+    free_.push_back(index);
+    --transfer->inflight_;
+}
+
+void UringReceiver::on_sync(Transfer* transfer, i32 result)
+{
+    transfer->syncing_ = false;
+    --transfer->inflight_;
+
+    if( result == 0 )
+        sync_.synced(&transfer->sync_);
+    else if( transfer->error_.empty() )
+        transfer->error_ = system_exception("io_uring fdatasync", -result).reason();
+}
+
+bool UringReceiver::finish(Transfer* transfer)
+{
+    if( transfer->inflight_ || transfer->reading_ )
+        return false;
+    if( transfer->remaining_ && transfer->error_.empty() )
+        return false;
+
+    transfers_.remove(transfer);
+    if( transfer->owner_ )
+        transfer->owner_->payload_done(transfer->written_, transfer->error_);
+    delete transfer;
+    return true;
+}
+
+void UringReceiver::complete()
+{
+    IoRing::Completion completion;
+    while( ring_.complete(&completion) )
+    {
+        u64 kind = completion.userData_ & REQUEST_MASK;
+        u16 index = (u16)(completion.userData_ >> 2);
+        if( kind == SYNC_REQUEST )
+            on_sync((Transfer*)(completion.userData_ & ~REQUEST_MASK), completion.result_);
+        else if( kind == WRITE_REQUEST )
+            on_write(index, completion.result_);
+        else
+            on_read(index, completion.result_);
+    }
+
+    // the freed buffers are given to whoever is waiting for them
+    TransfersT::iterator It = transfers_.begin();
+    while( It != transfers_.end() )
+    {
+        Transfer* transfer = *It++;
+        if( !finish(transfer) )
+            pump(transfer);
+    }
+    ring_.submit();
+}
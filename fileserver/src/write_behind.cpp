@@ -0,0 +1,490 @@
+#ifndef WIN32
+#   include <sys/uio.h>
+#endif
+
+#include "write_behind.h"
+#include "rawfile.h"
+#include "reactor.h"
+#include "aligned_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+/*  The maximum number of contiguous chunks written by one system call */
+const u32 MAX_CHUNKS_PER_WRITE = 64;
+
+/////////////////////////////////////////////////////////////////////////
+WriteBehind::DiskThread::DiskThread(const std::string& name, WriteBehind* owner)
+    : Thread(name),
+    owner_(owner)
+{}
+
+void WriteBehind::DiskThread::run()
+{
+    owner_->drain();
+}
+
+/////////////////////////////////////////////////////////////////////////
+WriteBehind::Job::Job()
+    : cancelled_(false),
+    done_(false),
+    reactor_(NULL),
+    task_(NULL)
+{}
+
+WriteBehind::Job::~Job()
+{}
+
+void WriteBehind::Job::execute()
+{
+    try {
+        run();
+    }
+    catch(const Exception& ex) {
+        error_ = ex.reason();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+WriteBehind::WriteBehind(u16 threads, u32 limit, const SyncPolicy& sync)
+    : limit_(limit),
+    sync_(sync),
+    stopping_(false)
+{
+    memset(&stats_, 0, sizeof(stats_));
+    for(u16 i = 0; i < threads; ++i)
+    {
+        threads_.push_back( new DiskThread("Disk-" + tostring((u32)i), this) );
+        threads_.back()->start();
+    }
+}
+
+WriteBehind::~WriteBehind()
+{
+    stop();
+
+    for(QueuesT::iterator It = queues_.begin(); It != queues_.end(); ++It)
+        delete It->second;
+}
+
+void WriteBehind::stop()
+{
+    {
+        MGuard g(lock_);
+        if( stopping_ )
+            return;
+        stopping_ = true;
+        cond_.broadcast();
+    }
+
+    for(ThreadsT::iterator It = threads_.begin(); It != threads_.end(); ++It)
+    {
+        (*It)->join();
+        delete *It;
+    }
+    threads_.clear();
+}
+
+WriteBehind::FileQueue* WriteBehind::get_queue(RawFile* file)
+{
+    QueuesT::iterator It = queues_.find(file);
+    if( It == queues_.end() )
+    {
+        FileQueue* queue = new FileQueue();
+        queue->file_ = file;
+        queue->bytes_ = 0;
+        queue->busy_ = false;
+        queue->scheduled_ = false;
+        queue->reactor_ = NULL;
+        queue->waiter_ = NULL;
+        queue->waitFlushed_ = false;
+        queue->blockedSince_ = 0;
+        queue->syncPending_ = false;
+        queue->synced_ = true;
+        It = queues_.insert( QueuesT::value_type(file, queue) ).first;
+    }
+
+    FileQueue* queue = It->second;
+    if( !queue->error_.empty() )
+    {
+        // the error is reported once, the file is written from scratch after that
+        string error = queue->error_;
+        queue->error_.clear();
+        throw Exception("Writing to \"" + file->path() + "\" is failed: " + error);
+    }
+    return queue;
+}
+
+bool WriteBehind::write(RawFile* file, const u8* data, u32 size, i64 offset, Reactor* reactor, Task* task)
+{
+    Chunk* chunk = new Chunk();
+    chunk->offset_ = offset;
+    chunk->copy_.set(data, size);
+    chunk->data_ = chunk->copy_.get();
+    chunk->size_ = size;
+    chunk->pool_ = NULL;
+
+    MGuard g(lock_);
+    return enqueue(file, chunk, reactor, task);
+}
+
+bool WriteBehind::write(RawFile* file, u8* buffer, AlignedPool* pool, u32 size, i64 offset, Reactor* reactor, Task* task)
+{
+    Chunk* chunk = new Chunk();
+    chunk->offset_ = offset;
+    chunk->data_ = buffer;
+    chunk->size_ = size;
+    chunk->pool_ = pool;
+
+    MGuard g(lock_);
+    return enqueue(file, chunk, reactor, task);
+}
+
+bool WriteBehind::enqueue(RawFile* file, Chunk* chunk, Reactor* reactor, Task* task)
+{
+    FileQueue* queue = NULL;
+    try {
+        if( stopping_ )
+            throw Exception("Writing to \"" + file->path() + "\" is failed: server is stopping");
+        queue = get_queue(file);
+    }
+    catch(const Exception&) {
+        release(chunk);
+        throw;
+    }
+
+    u32 size = chunk->size_;
+    queue->chunks_.push_back(chunk);
+    queue->bytes_ += size;
+    queue->synced_ = false;
+
+    stats_.queuedBytes_ += size;
+    stats_.queuedChunks_++;
+    if( stats_.queuedBytes_ > stats_.peakQueuedBytes_ )
+        stats_.peakQueuedBytes_ = stats_.queuedBytes_;
+
+    schedule(queue);
+
+    if( queue->bytes_ < limit_ )
+        return true;
+
+    wait(queue, reactor, task, false);
+    return false;
+}
+
+bool WriteBehind::ready(RawFile* file, Reactor* reactor, Task* task)
+{
+    MGuard g(lock_);
+    FileQueue* queue = get_queue(file);
+    if( queue->bytes_ <= limit_ / 2 )
+    {
+        unblock(queue);
+        return true;
+    }
+
+    wait(queue, reactor, task, false);
+    return false;
+}
+
+bool WriteBehind::flushed(RawFile* file, Reactor* reactor, Task* task)
+{
+    MGuard g(lock_);
+    FileQueue* queue = get_queue(file);
+    if( is_flushed(queue) )
+    {
+        unblock(queue);
+        return true;
+    }
+
+    if( sync_.at_finish() && !queue->synced_ && !queue->syncPending_ )
+    {
+        queue->syncPending_ = true;
+        schedule(queue);
+    }
+    wait(queue, reactor, task, true);
+    return false;
+}
+
+bool WriteBehind::is_flushed(const FileQueue* queue) const
+{
+    if( queue->bytes_ || queue->busy_ || queue->syncPending_ )
+        return false;
+    return !sync_.at_finish() || queue->synced_;
+}
+
+void WriteBehind::release(Chunk* chunk)
+{
+    if( chunk->pool_ )
+        chunk->pool_->put( (u8*)chunk->data_ );
+    delete chunk;
+}
+
+void WriteBehind::schedule(FileQueue* queue)
+{
+    if( queue->busy_ || queue->scheduled_ )
+        return;
+
+    queue->scheduled_ = true;
+    ready_.push_back(queue);
+    cond_.signal();
+}
+
+void WriteBehind::touch(RawFile* file)
+{
+    MGuard g(lock_);
+    get_queue(file)->synced_ = false;
+}
+
+void WriteBehind::submit(Job* job, Reactor* reactor, Task* task)
+{
+    MGuard g(lock_);
+    job->reactor_ = reactor;
+    job->task_ = task;
+    jobs_.push_back(job);
+    cond_.signal();
+}
+
+bool WriteBehind::done(const Job* job) const
+{
+    MGuard g(lock_);
+    return job->done_;
+}
+
+void WriteBehind::cancel(Job* job)
+{
+    MGuard g(lock_);
+    job->cancelled_ = true;
+    job->task_ = NULL;
+    JobsT::iterator It = find(jobs_.begin(), jobs_.end(), job);
+    if( It != jobs_.end() )
+    {
+        jobs_.erase(It);
+        return;
+    }
+    while( !job->done_ )
+        jobDone_.wait(&lock_);
+}
+
+void WriteBehind::forget(Task* task)
+{
+    MGuard g(lock_);
+    for(JobsT::iterator It = jobs_.begin(); It != jobs_.end(); ++It)
+    {
+        if( (*It)->task_ == task )
+            (*It)->task_ = NULL;
+    }
+    for(QueuesT::iterator It = queues_.begin(); It != queues_.end(); ++It)
+    {
+        if( It->second->waiter_ == task )
+        {
+            unblock(It->second);
+            It->second->waiter_ = NULL;
+            It->second->reactor_ = NULL;
+        }
+    }
+}
+
+bool WriteBehind::abandon(RawFile* file)
+{
+    MGuard g(lock_);
+    QueuesT::iterator It = queues_.find(file);
+    if( It == queues_.end() )
+        return true;
+
+    FileQueue* queue = It->second;
+    if( queue->bytes_ || queue->busy_ || queue->scheduled_ )
+        return false;
+
+    // the error would be reported to the next stream of the file otherwise
+    queue->error_.clear();
+    queue->syncPending_ = false;
+    queue->synced_ = true;
+    return true;
+}
+
+WriteBehind::Stats WriteBehind::get_stats() const
+{
+    MGuard g(lock_);
+    Stats stats = stats_;
+
+    // the running blockings are counted too
+    u64 now = current_time();
+    for(QueuesT::const_iterator It = queues_.begin(); It != queues_.end(); ++It)
+    {
+        if( It->second->blockedSince_ )
+            stats.blockedTime_ += now - It->second->blockedSince_;
+    }
+    return stats;
+}
+
+void WriteBehind::wait(FileQueue* queue, Reactor* reactor, Task* task, bool flushed)
+{
+    queue->reactor_ = reactor;
+    queue->waiter_ = task;
+    queue->waitFlushed_ = flushed;
+
+    if( !flushed && queue->blockedSince_ == 0 )
+    {
+        queue->blockedSince_ = current_time();
+        stats_.blockedNow_++;
+        stats_.blockings_++;
+    }
+}
+
+void WriteBehind::unblock(FileQueue* queue)
+{
+    if( queue->blockedSince_ )
+    {
+        stats_.blockedTime_ += current_time() - queue->blockedSince_;
+        stats_.blockedNow_--;
+        queue->blockedSince_ = 0;
+    }
+}
+
+void WriteBehind::notify_waiter(FileQueue* queue)
+{
+    if( NULL == queue->waiter_ )
+        return;
+
+    bool wakeup = queue->waitFlushed_ ? is_flushed(queue)
+                                      : (queue->bytes_ <= limit_ / 2);
+    if( !wakeup && queue->error_.empty() )
+        return;
+
+    // the task is resumed in the reactor thread, it checks the queue by itself
+    queue->reactor_->resume(queue->waiter_);
+    queue->waiter_ = NULL;
+    queue->reactor_ = NULL;
+}
+
+void WriteBehind::drain()
+{
+    MGuard g(lock_);
+    for(;;)
+    {
+        while( ready_.empty() && jobs_.empty() && !stopping_ )
+            cond_.wait(&lock_);
+        if( !jobs_.empty() )
+        {
+            Job* job = jobs_.front();
+            jobs_.pop_front();
+            run_job(job);
+            continue;
+        }
+        if( ready_.empty() )
+            return;
+
+        FileQueue* queue = ready_.front();
+        ready_.pop_front();
+        queue->scheduled_ = false;
+        queue->busy_ = true;
+
+        ChunksT chunks;
+        chunks.swap(queue->chunks_);
+
+        // the finishing synchronization is requested when nothing is written anymore
+        bool finish = queue->syncPending_;
+        u32 syncs = 0;
+
+        string error;
+        {
+            Unlocker<Mutex> unlocker(lock_);
+            try {
+                u64 written = write_chunks(queue->file_, chunks);
+                if( sync_.written(&queue->sync_, written) || finish )
+                {
+                    queue->file_->sync();
+                    sync_.synced(&queue->sync_);
+                    ++syncs;
+                }
+            }
+            catch(const Exception& ex) {
+                error = ex.reason();
+            }
+        }
+
+        stats_.syncs_ += syncs;
+        if( syncs )
+            queue->synced_ = queue->chunks_.empty();
+        if( finish )
+            queue->syncPending_ = false;
+
+        u64 bytes = 0;
+        for(ChunksT::iterator It = chunks.begin(); It != chunks.end(); ++It)
+        {
+            bytes += (*It)->size_;
+            release(*It);
+        }
+
+        queue->busy_ = false;
+        queue->bytes_ -= bytes;
+        stats_.queuedBytes_ -= bytes;
+        stats_.queuedChunks_ -= (u32)chunks.size();
+        if( error.empty() )
+            stats_.writtenBytes_ += bytes;
+        else if( queue->error_.empty() )
+            queue->error_ = error;
+
+        if( !queue->chunks_.empty() || queue->syncPending_ )
+        {
+            queue->scheduled_ = true;
+            ready_.push_back(queue);
+        }
+        notify_waiter(queue);
+    }
+}
+
+void WriteBehind::run_job(Job* job)
+{
+    {
+        Unlocker<Mutex> unlocker(lock_);
+        job->execute();
+    }
+
+    // the task is resumed in the reactor thread, it takes the result by itself
+    job->done_ = true;
+    if( job->task_ )
+        job->reactor_->resume(job->task_);
+    job->task_ = NULL;
+    job->reactor_ = NULL;
+    jobDone_.broadcast();
+}
+
+u64 WriteBehind::write_chunks(RawFile* file, const ChunksT& chunks)
+{
+    u64 written = 0;
+    vector<struct iovec> iov;
+    iov.reserve(MAX_CHUNKS_PER_WRITE);
+
+    i64 offset = 0;
+    i64 next = -1;
+    for(ChunksT::const_iterator It = chunks.begin(); It != chunks.end(); ++It)
+    {
+        if( (*It)->offset_ != next || iov.size() == MAX_CHUNKS_PER_WRITE )
+        {
+            if( !iov.empty() )
+                written += write_range(file, iov, offset);
+            iov.clear();
+            offset = next = (*It)->offset_;
+        }
+
+        struct iovec v;
+        v.iov_base = (void*)(*It)->data_;
+        v.iov_len = (*It)->size_;
+        iov.push_back(v);
+        next += v.iov_len;
+    }
+
+    if( !iov.empty() )
+        written += write_range(file, iov, offset);
+    return written;
+}
+
+u64 WriteBehind::write_range(RawFile* file, const vector<struct iovec>& iov, i64 offset)
+{
+    u64 written = file->pwritev(&iov[0], (u32)iov.size(), offset);
+    // the disk thread can wait for the writeback of dropped pages
+    file->written(offset, written);
+    return written;
+}
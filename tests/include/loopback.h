@@ -0,0 +1,136 @@
+#ifndef __loopback_h__
+#define __loopback_h__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <sys/types.h>
+
+#include "common_types.h"
+#include "frame.h"
+#include "thread.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The transfer tests run the file server built by its Makefile and speak the frames
+// to it over the loopback connections as the client does. The server binary may be
+// given by TEST_SERVER environment variable.
+
+/*  The file server run in its own temporary directory, it is stopped and
+    the directory is removed when the object is destroyed
+*/
+class TestServer
+{
+public:
+    /*  Starts the server and waits until it accepts the connections
+        @param options - the command line options separated by spaces, e.g. "--workers=2"
+        @throw Exception if the server can't be started
+    */
+    explicit TestServer(const std::string& name, const std::string& options = "");
+    ~TestServer();
+
+    u16 port() const
+    { return port_; }
+
+    /*  Returns the path of the file in the directory of server */
+    std::string path(const std::string& name) const
+    { return dir_ + "/" + name; }
+
+private:
+    TestServer(const TestServer&);
+    TestServer& operator=(const TestServer&);
+
+    /*  Stops the server, it is killed if it doesn't quit in time */
+    void stop();
+
+    std::string dir_;   /* the working directory of server, the received files go there */
+    pid_t pid_;
+    i32 input_;         /* the standard input of server, it quits by 'q' key */
+    u16 port_;
+};
+
+/*  The connection to the test server which sends and receives the frames */
+class FrameConnection
+{
+public:
+    /*  Connects to the server
+        @param narrow - the connection has the small window and segments, so the server
+                        sizes its socket buffer by them and it is filled soon
+        @throw Exception
+    */
+    explicit FrameConnection(u16 port, bool narrow = false);
+    ~FrameConnection();
+
+    /*  Sends the encoded frames, it blocks until they are sent
+        @throw Exception
+    */
+    void send(const std::string& frames);
+
+    /*  Receives the next frame of the server
+        @param payload - the payload of SIGNATURE, HAVE, FILTER and ADDED frames,
+                         the other ones carry their value in the length
+        @Returns false if no frame comes in 'timeout' milliseconds
+        @throw Exception if the connection is closed
+    */
+    bool receive(FrameHeader* header, std::string* payload, u32 timeout);
+
+private:
+    FrameConnection(const FrameConnection&);
+    FrameConnection& operator=(const FrameConnection&);
+
+    i32 fd_;
+    std::string buffer_;  /* the received bytes of the next frames */
+};
+
+/*  The long fat link between the test client and the server. The data of every connection to
+    its port reaches the server after the delay and at most 'window' bytes of it are on the way,
+    as the congestion window limits one TCP flow, so a flow carries 'window' bytes per delay.
+    The answers of server go back at once.
+*/
+class DelayLink : public Thread
+{
+public:
+    /*  Starts relaying the connections to the server
+        @throw Exception
+    */
+    DelayLink(u16 server, u32 delay, u32 window);
+    ~DelayLink();
+
+    u16 port() const
+    { return port_; }
+
+protected:
+    virtual void run();
+
+private:
+    /*  The bytes of client which go to the server at 'due' milliseconds */
+    struct Piece
+    {
+        u64 due_;
+        std::string data_;
+    };
+
+    struct Flow
+    {
+        i32 client_;
+        i32 server_;
+        std::deque<Piece> pieces_;
+        u32 flying_;            /* the bytes of pieces, they are less than the window */
+        std::string answers_;   /* the bytes of server the client doesn't take yet */
+        bool closed_;           /* the client sent everything */
+    };
+
+    /*  Relays the bytes of flow which are ready
+        @Returns false if the flow is over
+    */
+    bool relay(Flow* flow, short clientEvents, short serverEvents);
+
+    u16 server_;
+    u32 delay_;
+    u32 window_;
+    i32 listener_;
+    u16 port_;
+    volatile bool running_;
+    std::vector<Flow> flows_;
+};
+
+#endif /* __loopback_h__ */
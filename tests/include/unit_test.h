@@ -0,0 +1,66 @@
+#ifndef __unit_test_h__
+#define __unit_test_h__
+
+#include <string>
+
+#include "common_types.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The regression checks of the codecs and the file routines. Every test registers
+// itself by TEST macro before main(), the runner calls them one by one and counts
+// the failed ones. The failed check throws, so the rest of its test is skipped.
+// The benchmarks are registered by BENCHMARK macro, they print the rates and check
+// them against the budgets, the runner calls them by name or by --benchmark option only.
+
+/*  The failed check */
+class TestFailure
+{
+public:
+    TestFailure(const char* file, u32 line, const std::string& condition);
+
+    std::string reason_;
+};
+
+typedef void (*TestFunc)();
+
+/*  Adds the test or the benchmark to the runner */
+class TestRegistrar
+{
+public:
+    TestRegistrar(const char* name, TestFunc func, bool benchmark = false);
+};
+
+#define TEST(name) \
+    static void name##_test(); \
+    static TestRegistrar name##_registrar(#name, name##_test); \
+    static void name##_test()
+
+#define BENCHMARK(name) \
+    static void name##_benchmark(); \
+    static TestRegistrar name##_registrar(#name, name##_benchmark, true); \
+    static void name##_benchmark()
+
+#define CHECK(condition) \
+    do { if( !(condition) ) throw TestFailure(__FILE__, __LINE__, #condition); } while(0)
+
+/*  Fills the buffer with the pseudo-random bytes, the same seed gives the same bytes */
+void fill_random(u8* data, u32 size, u32 seed);
+
+/*  Returns the bytes as the lowercase hex digits */
+std::string hex(const u8* data, u32 size);
+
+/*  Returns the path of temporary file of the test in the current directory,
+    it is removed by the test
+*/
+std::string temp_path(const std::string& name);
+
+/*  Removes the temporary directory with its files */
+void remove_tree(const std::string& dir);
+
+/*  Returns the milliseconds of monotonic clock */
+u64 now_ms();
+
+/*  Prints the measurement of benchmark under its name */
+void report(const std::string& line);
+
+#endif /* __unit_test_h__ */
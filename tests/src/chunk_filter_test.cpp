@@ -0,0 +1,83 @@
+#include <vector>
+
+#include "unit_test.h"
+#include "chunker.h"
+
+using namespace std;
+
+namespace {
+
+/*  Returns the key of the random name, as the chunk names are */
+u64 random_key(u32 seed)
+{
+    u8 name[CDC_HASH_SIZE];
+    fill_random(name, sizeof(name), seed);
+    return ChunkFilter::key(name);
+}
+
+} // namespace
+
+// The key is the first 8 bytes of name in network byte order
+TEST(chunk_filter_key)
+{
+    u8 name[CDC_HASH_SIZE] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xff };
+    CHECK( 0x0123456789abcdefULL == ChunkFilter::key(name) );
+}
+
+// The added keys are always found, the other ones pass as rarely as the filter is sized for
+TEST(chunk_filter)
+{
+    const u32 keys = 65536;
+    ChunkFilter filter;
+    CHECK( 0 == filter.bits() && !filter.complete() );
+
+    // 16 bits per key
+    filter.reset(20, 6);
+    CHECK( 20 == filter.bits() && 6 == filter.hashes() && 131072 == filter.data().size() );
+    for(u32 i = 1; i <= keys; ++i)
+        filter.add(random_key(i));
+    for(u32 i = 1; i <= keys; ++i)
+        CHECK( filter.contains(random_key(i)) );
+
+    // the false positives are 0.1% or so
+    u32 passed = 0;
+    for(u32 i = keys + 1; i <= 2 * keys; ++i)
+        if( filter.contains(random_key(i)) )
+            ++passed;
+    CHECK( passed < keys / 200 );
+
+    filter.clear();
+    CHECK( 0 == filter.bits() && filter.data().empty() );
+}
+
+// The filter sent by pieces is the same as the receiver's one
+TEST(chunk_filter_load)
+{
+    ChunkFilter sent;
+    sent.reset(CDC_FILTER_MIN_BITS, 4);
+    for(u32 i = 1; i <= 1000; ++i)
+        sent.add(random_key(i));
+    const vector<u8>& data = sent.data();
+    u32 size = (u32)data.size();
+
+    ChunkFilter received;
+    received.reset(sent.bits(), sent.hashes());
+    CHECK( received.load(0, &data[0], 1000) );
+    CHECK( !received.complete() );
+
+    // the pieces must go on with the loaded ones and not exceed the filter
+    CHECK( !received.load(0, &data[0], 1000) );
+    CHECK( !received.load(2000, &data[2000], 1000) );
+    CHECK( received.load(1000, &data[1000], 0) );
+    CHECK( received.load(1000, &data[1000], size - 1000 - 1) );
+    CHECK( !received.load(size - 1, &data[size - 1], 2) );
+    CHECK( received.load(size - 1, &data[size - 1], 1) );
+    CHECK( received.complete() );
+    CHECK( data == received.data() );
+    for(u32 i = 1; i <= 1000; ++i)
+        CHECK( received.contains(random_key(i)) );
+
+    // the filter made anew starts from the beginning
+    received.reset(sent.bits(), sent.hashes());
+    CHECK( !received.complete() && !received.contains(random_key(1)) );
+}
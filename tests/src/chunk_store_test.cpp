@@ -0,0 +1,146 @@
+#include <string.h>
+#include <vector>
+
+#include "unit_test.h"
+#include "chunk_store.h"
+
+using namespace std;
+
+namespace {
+
+struct TestChunk
+{
+    vector<u8> data_;
+    u8 name_[CDC_HASH_SIZE];
+    u8 record_[CDC_RECORD_SIZE];
+};
+
+void make_chunk(TestChunk* chunk, u32 size, u32 seed)
+{
+    chunk->data_.resize(size);
+    fill_random(&chunk->data_[0], size, seed);
+    Chunker::hash(&chunk->data_[0], size, chunk->name_);
+    Chunker::encode(chunk->name_, size, chunk->record_);
+}
+
+string records(const TestChunk* chunks[], u32 count)
+{
+    string text;
+    for(u32 i = 0; i < count; ++i)
+        text.append((const char*)chunks[i]->record_, CDC_RECORD_SIZE);
+    return text;
+}
+
+bool stored(const ChunkStore& store, const TestChunk& chunk)
+{
+    Message data;
+    if( !store.read(chunk.name_, (u32)chunk.data_.size(), &data) )
+        return false;
+    return data.size() == chunk.data_.size() && 0 == memcmp(data.get(), &chunk.data_[0], data.size());
+}
+
+} // namespace
+
+// The chunks are kept while the files refer to them, the others are removed when the store is opened
+TEST(chunk_store)
+{
+    string dir = temp_path("chunk_store");
+    string path = temp_path("chunk_store_file");
+    remove_tree(dir);
+
+    TestChunk first, second, loose, missing;
+    make_chunk(&first, CDC_MIN_CHUNK, 241);
+    make_chunk(&second, CDC_AVG_CHUNK + 1, 242);
+    make_chunk(&loose, 100, 243);
+    make_chunk(&missing, 200, 244);
+    {
+        ChunkStore store(dir);
+        CHECK( 0 == store.chunks() );
+        store.put(first.name_, &first.data_[0], (u32)first.data_.size());
+        store.put(second.name_, &second.data_[0], (u32)second.data_.size());
+        store.put(loose.name_, &loose.data_[0], (u32)loose.data_.size());
+        store.put(first.name_, &first.data_[0], (u32)first.data_.size());
+        CHECK( 3 == store.chunks() );
+        CHECK( first.data_.size() + second.data_.size() + loose.data_.size() == store.bytes() );
+        CHECK( store.has(second.name_) && !store.has(missing.name_) );
+        CHECK( stored(store, first) && stored(store, loose) );
+
+        // the size of record must match
+        Message data;
+        CHECK( !store.read(first.name_, (u32)first.data_.size() + 1, &data) );
+
+        // the chunks the store has not are skipped
+        const TestChunk* chunks[] = { &first, &missing, &second };
+        store.refer(path, records(chunks, 3));
+    }
+    {
+        ChunkStore store(dir);
+        CHECK( 2 == store.chunks() );
+        CHECK( stored(store, first) && stored(store, second) );
+        CHECK( !store.has(loose.name_) );
+
+        // the new content of file releases the chunks of old one
+        const TestChunk* chunks[] = { &second };
+        store.refer(path, records(chunks, 1));
+    }
+    {
+        ChunkStore store(dir);
+        CHECK( 1 == store.chunks() && second.data_.size() == store.bytes() );
+        CHECK( stored(store, second) && !store.has(first.name_) );
+        store.refer(path, string());
+    }
+    {
+        ChunkStore store(dir);
+        CHECK( 0 == store.chunks() );
+    }
+    remove_tree(dir);
+}
+
+// The published filter has the chunks of store, the chunks stored later go by the added keys
+TEST(chunk_store_filter)
+{
+    string dir = temp_path("chunk_store_filter");
+    string path = temp_path("chunk_store_filter_file");
+    remove_tree(dir);
+
+    TestChunk first, second, third;
+    make_chunk(&first, 1000, 251);
+    make_chunk(&second, 2000, 252);
+    make_chunk(&third, 3000, 253);
+    {
+        ChunkStore store(dir);
+        store.put(first.name_, &first.data_[0], (u32)first.data_.size());
+        const TestChunk* chunks[] = { &first };
+        store.refer(path, records(chunks, 1));
+    }
+
+    ChunkStore store(dir);
+    RefCountedPtr<ChunkStore::Filter> published = store.filter();
+    CHECK( CDC_FILTER_MIN_BITS == published->bits_ && published->data_.size() << 3 == (u64)1 << published->bits_ );
+    CHECK( 0 == published->keys_ );
+
+    ChunkFilter filter;
+    filter.reset(published->bits_, published->hashes_);
+    CHECK( filter.load(0, &published->data_[0], (u32)published->data_.size()) );
+    CHECK( filter.contains(ChunkFilter::key(first.name_)) );
+
+    // the stored chunks are added to the filter of the same generation, the filter is shared
+    store.put(second.name_, &second.data_[0], (u32)second.data_.size());
+    store.put(third.name_, &third.data_[0], (u32)third.data_.size());
+    u64 from = 0;
+    vector<u64> keys;
+    CHECK( store.added(published->generation_, &from, &keys) );
+    CHECK( 2 == from && 2 == keys.size() );
+    CHECK( ChunkFilter::key(second.name_) == keys[0] && ChunkFilter::key(third.name_) == keys[1] );
+    CHECK( published.get() == store.filter().get() );
+
+    keys.clear();
+    CHECK( store.added(published->generation_, &from, &keys) );
+    CHECK( 2 == from && keys.empty() );
+
+    // the sender of other generation gets the filter anew
+    CHECK( !store.added(published->generation_ + 1, &from, &keys) );
+
+    store.refer(path, string());
+    remove_tree(dir);
+}
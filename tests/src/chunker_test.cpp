@@ -0,0 +1,87 @@
+#include <vector>
+#include <set>
+
+#include "unit_test.h"
+#include "chunker.h"
+
+using namespace std;
+
+namespace {
+
+typedef set<u32> CutsT;
+
+/*  Returns the ends of chunks of the data from 'from' as the offsets in the data */
+CutsT cuts(const vector<u8>& data, u32 from)
+{
+    CutsT ends;
+    for(u32 offset = from; offset < data.size(); )
+    {
+        u32 rest = (u32)data.size() - offset;
+        u32 size = Chunker::cut(&data[offset], rest);
+        CHECK( size > 0 && size <= rest && size <= CDC_MAX_CHUNK );
+        CHECK( size >= CDC_MIN_CHUNK || size == rest );
+        offset += size;
+        ends.insert(offset);
+    }
+    return ends;
+}
+
+} // namespace
+
+// The name of chunk is its BLAKE3 hash, the record carries the name and the size
+TEST(chunk_records)
+{
+    u8 name[CDC_HASH_SIZE];
+    Chunker::hash((const u8*)"", 0, name);
+    CHECK( "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" == hex(name, CDC_HASH_SIZE) );
+
+    u8 record[CDC_RECORD_SIZE];
+    Chunker::encode(name, CDC_MAX_CHUNK, record);
+    CHECK( 0 == memcmp(name, record, CDC_HASH_SIZE) );
+    CHECK( CDC_MAX_CHUNK == Chunker::record_size(record) );
+    // the size is in network byte order
+    CHECK( 0 == record[CDC_HASH_SIZE] && 0x04 == record[CDC_HASH_SIZE + 1] && 0 == record[CDC_RECORD_SIZE - 1] );
+}
+
+// The same data is cut the same way, the chunks are about the average size
+TEST(chunk_cuts)
+{
+    const u32 size = 16 * 1048576;
+    vector<u8> data(size);
+    fill_random(&data[0], size, 24);
+
+    CutsT ends = cuts(data, 0);
+    CHECK( ends == cuts(data, 0) );
+    CHECK( size / ends.size() >= CDC_AVG_CHUNK / 2 && size / ends.size() <= CDC_AVG_CHUNK * 2 );
+
+    // the data of the same bytes is cut at the largest chunks
+    vector<u8> zeros(size);
+    CutsT zeroEnds = cuts(zeros, 0);
+    CHECK( size / CDC_MAX_CHUNK == zeroEnds.size() );
+}
+
+// The data shifted by the inserted bytes is cut at the same places after a few chunks,
+// so its chunks are found in the store
+TEST(chunk_shift)
+{
+    const u32 size = 8 * 1048576;
+    vector<u8> data(size);
+    fill_random(&data[0], size, 240);
+    CutsT ends = cuts(data, 0);
+
+    static const u32 shifts[] = { 1, 777, 100000 };
+    for(u32 i = 0; i < sizeof(shifts) / sizeof(shifts[0]); ++i)
+    {
+        // the inserted bytes come before the data, so its offsets are the same from 'shift'
+        vector<u8> shifted(shifts[i]);
+        fill_random(&shifted[0], shifts[i], 241 + i);
+        shifted.insert(shifted.end(), data.begin(), data.end());
+
+        CutsT shiftedEnds = cuts(shifted, 0);
+        u32 same = 0;
+        for(CutsT::const_iterator It = shiftedEnds.begin(); It != shiftedEnds.end(); ++It)
+            if( *It > shifts[i] && ends.count(*It - shifts[i]) )
+                ++same;
+        CHECK( same + 3 >= ends.size() );
+    }
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <vector>
+
+#include "unit_test.h"
+#include "delta_signature.h"
+
+using namespace std;
+
+namespace {
+
+void write_file(const string& path, const vector<u8>& data)
+{
+    RawFile file(path, "wb+");
+    CHECK( data.size() == file.pwrite(&data[0], (u32)data.size(), 0) );
+}
+
+/*  Puts the new file together from its literals and the blocks of basis found by the matcher
+    @param piece - the most literals taken at once, the rest of them is asked again
+    @param copied - set to the bytes taken from the basis
+*/
+vector<u8> patch(DeltaMatcher* matcher, const string& path, const vector<u8>& basis, u32 piece, u64* copied)
+{
+    File file(path, "rb");
+    i64 end = file.size();
+    u32 blockSize = matcher->signatures().block_size();
+    vector<u8> result;
+    *copied = 0;
+    for(i64 offset = 0; offset < end; )
+    {
+        u32 block = 0;
+        u32 size = 0;
+        u32 literals = matcher->next(&file, offset, end, &block, &size);
+        if( 0 == literals )
+        {
+            u64 from = (u64)block * blockSize;
+            CHECK( size > 0 && from + size <= basis.size() );
+            result.insert(result.end(), basis.begin() + (size_t)from, basis.begin() + (size_t)(from + size));
+            *copied += size;
+            offset += size;
+            continue;
+        }
+
+        literals = min(literals, piece);
+        vector<u8> data(literals);
+        file.seek(offset, SEEK_SET);
+        CHECK( literals == file.read(&data[0], literals) );
+        result.insert(result.end(), data.begin(), data.end());
+        offset += literals;
+    }
+    return result;
+}
+
+} // namespace
+
+// The weak checksum sums the bytes and their prefix sums, the strong hash is the start of BLAKE3
+TEST(delta_hashes)
+{
+    // a = 97 + 98 + 99, b = 97 + 195 + 294
+    CHECK( (294 | (586 << 16)) == BlockSignatures::checksum((const u8*)"abc", 3) );
+    CHECK( 0 == BlockSignatures::checksum((const u8*)"", 0) );
+
+    u8 hash[DELTA_STRONG_SIZE];
+    BlockSignatures::strong((const u8*)"", 0, hash);
+    CHECK( "af1349b9f5f9a1a6a0404dea36dcc949" == hex(hash, DELTA_STRONG_SIZE) );
+
+    CHECK( DELTA_MIN_BLOCK == BlockSignatures::block_size(0) );
+    CHECK( 4096 == BlockSignatures::block_size(16 * 1048576) );
+    CHECK( 8192 == BlockSignatures::block_size(16 * 1048576 + 1) );
+    CHECK( DELTA_MAX_BLOCK == BlockSignatures::block_size(1LL << 40) );
+}
+
+// The signatures sent by frames are the same as computed
+TEST(delta_signatures)
+{
+    const u32 size = 1000000;
+    vector<u8> data(size);
+    fill_random(&data[0], size, 23);
+    string path = temp_path("delta_signatures");
+    write_file(path, data);
+
+    BlockSignatures signatures;
+    {
+        RawFile file(path, "rb");
+        signatures.compute(file);
+    }
+    remove(path.c_str());
+
+    u32 blockSize = signatures.block_size();
+    CHECK( DELTA_MIN_BLOCK == blockSize );
+    CHECK( (size + blockSize - 1) / blockSize == signatures.blocks() );
+    CHECK( signatures.blocks() == signatures.count() );
+    CHECK( size % blockSize == signatures.length(signatures.blocks() - 1) );
+
+    u32 last = signatures.blocks() - 1;
+    u8 hash[DELTA_STRONG_SIZE];
+    BlockSignatures::strong(&data[(size_t)last * blockSize], size % blockSize, hash);
+    CHECK( 0 == memcmp(hash, signatures.strong(last), DELTA_STRONG_SIZE) );
+    CHECK( BlockSignatures::checksum(&data[blockSize], blockSize) == signatures.weak(1) );
+
+    // they are added by several frames
+    Message encoded;
+    signatures.encode(&encoded);
+    CHECK( signatures.blocks() * DELTA_SIGNATURE_SIZE == encoded.size() );
+
+    BlockSignatures received;
+    received.reset(blockSize, size);
+    CHECK( received.add(encoded.get(), 100) );
+    CHECK( received.add(encoded.get() + 100 * DELTA_SIGNATURE_SIZE, signatures.blocks() - 100) );
+    CHECK( !received.add(encoded.get(), 1) );
+    for(u32 i = 0; i < signatures.blocks(); ++i)
+    {
+        CHECK( signatures.weak(i) == received.weak(i) );
+        CHECK( 0 == memcmp(signatures.strong(i), received.strong(i), DELTA_STRONG_SIZE) );
+    }
+}
+
+// The new file is put together from the blocks of old one and the changed data,
+// the blocks are found after the inserted and removed bytes
+TEST(delta_round_trip)
+{
+    const u32 size = 3 * 1048576 + 1234;
+    vector<u8> basis(size);
+    fill_random(&basis[0], size, 230);
+
+    vector<u8> changed(basis.begin(), basis.begin() + 500000);
+    vector<u8> inserted(777);
+    fill_random(&inserted[0], (u32)inserted.size(), 231);
+    changed.insert(changed.end(), inserted.begin(), inserted.end());
+    changed.insert(changed.end(), basis.begin() + 500000, basis.begin() + 2000000);
+    changed.insert(changed.end(), basis.begin() + 2100001, basis.end());
+    changed[1500000] ^= 0x5a;
+    changed.insert(changed.end(), inserted.begin(), inserted.end());
+
+    string basisPath = temp_path("delta_basis");
+    string changedPath = temp_path("delta_changed");
+    write_file(basisPath, basis);
+    write_file(changedPath, changed);
+
+    for(u32 piece = 1000; piece <= 65536; piece *= 64)
+    {
+        DeltaMatcher matcher(65536);
+        {
+            RawFile file(basisPath, "rb");
+            matcher.signatures().compute(file);
+        }
+        matcher.index();
+
+        u64 copied = 0;
+        CHECK( changed == patch(&matcher, changedPath, basis, piece, &copied) );
+
+        // the blocks spoiled by the changes are sent by literals only
+        u32 blockSize = matcher.signatures().block_size();
+        CHECK( copied + 5 * blockSize + 2 * inserted.size() >= changed.size() );
+    }
+
+    // the matcher without signatures sends everything by literals
+    DeltaMatcher matcher(65536);
+    u64 copied = 0;
+    CHECK( changed == patch(&matcher, changedPath, basis, 65536, &copied) );
+    CHECK( 0 == copied );
+
+    remove(basisPath.c_str());
+    remove(changedPath.c_str());
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "unit_test.h"
+#include "rawfile.h"
+
+using namespace std;
+
+// The preallocated space is the whole file at once, the file size is kept as it is
+TEST(preallocate)
+{
+    const i64 size = 8 * 1048576;
+    string path = temp_path("preallocate");
+    {
+        RawFile file(path, "wb+");
+        file.resize(size);
+        bool allocated = file.allocate(size);
+        CHECK( size == file.size() );
+
+        // the file system which can't preallocate leaves the file sparse
+        struct stat info;
+        CHECK( 0 == stat(path.c_str(), &info) );
+        if( allocated )
+            CHECK( (i64)info.st_blocks * 512 >= size );
+
+        u8 data[4096];
+        fill_random(data, sizeof(data), 8);
+        CHECK( sizeof(data) == file.pwrite(data, sizeof(data), size - (i64)sizeof(data)) );
+        CHECK( size == file.size() );
+    }
+    remove(path.c_str());
+}
+
+// The allocation beyond the end doesn't grow the file
+TEST(preallocate_keeps_size)
+{
+    string path = temp_path("preallocate_keeps_size");
+    {
+        RawFile file(path, "wb+");
+        file.resize(4096);
+        file.allocate(1048576);
+        CHECK( 4096 == file.size() );
+    }
+    remove(path.c_str());
+}
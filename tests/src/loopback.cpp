@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <vector>
+#include <algorithm>
+
+#include "unit_test.h"
+#include "loopback.h"
+#include "ipaddress.h"
+#include "system_exception.h"
+#include "useful.h"
+
+using namespace std;
+
+namespace {
+
+/*  The server waits so long to start, to quit and to answer */
+const u64 SERVER_TIMEOUT_MS = 10000;
+
+/*  The window and the segment size of narrow connection, the loopback ones are 64 Kb
+    and the send buffer of server is some of them
+*/
+const i32 NARROW_WINDOW = 4096;
+const i32 NARROW_SEGMENT = 536;
+
+/*  Returns the port nobody listens to, the system chooses it */
+u16 free_port()
+{
+    i32 fd = socket(AF_INET, SOCK_STREAM, 0);
+    if( -1 == fd )
+        throw system_exception("socket", errno);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    socklen_t size = sizeof(addr);
+    if( 0 != bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || 0 != getsockname(fd, (struct sockaddr*)&addr, &size) )
+    {
+        i32 err = errno;
+        close(fd);
+        throw system_exception("bind", err);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+void set_nonblocking(i32 fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/*  Connects to the server on the local host as the client does
+    @Returns the descriptor or -1 if nobody listens yet
+*/
+i32 connect_server(u16 port, bool narrow)
+{
+    i32 fd = socket(AF_INET, SOCK_STREAM, 0);
+    if( -1 == fd )
+        throw system_exception("socket", errno);
+
+    // the window and the segments are chosen when the connection is made
+    if( narrow )
+    {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &NARROW_WINDOW, sizeof(NARROW_WINDOW));
+        setsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &NARROW_SEGMENT, sizeof(NARROW_SEGMENT));
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = IPAddress::getLocalHost().get_address();
+    addr.sin_port = htons(port);
+    if( 0 != connect(fd, (struct sockaddr*)&addr, sizeof(addr)) )
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*  Returns true if the frame of server carries the payload */
+bool has_payload(u8 type)
+{
+    return signature_FrameType == type || have_FrameType == type || filter_FrameType == type || added_FrameType == type;
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+TestServer::TestServer(const string& name, const string& options)
+    : pid_(-1),
+    input_(-1),
+    port_(0)
+{
+    char cwd[PATH_MAX];
+    if( NULL == getcwd(cwd, sizeof(cwd)) )
+        throw system_exception("getcwd", errno);
+    dir_ = string(cwd) + "/" + temp_path(name);
+    remove_tree(dir_);
+    if( 0 != mkdir(dir_.c_str(), 0755) )
+        throw system_exception("mkdir " + dir_, errno);
+
+    // the server runs in its directory, so its path is resolved before
+    const char* binary = getenv("TEST_SERVER");
+    char server[PATH_MAX];
+    if( NULL == realpath(binary ? binary : TEST_SERVER, server) )
+        throw system_exception(string("the server ") + (binary ? binary : TEST_SERVER) + " is not built", errno);
+
+    vector<string> args;
+    args.push_back(server);
+    string rest = options;
+    while( !rest.empty() )
+    {
+        string::size_type space = rest.find(' ');
+        if( space )
+            args.push_back(rest.substr(0, space));
+        rest = (string::npos == space) ? string() : rest.substr(space + 1);
+    }
+    vector<char*> argv;
+    for(u32 i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    port_ = free_port();
+    i32 input[2];
+    if( 0 != pipe(input) )
+        throw system_exception("pipe", errno);
+    pid_ = fork();
+    if( -1 == pid_ )
+        throw system_exception("fork", errno);
+    if( 0 == pid_ )
+    {
+        // the console of server is not the one of tests
+        i32 output = open("/dev/null", O_WRONLY);
+        dup2(input[0], STDIN_FILENO);
+        dup2(output, STDOUT_FILENO);
+        dup2(output, STDERR_FILENO);
+        close(input[0]);
+        close(input[1]);
+        if( 0 == chdir(dir_.c_str()) )
+            execv(server, &argv[0]);
+        _exit(127);
+    }
+    close(input[0]);
+    input_ = input[1];
+
+    string port = tostring((u32)port_) + "\n";
+    if( (ssize_t)port.length() != write(input_, port.data(), port.length()) )
+    {
+        stop();
+        throw system_exception("the server doesn't take its port", errno);
+    }
+
+    for(u64 start = now_ms(); now_ms() - start < SERVER_TIMEOUT_MS; usleep(10000))
+    {
+        i32 fd = connect_server(port_, false);
+        if( -1 != fd )
+        {
+            close(fd);
+            return;
+        }
+        if( pid_ == waitpid(pid_, NULL, WNOHANG) )
+        {
+            pid_ = -1;
+            break;
+        }
+    }
+    stop();
+    throw Exception("the server " + string(server) + " doesn't listen to port " + tostring((u32)port_));
+}
+
+TestServer::~TestServer()
+{
+    stop();
+    remove_tree(dir_);
+}
+
+void TestServer::stop()
+{
+    if( -1 != input_ )
+    {
+        // the write fails if the server is gone already
+        write(input_, "q", 1);
+        close(input_);
+        input_ = -1;
+    }
+    if( -1 == pid_ )
+        return;
+
+    for(u64 start = now_ms(); now_ms() - start < SERVER_TIMEOUT_MS; usleep(10000))
+    {
+        if( pid_ == waitpid(pid_, NULL, WNOHANG) )
+        {
+            pid_ = -1;
+            return;
+        }
+    }
+    kill(pid_, SIGKILL);
+    waitpid(pid_, NULL, 0);
+    pid_ = -1;
+}
+
+/////////////////////////////////////////////////////////////////////////
+FrameConnection::FrameConnection(u16 port, bool narrow)
+    : fd_(connect_server(port, narrow))
+{
+    if( -1 == fd_ )
+        throw system_exception("connect to port " + tostring((u32)port), errno);
+}
+
+FrameConnection::~FrameConnection()
+{
+    close(fd_);
+}
+
+void FrameConnection::send(const string& frames)
+{
+    for(string::size_type offset = 0; offset < frames.length(); )
+    {
+        ssize_t sent = ::send(fd_, frames.data() + offset, frames.length() - offset, MSG_NOSIGNAL);
+        if( -1 == sent && EINTR == errno )
+            continue;
+        if( -1 == sent )
+            throw system_exception("send", errno);
+        offset += sent;
+    }
+}
+
+bool FrameConnection::receive(FrameHeader* header, string* payload, u32 timeout)
+{
+    u64 start = now_ms();
+    for(;;)
+    {
+        if( buffer_.length() >= FRAME_HEADER_SIZE )
+        {
+            if( !decode_frame_header((const u8*)buffer_.data(), header) )
+                throw Exception("invalid frame magic of server");
+            u64 length = has_payload(header->type_) ? header->length_ : 0;
+            if( buffer_.length() - FRAME_HEADER_SIZE >= length )
+            {
+                payload->assign(buffer_, FRAME_HEADER_SIZE, (string::size_type)length);
+                buffer_.erase(0, FRAME_HEADER_SIZE + (string::size_type)length);
+                return true;
+            }
+        }
+
+        u64 passed = now_ms() - start;
+        if( passed >= timeout )
+            return false;
+        struct pollfd wait;
+        wait.fd = fd_;
+        wait.events = POLLIN;
+        if( 0 >= poll(&wait, 1, (int)(timeout - passed)) )
+            continue;
+
+        char data[65536];
+        ssize_t received = recv(fd_, data, sizeof(data), 0);
+        if( -1 == received && EINTR == errno )
+            continue;
+        if( -1 == received )
+            throw system_exception("recv", errno);
+        if( 0 == received )
+            throw Exception("the server closed the connection");
+        buffer_.append(data, received);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+DelayLink::DelayLink(u16 server, u32 delay, u32 window)
+    : Thread("DelayLink"),
+    server_(server),
+    delay_(delay),
+    window_(window),
+    listener_(-1),
+    port_(0),
+    running_(true)
+{
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    if( -1 == listener_ )
+        throw system_exception("socket", errno);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    socklen_t size = sizeof(addr);
+    if( 0 != bind(listener_, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(listener_, 64) ||
+        0 != getsockname(listener_, (struct sockaddr*)&addr, &size) )
+    {
+        i32 err = errno;
+        close(listener_);
+        throw system_exception("listen", err);
+    }
+    port_ = ntohs(addr.sin_port);
+    start();
+}
+
+DelayLink::~DelayLink()
+{
+    running_ = false;
+    join();
+    for(u32 i = 0; i < flows_.size(); ++i)
+    {
+        close(flows_[i].client_);
+        close(flows_[i].server_);
+    }
+    close(listener_);
+}
+
+void DelayLink::run()
+{
+    while( running_ )
+    {
+        // the client is read while its window has room, the server while the due piece waits for it
+        u64 now = now_ms();
+        i32 timeout = 10;
+        vector<struct pollfd> waits(1 + 2 * flows_.size());
+        waits[0].fd = listener_;
+        waits[0].events = POLLIN;
+        for(u32 i = 0; i < flows_.size(); ++i)
+        {
+            const Flow& flow = flows_[i];
+            waits[1 + 2 * i].fd = flow.client_;
+            waits[1 + 2 * i].events = ((!flow.closed_ && flow.flying_ < window_) ? POLLIN : 0) | (flow.answers_.empty() ? 0 : POLLOUT);
+            waits[2 + 2 * i].fd = flow.server_;
+            waits[2 + 2 * i].events = POLLIN;
+            if( !flow.pieces_.empty() )
+            {
+                if( flow.pieces_.front().due_ <= now )
+                    waits[2 + 2 * i].events |= POLLOUT;
+                else
+                    timeout = min(timeout, (i32)(flow.pieces_.front().due_ - now));
+            }
+        }
+        if( 0 > poll(&waits[0], waits.size(), timeout) && EINTR != errno )
+            break;
+
+        for(u32 i = (u32)flows_.size(); i-- > 0; )
+        {
+            if( relay(&flows_[i], waits[1 + 2 * i].revents, waits[2 + 2 * i].revents) )
+                continue;
+            close(flows_[i].client_);
+            close(flows_[i].server_);
+            flows_.erase(flows_.begin() + i);
+        }
+
+        if( waits[0].revents & POLLIN )
+        {
+            Flow flow;
+            flow.client_ = accept(listener_, NULL, NULL);
+            if( -1 == flow.client_ )
+                continue;
+            flow.server_ = connect_server(server_, false);
+            if( -1 == flow.server_ )
+            {
+                close(flow.client_);
+                continue;
+            }
+            set_nonblocking(flow.client_);
+            set_nonblocking(flow.server_);
+            flow.flying_ = 0;
+            flow.closed_ = false;
+            flows_.push_back(flow);
+        }
+    }
+}
+
+bool DelayLink::relay(Flow* flow, short clientEvents, short serverEvents)
+{
+    if( (clientEvents & (POLLIN | POLLHUP | POLLERR)) && !flow->closed_ && flow->flying_ < window_ )
+    {
+        char data[65536];
+        ssize_t received = recv(flow->client_, data, min((u32)sizeof(data), window_ - flow->flying_), 0);
+        if( received > 0 )
+        {
+            Piece piece;
+            piece.due_ = now_ms() + delay_;
+            piece.data_.assign(data, received);
+            flow->pieces_.push_back(piece);
+            flow->flying_ += (u32)received;
+        }
+        else if( 0 == received || (EAGAIN != errno && EINTR != errno) )
+            flow->closed_ = true;
+    }
+
+    // the pieces which are due go to the server as it takes them
+    u64 now = now_ms();
+    while( !flow->pieces_.empty() && flow->pieces_.front().due_ <= now )
+    {
+        Piece& piece = flow->pieces_.front();
+        ssize_t sent = send(flow->server_, piece.data_.data(), piece.data_.size(), MSG_NOSIGNAL);
+        if( -1 == sent && (EAGAIN == errno || EINTR == errno) )
+            break;
+        if( sent <= 0 )
+            return false;
+        flow->flying_ -= (u32)sent;
+        if( (size_t)sent < piece.data_.size() )
+        {
+            piece.data_.erase(0, sent);
+            break;
+        }
+        flow->pieces_.pop_front();
+    }
+    if( flow->closed_ && flow->pieces_.empty() )
+        return false;
+
+    if( serverEvents & (POLLIN | POLLHUP | POLLERR) )
+    {
+        char data[65536];
+        ssize_t received = recv(flow->server_, data, sizeof(data), 0);
+        if( received > 0 )
+            flow->answers_.append(data, received);
+        else if( 0 == received || (EAGAIN != errno && EINTR != errno) )
+            return false;
+    }
+    if( !flow->answers_.empty() )
+    {
+        ssize_t sent = send(flow->client_, flow->answers_.data(), flow->answers_.size(), MSG_NOSIGNAL);
+        if( sent > 0 )
+            flow->answers_.erase(0, sent);
+        else if( -1 == sent && EAGAIN != errno && EINTR != errno )
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+#include <string.h>
+#include <vector>
+#include <string>
+
+#include "unit_test.h"
+#include "useful.h"
+#include "lz4_block.h"
+
+using namespace std;
+
+namespace {
+
+/*  The text of 'block N of the file server, ' for N = i % 7, i < 40 */
+string reference_text()
+{
+    string text;
+    for(u32 i = 0; i < 40; ++i)
+        text += "block " + tostring(i % 7) + " of the file server, ";
+    return text;
+}
+
+/*  The block of reference text made by the reference LZ4 in its high compression mode,
+    it has the long literal run, the overlapped matches and the extended match length
+*/
+const u8 reference_block[] = {
+    0xf2, 0x0d, 0x62, 0x6c, 0x6f, 0x63, 0x6b, 0x20, 0x30, 0x20, 0x6f, 0x66, 0x20, 0x74, 0x68, 0x65,
+    0x20, 0x66, 0x69, 0x6c, 0x65, 0x20, 0x73, 0x65, 0x72, 0x76, 0x65, 0x72, 0x2c, 0x20, 0x1c, 0x00,
+    0x1f, 0x31, 0x1c, 0x00, 0x08, 0x1f, 0x32, 0x1c, 0x00, 0x08, 0x1f, 0x33, 0x1c, 0x00, 0x08, 0x1f,
+    0x34, 0x1c, 0x00, 0x08, 0x1f, 0x35, 0x1c, 0x00, 0x08, 0x1f, 0x36, 0x1c, 0x00, 0x02, 0x0f, 0xc4,
+    0x00, 0xff, 0xff, 0xff, 0x87, 0x50, 0x76, 0x65, 0x72, 0x2c, 0x20,
+};
+
+/*  Compresses and decompresses the data, the output buffer is exact, so any overrun is caught */
+void round_trip(const vector<u8>& data, bool high)
+{
+    u32 size = (u32)data.size();
+    vector<u8> block(lz4_bound(size) + 1);
+    u32 packed = lz4_compress(size ? &data[0] : NULL, size, &block[0], (u32)block.size(), high);
+    CHECK( packed > 0 && packed <= lz4_bound(size) );
+
+    vector<u8> unpacked(size ? size : 1);
+    CHECK( (i32)size == lz4_decompress(&block[0], packed, &unpacked[0], size) );
+    CHECK( 0 == size || 0 == memcmp(&data[0], &unpacked[0], size) );
+
+    // the capacity short of one byte is not overrun
+    if( size > 0 )
+        CHECK( -1 == lz4_decompress(&block[0], packed, &unpacked[0], size - 1) );
+}
+
+} // namespace
+
+// The block of reference implementation is decoded
+TEST(lz4_reference_block)
+{
+    string text = reference_text();
+    CHECK( 1120 == text.size() );
+
+    vector<u8> data(text.size());
+    CHECK( (i32)text.size() == lz4_decompress(reference_block, sizeof(reference_block), &data[0], (u32)data.size()) );
+    CHECK( text == string((const char*)&data[0], data.size()) );
+}
+
+// The random, repeated and mixed data of both modes comes back as it was
+TEST(lz4_round_trip)
+{
+    static const u32 sizes[] = { 0, 1, 12, 13, 100, 4096, 65536, 65537, 300000 };
+    for(u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        vector<u8> data(sizes[i]);
+        round_trip(data, false);
+        round_trip(data, true);
+
+        // the text which matches far and near
+        string text = reference_text();
+        for(u32 j = 0; j < data.size(); ++j)
+            data[j] = (u8)text[(j * 7 / 5) % text.size()];
+        if( data.size() > 1000 )
+            fill_random(&data[data.size() / 2], 500, i + 1);
+        round_trip(data, false);
+        round_trip(data, true);
+    }
+
+    // the random data doesn't fit its own size
+    vector<u8> data(65536), block(65536);
+    fill_random(&data[0], (u32)data.size(), 21);
+    CHECK( 0 == lz4_compress(&data[0], (u32)data.size(), &block[0], (u32)block.size()) );
+    CHECK( 0 == lz4_compress(&data[0], (u32)data.size(), &block[0], (u32)block.size(), true) );
+
+    // though the bound fits everything
+    block.resize(lz4_bound((u32)data.size()));
+    u32 packed = lz4_compress(&data[0], (u32)data.size(), &block[0], (u32)block.size());
+    CHECK( packed > 0 );
+    vector<u8> unpacked(data.size());
+    CHECK( (i32)data.size() == lz4_decompress(&block[0], packed, &unpacked[0], (u32)unpacked.size()) );
+    CHECK( data == unpacked );
+}
+
+// The cut and garbled blocks are rejected without reading or writing out of the buffers,
+// the buffers are exact, so the memory checker catches any overrun
+TEST(lz4_malformed)
+{
+    // the block cut after the literals is a valid shorter one
+    vector<u8> unpacked(1120);
+    for(u32 size = 0; size < sizeof(reference_block); ++size)
+    {
+        vector<u8> cut(reference_block, reference_block + size);
+        i32 result = lz4_decompress(size ? &cut[0] : NULL, size, &unpacked[0], (u32)unpacked.size());
+        CHECK( -1 == result || (0 < result && result < 1120) );
+    }
+
+    // the match before the start of data
+    const u8 before[] = { 0x10, 'a', 0x02, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f' };
+    CHECK( -1 == lz4_decompress(before, sizeof(before), &unpacked[0], (u32)unpacked.size()) );
+
+    // the zero offset
+    const u8 zero[] = { 0x10, 'a', 0x00, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f' };
+    CHECK( -1 == lz4_decompress(zero, sizeof(zero), &unpacked[0], (u32)unpacked.size()) );
+
+    // the garbage is decoded to something or rejected, never beyond the buffers
+    for(u32 seed = 1; seed <= 2000; ++seed)
+    {
+        vector<u8> garbage(1 + seed % 97);
+        fill_random(&garbage[0], (u32)garbage.size(), seed);
+        vector<u8> out(seed % 300);
+        i32 size = lz4_decompress(&garbage[0], (u32)garbage.size(), out.empty() ? NULL : &out[0], (u32)out.size());
+        CHECK( -1 <= size && size <= (i32)out.size() );
+    }
+}
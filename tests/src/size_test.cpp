@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unit_test.h"
+#include "useful.h"
+#include "file.h"
+#include "rawfile.h"
+
+using namespace std;
+
+// The sizes of large files are parsed without truncation, the garbage is rejected
+TEST(atou64)
+{
+    u64 value = 0;
+    CHECK( atou64("0", &value) && 0 == value );
+    CHECK( atou64("4294967296", &value) && 4294967296ULL == value );
+    CHECK( atou64("8589934592", &value) && 8589934592ULL == value );
+    CHECK( atou64("18446744073709551615", &value) && (u64)-1 == value );
+
+    value = 7;
+    CHECK( !atou64("18446744073709551616", &value) );
+    CHECK( !atou64("99999999999999999999", &value) );
+    CHECK( !atou64("", &value) );
+    CHECK( !atou64("-1", &value) );
+    CHECK( !atou64("12 ", &value) );
+    CHECK( !atou64("0x10", &value) );
+    CHECK( 7 == value );
+}
+
+// The data beyond 4 Gb is written and read at its place, the file is sparse
+TEST(large_file)
+{
+    const i64 size = 5368709120LL;
+    const i64 offset = 4294967296LL + 12345;
+    string path = temp_path("large_file");
+
+    u8 data[4096];
+    fill_random(data, sizeof(data), 14);
+    {
+        RawFile file(path, "wb+");
+        file.resize(size);
+        CHECK( size == file.size() );
+        CHECK( sizeof(data) == file.pwrite(data, sizeof(data), offset) );
+
+        u8 read[sizeof(data)];
+        CHECK( sizeof(read) == file.pread(read, sizeof(read), offset) );
+        CHECK( 0 == memcmp(data, read, sizeof(data)) );
+
+        // the range is cut at the end of file
+        CHECK( 100 == file.pread(read, sizeof(read), size - 100) );
+    }
+    {
+        File file(path, "rb");
+        CHECK( size == file.size() );
+        file.seek(offset, SEEK_SET);
+        CHECK( offset == file.tell() );
+
+        u8 read[sizeof(data)];
+        CHECK( sizeof(read) == file.read(read, sizeof(read)) );
+        CHECK( 0 == memcmp(data, read, sizeof(data)) );
+    }
+    {
+        File file(path, "rb+");
+        file.resize(offset);
+        CHECK( offset == file.size() );
+    }
+    remove(path.c_str());
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "unit_test.h"
+#include "frame.h"
+#include "recv_stream.h"
+
+using namespace std;
+
+// The stripe of START frame is decoded as it is sent
+TEST(stripe_start_frame)
+{
+    FileStripe stripe = { 0x0123456789abcdefULL, 4294967296ULL, 1073741824ULL, 5 };
+    string frame = start_frame(7, "disk.img", 5368709120ULL, 0, NULL, &stripe);
+
+    FrameHeader header;
+    CHECK( decode_frame_header((const u8*)frame.data(), &header) );
+    CHECK( start_FrameType == header.type_ );
+    CHECK( 7 == header.stream_ );
+    CHECK( 0 != (header.flags_ & striped_FrameFlag) );
+    CHECK( 0 == (header.flags_ & resume_FrameFlag) );
+    CHECK( 8 + FRAME_STRIPE_SIZE + 8 == header.length_ );
+    CHECK( FRAME_HEADER_SIZE + header.length_ == frame.size() );
+
+    const u8* payload = (const u8*)frame.data() + FRAME_HEADER_SIZE;
+    CHECK( 5368709120ULL == frame::get64(payload) );
+    CHECK( stripe.transfer_ == frame::get64(payload + 8) );
+    CHECK( stripe.offset_ == frame::get64(payload + 16) );
+    CHECK( stripe.length_ == frame::get64(payload + 24) );
+    CHECK( stripe.count_ == frame::get32(payload + 32) );
+    CHECK( "disk.img" == string((const char*)payload + 8 + FRAME_STRIPE_SIZE, 8) );
+}
+
+// The file is complete when every stripe is received once, the stripe sent again is counted once
+TEST(striped_files)
+{
+    const i64 size = 3 * 65536 + 100;
+    string path = temp_path("striped_files");
+    StripedFiles files;
+    FileStripe stripes[3];
+    for(u32 i = 0; i < 3; ++i)
+    {
+        stripes[i].transfer_ = 42;
+        stripes[i].offset_ = i * 65536;
+        stripes[i].length_ = (i < 2) ? 65536 : size - 2 * 65536;
+        stripes[i].count_ = 3;
+    }
+
+    RawFile first, second, third;
+    files.open(&first, path, size, stripes[0], false, true);
+    CHECK( size == first.size() );
+
+    u8 data[100];
+    fill_random(data, sizeof(data), 18);
+    CHECK( sizeof(data) == first.pwrite(data, sizeof(data), size - (i64)sizeof(data)) );
+
+    // the other stripes open the same file, it is not truncated
+    files.open(&second, path, size, stripes[1], false, true);
+    files.open(&third, path, size, stripes[2], false, true);
+    u8 read[sizeof(data)];
+    CHECK( sizeof(read) == third.pread(read, sizeof(read), size - (i64)sizeof(read)) );
+    CHECK( 0 == memcmp(data, read, sizeof(data)) );
+
+    // the stripe of other file doesn't join the transfer
+    RawFile other;
+    bool thrown = false;
+    try {
+        files.open(&other, path, size + 1, stripes[1], false, false);
+    }
+    catch(const Exception&) {
+        thrown = true;
+    }
+    CHECK( thrown );
+
+    i64 complete = 0;
+    CHECK( !files.received(stripes[1], &complete) );
+    CHECK( !files.received(stripes[1], &complete) );
+    CHECK( !files.received(stripes[0], &complete) );
+    CHECK( 0 == complete );
+    CHECK( files.received(stripes[2], &complete) );
+    CHECK( size == complete );
+
+    // the transfer is forgotten when it is complete
+    complete = 0;
+    CHECK( !files.received(stripes[2], &complete) );
+    CHECK( 0 == complete );
+
+    first.close();
+    second.close();
+    third.close();
+    remove(path.c_str());
+}
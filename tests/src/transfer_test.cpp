@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <vector>
+#include <algorithm>
+
+#include "unit_test.h"
+#include "useful.h"
+#include "loopback.h"
+#include "rawfile.h"
+#include "crc32c.h"
+#include "tree_hash.h"
+#include "delta_signature.h"
+#include "chunker.h"
+
+using namespace std;
+
+namespace {
+
+/*  The server answers in this time or never */
+const u32 ANSWER_TIMEOUT_MS = 10000;
+
+/*  The payload of DATA frames of the uploads, the quantum of client's streams */
+const u32 UPLOAD_QUANTUM = 1048576;
+
+/*  Returns the content of file, it is empty if the file doesn't exist */
+string read_file(const string& path)
+{
+    string content;
+    try {
+        RawFile file(path, "rb");
+        content.resize((string::size_type)file.size());
+        if( content.size() && (i64)content.size() != file.pread(&content[0], (u32)content.size(), 0) )
+            content.clear();
+    }
+    catch(const Exception&) // the file is not there yet
+    {}
+    return content;
+}
+
+/*  Waits until the server puts the file in place */
+string wait_file(const string& path, u64 size)
+{
+    string content;
+    for(u64 start = now_ms(); now_ms() - start < ANSWER_TIMEOUT_MS; usleep(10000))
+    {
+        content = read_file(path);
+        if( content.size() == size )
+            break;
+    }
+    return content;
+}
+
+/*  Waits until the server writes the content at the offset of file */
+bool wait_range(const string& path, i64 offset, const string& content)
+{
+    string range(content.size(), 0);
+    for(u64 start = now_ms(); now_ms() - start < ANSWER_TIMEOUT_MS; usleep(10000))
+    {
+        try {
+            RawFile file(path, "rb");
+            if( (i64)range.size() == file.pread(&range[0], (u32)range.size(), offset) && range == content )
+                return true;
+        }
+        catch(const Exception&) // the file is not there yet
+        {}
+    }
+    return false;
+}
+
+/*  Returns the chaining value of the only leaf of data */
+string leaf_hash(const u8* data, u32 size)
+{
+    HashWorkers workers(1);
+    TreeHash hash(&workers);
+    hash.update(data, size);
+    u8 root[TREE_HASH_SIZE];
+    hash.finish(root);
+    u8 cv[TREE_HASH_SIZE];
+    hash.leaf(0, cv);
+    return string((const char*)cv, TREE_HASH_SIZE);
+}
+
+/*  Receives the frames of connection until the answer to CHUNKS frame and the whole filter
+    @param added - the keys of ADDED frames are appended to it
+    @Returns the payload of HAVE frame
+*/
+string receive_answer(FrameConnection* connection, u32 stream, ChunkFilter* filter, vector<u64>* added)
+{
+    FrameHeader header;
+    string payload;
+    string answer;
+    bool answered = false;
+    while( !answered || !filter->complete() )
+    {
+        CHECK( connection->receive(&header, &payload, ANSWER_TIMEOUT_MS) );
+        const u8* data = (const u8*)payload.data();
+        if( filter_FrameType == header.type_ )
+        {
+            CHECK( FRAME_CONNECTION_STREAM == header.stream_ && payload.size() > FRAME_FILTER_HEAD );
+            u64 offset = frame::get64(data + 2);
+            if( 0 == offset )
+                filter->reset(data[0], data[1]);
+            CHECK( filter->load(offset, data + FRAME_FILTER_HEAD, (u32)payload.size() - FRAME_FILTER_HEAD) );
+        }
+        else if( added_FrameType == header.type_ )
+        {
+            // the keys go on with the whole filter
+            CHECK( filter->complete() && 0 == payload.size() % 8 );
+            for(u32 i = 0; i < payload.size(); i += 8)
+                added->push_back(frame::get64(data + i));
+        }
+        else
+        {
+            CHECK( have_FrameType == header.type_ && stream == header.stream_ && !answered );
+            CHECK( FRAME_CHUNKS_HEAD + 1 == payload.size() && 0 == frame::get64(data) );
+            answer = payload;
+            answered = true;
+        }
+    }
+    return answer;
+}
+
+/*  Waits for the end of checksummed stream being confirmed */
+void receive_end(FrameConnection* connection, u32 stream, u64 size)
+{
+    FrameHeader header;
+    string payload;
+    CHECK( connection->receive(&header, &payload, ANSWER_TIMEOUT_MS) );
+    CHECK( offset_FrameType == header.type_ && stream == header.stream_ && size == header.length_ );
+}
+
+/*  Returns the number of extents of file, 0 if the file system doesn't tell them */
+u32 file_extents(const string& path)
+{
+    i32 fd = open(path.c_str(), O_RDONLY);
+    if( -1 == fd )
+        return 0;
+    // the extents are counted only, the delayed allocation is flushed before
+    struct fiemap map;
+    memset(&map, 0, sizeof(map));
+    map.fm_length = FIEMAP_MAX_OFFSET;
+    map.fm_flags = FIEMAP_FLAG_SYNC;
+    i32 result = ioctl(fd, FS_IOC_FIEMAP, &map);
+    close(fd);
+    return (0 == result) ? map.fm_mapped_extents : 0;
+}
+
+/*  The checksummed stream started by its connection */
+struct Upload
+{
+    FrameConnection* connection_;
+    u32 stream_;
+    u64 size_;      /* the payload of stream */
+};
+
+/*  Sends the payload of the streams at once, a quantum of each in turn, the payload is the same
+    random quantum over and over
+    @Returns the milliseconds until the server confirms the end of all of them
+*/
+u64 send_uploads(const vector<Upload>& uploads)
+{
+    vector<u8> quantum(UPLOAD_QUANTUM);
+    fill_random(&quantum[0], (u32)quantum.size(), 8);
+    u32 crc = crc32c(&quantum[0], (u32)quantum.size());
+
+    u64 start = now_ms();
+    vector<u64> sent(uploads.size(), 0);
+    for(bool sending = true; sending; )
+    {
+        sending = false;
+        for(u32 i = 0; i < uploads.size(); ++i)
+        {
+            const Upload& upload = uploads[i];
+            if( sent[i] == upload.size_ )
+                continue;
+            u32 portion = (u32)min(upload.size_ - sent[i], (u64)quantum.size());
+            string frames = frame_header(data_FrameType, upload.stream_, portion) + string((const char*)&quantum[0], portion);
+            frames += frame_header(checksum_FrameType, upload.stream_, (portion == quantum.size()) ? crc : crc32c(&quantum[0], portion));
+            sent[i] += portion;
+            if( sent[i] == upload.size_ )
+                frames += frame_header(end_FrameType, upload.stream_, 0);
+            upload.connection_->send(frames);
+            sending = true;
+        }
+    }
+    for(u32 i = 0; i < uploads.size(); ++i)
+        receive_end(uploads[i].connection_, uploads[i].stream_, uploads[i].size_);
+    return now_ms() - start;
+}
+
+} // namespace
+
+// The signatures of the large file don't fit the socket buffers, the server sends the rest
+// as the connection becomes writable. The file is replaced by delta then.
+TEST(transfer_delta_signatures)
+{
+    const i64 basisSize = 256 * 1048576;
+    const u32 literals = 1000;
+    const u32 stream = FRAME_FILE_STREAM;
+    u32 block = BlockSignatures::block_size(basisSize);
+    u32 blocks = (u32)((basisSize + block - 1) / block);
+    CHECK( (u64)blocks * DELTA_SIGNATURE_SIZE > 262144 );
+
+    TestServer server("transfer_delta");
+    {
+        RawFile basis(server.path("basis"), "wb+");
+        basis.resize(basisSize);
+    }
+
+    // the new file is the second block of basis and the literals
+    vector<u8> data(block + literals);
+    fill_random(&data[block], literals, 23);
+
+    // the narrow connection keeps the signatures in the socket buffer of server
+    FrameConnection connection(server.port(), true);
+    connection.send(start_frame(stream, "basis", data.size(), checksummed_FrameFlag | hashed_FrameFlag | delta_FrameFlag));
+
+    FrameHeader header;
+    string payload;
+    u32 signatures = 0;
+    while( signatures < blocks )
+    {
+        CHECK( connection.receive(&header, &payload, ANSWER_TIMEOUT_MS) );
+        CHECK( signature_FrameType == header.type_ && stream == header.stream_ );
+        CHECK( payload.size() > FRAME_SIGNATURE_HEAD && 0 == (payload.size() - FRAME_SIGNATURE_HEAD) % DELTA_SIGNATURE_SIZE );
+        const u8* head = (const u8*)payload.data();
+        CHECK( block == frame::get32(head) && (u64)basisSize == frame::get64(head + 4) );
+        signatures += (u32)(payload.size() - FRAME_SIGNATURE_HEAD) / DELTA_SIGNATURE_SIZE;
+    }
+    CHECK( blocks == signatures );
+
+    u8 copy[FRAME_COPY_SIZE];
+    frame::put32(copy, 1);
+    frame::put32(copy + 4, block);
+    string frames = frame_header(copy_FrameType, stream, FRAME_COPY_SIZE) + string((const char*)copy, FRAME_COPY_SIZE);
+    frames += frame_header(data_FrameType, stream, literals) + string((const char*)&data[block], literals);
+    frames += frame_header(checksum_FrameType, stream, crc32c(&data[block], literals));
+    frames += frame_header(hash_FrameType, stream, TREE_HASH_SIZE) + leaf_hash(&data[0], (u32)data.size());
+    frames += frame_header(end_FrameType, stream, 0);
+    connection.send(frames);
+
+    receive_end(&connection, stream, data.size());
+    CHECK( string((const char*)&data[0], data.size()) == wait_file(server.path("basis"), data.size()) );
+}
+
+// The filter of chunk store doesn't fit the socket buffers, it goes as the connection takes it.
+// The chunk stored by the first file is added to the filter, the second file refers to it.
+TEST(transfer_dedup_filter)
+{
+    const u32 size = 1000;
+    const u16 flags = checksummed_FrameFlag | hashed_FrameFlag | dedup_FrameFlag;
+    CHECK( ((u64)1 << CDC_FILTER_MIN_BITS) / 8 > 65536 );
+
+    vector<u8> data(size);
+    fill_random(&data[0], size, 25);
+    string content((const char*)&data[0], size);
+    u8 name[CDC_HASH_SIZE];
+    Chunker::hash(&data[0], size, name);
+    u8 chunks[FRAME_CHUNKS_HEAD + CDC_RECORD_SIZE];
+    frame::put64(chunks, 0);
+    Chunker::encode(name, size, chunks + FRAME_CHUNKS_HEAD);
+
+    TestServer server("transfer_dedup", "--dedup=store");
+    FrameConnection connection(server.port(), true);
+    ChunkFilter filter;
+    vector<u64> added;
+
+    // the store has not the chunk, so it is sent and stored
+    connection.send(start_frame(1, "first", size, flags) + frame_header(chunks_FrameType, 1, sizeof(chunks)) +
+                    string((const char*)chunks, sizeof(chunks)));
+    string answer = receive_answer(&connection, 1, &filter, &added);
+    CHECK( 0 == answer[FRAME_CHUNKS_HEAD] && added.empty() );
+    CHECK( !filter.contains(ChunkFilter::key(name)) );
+    connection.send(frame_header(data_FrameType, 1, size) + content + frame_header(checksum_FrameType, 1, crc32c(&data[0], size)) +
+                    frame_header(hash_FrameType, 1, TREE_HASH_SIZE) + leaf_hash(&data[0], size) + frame_header(end_FrameType, 1, 0));
+    receive_end(&connection, 1, size);
+    CHECK( content == wait_file(server.path("first"), size) );
+
+    // the stored chunk is added after the filter and referred to
+    connection.send(start_frame(2, "second", size, flags) + frame_header(chunks_FrameType, 2, sizeof(chunks)) +
+                    string((const char*)chunks, sizeof(chunks)));
+    answer = receive_answer(&connection, 2, &filter, &added);
+    CHECK( 1 == answer[FRAME_CHUNKS_HEAD] );
+    CHECK( 1 == added.size() && ChunkFilter::key(name) == added[0] );
+    connection.send(frame_header(reference_FrameType, 2, CDC_RECORD_SIZE) +
+                    string((const char*)chunks + FRAME_CHUNKS_HEAD, CDC_RECORD_SIZE) +
+                    frame_header(hash_FrameType, 2, TREE_HASH_SIZE) + leaf_hash(&data[0], size) + frame_header(end_FrameType, 2, 0));
+    receive_end(&connection, 2, size);
+    CHECK( content == wait_file(server.path("second"), size) );
+}
+
+// The sparse file of 8 Gb is resumed beyond 4 Gb, so the size of START frame, the offsets of OFFSET
+// frames, the resume point and the writing of stream keep 64 bits
+TEST(transfer_large_resumed)
+{
+    const i64 committed = 8589934592LL;
+    const u32 tail = 200000;
+    const i64 size = committed + tail;
+    const u32 stream = FRAME_FILE_STREAM;
+    FileIdentity identity;
+    identity.mtime_ = 1400000014;
+    identity.hash_ = 0x0123456789abcdefULL;
+
+    // the first 8 Gb are received already, they are the holes of the file
+    TestServer server("transfer_large");
+    string path = server.path("large");
+    {
+        RawFile file(path, "wb+");
+        file.resize(size);
+    }
+    string point = tostring((u64)size) + " " + tostring((u64)identity.mtime_) + " " + tostring(identity.hash_) +
+                   " " + tostring((u64)committed) + "\n";
+    FILE* file = fopen((path + ".resume").c_str(), "w");
+    CHECK( NULL != file );
+    CHECK( point.length() == fwrite(point.data(), 1, point.length(), file) );
+    CHECK( 0 == fclose(file) );
+
+    FrameConnection connection(server.port());
+    connection.send(start_frame(stream, "large", size, checksummed_FrameFlag, &identity));
+    FrameHeader header;
+    string payload;
+    CHECK( connection.receive(&header, &payload, ANSWER_TIMEOUT_MS) );
+    CHECK( offset_FrameType == header.type_ && stream == header.stream_ && (u64)committed == header.length_ );
+
+    vector<u8> data(tail);
+    fill_random(&data[0], tail, 14);
+    string frames;
+    for(u32 offset = 0; offset < tail; offset += 65536)
+    {
+        u32 portion = min(tail - offset, (u32)65536);
+        frames += frame_header(data_FrameType, stream, portion) + string((const char*)&data[offset], portion);
+        frames += frame_header(checksum_FrameType, stream, crc32c(&data[offset], portion));
+    }
+    connection.send(frames + frame_header(end_FrameType, stream, 0));
+    receive_end(&connection, stream, size);
+
+    CHECK( wait_range(path, committed, string((const char*)&data[0], tail)) );
+    CHECK( wait_range(path, committed - 4096, string(4096, 0)) );
+    RawFile received(path, "rb");
+    CHECK( size == received.size() );
+}
+
+// The parallel uploads get their extents piece by piece in the sparse files, the preallocated
+// ones are allocated at once. The files are interleaved by a quantum as the connections go.
+BENCHMARK(transfer_preallocation)
+{
+    const u32 files = 4;
+    const u64 size = 256 * 1048576;
+    u32 sparse = 0;
+    for(u32 preallocate = 0; preallocate < 2; ++preallocate)
+    {
+        string option = preallocate ? "--preallocate=yes" : "--preallocate=no";
+        TestServer server("transfer_preallocation", option);
+        vector<FrameConnection*> connections;
+        vector<Upload> uploads;
+        for(u32 i = 0; i < files; ++i)
+        {
+            connections.push_back(new FrameConnection(server.port()));
+            Upload upload = { connections.back(), FRAME_FILE_STREAM, size };
+            uploads.push_back(upload);
+            connections.back()->send(start_frame(FRAME_FILE_STREAM, "file" + tostring(i), size, checksummed_FrameFlag));
+        }
+        u64 passed = send_uploads(uploads);
+
+        u32 extents = 0;
+        for(u32 i = 0; i < files; ++i)
+        {
+            extents += file_extents(server.path("file" + tostring(i)));
+            delete connections[i];
+        }
+        report(option + ": " + tostring(files * size / 1048576 * 1000 / max(passed, (u64)1)) + " MB/s, " +
+               (extents ? tostring(extents / files) + " extents per file" : string("the extents are unknown")));
+
+        // the file system which can't preallocate leaves the files sparse
+        if( !preallocate )
+            sparse = extents;
+        else if( extents && sparse )
+            CHECK( extents <= sparse );
+    }
+}
+
+// One flow of the long fat link carries its window per delay, so the stripes of file sent
+// by several connections add up until the server or the disk bounds them
+BENCHMARK(transfer_stripes)
+{
+    const u32 delay = 5;
+    const u32 window = 262144;
+    const u64 size = 64 * 1048576;
+    static const u32 counts[] = { 1, 2, 4, 8 };
+    report("the link delays " + tostring(delay) + " ms, " + tostring(window / 1024) + " Kb are on the way per connection");
+
+    u64 single = 0;
+    for(u32 i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+    {
+        TestServer server("transfer_stripes");
+        DelayLink link(server.port(), delay, window);
+        vector<FrameConnection*> connections;
+        vector<Upload> uploads;
+        for(u32 k = 0; k < counts[i]; ++k)
+        {
+            FileStripe stripe = { counts[i], k * (size / counts[i]), size / counts[i], counts[i] };
+            connections.push_back(new FrameConnection(link.port()));
+            Upload upload = { connections.back(), FRAME_FILE_STREAM, stripe.length_ };
+            uploads.push_back(upload);
+            connections.back()->send(start_frame(FRAME_FILE_STREAM, "striped", size, checksummed_FrameFlag, NULL, &stripe));
+        }
+        u64 passed = max(send_uploads(uploads), (u64)1);
+        for(u32 k = 0; k < counts[i]; ++k)
+            delete connections[k];
+
+        u64 rate = size / 1048576 * 1000 / passed;
+        report(tostring(counts[i]) + " stripes: " + tostring(passed) + " ms, " + tostring(rate) + " MB/s");
+        if( 1 == counts[i] )
+            single = rate;
+        else if( 4 == counts[i] )
+            CHECK( rate > 2 * single );
+    }
+}
+
+// The connections are spread over the workers, every file comes whole by its own connection
+TEST(transfer_many_connections)
+{
+    const u32 count = 32;
+    TestServer server("transfer_many", "--workers=4");
+    vector<FrameConnection*> connections;
+    vector<string> contents;
+    // all the connections are open at once, so every worker gets its share
+    for(u32 i = 0; i < count; ++i)
+        connections.push_back(new FrameConnection(server.port()));
+    for(u32 i = 0; i < count; ++i)
+    {
+        vector<u8> data(50000 + 1000 * i);
+        fill_random(&data[0], (u32)data.size(), 200 + i);
+        contents.push_back(string((const char*)&data[0], data.size()));
+        connections[i]->send(start_frame(FRAME_FILE_STREAM, "file" + tostring(i), data.size(), checksummed_FrameFlag) +
+                             frame_header(data_FrameType, FRAME_FILE_STREAM, data.size()) + contents.back() +
+                             frame_header(checksum_FrameType, FRAME_FILE_STREAM, crc32c(&data[0], (u32)data.size())) +
+                             frame_header(end_FrameType, FRAME_FILE_STREAM, 0));
+    }
+    for(u32 i = 0; i < count; ++i)
+        receive_end(connections[i], FRAME_FILE_STREAM, contents[i].size());
+
+    for(u32 i = 0; i < count; ++i)
+    {
+        delete connections[i];
+        CHECK( contents[i] == wait_file(server.path("file" + tostring(i)), contents[i].size()) );
+    }
+}
+
+// The connections of many clients are received by the workers at once, so the ingest grows
+// with the workers while the cores last
+BENCHMARK(transfer_workers)
+{
+    const u32 clients = 16;
+    const u64 size = 32 * 1048576;
+    static const u32 counts[] = { 1, 2, 4, 8 };
+    u32 cores = Thread::getNumberOfProcessors();
+    report(tostring(clients) + " clients send " + tostring(size / 1048576) + " Mb each to " + tostring(cores) + " cores");
+
+    u64 single = 0;
+    for(u32 i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+    {
+        TestServer server("transfer_workers", "--workers=" + tostring(counts[i]));
+        vector<FrameConnection*> connections;
+        vector<Upload> uploads;
+        for(u32 k = 0; k < clients; ++k)
+        {
+            connections.push_back(new FrameConnection(server.port()));
+            Upload upload = { connections.back(), FRAME_FILE_STREAM, size };
+            uploads.push_back(upload);
+            connections.back()->send(start_frame(FRAME_FILE_STREAM, "file" + tostring(k), size, checksummed_FrameFlag));
+        }
+        u64 passed = max(send_uploads(uploads), (u64)1);
+        for(u32 k = 0; k < clients; ++k)
+            delete connections[k];
+
+        u64 rate = clients * size / 1048576 * 1000 / passed;
+        report(tostring(counts[i]) + " workers: " + tostring(passed) + " ms, " + tostring(rate) + " MB/s");
+        if( 1 == counts[i] )
+            single = rate;
+        // the client takes a core too
+        else if( 4 == counts[i] && cores > 4 )
+            CHECK( 2 * rate > 3 * single );
+    }
+}
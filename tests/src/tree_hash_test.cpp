@@ -0,0 +1,126 @@
+#include <vector>
+
+#include "unit_test.h"
+#include "tree_hash.h"
+
+using namespace std;
+
+namespace {
+
+struct HashVector
+{
+    u32 size_;
+    const char* hash_;
+};
+
+/*  BLAKE3 of the input bytes i % 251 as the official test vectors are made,
+    the sizes cross the chunks of 1024 bytes and the leaves of TREE_HASH_LEAF bytes
+*/
+const HashVector vectors[] = {
+    { 0,       "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+    { 1,       "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+    { 1023,    "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+    { 1024,    "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+    { 1025,    "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+    { 2048,    "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+    { 3072,    "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+    { 65536,   "68d647e619a930e7b1082f74f334b0c65a315725569bdc123f0ee11881717bfe" },
+    { 1048575, "f32b849d19684c18c138cf13e29dbadc776f4bc2a56b477680ef546b39ac3f71" },
+    { 1048576, "74cb441fd087764ca9c3694da742ebe30cbeb3060a17009ca81825c7a8d10343" },
+    { 1048577, "2f053cd7472cf0cd2f9adaf45c1180255b91b9a865404a63671a0ee5f792ed33" },
+    { 3158073, "ce1148523b8586723c3fd8b1fe92fe16394888a360c96965bf3b1900421f3e19" },
+};
+const u32 VECTORS = sizeof(vectors) / sizeof(vectors[0]);
+
+vector<u8> vector_input(u32 size)
+{
+    vector<u8> data(size + 1);
+    for(u32 i = 0; i < size; ++i)
+        data[i] = (u8)(i % 251);
+    return data;
+}
+
+/*  Hashes the data given by pieces of 'piece' bytes */
+string tree_hash(HashWorkers* workers, const vector<u8>& data, u32 size, u32 piece)
+{
+    TreeHash hash(workers);
+    for(u32 offset = 0; offset < size; offset += piece)
+        hash.update(&data[offset], size - offset < piece ? size - offset : piece);
+    CHECK( size == hash.size() );
+
+    u8 result[TREE_HASH_SIZE];
+    hash.finish(result);
+
+    // the empty data is one empty leaf
+    u32 leaves = size ? (size + TREE_HASH_LEAF - 1) / TREE_HASH_LEAF : 1;
+    CHECK( leaves == hash.ready() );
+    return TreeHash::hex(result);
+}
+
+} // namespace
+
+// The hash of data at once matches the reference BLAKE3
+TEST(blake3_vectors)
+{
+    for(u32 i = 0; i < VECTORS; ++i)
+    {
+        vector<u8> data = vector_input(vectors[i].size_);
+        u8 hash[TREE_HASH_SIZE];
+        TreeHash::digest(&data[0], vectors[i].size_, hash);
+        CHECK( vectors[i].hash_ == TreeHash::hex(hash) );
+    }
+}
+
+// The leaves hashed by the callers and by the workers are put together to the same hash
+TEST(tree_hash_vectors)
+{
+    HashWorkers callers(0);
+    HashWorkers workers(3);
+    for(u32 i = 0; i < VECTORS; ++i)
+    {
+        vector<u8> data = vector_input(vectors[i].size_);
+        CHECK( vectors[i].hash_ == tree_hash(&callers, data, vectors[i].size_, 65536) );
+        CHECK( vectors[i].hash_ == tree_hash(&workers, data, vectors[i].size_, 65536) );
+        CHECK( vectors[i].hash_ == tree_hash(&workers, data, vectors[i].size_, 300007) );
+    }
+    workers.stop();
+}
+
+// The leaves given again after rewinding are hashed as the first time
+TEST(tree_hash_rewind)
+{
+    const u32 size = 5 * TREE_HASH_LEAF + 777;
+    vector<u8> data(size);
+    fill_random(&data[0], size, 20);
+    u8 expected[TREE_HASH_SIZE];
+    TreeHash::digest(&data[0], size, expected);
+
+    HashWorkers workers(2);
+    TreeHash hash(&workers);
+    hash.update(&data[0], 3 * TREE_HASH_LEAF + 100);
+
+    // the offset in a hashed leaf drops it and the following ones
+    u64 offset = hash.rewind(TREE_HASH_LEAF + 5);
+    CHECK( TREE_HASH_LEAF == offset );
+    CHECK( 1 >= hash.ready() );
+    hash.update(&data[offset], size - (u32)offset);
+
+    u8 result[TREE_HASH_SIZE];
+    hash.finish(result);
+    CHECK( TreeHash::hex(expected) == TreeHash::hex(result) );
+    CHECK( 6 == hash.ready() );
+
+    // the chaining values of leaves don't depend on who hashed them
+    HashWorkers callers(0);
+    TreeHash other(&callers);
+    other.update(&data[0], size);
+    other.finish(result);
+    for(u32 i = 0; i < 6; ++i)
+    {
+        u8 cv[TREE_HASH_SIZE], otherCv[TREE_HASH_SIZE];
+        hash.leaf(i, cv);
+        other.leaf(i, otherCv);
+        CHECK( 0 == memcmp(cv, otherCv, TREE_HASH_SIZE) );
+    }
+    workers.stop();
+}
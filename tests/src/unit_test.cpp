@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <time.h>
+#include <ftw.h>
+#include <iostream>
+#include <vector>
+
+#include "unit_test.h"
+#include "generic_exception.h"
+#include "useful.h"
+
+using namespace std;
+
+namespace {
+
+struct TestCase
+{
+    const char* name_;
+    TestFunc func_;
+    bool benchmark_;
+};
+typedef vector<TestCase> TestsT;
+
+/*  The tests are registered by the static objects of several files, so the list is made at first use */
+TestsT& tests()
+{
+    static TestsT all;
+    return all;
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////
+TestFailure::TestFailure(const char* file, u32 line, const string& condition)
+    : reason_(string(file) + ":" + tostring(line) + ": " + condition)
+{}
+
+TestRegistrar::TestRegistrar(const char* name, TestFunc func, bool benchmark)
+{
+    TestCase test;
+    test.name_ = name;
+    test.func_ = func;
+    test.benchmark_ = benchmark;
+    tests().push_back(test);
+}
+
+void fill_random(u8* data, u32 size, u32 seed)
+{
+    // xorshift, the data is the same on every platform
+    u32 state = seed ? seed : 0x9e3779b9;
+    for(u32 i = 0; i < size; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        data[i] = (u8)(state >> 24);
+    }
+}
+
+string hex(const u8* data, u32 size)
+{
+    static const char digits[] = "0123456789abcdef";
+    string text;
+    for(u32 i = 0; i < size; ++i)
+    {
+        text += digits[data[i] >> 4];
+        text += digits[data[i] & 0x0f];
+    }
+    return text;
+}
+
+string temp_path(const string& name)
+{
+    return name + ".tmp";
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+void remove_tree(const string& dir)
+{
+    nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+u64 now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void report(const string& line)
+{
+    cout << "       " << line << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    // the tests are run by name if they are given, the benchmarks take their time,
+    // so they are run by name or all of them by --benchmark
+    bool benchmarks = (argc > 1 && string(argv[1]) == "--benchmark");
+    u32 failed = 0;
+    u32 run = 0;
+    for(TestsT::const_iterator It = tests().begin(); It != tests().end(); ++It)
+    {
+        bool wanted = benchmarks ? It->benchmark_ : (argc < 2 && !It->benchmark_);
+        for(int i = 1; i < argc && !wanted; ++i)
+            wanted = (string(argv[i]) == It->name_);
+        if( !wanted )
+            continue;
+
+        ++run;
+        try {
+            It->func_();
+            cout << "[ OK ] " << It->name_ << endl;
+            continue;
+        }
+        catch(const TestFailure& ex) {
+            cout << "[FAIL] " << It->name_ << ": " << ex.reason_ << endl;
+        }
+        catch(const Exception& ex) {
+            cout << "[FAIL] " << It->name_ << ": " << ex.reason() << endl;
+        }
+        ++failed;
+    }
+
+    cout << run - failed << " of " << run << " tests passed" << endl;
+    return failed ? 1 : 0;
+}